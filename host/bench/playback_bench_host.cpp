@@ -0,0 +1,451 @@
+// The benchmarks in playback_bench.h, run on Linux against the WAVs in main/spiffs_data and the clips partition image
+// packed from them, instead of from app_main on the board. Timings are host timings, useful to compare strategies
+// and to catch regressions, not as ESP32 numbers.
+//
+//   playback_bench_host [strategies|synth|resample|convert|adpcm|dsp|mix|sources|reads|pipeline|phrase|headers]...
+//
+// All of them by default.
+
+#include "audio_pool.h"
+#include "clip_cache.h"
+#include "clip_store.h"
+#include "host_shim.h"
+#include "mixer.h"
+#include "playback_pipeline.h"
+#include "playback_bench.h"
+#include "sim_sink.h"
+#include "wav_file.h"
+#include "wav_player.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <algorithm>
+#include <mutex>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static const char *TAG = "bench_host";
+
+#define DMA_BUF_BYTES           4096    // As i2s_config in main.cpp
+#define DMA_BUF_COUNT           8
+#define AUDIO_POOL_BLOCKS       (PIPELINE_MAX_BLOCKS + 2)       // As app_main
+#define OUTPUT_RATE             44100
+#define SILENCE_SIZE            8096
+#define CLIP_CACHE_BUDGET       (128 * 1024)
+#define CLIP_STORE_PARTITION    "clips"
+#define SYNTH_BLOCKS            1000
+#define RESAMPLE_BLOCKS         2000
+#define CONVERT_BLOCKS          20000
+#define ADPCM_BLOCKS            20000
+#define DSP_BLOCKS              20000
+#define DSP_CPU_MHZ             160     // CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ, host time in cycles of the board's CPU
+#define MIX_BLOCKS              25
+#define MIX_FILE                "OYM-USA-male-1-16000.wav"      // At MIX_RATE, so the mix is not resampled
+#define MIX_RATE                16000
+#define PHRASE_RUNS             100
+#define HEADER_RUNS             1000
+#define LEGACY_READ_BYTES       1024    // What the first players read at a time
+#define NEWLIB_BUFSIZ           1024    // The FILE buffer newlib gives a file on the board
+#define PIPELINE_RUNS           3       // Plays of each WAV from each source, the first from a cold page cache
+#define PIPE_FEED_CHUNK         512     // As app_main, about what a UART driver hands over
+#define PIPE_FEED_TASK_STACK    3072
+#define PIPE_FEED_TASK_PRIORITY 3
+#define PHRASE_FILE             "OYM-USA-male-1-NoMiddle.wav"   // The WAV phrase_units.txt cuts on_your_marks from
+
+static char silence[SILENCE_SIZE];
+
+/**
+ * The WAV files in the current directory, sorted.
+ */
+static std::vector<std::string> list_wavs() {
+    std::vector<std::string> names;
+    DIR* dir = opendir(".");
+    const struct dirent* item;
+    while (dir != nullptr && (item = readdir(dir)) != nullptr) {
+        const size_t len = strlen(item->d_name);
+        if (len > 4 && strcasecmp(item->d_name + len - 4, ".wav") == 0) {
+            names.push_back(item->d_name);
+        }
+    }
+    if (dir != nullptr) {
+        closedir(dir);
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+static void bench_strategies(const std::vector<std::string>& wavs) {
+    for (const std::string& name : wavs) {
+        ESP_ERROR_CHECK(playback_bench_run(name.c_str(), DMA_BUF_BYTES, DMA_BUF_COUNT, OUTPUT_RATE, silence,
+                                           SILENCE_SIZE));
+    }
+}
+
+static void bench_sources(const std::vector<std::string>& wavs) {
+    for (const std::string& name : wavs) {
+        file_source_t file;
+        ESP_ERROR_CHECK(file_source_open(&file, name.c_str()));
+        ESP_ERROR_CHECK(playback_bench_source(&file.source, name.c_str(), DMA_BUF_BYTES));
+        file_source_close(&file);
+    }
+}
+
+// SPIFFS as it lays files out on the board, for comparing read paths. Each file is in pages of the SPIFFS
+// partition, each page behind its header and among the pages of other files, read whole with esp_partition_read
+// under the one file system lock. A file read goes through a FILE buffer as newlib keeps one, unless unbuffered.
+#define SPIFFS_PARTITION        "spiffs_partition"      // As partitions.csv
+#define SPIFFS_PARTITION_SIZE   0x30000
+#define SPIFFS_PAGE_SIZE        256     // CONFIG_SPIFFS_PAGE_SIZE
+#define SPIFFS_PAGE_HEADER      5       // Object id, span index and flags in front of the data of every page
+#define SPIFFS_PAGE_DATA        (SPIFFS_PAGE_SIZE - SPIFFS_PAGE_HEADER)
+#define SPIFFS_PAGE_STRIDE      2       // Pages of other files in between
+
+typedef struct {
+    audio_source_t source;
+    const esp_partition_t* partition;
+    uint32_t first_page;        // Offset of the file's first page in the partition
+    uint32_t size;
+    uint32_t position;
+    std::vector<char> buffer;   // The FILE buffer, empty for an unbuffered file
+    uint32_t buffer_start;      // File position of buffer[0]
+    uint32_t buffer_end;
+    uint32_t nr_reads;          // Reads that reached the file system
+    uint32_t nr_pages;          // Pages read from flash
+} spiffs_file_t;
+
+static std::mutex spiffs_mutex;
+static std::vector<std::pair<std::string, uint32_t>> spiffs_files;      // Name and offset of the first page
+
+/**
+ * Lays the WAVs out in pages of the SPIFFS partition.
+ */
+static void spiffs_format(const std::vector<std::string>& wavs) {
+    std::vector<char> image;
+    for (const std::string& name : wavs) {
+        spiffs_files.push_back(std::make_pair(name, (uint32_t) image.size()));
+        FILE* f = fopen(name.c_str(), "rb");
+        char data[SPIFFS_PAGE_DATA];
+        size_t nr_bytes_read;
+        while ((nr_bytes_read = fread(data, 1, sizeof(data), f)) > 0) {
+            const size_t page = image.size();
+            image.resize(page + SPIFFS_PAGE_STRIDE * SPIFFS_PAGE_SIZE, (char) 0xff);
+            memcpy(&image[page + SPIFFS_PAGE_HEADER], data, nr_bytes_read);
+        }
+        fclose(f);
+    }
+    ESP_ERROR_CHECK(host_partition_add_data(SPIFFS_PARTITION, ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS,
+                                            image.data(), image.size(), std::max((size_t) SPIFFS_PARTITION_SIZE,
+                                                                                 image.size())));
+}
+
+/**
+ * One read of the file system, page by page through a page buffer.
+ */
+static uint32_t spiffs_read_pages(spiffs_file_t* file, char* dst, uint32_t size) {
+    std::lock_guard<std::mutex> lock(spiffs_mutex);
+    file->nr_reads++;
+    char page[SPIFFS_PAGE_SIZE];
+    uint32_t nr_bytes_read = 0;
+    while (nr_bytes_read < size && file->position < file->size) {
+        const uint32_t page_index = file->position / SPIFFS_PAGE_DATA;
+        const uint32_t in_page = file->position % SPIFFS_PAGE_DATA;
+        ESP_ERROR_CHECK(esp_partition_read(file->partition,
+                                           file->first_page + page_index * SPIFFS_PAGE_STRIDE * SPIFFS_PAGE_SIZE, page,
+                                           sizeof(page)));
+        file->nr_pages++;
+        const uint32_t chunk = std::min(std::min(SPIFFS_PAGE_DATA - in_page, size - nr_bytes_read),
+                                        file->size - file->position);
+        memcpy(dst + nr_bytes_read, page + SPIFFS_PAGE_HEADER + in_page, chunk);
+        nr_bytes_read += chunk;
+        file->position += chunk;
+    }
+    return nr_bytes_read;
+}
+
+/**
+ * As fread, through the FILE buffer refilled a whole buffer at a time, or straight from the file system.
+ */
+static esp_err_t spiffs_read(void* ctx, char* dst, size_t size, size_t* nr_bytes_read) {
+    spiffs_file_t* file = (spiffs_file_t*) ctx;
+    if (file->buffer.empty()) {
+        *nr_bytes_read = spiffs_read_pages(file, dst, size);
+        return ESP_OK;
+    }
+    *nr_bytes_read = 0;
+    while (*nr_bytes_read < size) {
+        if (file->buffer_start == file->buffer_end) {
+            file->buffer_start = 0;
+            file->buffer_end = spiffs_read_pages(file, file->buffer.data(), file->buffer.size());
+            if (file->buffer_end == 0) {
+                break;
+            }
+        }
+        const uint32_t chunk = std::min((uint32_t) (size - *nr_bytes_read), file->buffer_end - file->buffer_start);
+        memcpy(dst + *nr_bytes_read, &file->buffer[file->buffer_start], chunk);
+        file->buffer_start += chunk;
+        *nr_bytes_read += chunk;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t spiffs_seek(void* ctx, uint32_t offset) {
+    spiffs_file_t* file = (spiffs_file_t*) ctx;
+    if (offset > file->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    file->position = offset;
+    file->buffer_start = file->buffer_end = 0;
+    return ESP_OK;
+}
+
+/**
+ * Opens a file formatted by spiffs_format with a FILE buffer of buffer_size, 0 for none.
+ */
+static esp_err_t spiffs_open(spiffs_file_t* file, const std::string& name, uint32_t buffer_size) {
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                                ESP_PARTITION_SUBTYPE_DATA_SPIFFS, SPIFFS_PARTITION);
+    for (const std::pair<std::string, uint32_t>& item : spiffs_files) {
+        if (item.first == name && partition != nullptr) {
+            FILE* f = fopen(name.c_str(), "rb");
+            fseek(f, 0, SEEK_END);
+            file->size = ftell(f);
+            fclose(f);
+            file->source.ctx = file;
+            file->source.read = spiffs_read;
+            file->source.seek = spiffs_seek;
+            file->partition = partition;
+            file->first_page = item.second;
+            file->position = 0;
+            file->buffer.assign(buffer_size, 0);
+            file->buffer_start = file->buffer_end = 0;
+            file->nr_reads = 0;
+            file->nr_pages = 0;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+/**
+ * The data of the WAV read through SPIFFS in pieces of read_bytes, with how many file system reads and flash pages
+ * each descriptor took.
+ */
+static void bench_spiffs_read(const std::string& name, const char* label, uint32_t buffer_size, uint32_t read_bytes) {
+    FILE* f = fopen(name.c_str(), "rb");
+    wav_header_t header;
+    uint32_t data_offset;
+    ESP_ERROR_CHECK(wav_parse_header(f, &header, &data_offset));
+    fclose(f);
+
+    static spiffs_file_t file;
+    ESP_ERROR_CHECK(spiffs_open(&file, name, buffer_size));
+    ESP_ERROR_CHECK(spiffs_seek(&file, data_offset));
+    ESP_ERROR_CHECK(playback_bench_read(&file.source, label, header.data.chunk_size, read_bytes, DMA_BUF_BYTES,
+                                        header.ByteRate));
+    const float nr_blocks = (float) header.data.chunk_size / DMA_BUF_BYTES;
+    ESP_LOGI(TAG, "%s: %.1f reads/block %.1f pages/block", label, file.nr_reads / nr_blocks, file.nr_pages / nr_blocks);
+}
+
+/**
+ * The data of each WAV read three ways: as the first players read SPIFFS, a buffered FILE in 1 KB reads, unbuffered
+ * a descriptor at a time, and straight from its copy in the clips partition.
+ */
+static void bench_reads(const std::vector<std::string>& wavs) {
+    for (const std::string& name : wavs) {
+        ESP_LOGI(TAG, "%s", name.c_str());
+        bench_spiffs_read(name, "spiffs 1K", NEWLIB_BUFSIZ, LEGACY_READ_BYTES);
+        bench_spiffs_read(name, "spiffs 4K", 0, DMA_BUF_BYTES);
+
+        const clip_table_entry_t* entry = clip_store_find_entry(name.c_str());
+        if (entry == nullptr) {
+            continue;
+        }
+        partition_source_t part;
+        ESP_ERROR_CHECK(partition_source_open(&part, CLIP_STORE_PARTITION, entry->offset, entry->nr_bytes));
+        ESP_ERROR_CHECK(playback_bench_read(&part.source, "partition 4K", entry->nr_bytes, DMA_BUF_BYTES, DMA_BUF_BYTES,
+                                            entry->sample_rate * entry->block_align));
+    }
+}
+
+/**
+ * The mixer on a simulated DMA ring at the clip's rate, so the voices are summed without being resampled.
+ */
+static void bench_mix() {
+    static sim_sink_t sim;
+    ESP_ERROR_CHECK(sim_sink_init(&sim, DMA_BUF_BYTES, DMA_BUF_COUNT));
+    sim_sink_start(&sim, MIX_RATE);
+    ESP_ERROR_CHECK(mixer_init(&sim.sink));
+    ESP_ERROR_CHECK(playback_bench_mix(MIX_FILE, DMA_BUF_BYTES, DMA_BUF_COUNT, MIX_BLOCKS));
+}
+
+// The whole pipeline from an ordinary file and from a pipe, into a sink that takes every block as it comes, so the
+// time is all the pipeline's own. The writer empties the ring as fast as the reader fills it, so here the underruns
+// only count the times it caught up.
+static uint64_t nr_bytes_sunk;
+
+static esp_err_t null_write(void* ctx, const char* data, size_t size, size_t* nr_bytes_written) {
+    nr_bytes_sunk += size;
+    *nr_bytes_written = size;
+    return ESP_OK;
+}
+
+typedef struct {
+    file_source_t file;
+    pipe_source_t pipe;
+    SemaphoreHandle_t done;
+} pipe_feed_t;
+
+/**
+ * Copies a file into a pipe a little at a time, as app_main's pipe_feeder does.
+ */
+static void pipe_feeder(void* arg) {
+    pipe_feed_t* feed = (pipe_feed_t*) arg;
+    char chunk[PIPE_FEED_CHUNK];
+    size_t nr_bytes_read;
+    while (feed->file.source.read(feed->file.source.ctx, chunk, sizeof(chunk), &nr_bytes_read) == ESP_OK
+           && nr_bytes_read > 0) {
+        pipe_source_write(&feed->pipe, chunk, nr_bytes_read);
+    }
+    pipe_source_close_write(&feed->pipe);
+    xSemaphoreGive(feed->done);
+    vTaskDelete(nullptr);
+}
+
+static void bench_pipeline(const std::vector<std::string>& wavs) {
+    static const pcm_sink_t null_sink = {null_write, nullptr, nullptr, DMA_BUF_BYTES, DMA_BUF_COUNT, OUTPUT_RATE};
+    ESP_ERROR_CHECK(pipeline_init(&null_sink));
+    esp_log_level_set("pipeline", ESP_LOG_WARN);       // Every play is logged
+    esp_log_level_set("wav_file", ESP_LOG_WARN);       // As is every chunk skipped
+    for (const std::string& name : wavs) {
+        ESP_LOGI(TAG, "pipeline %s to a %dHz sink", name.c_str(), OUTPUT_RATE);
+        for (int i = 0; i < PIPELINE_RUNS; i++) {
+            file_source_t file;
+            ESP_ERROR_CHECK(file_source_open(&file, name.c_str()));
+            ESP_ERROR_CHECK(playback_bench_pipeline(&file.source, "file", OUTPUT_RATE));
+            file_source_close(&file);
+        }
+        for (int i = 0; i < PIPELINE_RUNS; i++) {
+            pipe_feed_t feed;
+            ESP_ERROR_CHECK(file_source_open(&feed.file, name.c_str()));
+            ESP_ERROR_CHECK(pipe_source_init(&feed.pipe, DMA_BUF_BYTES * DMA_BUF_COUNT));
+            feed.done = xSemaphoreCreateBinary();
+            xTaskCreate(pipe_feeder, "pipe_feeder", PIPE_FEED_TASK_STACK, &feed, PIPE_FEED_TASK_PRIORITY, nullptr);
+            ESP_ERROR_CHECK(playback_bench_pipeline(&feed.pipe.source, "pipe", OUTPUT_RATE));
+            // Whatever is left after the data, eg a smpl chunk, until the feeder is done.
+            char discard[PIPE_FEED_CHUNK];
+            while (audio_source_read_fully(&feed.pipe.source, discard, sizeof(discard)) > 0) {
+            }
+            xSemaphoreTake(feed.done, portMAX_DELAY);
+            vSemaphoreDelete(feed.done);
+            pipe_source_free(&feed.pipe);
+            file_source_close(&feed.file);
+        }
+    }
+}
+
+static void bench_phrase() {
+    static const phrase_t phrase = {{"on_your_marks"}, 1};
+    ESP_ERROR_CHECK(playback_bench_phrase(&phrase, PHRASE_FILE, PHRASE_RUNS));
+}
+
+/**
+ * Opening a WAV and walking its chunks, against reopening it from the header cache with one seek.
+ */
+static void bench_headers(const std::vector<std::string>& wavs) {
+    for (const std::string& name : wavs) {
+        wav_header_t header;
+        uint32_t data_offset;
+        int64_t start_us = esp_timer_get_time();
+        for (int i = 0; i < HEADER_RUNS; i++) {
+            FILE* f = fopen(name.c_str(), "rb");
+            setvbuf(f, nullptr, _IONBF, 0);
+            ESP_ERROR_CHECK(wav_parse_header(f, &header, &data_offset));
+            fclose(f);
+        }
+        const int64_t parse_us = esp_timer_get_time() - start_us;
+
+        FILE* f;
+        start_us = esp_timer_get_time();
+        for (int i = 0; i < HEADER_RUNS; i++) {
+            ESP_ERROR_CHECK(load_wav_header((char*) name.c_str(), &header, &f));
+            fclose(f);
+        }
+        const int64_t cached_us = esp_timer_get_time() - start_us;
+        ESP_LOGI(TAG, "headers %s: parsed %lldns cached %lldns per open", name.c_str(), parse_us * 1000 / HEADER_RUNS,
+                 cached_us * 1000 / HEADER_RUNS);
+    }
+}
+
+static bool wanted(int argc, char** argv, const char* bench) {
+    if (argc < 2) {
+        return true;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], bench) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    // Files are opened by name relative to the data directory, as they are relative to the SPIFFS root on the board.
+    if (chdir(HOST_SPIFFS_DATA) != 0) {
+        ESP_LOGE(TAG, "Cannot open %s", HOST_SPIFFS_DATA);
+        return 1;
+    }
+    ESP_ERROR_CHECK(host_partition_add(CLIP_STORE_PARTITION, ESP_PARTITION_TYPE_DATA,
+                                       (esp_partition_subtype_t) CLIP_STORE_PARTITION_TYPE, HOST_CLIPS_IMAGE,
+                                       HOST_CLIPS_PARTITION_SIZE));
+    ESP_ERROR_CHECK(clip_store_init(CLIP_STORE_PARTITION));
+    ESP_ERROR_CHECK(audio_pool_init(AUDIO_POOL_BLOCKS));
+    ESP_ERROR_CHECK(wav_player_init());
+    ESP_ERROR_CHECK(clip_cache_init(CLIP_CACHE_BUDGET));
+
+    const std::vector<std::string> wavs = list_wavs();
+    spiffs_format(wavs);
+    if (wanted(argc, argv, "strategies")) {
+        bench_strategies(wavs);
+    }
+    if (wanted(argc, argv, "synth")) {
+        ESP_ERROR_CHECK(playback_bench_synth(OUTPUT_RATE, SYNTH_BLOCKS));
+    }
+    if (wanted(argc, argv, "resample")) {
+        ESP_ERROR_CHECK(playback_bench_resample(OUTPUT_RATE, RESAMPLE_BLOCKS));
+    }
+    if (wanted(argc, argv, "convert")) {
+        ESP_ERROR_CHECK(playback_bench_convert(CONVERT_BLOCKS));
+    }
+    if (wanted(argc, argv, "adpcm")) {
+        ESP_ERROR_CHECK(playback_bench_adpcm(ADPCM_BLOCKS));
+    }
+    if (wanted(argc, argv, "dsp")) {
+        ESP_ERROR_CHECK(playback_bench_dsp(OUTPUT_RATE, DSP_CPU_MHZ, DSP_BLOCKS));
+    }
+    if (wanted(argc, argv, "mix")) {
+        bench_mix();
+    }
+    if (wanted(argc, argv, "sources")) {
+        bench_sources(wavs);
+    }
+    if (wanted(argc, argv, "reads")) {
+        bench_reads(wavs);
+    }
+    if (wanted(argc, argv, "pipeline")) {
+        bench_pipeline(wavs);
+    }
+    if (wanted(argc, argv, "phrase")) {
+        bench_phrase();
+    }
+    if (wanted(argc, argv, "headers")) {
+        esp_log_level_set("wav_file", ESP_LOG_WARN);
+        bench_headers(wavs);
+    }
+    return 0;
+}
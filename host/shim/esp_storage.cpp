@@ -0,0 +1,198 @@
+// Partitions, NVS and the file systems on the host. Partitions are images held in memory, NVS keeps its blobs in
+// memory for the life of the process, and files are ordinary host files so neither file system is mounted.
+
+#include "host_shim.h"
+
+#include <esp_partition.h>
+#include <esp_spiffs.h>
+#include <esp_vfs_fat.h>
+#include <nvs.h>
+#include <nvs_flash.h>
+
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HOST_MAX_PARTITIONS     8
+#define HOST_NVS_MAX_HANDLES    8
+
+typedef struct {
+    esp_partition_t partition;
+    uint8_t* data;
+} host_partition_t;
+
+static host_partition_t partitions[HOST_MAX_PARTITIONS];
+static uint32_t nr_partitions = 0;
+static uint32_t next_address = 0x110000;    // After the app partitions, as in partitions.csv
+
+static std::mutex nvs_mutex;
+static std::map<std::string, std::vector<uint8_t>> nvs_blobs;     // "namespace/key"
+static std::string nvs_namespaces[HOST_NVS_MAX_HANDLES + 1];        // By handle, 0 is never handed out
+static bool nvs_initialised = false;
+
+esp_err_t host_partition_add_data(const char* label, esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                  const void* data, uint32_t data_size, uint32_t size) {
+    if (nr_partitions == HOST_MAX_PARTITIONS || data_size > size || strlen(label) >= sizeof(esp_partition_t::label)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    host_partition_t* host = &partitions[nr_partitions];
+    host->data = (uint8_t*) malloc(size);
+    if (host->data == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(host->data, data, data_size);
+    memset(host->data + data_size, 0xff, size - data_size);
+    memset(&host->partition, 0, sizeof(esp_partition_t));
+    host->partition.type = type;
+    host->partition.subtype = subtype;
+    host->partition.address = next_address;
+    host->partition.size = size;
+    strcpy(host->partition.label, label);
+    next_address += size;
+    nr_partitions++;
+    return ESP_OK;
+}
+
+esp_err_t host_partition_add(const char* label, esp_partition_type_t type, esp_partition_subtype_t subtype,
+                             const char* image_path, uint32_t size) {
+    FILE* f = fopen(image_path, "rb");
+    if (f == nullptr) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    std::vector<uint8_t> image;
+    uint8_t chunk[4096];
+    size_t nr_bytes_read;
+    while ((nr_bytes_read = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        image.insert(image.end(), chunk, chunk + nr_bytes_read);
+    }
+    fclose(f);
+    return host_partition_add_data(label, type, subtype, image.data(), image.size(), size);
+}
+
+uint8_t* host_partition_data(const char* label) {
+    for (uint32_t i = 0; i < nr_partitions; i++) {
+        if (strcmp(partitions[i].partition.label, label) == 0) {
+            return partitions[i].data;
+        }
+    }
+    return nullptr;
+}
+
+static const host_partition_t* find_host(const esp_partition_t* partition) {
+    for (uint32_t i = 0; i < nr_partitions; i++) {
+        if (&partitions[i].partition == partition) {
+            return &partitions[i];
+        }
+    }
+    return nullptr;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label) {
+    for (uint32_t i = 0; i < nr_partitions; i++) {
+        const esp_partition_t* partition = &partitions[i].partition;
+        if (partition->type == type && (subtype == ESP_PARTITION_SUBTYPE_ANY || partition->subtype == subtype)
+            && (label == nullptr || strcmp(partition->label, label) == 0)) {
+            return partition;
+        }
+    }
+    return nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size) {
+    const host_partition_t* host = find_host(partition);
+    if (host == nullptr || src_offset > partition->size || size > partition->size - src_offset) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(dst, host->data + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+                             spi_flash_mmap_memory_t memory, const void** out_ptr, spi_flash_mmap_handle_t* out_handle) {
+    const host_partition_t* host = find_host(partition);
+    if (host == nullptr || offset > partition->size || size > partition->size - offset) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out_ptr = host->data + offset;
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle) {
+}
+
+esp_err_t nvs_flash_init(void) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    nvs_initialised = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    nvs_blobs.clear();
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    if (!nvs_initialised) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    for (nvs_handle_t handle = 1; handle <= HOST_NVS_MAX_HANDLES; handle++) {
+        if (nvs_namespaces[handle].empty()) {
+            nvs_namespaces[handle] = name;
+            *out_handle = handle;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    const auto blob = nvs_blobs.find(nvs_namespaces[handle] + "/" + key);
+    if (blob == nvs_blobs.end()) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (out_value == nullptr) {
+        *length = blob->second.size();
+        return ESP_OK;
+    }
+    if (*length < blob->second.size()) {
+        *length = blob->second.size();
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    *length = blob->second.size();
+    memcpy(out_value, blob->second.data(), blob->second.size());
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    const uint8_t* bytes = (const uint8_t*) value;
+    nvs_blobs[nvs_namespaces[handle] + "/" + key].assign(bytes, bytes + length);
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    nvs_namespaces[handle].clear();
+}
+
+esp_err_t esp_vfs_spiffs_register(const esp_vfs_spiffs_conf_t* conf) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_vfs_fat_spiflash_mount(const char* base_path, const char* partition_label,
+                                     const esp_vfs_fat_mount_config_t* mount_config, wl_handle_t* wl_handle) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
@@ -0,0 +1,150 @@
+#include "host_shim.h"
+
+#include <esp_err.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <malloc.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cstring>
+
+static std::mutex log_mutex;
+static esp_log_level_t log_default_level = ESP_LOG_INFO;
+static std::map<std::string, esp_log_level_t> log_tag_levels;     // Set for a tag of their own, as in ESP-IDF
+static std::atomic<size_t> heap_used(0);
+
+const char* esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK:
+            return "ESP_OK";
+        case ESP_FAIL:
+            return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:
+            return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:
+            return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE:
+            return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:
+            return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:
+            return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED:
+            return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT:
+            return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_RESPONSE:
+            return "ESP_ERR_INVALID_RESPONSE";
+        case ESP_ERR_INVALID_CRC:
+            return "ESP_ERR_INVALID_CRC";
+        default:
+            return "UNKNOWN ERROR";
+    }
+}
+
+void esp_log_level_set(const char* tag, esp_log_level_t level) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    if (strcmp(tag, "*") == 0) {
+        // As ESP-IDF, the default replaces every level set before.
+        log_default_level = level;
+        log_tag_levels.clear();
+    } else {
+        log_tag_levels[tag] = level;
+    }
+}
+
+static esp_log_level_t tag_level(const char* tag) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    const auto found = log_tag_levels.find(tag);
+    return found != log_tag_levels.end() ? found->second : log_default_level;
+}
+
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...) {
+    if (level > tag_level(tag)) {
+        return;
+    }
+    static const char LETTERS[] = "NEWIDV";
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    // One printf per line, so lines from different tasks do not interleave.
+    printf("%c (%lld) %s: %s\n", LETTERS[level], (long long) (esp_timer_get_time() / 1000), tag, line);
+}
+
+void* heap_caps_malloc(size_t size, uint32_t caps) {
+    if (caps & MALLOC_CAP_SPIRAM) {
+        return nullptr;
+    }
+    void* ptr = malloc(size);
+    if (ptr != nullptr) {
+        heap_used += malloc_usable_size(ptr);
+    }
+    return ptr;
+}
+
+void* heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+    if (caps & MALLOC_CAP_SPIRAM) {
+        return nullptr;
+    }
+    void* ptr = calloc(n, size);
+    if (ptr != nullptr) {
+        heap_used += malloc_usable_size(ptr);
+    }
+    return ptr;
+}
+
+void* heap_caps_realloc(void* ptr, size_t size, uint32_t caps) {
+    if (caps & MALLOC_CAP_SPIRAM) {
+        return nullptr;
+    }
+    const size_t old_size = malloc_usable_size(ptr);
+    void* new_ptr = realloc(ptr, size);
+    if (new_ptr != nullptr || size == 0) {
+        heap_used -= old_size;
+        heap_used += malloc_usable_size(new_ptr);
+    }
+    return new_ptr;
+}
+
+void heap_caps_free(void* ptr) {
+    heap_used -= malloc_usable_size(ptr);
+    free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+    const size_t used = heap_used.load();
+    return caps & MALLOC_CAP_SPIRAM || used >= HOST_HEAP_SIZE ? 0 : HOST_HEAP_SIZE - used;
+}
+
+size_t heap_caps_get_total_size(uint32_t caps) {
+    return caps & MALLOC_CAP_SPIRAM ? 0 : HOST_HEAP_SIZE;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    return heap_caps_get_free_size(caps);
+}
+
+size_t host_heap_used() {
+    return heap_used.load();
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const* buf, uint32_t len) {
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
@@ -0,0 +1,482 @@
+// FreeRTOS on pthreads, enough of it for the playback code's tasks to run on the host. Priorities and cores are
+// ignored, Linux schedules the threads, so tests must not rely on one task pre-empting another. The tick count and
+// esp_timer read the monotonic clock, or the simulated one once host_clock_simulate is called.
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/stream_buffer.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include "host_shim.h"
+
+#include <atomic>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <cstring>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SIMULATED_POLL_NS       1000000 // Real time a blocked task sleeps between looks at the simulated clock
+#define SIMULATED_START_US      1000000 // Where the simulated clock starts, clear of the 0 some stats keep for never
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t notify_count;
+    TaskFunction_t code;
+    void* parameters;
+} host_task_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;     // Signalled whenever an item or a byte is added or taken
+    uint8_t* items;
+    UBaseType_t item_size;      // 0 for a semaphore, only the count matters
+    UBaseType_t length;
+    UBaseType_t count;
+    UBaseType_t head;
+} host_queue_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    uint8_t* bytes;
+    size_t size;
+    size_t count;
+    size_t head;
+    size_t trigger_level;
+} host_stream_t;
+
+/**
+ * A task blocked on the simulated clock, until it is woken or the clock reaches until_us.
+ */
+typedef struct sleeper {
+    int64_t until_us;           // INT64_MAX to wait for a wake up only
+    pthread_cond_t* cond;       // What the task waits on, broadcast when it is woken
+    bool woken;
+    struct sleeper* next;
+} sleeper_t;
+
+static thread_local host_task_t* current_task = nullptr;
+
+static int64_t monotonic_us() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static const int64_t start_us = monotonic_us();
+
+// The simulated clock, see host_clock_simulate. Taken after any queue's or task's mutex, never before.
+static std::atomic<bool> simulated(false);
+static pthread_mutex_t clock_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int64_t simulated_us;
+static uint32_t nr_running;         // Tasks not blocked in the shim, the clock stands still while there are any
+static sleeper_t* sleepers;
+
+static int64_t clock_us() {
+    if (!simulated.load(std::memory_order_acquire)) {
+        return monotonic_us();
+    }
+    pthread_mutex_lock(&clock_mutex);
+    const int64_t now_us = simulated_us;
+    pthread_mutex_unlock(&clock_mutex);
+    return now_us;
+}
+
+/**
+ * Takes the sleeper at *link off the list and counts its task as running again. clock_mutex held.
+ */
+static void wake(sleeper_t** link) {
+    sleeper_t* sleeper = *link;
+    *link = sleeper->next;
+    sleeper->woken = true;
+    nr_running++;
+    pthread_cond_broadcast(sleeper->cond);
+}
+
+/**
+ * Once every task is blocked, moves the clock on to the first timeout and wakes the tasks it is up for. clock_mutex
+ * held.
+ */
+static void run_clock() {
+    if (nr_running > 0) {
+        return;
+    }
+    int64_t next_us = INT64_MAX;
+    for (sleeper_t* sleeper = sleepers; sleeper != nullptr; sleeper = sleeper->next) {
+        next_us = sleeper->until_us < next_us ? sleeper->until_us : next_us;
+    }
+    if (next_us == INT64_MAX) {
+        fprintf(stderr, "Every task is blocked for good, the simulated clock cannot move on\n");
+        abort();
+    }
+    simulated_us = next_us > simulated_us ? next_us : simulated_us;
+    for (sleeper_t** link = &sleepers; *link != nullptr;) {
+        if ((*link)->until_us <= simulated_us) {
+            wake(link);
+        } else {
+            link = &(*link)->next;
+        }
+    }
+}
+
+/**
+ * Counts the tasks waiting on cond as running before it is signalled, so the clock cannot move on while they wake.
+ * Their mutex held.
+ */
+static void wake_waiters(pthread_cond_t* cond) {
+    if (!simulated.load(std::memory_order_acquire)) {
+        return;
+    }
+    pthread_mutex_lock(&clock_mutex);
+    for (sleeper_t** link = &sleepers; *link != nullptr;) {
+        if ((*link)->cond == cond) {
+            wake(link);
+        } else {
+            link = &(*link)->next;
+        }
+    }
+    pthread_mutex_unlock(&clock_mutex);
+}
+
+/**
+ * Blocks the calling task on cond, mutex held, until it is woken or the simulated clock reaches until_us. Returns
+ * false once the clock has.
+ */
+static bool sleep_simulated(pthread_cond_t* cond, pthread_mutex_t* mutex, int64_t until_us) {
+    sleeper_t sleeper = {until_us, cond, false, nullptr};
+    pthread_mutex_lock(&clock_mutex);
+    if (until_us <= simulated_us) {
+        pthread_mutex_unlock(&clock_mutex);
+        return false;
+    }
+    sleeper.next = sleepers;
+    sleepers = &sleeper;
+    nr_running--;
+    run_clock();
+    while (!sleeper.woken) {
+        // The clock wakes sleepers without holding their mutex, so the broadcast can come before the wait.
+        pthread_mutex_unlock(&clock_mutex);
+        timespec poll;
+        clock_gettime(CLOCK_MONOTONIC, &poll);
+        poll.tv_nsec += SIMULATED_POLL_NS;
+        poll.tv_sec += poll.tv_nsec / 1000000000;
+        poll.tv_nsec %= 1000000000;
+        pthread_cond_timedwait(cond, mutex, &poll);
+        pthread_mutex_lock(&clock_mutex);
+    }
+    const bool timed_out = simulated_us >= until_us;
+    pthread_mutex_unlock(&clock_mutex);
+    return !timed_out;
+}
+
+/**
+ * A task is starting (+1) or ending (-1), for the simulated clock's count of running tasks.
+ */
+static void count_task(int change) {
+    if (!simulated.load(std::memory_order_acquire)) {
+        return;
+    }
+    pthread_mutex_lock(&clock_mutex);
+    nr_running += change;
+    run_clock();
+    pthread_mutex_unlock(&clock_mutex);
+}
+
+static void init_cond(pthread_cond_t* cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static host_task_t* new_task(TaskFunction_t code, void* parameters) {
+    host_task_t* task = (host_task_t*) calloc(1, sizeof(host_task_t));
+    pthread_mutex_init(&task->mutex, nullptr);
+    init_cond(&task->cond);
+    task->code = code;
+    task->parameters = parameters;
+    return task;
+}
+
+/**
+ * Deadline ticks from now on the monotonic clock, for pthread_cond_timedwait.
+ */
+static timespec deadline(TickType_t ticks) {
+    timespec when;
+    clock_gettime(CLOCK_MONOTONIC, &when);
+    const int64_t ns = when.tv_nsec + (int64_t) ticks * portTICK_PERIOD_MS * 1000000;
+    when.tv_sec += ns / 1000000000;
+    when.tv_nsec = ns % 1000000000;
+    return when;
+}
+
+/**
+ * Waits on cond, with mutex held, until ready() or ticks have passed. Returns ready().
+ */
+template <typename Ready>
+static bool wait_for(pthread_cond_t* cond, pthread_mutex_t* mutex, TickType_t ticks, Ready ready) {
+    if (simulated.load(std::memory_order_acquire)) {
+        const int64_t until_us = ticks == portMAX_DELAY ? INT64_MAX
+                : clock_us() + (int64_t) ticks * portTICK_PERIOD_MS * 1000;
+        while (!ready()) {
+            if (ticks == 0 || !sleep_simulated(cond, mutex, until_us)) {
+                return ready();
+            }
+        }
+        return true;
+    }
+    const timespec until = deadline(ticks == portMAX_DELAY ? 0 : ticks);
+    while (!ready()) {
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(cond, mutex);
+        } else if (ticks == 0 || pthread_cond_timedwait(cond, mutex, &until) == ETIMEDOUT) {
+            return ready();
+        }
+    }
+    return true;
+}
+
+static void* run_task(void* arg) {
+    current_task = (host_task_t*) arg;
+    current_task->code(current_task->parameters);
+    count_task(-1);
+    return nullptr;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task_code, const char* name, uint32_t stack_depth, void* parameters,
+                                   UBaseType_t priority, TaskHandle_t* created_task, BaseType_t core_id) {
+    host_task_t* task = new_task(task_code, parameters);
+    count_task(1);
+    pthread_t thread;
+    if (pthread_create(&thread, nullptr, run_task, task) != 0) {
+        count_task(-1);
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    if (created_task != nullptr) {
+        *created_task = task;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task == nullptr || task == current_task) {
+        count_task(-1);
+        pthread_exit(nullptr);
+    }
+    abort();
+}
+
+void vTaskDelay(TickType_t ticks) {
+    host_clock_wait_until(clock_us() + (int64_t) ticks * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount(void) {
+    const int64_t boot_us = simulated.load(std::memory_order_acquire) ? 0 : start_us;
+    return (TickType_t) ((clock_us() - boot_us) / (portTICK_PERIOD_MS * 1000));
+}
+
+int64_t esp_timer_get_time(void) {
+    return clock_us();
+}
+
+void host_clock_simulate() {
+    pthread_mutex_lock(&clock_mutex);
+    simulated_us = SIMULATED_START_US;
+    nr_running = 1;
+    simulated.store(true, std::memory_order_release);
+    pthread_mutex_unlock(&clock_mutex);
+}
+
+void host_clock_wait_until(int64_t until_us) {
+    if (!simulated.load(std::memory_order_acquire)) {
+        const timespec until = {(time_t) (until_us / 1000000), (long) (until_us % 1000000 * 1000)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr) == EINTR) {
+        }
+        return;
+    }
+    host_task_t* task = (host_task_t*) xTaskGetCurrentTaskHandle();
+    pthread_mutex_lock(&task->mutex);
+    while (sleep_simulated(&task->cond, &task->mutex, until_us)) {
+        // Woken by a notification, which a delay does not end
+    }
+    pthread_mutex_unlock(&task->mutex);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    if (current_task == nullptr) {
+        current_task = new_task(nullptr, nullptr);
+    }
+    return current_task;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t handle) {
+    host_task_t* task = (host_task_t*) handle;
+    pthread_mutex_lock(&task->mutex);
+    task->notify_count++;
+    wake_waiters(&task->cond);
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->mutex);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait) {
+    host_task_t* task = (host_task_t*) xTaskGetCurrentTaskHandle();
+    pthread_mutex_lock(&task->mutex);
+    wait_for(&task->cond, &task->mutex, ticks_to_wait, [task] { return task->notify_count > 0; });
+    const uint32_t count = task->notify_count;
+    if (count > 0) {
+        task->notify_count = clear_count_on_exit ? 0 : count - 1;
+    }
+    pthread_mutex_unlock(&task->mutex);
+    return count;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    host_queue_t* queue = (host_queue_t*) calloc(1, sizeof(host_queue_t));
+    pthread_mutex_init(&queue->mutex, nullptr);
+    init_cond(&queue->changed);
+    queue->items = (uint8_t*) calloc(length, item_size > 0 ? item_size : 1);
+    queue->item_size = item_size;
+    queue->length = length;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t handle, const void* item, TickType_t ticks_to_wait) {
+    host_queue_t* queue = (host_queue_t*) handle;
+    pthread_mutex_lock(&queue->mutex);
+    const bool room = wait_for(&queue->changed, &queue->mutex, ticks_to_wait,
+                               [queue] { return queue->count < queue->length; });
+    if (room) {
+        const UBaseType_t tail = (queue->head + queue->count) % queue->length;
+        if (queue->item_size > 0) {
+            memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+        }
+        queue->count++;
+        wake_waiters(&queue->changed);
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return room ? pdPASS : pdFAIL;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t handle, void* buffer, TickType_t ticks_to_wait) {
+    host_queue_t* queue = (host_queue_t*) handle;
+    pthread_mutex_lock(&queue->mutex);
+    const bool got = wait_for(&queue->changed, &queue->mutex, ticks_to_wait, [queue] { return queue->count > 0; });
+    if (got) {
+        if (queue->item_size > 0) {
+            memcpy(buffer, queue->items + queue->head * queue->item_size, queue->item_size);
+        }
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        wake_waiters(&queue->changed);
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return got ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t handle) {
+    host_queue_t* queue = (host_queue_t*) handle;
+    pthread_mutex_lock(&queue->mutex);
+    queue->count = 0;
+    queue->head = 0;
+    wake_waiters(&queue->changed);
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdPASS;
+}
+
+void vQueueDelete(QueueHandle_t handle) {
+    host_queue_t* queue = (host_queue_t*) handle;
+    pthread_cond_destroy(&queue->changed);
+    pthread_mutex_destroy(&queue->mutex);
+    free(queue->items);
+    free(queue);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count) {
+    host_queue_t* queue = (host_queue_t*) xQueueCreate(max_count, 0);
+    queue->count = initial_count;
+    return queue;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    return xQueueSend(semaphore, nullptr, 0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait) {
+    return xQueueReceive(semaphore, nullptr, ticks_to_wait);
+}
+
+StreamBufferHandle_t xStreamBufferCreate(size_t buffer_size, size_t trigger_level) {
+    host_stream_t* stream = (host_stream_t*) calloc(1, sizeof(host_stream_t));
+    stream->bytes = (uint8_t*) malloc(buffer_size);
+    if (stream->bytes == nullptr) {
+        free(stream);
+        return nullptr;
+    }
+    pthread_mutex_init(&stream->mutex, nullptr);
+    init_cond(&stream->changed);
+    stream->size = buffer_size;
+    stream->trigger_level = trigger_level > 0 ? trigger_level : 1;
+    return stream;
+}
+
+size_t xStreamBufferSend(StreamBufferHandle_t handle, const void* data, size_t size, TickType_t ticks_to_wait) {
+    host_stream_t* stream = (host_stream_t*) handle;
+    const size_t wanted = size < stream->size ? size : stream->size;
+    pthread_mutex_lock(&stream->mutex);
+    wait_for(&stream->changed, &stream->mutex, ticks_to_wait,
+             [stream, wanted] { return stream->size - stream->count >= wanted; });
+    const size_t room = stream->size - stream->count;
+    const size_t nr_bytes = size < room ? size : room;
+    for (size_t i = 0; i < nr_bytes; i++) {
+        stream->bytes[(stream->head + stream->count + i) % stream->size] = ((const uint8_t*) data)[i];
+    }
+    stream->count += nr_bytes;
+    wake_waiters(&stream->changed);
+    pthread_cond_broadcast(&stream->changed);
+    pthread_mutex_unlock(&stream->mutex);
+    return nr_bytes;
+}
+
+size_t xStreamBufferReceive(StreamBufferHandle_t handle, void* data, size_t size, TickType_t ticks_to_wait) {
+    host_stream_t* stream = (host_stream_t*) handle;
+    pthread_mutex_lock(&stream->mutex);
+    wait_for(&stream->changed, &stream->mutex, ticks_to_wait,
+             [stream] { return stream->count >= stream->trigger_level; });
+    const size_t nr_bytes = size < stream->count ? size : stream->count;
+    for (size_t i = 0; i < nr_bytes; i++) {
+        ((uint8_t*) data)[i] = stream->bytes[(stream->head + i) % stream->size];
+    }
+    stream->head = (stream->head + nr_bytes) % stream->size;
+    stream->count -= nr_bytes;
+    wake_waiters(&stream->changed);
+    pthread_cond_broadcast(&stream->changed);
+    pthread_mutex_unlock(&stream->mutex);
+    return nr_bytes;
+}
+
+void vStreamBufferDelete(StreamBufferHandle_t handle) {
+    host_stream_t* stream = (host_stream_t*) handle;
+    pthread_cond_destroy(&stream->changed);
+    pthread_mutex_destroy(&stream->mutex);
+    free(stream->bytes);
+    free(stream);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+// Controls the host shim offers in place of what flashing and configuring a board would do.
+
+#include <stdint.h>
+#include <esp_err.h>
+#include <esp_partition.h>
+
+/**
+ * Adds a partition as if it were in partitions.csv and flashed with the file at image_path. The rest of its size
+ * reads as erased flash, 0xff. The image stays in memory, esp_partition_mmap points into it.
+ */
+esp_err_t host_partition_add(const char* label, esp_partition_type_t type, esp_partition_subtype_t subtype,
+                             const char* image_path, uint32_t size);
+
+/**
+ * As host_partition_add with the image already in memory, copied in.
+ */
+esp_err_t host_partition_add_data(const char* label, esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                  const void* data, uint32_t data_size, uint32_t size);
+
+/**
+ * Writable view of a partition's image, to corrupt it in tests. nullptr if there is no such partition.
+ */
+uint8_t* host_partition_data(const char* label);
+
+/**
+ * Bytes handed out by heap_caps_malloc and not yet freed. heap_caps_get_free_size is HOST_HEAP_SIZE less this.
+ */
+size_t host_heap_used();
+
+/**
+ * Runs esp_timer and the tick count on a simulated clock from here on, for timing tests that come out the same every
+ * run. The clock stands still while any task runs and, once every task is blocked in the shim, jumps to the first
+ * timeout. Call it before any task is created, from the thread that then counts as the first task. Every other thread
+ * that blocks in the shim must be a task, and nothing may spin on esp_timer, see host_clock_wait_until.
+ */
+void host_clock_simulate();
+
+/**
+ * Blocks the calling task until esp_timer reaches until_us, to the microsecond on the simulated clock.
+ */
+void host_clock_wait_until(int64_t until_us);
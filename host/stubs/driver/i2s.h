@@ -0,0 +1,101 @@
+#pragma once
+
+// Host stand in for ESP-IDF 4.4's driver/i2s.h, declarations only so main.cpp compiles on the host. It is not linked,
+// there is no I2S port, the players are run against a sim_sink_t instead.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+typedef enum {
+    GPIO_NUM_25 = 25,
+    GPIO_NUM_26 = 26,
+    GPIO_NUM_27 = 27,
+} gpio_num_t;
+
+typedef enum {
+    I2S_NUM_0 = 0,
+    I2S_NUM_1 = 1,
+} i2s_port_t;
+
+typedef enum {
+    I2S_MODE_MASTER = (1 << 0),
+    I2S_MODE_SLAVE = (1 << 1),
+    I2S_MODE_TX = (1 << 2),
+    I2S_MODE_RX = (1 << 3),
+} i2s_mode_t;
+
+typedef enum {
+    I2S_BITS_PER_SAMPLE_16BIT = 16,
+    I2S_BITS_PER_SAMPLE_32BIT = 32,
+} i2s_bits_per_sample_t;
+
+typedef enum {
+    I2S_BITS_PER_CHAN_DEFAULT = 0,
+} i2s_bits_per_chan_t;
+
+typedef enum {
+    I2S_CHANNEL_FMT_RIGHT_LEFT,
+    I2S_CHANNEL_FMT_ALL_RIGHT,
+    I2S_CHANNEL_FMT_ALL_LEFT,
+    I2S_CHANNEL_FMT_ONLY_RIGHT,
+    I2S_CHANNEL_FMT_ONLY_LEFT,
+} i2s_channel_fmt_t;
+
+typedef enum {
+    I2S_COMM_FORMAT_STAND_I2S = 0x01,
+} i2s_comm_format_t;
+
+typedef enum {
+    I2S_MCLK_MULTIPLE_DEFAULT = 0,
+} i2s_mclk_multiple_t;
+
+typedef enum {
+    I2S_EVENT_DMA_ERROR,
+    I2S_EVENT_TX_DONE,
+    I2S_EVENT_RX_DONE,
+    I2S_EVENT_TX_Q_OVF,
+    I2S_EVENT_RX_Q_OVF,
+    I2S_EVENT_MAX,
+} i2s_event_type_t;
+
+typedef struct {
+    i2s_event_type_t type;
+    size_t size;
+} i2s_event_t;
+
+#define ESP_INTR_FLAG_LEVEL1        (1 << 1)
+#define I2S_PIN_NO_CHANGE           (-1)
+
+typedef struct {
+    i2s_mode_t mode;
+    uint32_t sample_rate;
+    i2s_bits_per_sample_t bits_per_sample;
+    i2s_channel_fmt_t channel_format;
+    i2s_comm_format_t communication_format;
+    int intr_alloc_flags;
+    int dma_buf_count;
+    int dma_buf_len;
+    bool use_apll;
+    bool tx_desc_auto_clear;
+    int fixed_mclk;
+    i2s_mclk_multiple_t mclk_multiple;
+    i2s_bits_per_chan_t bits_per_chan;
+} i2s_config_t;
+
+typedef struct {
+    int mck_io_num;
+    int bck_io_num;
+    int ws_io_num;
+    int data_out_num;
+    int data_in_num;
+} i2s_pin_config_t;
+
+esp_err_t i2s_driver_install(i2s_port_t i2s_num, const i2s_config_t* i2s_config, int queue_size, void* i2s_queue);
+esp_err_t i2s_set_pin(i2s_port_t i2s_num, const i2s_pin_config_t* pin);
+esp_err_t i2s_set_sample_rates(i2s_port_t i2s_num, uint32_t rate);
+esp_err_t i2s_write(i2s_port_t i2s_num, const void* src, size_t size, size_t* bytes_written, TickType_t ticks_to_wait);
+esp_err_t i2s_zero_dma_buffer(i2s_port_t i2s_num);
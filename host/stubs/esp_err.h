@@ -0,0 +1,33 @@
+#pragma once
+
+// Host stand in for ESP-IDF's esp_err.h, the codes the playback code uses with their ESP-IDF values.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK                          0
+#define ESP_FAIL                        -1
+#define ESP_ERR_NO_MEM                  0x101
+#define ESP_ERR_INVALID_ARG             0x102
+#define ESP_ERR_INVALID_STATE           0x103
+#define ESP_ERR_INVALID_SIZE            0x104
+#define ESP_ERR_NOT_FOUND               0x105
+#define ESP_ERR_NOT_SUPPORTED           0x106
+#define ESP_ERR_TIMEOUT                 0x107
+#define ESP_ERR_INVALID_RESPONSE        0x108
+#define ESP_ERR_INVALID_CRC             0x109
+
+const char* esp_err_to_name(esp_err_t code);
+
+#define ESP_ERROR_CHECK(x) do {                                                                         \
+        const esp_err_t err_rc_ = (x);                                                                  \
+        if (err_rc_ != ESP_OK) {                                                                        \
+            fprintf(stderr, "ESP_ERROR_CHECK failed: esp_err_t 0x%x (%s) at %s:%d\nexpression: %s\n",   \
+                    err_rc_, esp_err_to_name(err_rc_), __FILE__, __LINE__, #x);                         \
+            abort();                                                                                    \
+        }                                                                                               \
+    } while (0)
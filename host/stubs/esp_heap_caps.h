@@ -0,0 +1,26 @@
+#pragma once
+
+// Host stand in for ESP-IDF's esp_heap_caps.h. Every capability but MALLOC_CAP_SPIRAM is served by malloc, there is
+// no PSRAM, as on the board. The free sizes count down from HOST_HEAP_SIZE as blocks are allocated, so heap growth
+// shows on the host as it would on the ESP32.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_EXEC             (1 << 0)
+#define MALLOC_CAP_32BIT            (1 << 1)
+#define MALLOC_CAP_8BIT             (1 << 2)
+#define MALLOC_CAP_DMA              (1 << 3)
+#define MALLOC_CAP_SPIRAM           (1 << 10)
+#define MALLOC_CAP_INTERNAL         (1 << 11)
+#define MALLOC_CAP_DEFAULT          (1 << 12)
+
+#define HOST_HEAP_SIZE              (300 * 1024)    // About what the ESP32 has free once the app has started
+
+void* heap_caps_malloc(size_t size, uint32_t caps);
+void* heap_caps_calloc(size_t n, size_t size, uint32_t caps);
+void* heap_caps_realloc(void* ptr, size_t size, uint32_t caps);
+void heap_caps_free(void* ptr);
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_total_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
@@ -0,0 +1,10 @@
+#pragma once
+
+// Host stand in for ESP-IDF's esp_rom_crc.h.
+
+#include <stdint.h>
+
+/**
+ * CRC-32 as the ESP32 ROM computes it, the same as zlib's crc32 and Python's zlib.crc32.
+ */
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const* buf, uint32_t len);
@@ -0,0 +1,19 @@
+#pragma once
+
+// Host stand in for ESP-IDF's esp_spiffs.h. The host has no SPIFFS, its files are ordinary files.
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+typedef struct {
+    const char* base_path;
+    const char* partition_label;
+    size_t max_files;
+    bool format_if_mount_failed;
+} esp_vfs_spiffs_conf_t;
+
+/**
+ * Returns ESP_ERR_NOT_SUPPORTED, files are opened by their host paths instead.
+ */
+esp_err_t esp_vfs_spiffs_register(const esp_vfs_spiffs_conf_t* conf);
@@ -0,0 +1,10 @@
+#pragma once
+
+// Host stand in for ESP-IDF's esp_timer.h.
+
+#include <stdint.h>
+
+/**
+ * Microseconds from CLOCK_MONOTONIC, like the ESP32's it only ever goes forwards.
+ */
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,21 @@
+#pragma once
+
+// Host stand in for ESP-IDF's esp_vfs_fat.h. The host has no FAT partition, its files are ordinary files.
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+typedef int32_t wl_handle_t;
+
+typedef struct {
+    bool format_if_mount_failed;
+    int max_files;
+    size_t allocation_unit_size;
+} esp_vfs_fat_mount_config_t;
+
+/**
+ * Returns ESP_ERR_NOT_SUPPORTED, files are opened by their host paths instead.
+ */
+esp_err_t esp_vfs_fat_spiflash_mount(const char* base_path, const char* partition_label,
+                                     const esp_vfs_fat_mount_config_t* mount_config, wl_handle_t* wl_handle);
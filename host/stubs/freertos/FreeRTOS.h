@@ -0,0 +1,24 @@
+#pragma once
+
+// Host stand in for FreeRTOS as configured in sdkconfig, the types and constants the playback code uses. Tasks are
+// pthreads, scheduled by Linux rather than by priority, see host/shim/freertos.cpp.
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define configTICK_RATE_HZ          1000    // CONFIG_FREERTOS_HZ
+#define configMAX_PRIORITIES        25
+#define portTICK_PERIOD_MS          ((TickType_t) 1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY               ((TickType_t) 0xffffffffUL)
+#define pdMS_TO_TICKS(ms)           ((TickType_t) (((TickType_t) (ms) * configTICK_RATE_HZ) / 1000))
+
+#define pdFALSE                     ((BaseType_t) 0)
+#define pdTRUE                      ((BaseType_t) 1)
+#define pdFAIL                      pdFALSE
+#define pdPASS                      pdTRUE
+
+#define tskNO_AFFINITY              0x7fffffff
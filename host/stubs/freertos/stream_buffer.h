@@ -0,0 +1,19 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef void* StreamBufferHandle_t;
+
+StreamBufferHandle_t xStreamBufferCreate(size_t buffer_size, size_t trigger_level);
+
+/**
+ * Sends as much of data as fits, waiting up to ticks_to_wait for room. Returns the number of bytes sent.
+ */
+size_t xStreamBufferSend(StreamBufferHandle_t buffer, const void* data, size_t size, TickType_t ticks_to_wait);
+
+/**
+ * Receives up to size bytes, waiting up to ticks_to_wait for the trigger level. Returns the number received.
+ */
+size_t xStreamBufferReceive(StreamBufferHandle_t buffer, void* data, size_t size, TickType_t ticks_to_wait);
+
+void vStreamBufferDelete(StreamBufferHandle_t buffer);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef void* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+/**
+ * Starts a pthread running task_code. The stack depth, priority and core are ignored.
+ */
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task_code, const char* name, uint32_t stack_depth, void* parameters,
+                                   UBaseType_t priority, TaskHandle_t* created_task, BaseType_t core_id);
+
+static inline BaseType_t xTaskCreate(TaskFunction_t task_code, const char* name, uint32_t stack_depth, void* parameters,
+                                     UBaseType_t priority, TaskHandle_t* created_task) {
+    return xTaskCreatePinnedToCore(task_code, name, stack_depth, parameters, priority, created_task, tskNO_AFFINITY);
+}
+
+/**
+ * Only a task deleting itself, with nullptr, is supported.
+ */
+void vTaskDelete(TaskHandle_t task);
+
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+
+/**
+ * The calling thread's handle, made on first use for threads not started by xTaskCreate, eg main.
+ */
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait);
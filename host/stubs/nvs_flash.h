@@ -0,0 +1,8 @@
+#pragma once
+
+// Host stand in for ESP-IDF's nvs_flash.h.
+
+#include "nvs.h"
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
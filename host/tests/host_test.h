@@ -0,0 +1,51 @@
+#pragma once
+
+// Checks for the host tests. A failed check is reported and counted, the test carries on so one run shows every
+// failure, and main returns host_test_result().
+
+#include <stdio.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include <esp_log.h>
+
+static int host_test_failures = 0;
+
+#define CHECK(cond) do {                                                                        \
+        if (!(cond)) {                                                                          \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);                     \
+            host_test_failures++;                                                               \
+        }                                                                                       \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) do {                                                         \
+        const long long actual_ = (long long) (actual);                                         \
+        const long long expected_ = (long long) (expected);                                     \
+        if (actual_ != expected_) {                                                             \
+            printf("%s:%d: CHECK_EQ(%s, %s) failed, %lld != %lld\n", __FILE__, __LINE__,        \
+                   #actual, #expected, actual_, expected_);                                     \
+            host_test_failures++;                                                               \
+        }                                                                                       \
+    } while (0)
+
+#define CHECK_OK(expr) CHECK_EQ(expr, ESP_OK)
+
+/**
+ * Runs test, a function taking no arguments, and says which one it was.
+ */
+#define RUN_TEST(test) do {                                                                     \
+        printf("--- %s\n", #test);                                                              \
+        test();                                                                                 \
+    } while (0)
+
+/**
+ * Quietens the playback code's logging to warnings, so test output shows the checks.
+ */
+static inline void host_test_init() {
+    esp_log_level_set("*", ESP_LOG_WARN);
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+}
+
+static inline int host_test_result() {
+    printf(host_test_failures == 0 ? "PASS\n" : "FAIL, %d checks failed\n", host_test_failures);
+    return host_test_failures == 0 ? 0 : 1;
+}
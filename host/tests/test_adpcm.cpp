@@ -0,0 +1,272 @@
+// The branch free IMA-ADPCM decoder against the reference decoder of the IMA recommendation, one branch per bit: every
+// sample of encoded tones and of random data, which drives the predictor into both limits, has to come out the same
+// for mono and stereo at every block size, however the stream is fed to it.
+
+#include "host_test.h"
+#include "adpcm.h"
+
+#include <cmath>
+#include <vector>
+
+#define NR_BLOCKS               7
+#define TAIL_GROUPS             2       // A last block cut short after this many groups, as a file's last block is
+#define RANDOM_BYTES            (64 * 1024)
+
+static const int32_t ima_step_table[89] = {
+        7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97,
+        107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+        876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871,
+        5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623,
+        27086, 29794, 32767};
+
+static const int32_t ima_index_table[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+typedef struct {
+    int32_t predictor;
+    int32_t index;
+} ima_state_t;
+
+/**
+ * One sample as the IMA recommendation decodes it.
+ */
+static int32_t reference_nibble(ima_state_t* state, uint32_t nibble) {
+    const int32_t step = ima_step_table[state->index];
+    int32_t diff = step >> 3;
+    if (nibble & 4) {
+        diff += step;
+    }
+    if (nibble & 2) {
+        diff += step >> 1;
+    }
+    if (nibble & 1) {
+        diff += step >> 2;
+    }
+    if (nibble & 8) {
+        state->predictor -= diff;
+    } else {
+        state->predictor += diff;
+    }
+    if (state->predictor > 32767) {
+        state->predictor = 32767;
+    } else if (state->predictor < -32768) {
+        state->predictor = -32768;
+    }
+    state->index += ima_index_table[nibble];
+    if (state->index < 0) {
+        state->index = 0;
+    } else if (state->index > 88) {
+        state->index = 88;
+    }
+    return state->predictor;
+}
+
+/**
+ * The whole of data as 16 bit stereo, block by block as WAV lays it out, a partial group at the end left out.
+ */
+static std::vector<int16_t> reference_decode(const std::vector<uint8_t>& data, uint16_t num_channels,
+                                             uint16_t block_align) {
+    std::vector<int16_t> out;
+    for (size_t block = 0; block < data.size(); block += block_align) {
+        const size_t end = block + block_align < data.size() ? block + block_align : data.size();
+        if (end - block < 4u * num_channels) {
+            break;
+        }
+        ima_state_t state[2];
+        std::vector<int16_t> channel[2];
+        for (uint32_t ch = 0; ch < num_channels; ch++) {
+            const uint8_t* header = &data[block + 4 * ch];
+            state[ch].predictor = (int16_t) (header[0] | (header[1] << 8));
+            state[ch].index = header[2] > 88 ? 88 : header[2];
+            channel[ch].push_back((int16_t) state[ch].predictor);
+        }
+        // Then 4 bytes of each channel in turn, 8 samples low nibble first.
+        for (size_t group = block + 4 * num_channels; group + 4 * num_channels <= end; group += 4 * num_channels) {
+            for (uint32_t ch = 0; ch < num_channels; ch++) {
+                for (uint32_t i = 0; i < 8; i++) {
+                    const uint8_t byte = data[group + 4 * ch + i / 2];
+                    channel[ch].push_back((int16_t) reference_nibble(&state[ch], (i & 1) ? byte >> 4 : byte & 15));
+                }
+            }
+        }
+        for (size_t i = 0; i < channel[0].size(); i++) {
+            out.push_back(channel[0][i]);
+            out.push_back(channel[num_channels - 1][i]);
+        }
+    }
+    return out;
+}
+
+/**
+ * The nibble that takes state closest to sample, as an encoder picks it.
+ */
+static uint32_t encode_nibble(ima_state_t* state, int32_t sample) {
+    int32_t step = ima_step_table[state->index];
+    int32_t diff = sample - state->predictor;
+    uint32_t nibble = 0;
+    if (diff < 0) {
+        nibble = 8;
+        diff = -diff;
+    }
+    for (uint32_t bit = 4; bit > 0; bit >>= 1) {
+        if (diff >= step) {
+            nibble |= bit;
+            diff -= step;
+        }
+        step >>= 1;
+    }
+    reference_nibble(state, nibble);
+    return nibble;
+}
+
+/**
+ * NR_BLOCKS blocks of two tones with noise encoded, then a short last block.
+ */
+static std::vector<uint8_t> encode_tones(uint16_t num_channels, uint16_t block_align) {
+    const uint32_t frames_per_block = (block_align / num_channels - 4) * 2 + 1;
+    std::vector<uint8_t> data;
+    ima_state_t state[2] = {{0, 0}, {0, 0}};
+    uint32_t t = 0;
+    uint32_t noise = 1;
+    for (uint32_t block = 0; block <= NR_BLOCKS; block++) {
+        const uint32_t nr_frames = block < NR_BLOCKS ? frames_per_block : 1 + TAIL_GROUPS * 8;
+        std::vector<int32_t> pcm[2];
+        for (uint32_t ch = 0; ch < num_channels; ch++) {
+            for (uint32_t i = 0; i < nr_frames; i++) {
+                noise = noise * 1103515245 + 12345;
+                pcm[ch].push_back((int32_t) (12000 * sin((t + i) * 0.03 * (ch + 1))) + (int32_t) ((noise >> 16) % 2000)
+                                  - 1000);
+            }
+        }
+        t += nr_frames;
+        for (uint32_t ch = 0; ch < num_channels; ch++) {
+            state[ch].predictor = pcm[ch][0];
+            data.push_back(pcm[ch][0] & 0xff);
+            data.push_back((pcm[ch][0] >> 8) & 0xff);
+            data.push_back(state[ch].index);
+            data.push_back(0);
+        }
+        for (uint32_t first = 1; first < nr_frames; first += 8) {
+            for (uint32_t ch = 0; ch < num_channels; ch++) {
+                uint8_t bytes[4] = {0, 0, 0, 0};
+                for (uint32_t i = 0; i < 8; i++) {
+                    bytes[i / 2] |= encode_nibble(&state[ch], pcm[ch][first + i]) << ((i & 1) * 4);
+                }
+                data.insert(data.end(), bytes, bytes + 4);
+            }
+        }
+    }
+    return data;
+}
+
+/**
+ * Decodes data asking for a different number of frames each call, with exactly the bytes adpcm_input_bytes asks for.
+ */
+static std::vector<int16_t> decode_in_pieces(const std::vector<uint8_t>& data, uint16_t num_channels,
+                                             uint16_t block_align) {
+    adpcm_decoder_t decoder;
+    adpcm_init(&decoder, num_channels, block_align);
+    std::vector<int16_t> out(2 * adpcm_stream_frames(&decoder, data.size()));
+    uint32_t position = 0;
+    uint32_t nr_frames = 0;
+    uint32_t want = 0;
+    while (position < data.size()) {
+        want = want * 7 % 301 + 8;      // Never too few for the next group
+        uint32_t nr_bytes = adpcm_input_bytes(&decoder, want);
+        const bool last = nr_bytes >= data.size() - position;
+        nr_bytes = last ? data.size() - position : nr_bytes;
+        uint32_t nr_used;
+        const uint32_t nr_out = adpcm_decode(&decoder, &data[position], nr_bytes, &out[2 * nr_frames],
+                                             last ? out.size() / 2 - nr_frames : want, &nr_used);
+        if (!last) {
+            CHECK_EQ(nr_used, nr_bytes);
+        }
+        if (nr_used == 0) {
+            break;      // Only a partial group left
+        }
+        position += nr_used;
+        nr_frames += nr_out;
+    }
+    CHECK_EQ(nr_frames, out.size() / 2);
+    out.resize(2 * nr_frames);
+    return out;
+}
+
+static void check_bit_exact(const std::vector<uint8_t>& data, uint16_t num_channels, uint16_t block_align) {
+    const std::vector<int16_t> expected = reference_decode(data, num_channels, block_align);
+    adpcm_decoder_t decoder;
+    adpcm_init(&decoder, num_channels, block_align);
+    CHECK_EQ(adpcm_stream_frames(&decoder, data.size()), expected.size() / 2);
+
+    // All in one call.
+    std::vector<int16_t> whole(expected.size() + 2);
+    uint32_t nr_used;
+    const uint32_t nr_frames = adpcm_decode(&decoder, data.data(), data.size(), whole.data(), whole.size() / 2, &nr_used);
+    CHECK_EQ(nr_frames, expected.size() / 2);
+    whole.resize(2 * nr_frames);
+    const bool same = whole == expected;
+    if (!same) {
+        printf("%d channels, block_align %d: differs from the reference\n", num_channels, block_align);
+    }
+    CHECK(same);
+    CHECK(decode_in_pieces(data, num_channels, block_align) == expected);
+}
+
+static void test_tones_match_the_reference() {
+    const uint16_t block_aligns[] = {36, 256, 512, 1024, 2048};
+    for (uint16_t num_channels = 1; num_channels <= 2; num_channels++) {
+        for (uint16_t block_align : block_aligns) {
+            if (adpcm_valid_block_align(num_channels, block_align)) {
+                std::vector<uint8_t> data = encode_tones(num_channels, block_align);
+                data.push_back(1);      // A partial group after the last whole one, decoded to nothing
+                check_bit_exact(data, num_channels, block_align);
+            }
+        }
+    }
+}
+
+static void test_random_data_matches_the_reference() {
+    // Any nibble in any order, with header indexes past the table, runs the predictor into both limits.
+    std::vector<uint8_t> data(RANDOM_BYTES);
+    uint32_t state = 99;
+    for (uint8_t& byte : data) {
+        state = state * 1103515245 + 12345;
+        byte = (uint8_t) (state >> 16);
+    }
+    for (uint16_t num_channels = 1; num_channels <= 2; num_channels++) {
+        check_bit_exact(data, num_channels, 1024);
+        check_bit_exact(data, num_channels, 36 * num_channels);
+    }
+
+    // Full scale steps all one way must clamp, not wrap.
+    std::vector<uint8_t> rising(256, 0x77);
+    rising[0] = 0x00;
+    rising[1] = 0x70;
+    rising[2] = 60;
+    rising[3] = 0;
+    check_bit_exact(rising, 1, 256);
+    const std::vector<int16_t> out = reference_decode(rising, 1, 256);
+    CHECK_EQ(out.back(), 32767);
+}
+
+static void test_block_align_limits() {
+    CHECK(adpcm_valid_block_align(1, 256));
+    CHECK(adpcm_valid_block_align(2, 1024));
+    CHECK(!adpcm_valid_block_align(2, 8));          // Headers only
+    CHECK(!adpcm_valid_block_align(2, 1026));       // Not whole groups
+    CHECK(!adpcm_valid_block_align(3, 1020));
+    adpcm_decoder_t decoder;
+    adpcm_init(&decoder, 2, 1024);
+    CHECK_EQ(decoder.frames_per_block, 1017);
+    CHECK_EQ(adpcm_stream_frames(&decoder, 1024 + 8 + 16), 1017 + 1 + 16);
+    CHECK_EQ(adpcm_input_bytes(&decoder, 1), 8);
+    CHECK_EQ(adpcm_input_bytes(&decoder, 8), 8);    // The header frame, the next group would overshoot
+    CHECK_EQ(adpcm_input_bytes(&decoder, 9), 16);
+}
+
+int main() {
+    host_test_init();
+    RUN_TEST(test_tones_match_the_reference);
+    RUN_TEST(test_random_data_matches_the_reference);
+    RUN_TEST(test_block_align_limits);
+    return host_test_result();
+}
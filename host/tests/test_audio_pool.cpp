@@ -0,0 +1,216 @@
+// The audio pool: every block handed out must be its own, aligned and in the pool, blocks taken and given back from
+// several tasks at once must never be handed out twice, and thousands of plays through the pipeline and the clip
+// cache must leave the heap and the pool as they found them.
+
+#include "host_test.h"
+#include "audio_pool.h"
+#include "clip_cache.h"
+#include "host_shim.h"
+#include "pcm_ramp.h"
+#include "playback_pipeline.h"
+#include "wav_player.h"
+
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <unistd.h>
+#include <cstring>
+
+#define POOL_BLOCKS             (PIPELINE_MAX_BLOCKS + 2)       // As app_main
+#define DMA_BUF_BYTES           4096    // As i2s_config in main.cpp
+#define DMA_BUF_COUNT           8
+#define SAMPLE_RATE             16000   // The clips' rate, so nothing is resampled
+#define NR_TASKS                4
+#define CYCLES_PER_TASK         20000
+#define NR_PLAYS                3000
+#define CACHE_BUDGET            (100 * 1024)    // One of the clips at a time, so every cached play evicts the other
+
+static const char* const clip_names[] = {"OYM-USA-male-1-16000.wav", "OYM-USA-male-1-NoMiddle.wav"};
+
+static uint64_t nr_bytes_sunk;
+
+/**
+ * Takes whatever it is given at once, so plays run as fast as they can be read.
+ */
+static esp_err_t null_write(void* ctx, const char* data, size_t size, size_t* nr_bytes_written) {
+    nr_bytes_sunk += size;
+    *nr_bytes_written = size;
+    return ESP_OK;
+}
+
+static const pcm_sink_t null_sink = {null_write, nullptr, nullptr, DMA_BUF_BYTES, DMA_BUF_COUNT, SAMPLE_RATE};
+
+static void test_blocks_are_distinct() {
+    audio_pool_stats_t before, after;
+    audio_pool_get_stats(&before);
+    CHECK_EQ(before.nr_free, POOL_BLOCKS);
+
+    char* blocks[POOL_BLOCKS];
+    for (int i = 0; i < POOL_BLOCKS; i++) {
+        blocks[i] = audio_pool_acquire();
+        CHECK(blocks[i] != nullptr);
+        CHECK_EQ((uintptr_t) blocks[i] % 4, 0);
+        memset(blocks[i], i, AUDIO_POOL_BLOCK_SIZE);
+    }
+    CHECK(audio_pool_acquire() == nullptr);
+    for (int i = 0; i < POOL_BLOCKS; i++) {
+        for (int j = 0; j < POOL_BLOCKS; j++) {
+            CHECK(i == j || blocks[i] + AUDIO_POOL_BLOCK_SIZE <= blocks[j] || blocks[j] + AUDIO_POOL_BLOCK_SIZE <= blocks[i]);
+        }
+        CHECK(blocks[i][0] == i && blocks[i][AUDIO_POOL_BLOCK_SIZE - 1] == i);
+    }
+    audio_pool_get_stats(&after);
+    CHECK_EQ(after.nr_free, 0);
+    CHECK_EQ(after.min_free, 0);
+    CHECK_EQ(after.nr_acquired - before.nr_acquired, POOL_BLOCKS);
+    CHECK_EQ(after.nr_exhausted - before.nr_exhausted, 1);
+
+    // Given back in a different order from the one they were taken in.
+    for (int i = 0; i < POOL_BLOCKS; i += 2) {
+        audio_pool_release(blocks[i]);
+    }
+    for (int i = 1; i < POOL_BLOCKS; i += 2) {
+        audio_pool_release(blocks[i]);
+    }
+    audio_pool_get_stats(&after);
+    CHECK_EQ(after.nr_free, POOL_BLOCKS);
+}
+
+static SemaphoreHandle_t tasks_done;
+
+typedef struct {
+    uint8_t mark;
+    uint32_t nr_cycles;
+    uint32_t nr_empty;
+    uint32_t nr_corrupt;
+} pool_task_t;
+
+/**
+ * Takes one or two blocks at a time, marks them as its own and checks nobody else wrote to them before giving them
+ * back.
+ */
+static void pool_task(void* arg) {
+    pool_task_t* task = (pool_task_t*) arg;
+    for (int i = 0; i < CYCLES_PER_TASK; i++) {
+        char* blocks[2] = {audio_pool_acquire(), i & 1 ? audio_pool_acquire() : nullptr};
+        for (char* block : blocks) {
+            if (block != nullptr) {
+                memset(block, task->mark, AUDIO_POOL_BLOCK_SIZE);
+            }
+        }
+        if (blocks[0] == nullptr) {
+            task->nr_empty++;
+        }
+        if (i % 64 == 0) {
+            vTaskDelay(1);      // Let the others in while holding the blocks
+        }
+        for (char* block : blocks) {
+            if (block != nullptr) {
+                if (block[0] != (char) task->mark || block[AUDIO_POOL_BLOCK_SIZE / 2] != (char) task->mark
+                    || block[AUDIO_POOL_BLOCK_SIZE - 1] != (char) task->mark) {
+                    task->nr_corrupt++;
+                }
+                audio_pool_release(block);
+            }
+        }
+        task->nr_cycles++;
+    }
+    xSemaphoreGive(tasks_done);
+    vTaskDelete(nullptr);
+}
+
+static void test_several_tasks_never_share_a_block() {
+    tasks_done = xSemaphoreCreateCounting(NR_TASKS, 0);
+    pool_task_t tasks[NR_TASKS];
+    for (int i = 0; i < NR_TASKS; i++) {
+        tasks[i] = {(uint8_t) (0x11 * (i + 1)), 0, 0, 0};
+        CHECK(xTaskCreate(pool_task, "pool", 4096, &tasks[i], 5, nullptr) == pdPASS);
+    }
+    for (int i = 0; i < NR_TASKS; i++) {
+        CHECK(xSemaphoreTake(tasks_done, portMAX_DELAY) == pdTRUE);
+    }
+    for (const pool_task_t& task : tasks) {
+        CHECK_EQ(task.nr_cycles, CYCLES_PER_TASK);
+        CHECK_EQ(task.nr_corrupt, 0);
+        CHECK_EQ(task.nr_empty, 0);     // NR_TASKS * 2 blocks are never more than the pool
+    }
+    audio_pool_stats_t stats;
+    audio_pool_get_stats(&stats);
+    CHECK_EQ(stats.nr_free, POOL_BLOCKS);
+}
+
+/**
+ * Plays the clip through the pipeline from its file, then through the clip cache, which loads it over the other.
+ */
+static void play_both_ways(const char* filename) {
+    FILE* f = fopen(filename, "rb");
+    CHECK(f != nullptr);
+    if (f == nullptr) {
+        return;
+    }
+    wav_header_t header;
+    uint32_t data_offset;
+    CHECK_OK(wav_parse_header(f, &header, &data_offset));
+    CHECK_OK(pipeline_play(f, &header, nullptr));
+    fclose(f);
+
+    const wav_data_t* clip = clip_cache_get(filename);
+    CHECK(clip != nullptr);
+    uint32_t nr_bytes_written;
+    if (clip != nullptr) {
+        CHECK_OK(clip_cache_stream(clip, &null_sink, 0, &nr_bytes_written));
+    }
+}
+
+static void test_thousands_of_plays_do_not_grow_the_heap() {
+    // Once round both clips first, so whatever stays allocated between plays already is.
+    play_both_ways(clip_names[0]);
+    play_both_ways(clip_names[1]);
+    const size_t heap_used = host_heap_used();
+    audio_pool_stats_t before, after;
+    audio_pool_get_stats(&before);
+    clip_cache_stats_t cache_before, cache_after;
+    clip_cache_get_stats(&cache_before);
+    const uint64_t nr_bytes_before = nr_bytes_sunk;
+
+    for (int i = 0; i < NR_PLAYS; i++) {
+        play_both_ways(clip_names[i & 1]);
+        if (host_heap_used() != heap_used && i & 1) {
+            printf("Heap grew from %d to %d bytes after %d plays\n", (int) heap_used, (int) host_heap_used(), i + 1);
+            CHECK(false);
+            break;
+        }
+    }
+
+    CHECK_EQ(host_heap_used(), heap_used);
+    audio_pool_get_stats(&after);
+    CHECK_EQ(after.nr_free, POOL_BLOCKS);
+    CHECK_EQ(after.nr_exhausted, before.nr_exhausted);
+    CHECK_EQ(after.nr_acquired - before.nr_acquired, NR_PLAYS * DMA_BUF_COUNT);
+    CHECK_EQ(after.dma_largest_free, before.dma_largest_free);
+    clip_cache_get_stats(&cache_after);
+    CHECK_EQ(cache_after.evictions - cache_before.evictions, NR_PLAYS);
+    CHECK(nr_bytes_sunk - nr_bytes_before > (uint64_t) NR_PLAYS * 2 * DMA_BUF_BYTES);
+}
+
+int main() {
+    host_test_init();
+    if (chdir(HOST_SPIFFS_DATA) != 0) {
+        printf("Cannot open %s\n", HOST_SPIFFS_DATA);
+        return 1;
+    }
+    esp_log_level_set("*", ESP_LOG_WARN);       // Every play and load is logged
+    const pcm_ramp_config_t no_ramps = {0, 0, 0};
+    pcm_ramp_set_config(&no_ramps);
+    CHECK_OK(audio_pool_init(POOL_BLOCKS));
+    CHECK_EQ(audio_pool_init(POOL_BLOCKS), ESP_ERR_INVALID_STATE);
+    CHECK_OK(wav_player_init());
+    CHECK_OK(clip_cache_init(CACHE_BUDGET));
+    CHECK_OK(pipeline_init(&null_sink));
+
+    RUN_TEST(test_blocks_are_distinct);
+    RUN_TEST(test_several_tasks_never_share_a_block);
+    RUN_TEST(test_thousands_of_plays_do_not_grow_the_heap);
+    return host_test_result();
+}
@@ -0,0 +1,255 @@
+// The audio service on the FreeRTOS shim: a command must reach the mixer within a block of being sent, each command
+// type must start and stop what it says, queued clips must wait for the sound before them, and commands sent from
+// several tasks at once must all be carried out or refused, never lost.
+
+#include "host_test.h"
+#include "audio_pool.h"
+#include "audio_service.h"
+#include "clip_cache.h"
+#include "clip_store.h"
+#include "host_shim.h"
+#include "mixer.h"
+#include "sim_sink.h"
+#include "wav_player.h"
+
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <unistd.h>
+
+#define CLIPS_PARTITION         "clips"
+#define DMA_BUF_BYTES           4096    // As i2s_config in main.cpp
+#define DMA_BUF_COUNT           8
+#define SAMPLE_RATE             16000   // The clips' rate, so nothing is resampled
+#define BLOCK_US                ((DMA_BUF_BYTES / 4) * 1000000LL / SAMPLE_RATE)
+#define MAX_DISPATCH_US         10000   // Send to mixer_play, the service task only has to wake
+#define MAX_FIRST_SAMPLE_US     (BLOCK_US + 20000)      // The mixer waits for at most one descriptor to free
+#define STOP_WITHIN_US          (3 * BLOCK_US + 100000) // The ramp down, and the blocks already mixed
+#define POLL_MS                 5
+#define QUIET_MS                50      // Idle this long, past the service's own poll for queued clips
+#define DRAIN_TIMEOUT_MS        10000
+#define NR_TASKS                4
+#define SENDS_PER_TASK          200
+
+#define CLIP_LONG               0
+#define CLIP_SHORT              1
+
+static const char* const clip_names[] = {"OYM-USA-male-1-16000.wav", "OYM-USA-male-1-NoMiddle.wav"};
+
+static sim_sink_t sim;
+static int64_t clip_us[2];
+
+/**
+ * Polls the mixer until every voice has ended and nothing queued starts after them, returning the most that played
+ * at once and when the last one ended, or -1 on timeout.
+ */
+static int32_t wait_idle(int64_t* idle_us) {
+    int32_t most = 0;
+    int quiet_ms = 0;
+    for (int ms = 0; ms < DRAIN_TIMEOUT_MS; ms += POLL_MS) {
+        const int32_t nr_voices = mixer_active_voices();
+        most = nr_voices > most ? nr_voices : most;
+        if (nr_voices > 0) {
+            quiet_ms = 0;
+        } else if (quiet_ms == 0) {
+            *idle_us = esp_timer_get_time();
+        }
+        if (nr_voices == 0 && (quiet_ms += POLL_MS) > QUIET_MS) {
+            return most;
+        }
+        vTaskDelay(POLL_MS / portTICK_PERIOD_MS);
+    }
+    return -1;
+}
+
+static bool wait_playing() {
+    for (int ms = 0; ms < DRAIN_TIMEOUT_MS; ms += POLL_MS) {
+        if (mixer_active_voices() > 0) {
+            return true;
+        }
+        vTaskDelay(POLL_MS / portTICK_PERIOD_MS);
+    }
+    return false;
+}
+
+static void test_play_reaches_the_mixer_within_a_block() {
+    audio_service_stats_t before, after;
+    audio_service_get_stats(&before);
+    sim_sink_start(&sim, SAMPLE_RATE);
+    CHECK_OK(audio_service_send(AUDIO_CMD_PLAY, CLIP_SHORT, MIXER_GAIN_UNITY));
+    int64_t idle_us;
+    CHECK_EQ(wait_idle(&idle_us), 1);
+    sim_sink_drain(&sim);
+
+    audio_service_get_stats(&after);
+    mixer_stats_t mixer;
+    mixer_get_stats(&mixer);
+    CHECK_EQ(after.nr_commands, before.nr_commands + 1);
+    CHECK_EQ(after.nr_failed, before.nr_failed);
+    CHECK(after.last_dispatch_us >= 0 && after.last_dispatch_us < MAX_DISPATCH_US);
+    CHECK(mixer.last_first_sample_us > 0 && mixer.last_first_sample_us < MAX_FIRST_SAMPLE_US);
+    CHECK(sim.stats.first_audible_us > 0);
+}
+
+static void test_stop_ends_the_clip_early() {
+    sim_sink_start(&sim, SAMPLE_RATE);
+    CHECK_OK(audio_service_send(AUDIO_CMD_PLAY, CLIP_LONG, MIXER_GAIN_UNITY));
+    CHECK(wait_playing());
+    const int64_t stop_us = esp_timer_get_time();
+    CHECK_OK(audio_service_send(AUDIO_CMD_STOP, CLIP_LONG, 0));
+    int64_t idle_us;
+    CHECK_EQ(wait_idle(&idle_us), 1);
+    sim_sink_drain(&sim);
+    CHECK(idle_us - stop_us < STOP_WITHIN_US);
+    CHECK(STOP_WITHIN_US < clip_us[CLIP_LONG]);
+
+    // A stop for a clip that is not playing is carried out and does nothing.
+    audio_service_stats_t before, after;
+    audio_service_get_stats(&before);
+    CHECK_OK(audio_service_send(AUDIO_CMD_STOP, CLIP_SHORT, 0));
+    vTaskDelay(20 / portTICK_PERIOD_MS);
+    audio_service_get_stats(&after);
+    CHECK_EQ(after.nr_commands, before.nr_commands + 1);
+    CHECK_EQ(mixer_active_voices(), 0);
+}
+
+static void test_queued_clip_waits_for_the_one_before() {
+    sim_sink_start(&sim, SAMPLE_RATE);
+    CHECK_OK(audio_service_send(AUDIO_CMD_PLAY, CLIP_SHORT, MIXER_GAIN_UNITY));
+    CHECK_OK(audio_service_send(AUDIO_CMD_QUEUE, CLIP_LONG, MIXER_GAIN_UNITY));
+    int64_t idle_us;
+    CHECK_EQ(wait_idle(&idle_us), 1);      // Never both at once
+    sim_sink_drain(&sim);
+    CHECK(sim.stats.last_audible_us - sim.stats.first_audible_us >= clip_us[CLIP_SHORT] + clip_us[CLIP_LONG]);
+}
+
+static void test_preempt_forgets_the_queue() {
+    audio_service_stats_t before, after;
+    audio_service_get_stats(&before);
+    const int64_t send_us = esp_timer_get_time();
+    CHECK_OK(audio_service_send(AUDIO_CMD_PLAY, CLIP_LONG, MIXER_GAIN_UNITY));
+    CHECK_OK(audio_service_send(AUDIO_CMD_QUEUE, CLIP_LONG, MIXER_GAIN_UNITY));
+    CHECK_OK(audio_service_send(AUDIO_CMD_QUEUE, CLIP_LONG, MIXER_GAIN_UNITY));
+    CHECK(wait_playing());
+    CHECK_OK(audio_service_send(AUDIO_CMD_PREEMPT, CLIP_SHORT, MIXER_GAIN_UNITY));
+    int64_t idle_us;
+    CHECK(wait_idle(&idle_us) >= 1);
+    // The short clip after the long one's ramp down, and nothing of the queue after it.
+    CHECK(idle_us - send_us < clip_us[CLIP_SHORT] + STOP_WITHIN_US + BLOCK_US * DMA_BUF_COUNT);
+    audio_service_get_stats(&after);
+    CHECK_EQ(after.nr_commands, before.nr_commands + 4);
+    CHECK_EQ(after.nr_failed, before.nr_failed);
+}
+
+static void test_refuses_what_it_cannot_hold() {
+    CHECK_EQ(audio_service_send(AUDIO_CMD_PLAY, 2, MIXER_GAIN_UNITY), ESP_ERR_INVALID_ARG);
+
+    // Only so many clips may wait, the rest are dropped.
+    audio_service_stats_t before, after;
+    audio_service_get_stats(&before);
+    CHECK_OK(audio_service_send(AUDIO_CMD_PLAY, CLIP_LONG, MIXER_GAIN_UNITY));
+    CHECK(wait_playing());
+    for (int i = 0; i < AUDIO_SERVICE_MAX_PENDING + 3; i++) {
+        CHECK_OK(audio_service_send(AUDIO_CMD_QUEUE, CLIP_SHORT, MIXER_GAIN_UNITY));
+        vTaskDelay(1);      // Each one handled before the next, so the command queue never fills
+    }
+    vTaskDelay(20 / portTICK_PERIOD_MS);
+    audio_service_get_stats(&after);
+    CHECK_EQ(after.nr_dropped - before.nr_dropped, 3);
+    CHECK_OK(audio_service_send(AUDIO_CMD_PREEMPT, CLIP_SHORT, MIXER_GAIN_UNITY));
+    int64_t idle_us;
+    CHECK(wait_idle(&idle_us) >= 1);
+}
+
+static SemaphoreHandle_t tasks_done;
+
+typedef struct {
+    uint32_t nr_sent;
+    uint32_t nr_refused;
+    uint32_t nr_failed;
+} sender_task_t;
+
+/**
+ * Sends stops as fast as it can, the cheapest command for the service to carry out, so the queue fills.
+ */
+static void sender_task(void* arg) {
+    sender_task_t* sender = (sender_task_t*) arg;
+    for (int i = 0; i < SENDS_PER_TASK; i++) {
+        const esp_err_t err = audio_service_send(AUDIO_CMD_STOP, CLIP_SHORT, 0);
+        if (err == ESP_OK) {
+            sender->nr_sent++;
+        } else if (err == ESP_ERR_NO_MEM) {
+            sender->nr_refused++;
+        } else {
+            sender->nr_failed++;
+        }
+    }
+    xSemaphoreGive(tasks_done);
+    vTaskDelete(nullptr);
+}
+
+static void test_commands_from_several_tasks() {
+    tasks_done = xSemaphoreCreateCounting(NR_TASKS, 0);
+    audio_service_stats_t before, after;
+    audio_service_get_stats(&before);
+
+    sender_task_t senders[NR_TASKS];
+    for (int i = 0; i < NR_TASKS; i++) {
+        senders[i] = {0, 0, 0};
+        CHECK(xTaskCreate(sender_task, "sender", 4096, &senders[i], 5, nullptr) == pdPASS);
+    }
+    for (int i = 0; i < NR_TASKS; i++) {
+        CHECK(xSemaphoreTake(tasks_done, portMAX_DELAY) == pdTRUE);
+    }
+    vTaskDelay(50 / portTICK_PERIOD_MS);
+
+    uint32_t nr_sent = 0, nr_refused = 0;
+    for (const sender_task_t& sender : senders) {
+        CHECK_EQ(sender.nr_failed, 0);
+        CHECK_EQ(sender.nr_sent + sender.nr_refused, SENDS_PER_TASK);
+        nr_sent += sender.nr_sent;
+        nr_refused += sender.nr_refused;
+    }
+    audio_service_get_stats(&after);
+    CHECK_EQ(after.nr_commands - before.nr_commands, nr_sent);      // Every one accepted was carried out once
+    CHECK_EQ(after.nr_dropped - before.nr_dropped, nr_refused);
+    CHECK(nr_sent > 0);
+
+    // Still taking commands.
+    CHECK_OK(audio_service_send(AUDIO_CMD_PLAY, CLIP_SHORT, MIXER_GAIN_UNITY));
+    int64_t idle_us;
+    CHECK_EQ(wait_idle(&idle_us), 1);
+}
+
+int main() {
+    host_test_init();
+    if (chdir(HOST_SPIFFS_DATA) != 0) {
+        printf("Cannot open %s\n", HOST_SPIFFS_DATA);
+        return 1;
+    }
+    esp_log_level_set("audio_service", ESP_LOG_ERROR);     // Each dropped clip is logged
+    CHECK_OK(host_partition_add(CLIPS_PARTITION, ESP_PARTITION_TYPE_DATA,
+                                (esp_partition_subtype_t) CLIP_STORE_PARTITION_TYPE, HOST_CLIPS_IMAGE,
+                                HOST_CLIPS_PARTITION_SIZE));
+    CHECK_OK(clip_store_init(CLIPS_PARTITION));
+    CHECK_OK(wav_player_init());
+    CHECK_OK(audio_pool_init(1));       // The mixer's output block
+    CHECK_OK(sim_sink_init(&sim, DMA_BUF_BYTES, DMA_BUF_COUNT));
+    sim_sink_start(&sim, SAMPLE_RATE);
+    CHECK_OK(mixer_init(&sim.sink));
+    CHECK_OK(audio_service_init(clip_names, 2));
+    for (int i = 0; i < 2; i++) {
+        wav_data_t clip;
+        CHECK_OK(clip_store_find(clip_names[i], &clip));
+        clip_us[i] = mixer_clip_frames(&clip) * 1000000LL / clip.sample_rate;
+    }
+
+    RUN_TEST(test_play_reaches_the_mixer_within_a_block);
+    RUN_TEST(test_stop_ends_the_clip_early);
+    RUN_TEST(test_queued_clip_waits_for_the_one_before);
+    RUN_TEST(test_preempt_forgets_the_queue);
+    RUN_TEST(test_refuses_what_it_cannot_hold);
+    RUN_TEST(test_commands_from_several_tasks);
+    return host_test_result();
+}
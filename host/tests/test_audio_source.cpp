@@ -0,0 +1,218 @@
+// The audio sources: a clip read from the clips partition with no file system must be the bytes its WAV holds however
+// it is read and sought, reads must stop at its end and not at the partition's, and ranges off the partition refused.
+// A pipe must hand over everything written to it in order, however the writes and reads are cut, and then end.
+
+#include "host_test.h"
+#include "audio_source.h"
+#include "clip_store.h"
+#include "host_shim.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <unistd.h>
+#include <cstring>
+#include <vector>
+
+#define CLIPS_PARTITION         "clips"
+#define DMA_BUF_BYTES           4096    // As i2s_config in main.cpp
+#define PIPE_SIZE               (DMA_BUF_BYTES / 2)     // Smaller than the reads, so the writer keeps filling it
+#define PIPE_WRITE_BYTES        777     // Writes that fall across the reads
+#define PIPE_PAUSE_EVERY        16      // Writes between pauses, so the reader also finds the pipe empty
+
+static const char* const clip_names[] = {"OYM-USA-male-1-16000.wav", "OYM-USA-male-1-NoMiddle.wav"};
+
+static std::vector<char> wav_data(const char* path) {
+    FILE* f = fopen(path, "rb");
+    wav_header_t header;
+    uint32_t data_offset;
+    CHECK_OK(wav_parse_header(f, &header, &data_offset));
+    std::vector<char> data(header.data.chunk_size);
+    CHECK_EQ(fread(data.data(), 1, data.size(), f), data.size());
+    fclose(f);
+    return data;
+}
+
+/**
+ * Reads the source to its end in pieces of read_bytes.
+ */
+static std::vector<char> read_all(const audio_source_t* source, uint32_t read_bytes) {
+    std::vector<char> bytes;
+    std::vector<char> piece(read_bytes);
+    size_t nr_bytes_read;
+    while (source->read(source->ctx, piece.data(), piece.size(), &nr_bytes_read) == ESP_OK && nr_bytes_read > 0) {
+        bytes.insert(bytes.end(), piece.begin(), piece.begin() + nr_bytes_read);
+    }
+    return bytes;
+}
+
+static void test_partition_reads_the_clip_data() {
+    const uint32_t read_sizes[] = {1, 1000, DMA_BUF_BYTES, 1 << 20};
+    for (const char* name : clip_names) {
+        const std::vector<char> data = wav_data(name);
+        const clip_table_entry_t* entry = clip_store_find_entry(name);
+        CHECK(entry != nullptr);
+        if (entry == nullptr) {
+            continue;
+        }
+        for (uint32_t read_bytes : read_sizes) {
+            partition_source_t part;
+            CHECK_OK(partition_source_open(&part, CLIPS_PARTITION, entry->offset, entry->nr_bytes));
+            CHECK(read_all(&part.source, read_bytes) == data);
+        }
+    }
+}
+
+static void test_partition_seeks() {
+    const std::vector<char> data = wav_data(clip_names[0]);
+    const clip_table_entry_t* entry = clip_store_find_entry(clip_names[0]);
+    partition_source_t part;
+    CHECK_OK(partition_source_open(&part, CLIPS_PARTITION, entry->offset, entry->nr_bytes));
+
+    char bytes[DMA_BUF_BYTES];
+    CHECK_OK(part.source.seek(part.source.ctx, 1001));
+    CHECK_EQ(audio_source_read_fully(&part.source, bytes, sizeof(bytes)), sizeof(bytes));
+    CHECK(memcmp(bytes, &data[1001], sizeof(bytes)) == 0);
+
+    // Skipped by seeking, as the players skip silence.
+    CHECK_OK(audio_source_skip(&part.source, 1001 + sizeof(bytes), 3000));
+    CHECK_EQ(audio_source_read_fully(&part.source, bytes, 10), 10);
+    CHECK(memcmp(bytes, &data[1001 + sizeof(bytes) + 3000], 10) == 0);
+
+    // Near the end, reads stop at the clip's last byte and not at the next clip's.
+    CHECK_OK(part.source.seek(part.source.ctx, data.size() - 100));
+    CHECK_EQ(audio_source_read_fully(&part.source, bytes, sizeof(bytes)), 100);
+    CHECK(memcmp(bytes, &data[data.size() - 100], 100) == 0);
+    CHECK_OK(part.source.seek(part.source.ctx, data.size()));
+    CHECK_EQ(audio_source_read_fully(&part.source, bytes, sizeof(bytes)), 0);
+    CHECK_EQ(part.source.seek(part.source.ctx, data.size() + 1), ESP_ERR_INVALID_ARG);
+}
+
+static void test_partition_refuses_bad_ranges() {
+    partition_source_t part;
+    CHECK_EQ(partition_source_open(&part, "no-such-partition", 0, 16), ESP_ERR_NOT_FOUND);
+    CHECK_EQ(partition_source_open(&part, CLIPS_PARTITION, HOST_CLIPS_PARTITION_SIZE - 16, 17), ESP_ERR_INVALID_ARG);
+    CHECK_EQ(partition_source_open(&part, CLIPS_PARTITION, HOST_CLIPS_PARTITION_SIZE + 1, 0), ESP_ERR_INVALID_ARG);
+    CHECK_EQ(partition_source_open(&part, CLIPS_PARTITION, 16, 0xffffffff), ESP_ERR_INVALID_ARG);
+
+    // The whole partition, up to its last byte.
+    CHECK_OK(partition_source_open(&part, CLIPS_PARTITION, 0, HOST_CLIPS_PARTITION_SIZE));
+    CHECK_EQ(read_all(&part.source, 65536).size(), HOST_CLIPS_PARTITION_SIZE);
+}
+
+static void test_file_and_memory_read_the_same() {
+    FILE* f = fopen(clip_names[1], "rb");
+    std::vector<char> whole(1 << 20);
+    whole.resize(fread(whole.data(), 1, whole.size(), f));
+    fclose(f);
+
+    file_source_t file;
+    CHECK_OK(file_source_open(&file, clip_names[1]));
+    CHECK(read_all(&file.source, 1000) == whole);
+    file_source_close(&file);
+
+    memory_source_t memory;
+    memory_source_init(&memory, whole.data(), whole.size());
+    CHECK(read_all(&memory.source, DMA_BUF_BYTES) == whole);
+}
+
+typedef struct {
+    pipe_source_t pipe;
+    const std::vector<char>* data;
+    SemaphoreHandle_t done;
+} pipe_writer_t;
+
+/**
+ * Writes the data into the pipe in pieces, pausing now and then, and closes it.
+ */
+static void pipe_writer(void* arg) {
+    pipe_writer_t* writer = (pipe_writer_t*) arg;
+    const std::vector<char>& data = *writer->data;
+    for (uint32_t position = 0, i = 0; position < data.size(); position += PIPE_WRITE_BYTES, i++) {
+        const uint32_t size = data.size() - position < PIPE_WRITE_BYTES ? data.size() - position : PIPE_WRITE_BYTES;
+        CHECK_OK(pipe_source_write(&writer->pipe, &data[position], size));
+        if (i % PIPE_PAUSE_EVERY == 0) {
+            vTaskDelay(1);
+        }
+    }
+    pipe_source_close_write(&writer->pipe);
+    xSemaphoreGive(writer->done);
+    vTaskDelete(nullptr);
+}
+
+static void test_pipe_hands_over_everything_in_order() {
+    FILE* f = fopen(clip_names[0], "rb");
+    std::vector<char> whole(1 << 20);
+    whole.resize(fread(whole.data(), 1, whole.size(), f));
+    fclose(f);
+
+    const uint32_t read_sizes[] = {1, 1000, DMA_BUF_BYTES};
+    for (uint32_t read_bytes : read_sizes) {
+        pipe_writer_t writer;
+        writer.data = &whole;
+        writer.done = xSemaphoreCreateBinary();
+        CHECK_OK(pipe_source_init(&writer.pipe, PIPE_SIZE));
+        CHECK(writer.pipe.source.seek == nullptr);
+        CHECK(xTaskCreate(pipe_writer, "pipe_writer", 4096, &writer, 5, nullptr) == pdPASS);
+        CHECK(read_all(&writer.pipe.source, read_bytes) == whole);
+
+        // Ended for good.
+        char byte;
+        size_t nr_bytes_read;
+        CHECK_OK(writer.pipe.source.read(writer.pipe.source.ctx, &byte, 1, &nr_bytes_read));
+        CHECK_EQ(nr_bytes_read, 0);
+        CHECK(xSemaphoreTake(writer.done, portMAX_DELAY) == pdTRUE);
+        vSemaphoreDelete(writer.done);
+        pipe_source_free(&writer.pipe);
+    }
+}
+
+static void test_pipe_parses_to_the_data() {
+    // Parsed in order up to the data, as it cannot seek back for chunks after it, and the data follows on.
+    const std::vector<char> data = wav_data(clip_names[1]);
+    FILE* f = fopen(clip_names[1], "rb");
+    std::vector<char> whole(1 << 20);
+    whole.resize(fread(whole.data(), 1, whole.size(), f));
+    fclose(f);
+
+    pipe_writer_t writer;
+    writer.data = &whole;
+    writer.done = xSemaphoreCreateBinary();
+    CHECK_OK(pipe_source_init(&writer.pipe, PIPE_SIZE));
+    CHECK(xTaskCreate(pipe_writer, "pipe_writer", 4096, &writer, 5, nullptr) == pdPASS);
+    wav_header_t header;
+    uint32_t data_offset;
+    CHECK_OK(wav_parse_source_header(&writer.pipe.source, &header, &data_offset));
+    CHECK_EQ(header.data.chunk_size, data.size());
+    CHECK_EQ(header.loop.end_frame, 0);
+    std::vector<char> read(data.size());
+    CHECK_EQ(audio_source_read_fully(&writer.pipe.source, read.data(), read.size()), data.size());
+    CHECK(read == data);
+
+    read_all(&writer.pipe.source, DMA_BUF_BYTES);       // The chunks after the data
+    CHECK(xSemaphoreTake(writer.done, portMAX_DELAY) == pdTRUE);
+    vSemaphoreDelete(writer.done);
+    pipe_source_free(&writer.pipe);
+}
+
+int main() {
+    host_test_init();
+    if (chdir(HOST_SPIFFS_DATA) != 0) {
+        printf("Cannot open %s\n", HOST_SPIFFS_DATA);
+        return 1;
+    }
+    esp_log_level_set("audio_source", ESP_LOG_NONE);   // The bad ranges
+    esp_log_level_set("wav_file", ESP_LOG_WARN);       // Every chunk skipped
+    CHECK_OK(host_partition_add(CLIPS_PARTITION, ESP_PARTITION_TYPE_DATA,
+                                (esp_partition_subtype_t) CLIP_STORE_PARTITION_TYPE, HOST_CLIPS_IMAGE,
+                                HOST_CLIPS_PARTITION_SIZE));
+    CHECK_OK(clip_store_init(CLIPS_PARTITION));
+
+    RUN_TEST(test_partition_reads_the_clip_data);
+    RUN_TEST(test_partition_seeks);
+    RUN_TEST(test_partition_refuses_bad_ranges);
+    RUN_TEST(test_file_and_memory_read_the_same);
+    RUN_TEST(test_pipe_hands_over_everything_in_order);
+    RUN_TEST(test_pipe_parses_to_the_data);
+    return host_test_result();
+}
@@ -0,0 +1,163 @@
+// The clip cache: hits, misses and LRU eviction within the budget, plays served straight from the cached PCM, and the
+// first sample latency it reports.
+
+#include "host_test.h"
+#include "clip_cache.h"
+#include "pcm_ramp.h"
+#include "wav_player.h"
+
+#include <esp_timer.h>
+#include <unistd.h>
+#include <cstring>
+#include <vector>
+
+#define CLIP_A                  "OYM-USA-male-1-16000.wav"
+#define CLIP_B                  "OYM-USA-male-1-NoMiddle.wav"
+#define CLIP_A_BYTES            69120   // Data sections, before trimming
+#define CLIP_B_BYTES            55932
+#define DMA_BUF_BYTES           4096
+#define DMA_BUF_COUNT           8
+#define SAMPLE_RATE             16000   // The clips' own rate, so they play without conversion
+
+/**
+ * Records what is written and how much of it came straight from the clip rather than through a copy.
+ */
+typedef struct {
+    pcm_sink_t sink;
+    const wav_data_t* clip;
+    std::vector<char> output;
+    uint32_t nr_bytes_direct;   // Written from a pointer into clip->data
+    int64_t first_write_us;
+} recording_sink_t;
+
+static esp_err_t recording_write(void* ctx, const char* src, size_t size, size_t* nr_bytes_written) {
+    recording_sink_t* recording = (recording_sink_t*) ctx;
+    if (recording->output.empty()) {
+        recording->first_write_us = esp_timer_get_time();
+    }
+    if (src >= recording->clip->data && src < recording->clip->data + recording->clip->nr_bytes) {
+        recording->nr_bytes_direct += size;
+    }
+    recording->output.insert(recording->output.end(), src, src + size);
+    *nr_bytes_written = size;
+    return ESP_OK;
+}
+
+static void recording_sink_init(recording_sink_t* recording, const wav_data_t* clip) {
+    memset(&recording->sink, 0, sizeof(pcm_sink_t));
+    recording->sink.write = recording_write;
+    recording->sink.ctx = recording;
+    recording->sink.dma_buf_bytes = DMA_BUF_BYTES;
+    recording->sink.dma_buf_count = DMA_BUF_COUNT;
+    recording->sink.sample_rate = SAMPLE_RATE;
+    recording->clip = clip;
+    recording->output.clear();
+    recording->nr_bytes_direct = 0;
+    recording->first_write_us = 0;
+}
+
+static void test_preloaded_clips_hit() {
+    CHECK_OK(clip_cache_init(CLIP_A_BYTES + CLIP_B_BYTES));
+    CHECK_OK(clip_cache_preload(CLIP_A));
+    CHECK_OK(clip_cache_preload(CLIP_B));
+    CHECK_OK(clip_cache_preload(CLIP_A));       // Already there, nothing to do
+    CHECK(clip_cache_get(CLIP_A) != nullptr);
+    CHECK(clip_cache_get(CLIP_B) != nullptr);
+    CHECK(clip_cache_get(CLIP_A) != nullptr);
+
+    clip_cache_stats_t stats;
+    clip_cache_get_stats(&stats);
+    CHECK_EQ(stats.hits, 3);
+    CHECK_EQ(stats.misses, 0);
+    CHECK_EQ(stats.evictions, 0);
+    CHECK(stats.bytes_used > 0);
+    CHECK_EQ(stats.bytes_used + stats.nr_bytes_trimmed, CLIP_A_BYTES + CLIP_B_BYTES);
+}
+
+static void test_evicts_least_recently_used() {
+    // Room for either clip, not both.
+    CHECK_OK(clip_cache_init(CLIP_A_BYTES));
+    CHECK(clip_cache_get(CLIP_A) != nullptr);   // Miss
+    CHECK(clip_cache_get(CLIP_A) != nullptr);   // Hit
+    CHECK(clip_cache_get(CLIP_B) != nullptr);   // Miss, evicts A
+    CHECK(clip_cache_get(CLIP_A) != nullptr);   // Miss, evicts B
+
+    clip_cache_stats_t stats;
+    clip_cache_get_stats(&stats);
+    CHECK_EQ(stats.hits, 1);
+    CHECK_EQ(stats.misses, 3);
+    CHECK_EQ(stats.evictions, 2);
+    CHECK(stats.bytes_used <= stats.budget);
+
+    // A clip larger than the whole budget is refused without evicting anything.
+    CHECK_OK(clip_cache_init(CLIP_B_BYTES));
+    CHECK(clip_cache_get(CLIP_B) != nullptr);
+    CHECK(clip_cache_get(CLIP_A) == nullptr);
+    CHECK(clip_cache_get(CLIP_B) != nullptr);
+    CHECK(clip_cache_get("no-such-clip.wav") == nullptr);
+    clip_cache_get_stats(&stats);
+    CHECK_EQ(stats.hits, 1);
+    CHECK_EQ(stats.misses, 3);
+    CHECK_EQ(stats.evictions, 0);
+}
+
+static void test_streams_straight_from_the_cache() {
+    CHECK_OK(clip_cache_init(CLIP_A_BYTES));
+    const wav_data_t* clip = clip_cache_get(CLIP_A);
+    CHECK(clip != nullptr);
+    if (clip == nullptr) {
+        return;
+    }
+
+    recording_sink_t recording;
+    recording_sink_init(&recording, clip);
+    uint32_t nr_bytes_written;
+    CHECK_OK(clip_cache_stream(clip, &recording.sink, esp_timer_get_time(), &nr_bytes_written));
+    CHECK_EQ(nr_bytes_written, clip->nr_bytes);
+    CHECK_EQ(recording.output.size(), clip->nr_bytes);
+    // With no ramps all but the first descriptor goes from the clip itself, the silent runs as zeros.
+    CHECK(memcmp(recording.output.data(), clip->data, clip->nr_bytes) == 0);
+    CHECK_EQ(recording.nr_bytes_direct + DMA_BUF_BYTES + clip->silence->nr_bytes, clip->nr_bytes);
+}
+
+static void test_reports_first_sample_latency() {
+    CHECK_OK(clip_cache_init(CLIP_A_BYTES + CLIP_B_BYTES));
+    CHECK_OK(clip_cache_preload(CLIP_A));
+    CHECK_OK(clip_cache_preload(CLIP_B));
+
+    int64_t max_us = 0;
+    const char* const cues[] = {CLIP_A, CLIP_B, CLIP_A};
+    for (const char* cue : cues) {
+        const int64_t request_us = esp_timer_get_time();
+        const wav_data_t* clip = clip_cache_get(cue);
+        recording_sink_t recording;
+        recording_sink_init(&recording, clip);
+        uint32_t nr_bytes_written;
+        CHECK_OK(clip_cache_stream(clip, &recording.sink, request_us, &nr_bytes_written));
+
+        clip_cache_stats_t stats;
+        clip_cache_get_stats(&stats);
+        // Measured when the sink takes the first descriptor, which this sink does at once.
+        CHECK(stats.last_first_sample_us >= recording.first_write_us - request_us);
+        CHECK(stats.last_first_sample_us < 5000);   // No file system on the way, a cold load takes far longer
+        max_us = stats.last_first_sample_us > max_us ? stats.last_first_sample_us : max_us;
+        CHECK_EQ(stats.max_first_sample_us, max_us);
+    }
+}
+
+int main() {
+    host_test_init();
+    if (chdir(HOST_SPIFFS_DATA) != 0) {
+        printf("Cannot open %s\n", HOST_SPIFFS_DATA);
+        return 1;
+    }
+    const pcm_ramp_config_t no_ramps = {0, 0, 0};
+    pcm_ramp_set_config(&no_ramps);
+    CHECK_OK(wav_player_init());
+
+    RUN_TEST(test_preloaded_clips_hit);
+    RUN_TEST(test_evicts_least_recently_used);
+    RUN_TEST(test_streams_straight_from_the_cache);
+    RUN_TEST(test_reports_first_sample_latency);
+    return host_test_result();
+}
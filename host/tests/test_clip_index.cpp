@@ -0,0 +1,209 @@
+// The clip index across simulated reboots on the NVS shim: a cold start scans and CRCs every clip, a warm one trusts
+// the stored index and is much quicker, checking the CRCs behind it, and corruption, truncation, new files and a
+// reflashed image of the same sizes are each caught.
+
+#include "host_test.h"
+#include "clip_index.h"
+#include "wav_file.h"
+
+#include <esp_rom_crc.h>
+#include <nvs_flash.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define IMAGE_ID                0x12345678
+#define REFLASHED_IMAGE_ID      0x9abcdef0
+#define NR_COPIES               6       // Of each WAV, so a cold scan has a realistic partition's worth to CRC
+#define POLL_MS                 5
+
+static const char* const wav_names[] = {"OYM-USA-male-1-16000.wav", "OYM-USA-male-1-NoMiddle.wav"};
+
+static std::string dir;
+
+static std::vector<char> read_file(const std::string& path) {
+    std::vector<char> bytes;
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        return bytes;
+    }
+    char chunk[4096];
+    size_t nr_bytes_read;
+    while ((nr_bytes_read = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        bytes.insert(bytes.end(), chunk, chunk + nr_bytes_read);
+    }
+    fclose(f);
+    return bytes;
+}
+
+static void write_file(const std::string& name, const std::vector<char>& bytes) {
+    FILE* f = fopen((dir + "/" + name).c_str(), "wb");
+    fwrite(bytes.data(), 1, bytes.size(), f);
+    fclose(f);
+}
+
+static std::string copy_name(uint32_t copy, uint32_t wav) {
+    return "clip" + std::to_string(copy) + "_" + std::to_string(wav) + ".wav";
+}
+
+/**
+ * Restarts the index as a boot would and waits for its background check to finish.
+ */
+static clip_index_stats_t boot(uint32_t image_id) {
+    CHECK_OK(clip_index_init(dir.c_str(), image_id));
+    clip_index_stats_t stats;
+    clip_index_get_stats(&stats);
+    const clip_index_stats_t at_init = stats;
+    while (stats.nr_verified < stats.nr_clips) {
+        vTaskDelay(POLL_MS / portTICK_PERIOD_MS);
+        clip_index_get_stats(&stats);
+    }
+    stats.init_us = at_init.init_us;
+    stats.warm = at_init.warm;
+    return stats;
+}
+
+/**
+ * The entry has the layout and CRC of the data section of the WAV it was indexed from, wav the whole file.
+ */
+static void check_entry(const std::string& name, const std::vector<char>& wav) {
+    const clip_index_entry_t* entry = clip_index_find(("/" + name).c_str());
+    CHECK(entry != nullptr);
+    if (entry == nullptr) {
+        return;
+    }
+    FILE* f = fopen((dir + "/" + name).c_str(), "rb");
+    wav_header_t header;
+    uint32_t data_offset;
+    CHECK_OK(wav_parse_header(f, &header, &data_offset));
+    fclose(f);
+    CHECK_EQ(entry->file_size, wav.size());
+    CHECK_EQ(entry->data_offset, data_offset);
+    CHECK_EQ(entry->nr_bytes, header.data.chunk_size);
+    CHECK_EQ(entry->crc32, esp_rom_crc32_le(0, (const uint8_t*) &wav[entry->data_offset], entry->nr_bytes));
+    CHECK_EQ(entry->format_id, WAV_FORMAT_PCM);
+    CHECK_EQ(entry->sample_rate, 16000);
+    CHECK_EQ(clip_index_check(name.c_str()), ESP_OK);
+}
+
+static void test_cold_then_warm_start() {
+    const clip_index_stats_t cold = boot(IMAGE_ID);
+    CHECK(!cold.warm);
+    CHECK_EQ(cold.nr_clips, NR_COPIES * 2);
+    CHECK_EQ(cold.nr_bad, 0);
+    CHECK_EQ(cold.verify_us, 0);        // The scan checked everything, there was nothing left to verify
+    for (uint32_t wav = 0; wav < 2; wav++) {
+        check_entry(copy_name(0, wav), read_file(dir + "/" + copy_name(0, wav)));
+    }
+
+    const clip_index_stats_t warm = boot(IMAGE_ID);
+    CHECK(warm.warm);
+    CHECK_EQ(warm.nr_clips, NR_COPIES * 2);
+    CHECK_EQ(warm.nr_bad, 0);
+    CHECK(warm.verify_us > 0);
+    printf("cold start %lldus, warm start %lldus with %lldus of checks behind it\n", (long long) cold.init_us,
+           (long long) warm.init_us, (long long) warm.verify_us);
+    CHECK(warm.init_us * 4 < cold.init_us);     // Listing the files and one NVS read against reading every clip
+    CHECK_EQ(clip_index_check("/no-such-clip.wav"), ESP_ERR_NOT_FOUND);
+}
+
+static void test_warm_start_catches_corruption() {
+    std::vector<char> wav = read_file(dir + "/" + copy_name(1, 0));
+    wav[wav.size() - 1000] ^= 0x40;     // Same size, so the stored entry is reused
+    write_file(copy_name(1, 0), wav);
+
+    // Found as soon as the data is in memory, before the background check gets to it.
+    CHECK_OK(clip_index_init(dir.c_str(), IMAGE_ID));
+    const clip_index_entry_t* entry = clip_index_find(copy_name(1, 0).c_str());
+    CHECK_EQ(clip_index_verify_data(copy_name(1, 0).c_str(), &wav[entry->data_offset], entry->nr_bytes),
+             ESP_ERR_INVALID_CRC);
+    clip_index_stats_t stats;
+    clip_index_get_stats(&stats);
+    while (stats.nr_verified < stats.nr_clips) {
+        vTaskDelay(POLL_MS / portTICK_PERIOD_MS);
+        clip_index_get_stats(&stats);
+    }
+    CHECK(stats.warm);
+    CHECK_EQ(stats.nr_bad, 1);
+    CHECK_EQ(clip_index_check(copy_name(1, 0).c_str()), ESP_ERR_INVALID_CRC);
+
+    // Left alone, the background check finds it.
+    const clip_index_stats_t again = boot(IMAGE_ID);
+    CHECK_EQ(again.nr_bad, 1);
+    CHECK_EQ(clip_index_check(copy_name(1, 0).c_str()), ESP_ERR_INVALID_CRC);
+}
+
+static void test_reflashed_image_is_rescanned() {
+    // The corrupted clip as a new image brings it, same size, new content: trusted again once the image has changed.
+    const clip_index_stats_t stats = boot(REFLASHED_IMAGE_ID);
+    CHECK(!stats.warm);
+    CHECK_EQ(stats.nr_bad, 0);
+    check_entry(copy_name(1, 0), read_file(dir + "/" + copy_name(1, 0)));
+    CHECK(boot(REFLASHED_IMAGE_ID).warm);
+}
+
+static void test_bad_and_new_files() {
+    // Cut short inside its data, and a header that does not parse.
+    std::vector<char> wav = read_file(dir + "/" + copy_name(2, 1));
+    wav.resize(wav.size() / 2);
+    write_file("short.wav", wav);
+    write_file("garbage.wav", std::vector<char>(500, 'x'));
+
+    const clip_index_stats_t stats = boot(REFLASHED_IMAGE_ID);
+    CHECK(!stats.warm);                 // The new files were scanned, the rest reused
+    CHECK_EQ(stats.nr_clips, NR_COPIES * 2 + 2);
+    CHECK_EQ(stats.nr_bad, 2);
+    CHECK_EQ(clip_index_check("short.wav"), ESP_ERR_INVALID_SIZE);
+    CHECK_EQ(clip_index_check("garbage.wav"), ESP_ERR_NOT_SUPPORTED);
+    CHECK_EQ(clip_index_check(copy_name(2, 1).c_str()), ESP_OK);
+
+    // Removed, they drop out of the index.
+    unlink((dir + "/short.wav").c_str());
+    unlink((dir + "/garbage.wav").c_str());
+    const clip_index_stats_t after = boot(REFLASHED_IMAGE_ID);
+    CHECK_EQ(after.nr_clips, NR_COPIES * 2);
+    CHECK_EQ(after.nr_bad, 0);
+    CHECK(clip_index_find("short.wav") == nullptr);
+}
+
+static void test_erased_nvs_is_a_cold_start() {
+    CHECK_OK(nvs_flash_erase());
+    CHECK(!boot(REFLASHED_IMAGE_ID).warm);
+    CHECK(boot(REFLASHED_IMAGE_ID).warm);
+}
+
+int main() {
+    host_test_init();
+    char dir_template[] = "/tmp/test_clip_index_XXXXXX";
+    if (mkdtemp(dir_template) == nullptr || chdir(HOST_SPIFFS_DATA) != 0) {
+        printf("Cannot open %s\n", HOST_SPIFFS_DATA);
+        return 1;
+    }
+    dir = dir_template;
+    for (uint32_t wav = 0; wav < 2; wav++) {
+        const std::vector<char> bytes = read_file(wav_names[wav]);
+        for (uint32_t copy = 0; copy < NR_COPIES; copy++) {
+            write_file(copy_name(copy, wav), bytes);
+        }
+    }
+    esp_log_level_set("clip_index", ESP_LOG_NONE);     // The bad clips are logged as errors
+    esp_log_level_set("wav_file", ESP_LOG_NONE);
+    CHECK_OK(nvs_flash_init());
+
+    RUN_TEST(test_cold_then_warm_start);
+    RUN_TEST(test_warm_start_catches_corruption);
+    RUN_TEST(test_reflashed_image_is_rescanned);
+    RUN_TEST(test_bad_and_new_files);
+    RUN_TEST(test_erased_nvs_is_a_cold_start);
+    for (uint32_t copy = 0; copy < NR_COPIES; copy++) {
+        for (uint32_t wav = 0; wav < 2; wav++) {
+            unlink((dir + "/" + copy_name(copy, wav)).c_str());
+        }
+    }
+    rmdir(dir_template);
+    return host_test_result();
+}
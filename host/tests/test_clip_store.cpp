@@ -0,0 +1,229 @@
+// tools/pack_clips.py and the clip store that reads what it packs: the image built from main/spiffs_data must hold
+// every clip and speech unit exactly, odd inputs must pack and read back, and bad inputs and tables must be refused.
+
+#include "host_test.h"
+#include "clip_store.h"
+#include "host_shim.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define CLIPS_PARTITION         "clips"
+#define UNITS_MANIFEST          HOST_SPIFFS_DATA "/../phrase_units.txt"
+
+static std::vector<char> read_file(const std::string& path) {
+    std::vector<char> bytes;
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        return bytes;
+    }
+    char chunk[4096];
+    size_t nr_bytes_read;
+    while ((nr_bytes_read = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        bytes.insert(bytes.end(), chunk, chunk + nr_bytes_read);
+    }
+    fclose(f);
+    return bytes;
+}
+
+static std::vector<char> wav_data(const char* path, wav_header_t* header) {
+    FILE* f = fopen(path, "rb");
+    uint32_t data_offset;
+    CHECK_OK(wav_parse_header(f, header, &data_offset));
+    std::vector<char> data(header->data.chunk_size);
+    CHECK_EQ(fread(data.data(), 1, data.size(), f), data.size());
+    fclose(f);
+    return data;
+}
+
+static void check_entry(const clip_table_entry_t* entry, const wav_header_t& header, const std::vector<char>& data,
+                        const char* base) {
+    CHECK(entry != nullptr);
+    if (entry == nullptr) {
+        return;
+    }
+    CHECK_EQ(entry->offset % 4, 0);
+    CHECK_EQ(entry->nr_bytes, data.size());
+    CHECK_EQ(entry->sample_rate, header.SampleRate);
+    CHECK_EQ(entry->format_id, header.FormatID);
+    CHECK_EQ(entry->num_channels, header.NumChannels);
+    CHECK_EQ(entry->bits_per_sample, header.BitsPerSample);
+    CHECK_EQ(entry->block_align, header.BlockAlign);
+    CHECK(memcmp(base + entry->offset, data.data(), data.size()) == 0);
+}
+
+static void test_packed_image_holds_the_clips() {
+    const char* base = (const char*) host_partition_data(CLIPS_PARTITION);
+    const char* const names[] = {"OYM-USA-male-1-16000.wav", "OYM-USA-male-1-NoMiddle.wav"};
+    for (const char* name : names) {
+        wav_header_t header;
+        const std::vector<char> data = wav_data(name, &header);
+        check_entry(clip_store_find_entry(name), header, data, base);
+
+        // Played from the mapped partition itself, the silence at either end left out.
+        wav_data_t clip;
+        CHECK_OK(clip_store_find((std::string("/") + name).c_str(), &clip));
+        CHECK(clip.data >= base + clip_store_find_entry(name)->offset);
+        CHECK(clip.data + clip.nr_bytes <= base + clip_store_find_entry(name)->offset + data.size());
+        CHECK(clip.nr_bytes > data.size() / 2);
+        CHECK_EQ(clip.sample_rate, header.SampleRate);
+    }
+    wav_data_t clip;
+    CHECK_EQ(clip_store_find("no-such-clip.wav", &clip), ESP_ERR_NOT_FOUND);
+}
+
+static void test_packed_image_holds_the_units() {
+    // on_your_marks in phrase_units.txt, 90 to 590ms of the NoMiddle recording.
+    wav_header_t header;
+    const std::vector<char> recording = wav_data("OYM-USA-male-1-NoMiddle.wav", &header);
+    const uint32_t start = 90 * header.SampleRate / 1000 * header.BlockAlign;
+    const uint32_t end = 590 * header.SampleRate / 1000 * header.BlockAlign;
+    CHECK(read_file(UNITS_MANIFEST).size() > 0);
+    check_entry(clip_store_find_entry("on_your_marks"), header,
+                std::vector<char>(recording.begin() + start, recording.begin() + end),
+                (const char*) host_partition_data(CLIPS_PARTITION));
+}
+
+/**
+ * Writes a WAV with a LIST chunk of list_size bytes, odd sizes padded as RIFF requires, before the data.
+ */
+static void write_wav(const std::string& path, uint16_t num_channels, uint16_t bits_per_sample,
+                      const std::vector<char>& data, uint32_t list_size) {
+    FILE* f = fopen(path.c_str(), "wb");
+    const uint32_t list_padded = list_size + (list_size & 1);
+    const uint32_t riff_size = 4 + 24 + (list_size > 0 ? 8 + list_padded : 0) + 8 + data.size() + (data.size() & 1);
+    const uint16_t block_align = num_channels * bits_per_sample / 8;
+    const uint32_t sample_rate = 8000;
+    const uint32_t byte_rate = sample_rate * block_align;
+    const uint32_t fmt_size = 16;
+    const uint16_t format_id = WAV_FORMAT_PCM;
+    fwrite("RIFF", 1, 4, f);
+    fwrite(&riff_size, 4, 1, f);
+    fwrite("WAVEfmt ", 1, 8, f);
+    fwrite(&fmt_size, 4, 1, f);
+    fwrite(&format_id, 2, 1, f);
+    fwrite(&num_channels, 2, 1, f);
+    fwrite(&sample_rate, 4, 1, f);
+    fwrite(&byte_rate, 4, 1, f);
+    fwrite(&block_align, 2, 1, f);
+    fwrite(&bits_per_sample, 2, 1, f);
+    if (list_size > 0) {
+        fwrite("LIST", 1, 4, f);
+        fwrite(&list_size, 4, 1, f);
+        const std::vector<char> list(list_padded, 'x');
+        fwrite(list.data(), 1, list.size(), f);
+    }
+    const uint32_t data_size = data.size();
+    fwrite("data", 1, 4, f);
+    fwrite(&data_size, 4, 1, f);
+    fwrite(data.data(), 1, data.size(), f);
+    if (data.size() & 1) {
+        fputc(0, f);
+    }
+    fclose(f);
+}
+
+static int pack(const std::string& args) {
+    const std::string command = std::string(HOST_PYTHON " " HOST_TOOLS_DIR "/pack_clips.py ") + args + " > /dev/null 2>&1";
+    return system(command.c_str());
+}
+
+static void test_packs_odd_inputs() {
+    char dir_template[] = "/tmp/test_clip_store_XXXXXX";
+    const std::string dir = mkdtemp(dir_template);
+    // 8 bit mono of an odd length, behind an odd sized LIST chunk, and 16 bit stereo after it.
+    std::vector<char> mono8(1001), stereo16(4 * 300);
+    for (size_t i = 0; i < mono8.size(); i++) {
+        mono8[i] = (char) (i * 7);
+    }
+    for (size_t i = 0; i < stereo16.size(); i++) {
+        stereo16[i] = (char) (i * 13);
+    }
+    write_wav(dir + "/a.wav", 1, 8, mono8, 5);
+    write_wav(dir + "/b.wav", 2, 16, stereo16, 0);
+    const std::string image = dir + "/clips.bin";
+    CHECK_EQ(pack("--size 0x1000 --output " + image + " " + dir + "/b.wav " + dir + "/a.wav"), 0);
+
+    std::vector<char> packed = read_file(image);
+    CHECK_EQ(packed.size(), 0x1000);
+    CHECK_EQ(packed.back(), (char) 0xff);      // Erased flash after the clips
+    CHECK_OK(clip_store_open(packed.data(), packed.size()));
+    const clip_table_header_t* header = (const clip_table_header_t*) packed.data();
+    CHECK_EQ(header->nr_clips, 2);
+    const clip_table_entry_t* entries = (const clip_table_entry_t*) (header + 1);
+    CHECK(strcmp(entries[0].name, "a.wav") == 0);  // Sorted
+    CHECK(strcmp(entries[1].name, "b.wav") == 0);
+
+    const clip_table_entry_t* a = clip_store_find_entry("a.wav");
+    const clip_table_entry_t* b = clip_store_find_entry("/b.wav");
+    CHECK(a != nullptr && b != nullptr);
+    if (a != nullptr && b != nullptr) {
+        CHECK_EQ(a->nr_bytes, mono8.size());
+        CHECK_EQ(a->num_channels, 1);
+        CHECK_EQ(a->bits_per_sample, 8);
+        CHECK(memcmp(packed.data() + a->offset, mono8.data(), mono8.size()) == 0);
+        CHECK_EQ(b->offset % 4, 0);
+        CHECK(b->offset >= a->offset + mono8.size());
+        CHECK(memcmp(packed.data() + b->offset, stereo16.data(), stereo16.size()) == 0);
+    }
+
+    // Refused: too small a partition, the same name twice, a name that does not fit, nothing to pack.
+    CHECK(pack("--size 0x400 --output " + image + " " + dir + "/a.wav " + dir + "/b.wav") != 0);
+    CHECK(pack("--size 0x1000 --output " + image + " " + dir + "/a.wav " + dir + "/a.wav") != 0);
+    const std::string long_name = dir + "/a-name-far-too-long-for-the-table.wav";
+    write_wav(long_name, 1, 8, mono8, 0);
+    CHECK(pack("--size 0x1000 --output " + image + " " + long_name) != 0);
+    CHECK(pack("--size 0x1000 --output " + image) != 0);
+
+    CHECK_EQ(system(("rm -rf " + dir).c_str()), 0);
+}
+
+static void test_refuses_bad_tables() {
+    std::vector<char> image = read_file(HOST_CLIPS_IMAGE);
+    std::vector<char> bad = image;
+    bad[0] = 'X';
+    CHECK_EQ(clip_store_open(bad.data(), bad.size()), ESP_ERR_NOT_FOUND);
+    CHECK_EQ(clip_store_open(bad.data(), 2), ESP_ERR_NOT_FOUND);
+
+    bad = image;
+    ((clip_table_header_t*) bad.data())->version = CLIP_TABLE_VERSION + 1;
+    CHECK_EQ(clip_store_open(bad.data(), bad.size()), ESP_ERR_NOT_SUPPORTED);
+
+    bad = image;
+    ((clip_table_header_t*) bad.data())->nr_clips = 0xffff;
+    CHECK_EQ(clip_store_open(bad.data(), bad.size()), ESP_ERR_INVALID_SIZE);
+
+    bad = image;
+    clip_table_entry_t* entry = (clip_table_entry_t*) (bad.data() + sizeof(clip_table_header_t));
+    entry->nr_bytes = bad.size() - entry->offset + 1;
+    CHECK_EQ(clip_store_open(bad.data(), bad.size()), ESP_ERR_INVALID_SIZE);
+
+    bad = image;
+    entry = (clip_table_entry_t*) (bad.data() + sizeof(clip_table_header_t));
+    memset(entry->name, 'x', CLIP_TABLE_NAME_SIZE);
+    CHECK_EQ(clip_store_open(bad.data(), bad.size()), ESP_ERR_INVALID_SIZE);
+
+    // The whole image is still fine.
+    CHECK_OK(clip_store_open(image.data(), image.size()));
+}
+
+int main() {
+    host_test_init();
+    if (chdir(HOST_SPIFFS_DATA) != 0) {
+        printf("Cannot open %s\n", HOST_SPIFFS_DATA);
+        return 1;
+    }
+    CHECK_OK(host_partition_add(CLIPS_PARTITION, ESP_PARTITION_TYPE_DATA,
+                                (esp_partition_subtype_t) CLIP_STORE_PARTITION_TYPE, HOST_CLIPS_IMAGE,
+                                HOST_CLIPS_PARTITION_SIZE));
+    CHECK_OK(clip_store_init(CLIPS_PARTITION));
+
+    RUN_TEST(test_packed_image_holds_the_clips);
+    RUN_TEST(test_packed_image_holds_the_units);
+    RUN_TEST(test_packs_odd_inputs);
+    RUN_TEST(test_refuses_bad_tables);
+    return host_test_result();
+}
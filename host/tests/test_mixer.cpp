@@ -0,0 +1,520 @@
+// The mixer against the simulated DMA ring: voices started on the same frame must sum exactly, each at its own Q15
+// gain, saturating at the int16 limits, voices played and stopped from several tasks at once must all end, a voice
+// started at a time must sound on the frame nearest that time, as must the times it reports, and a looping voice must
+// play exactly the clip unrolled, the frame after the last of its loop its first, at the clip's rate or resampled.
+
+#include "host_test.h"
+#include "host_shim.h"
+#include "audio_pool.h"
+#include "mixer.h"
+#include "pcm_ramp.h"
+#include "sim_sink.h"
+
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#define DMA_BUF_BYTES           4096    // As i2s_config in main.cpp
+#define DMA_BUF_COUNT           8
+#define SAMPLE_RATE             16000   // The clips' rate, so nothing is resampled
+#define BLOCK_FRAMES            (DMA_BUF_BYTES / 4)
+#define START_LEAD_FRAMES       ((DMA_BUF_COUNT + 4) * BLOCK_FRAMES)    // Past the ring the mixer fills at once
+#define CAPTURE_FRAMES          (SAMPLE_RATE * 4)
+#define CLIP_FRAMES             4096
+#define SHORT_CLIP_FRAMES       700     // Ends part way into a block
+#define NR_TASKS                4
+#define PLAYS_PER_TASK          40
+#define DRAIN_TIMEOUT_MS        5000
+#define FRAME_US                (1000000.0 / SAMPLE_RATE)
+#define CLOCK_ROUNDING_US       1.0     // Frame times are whole microseconds, rounded down
+#define IDLE_LEAD_US            1500000 // More than the two rings the mixer needs from idle, see mixer_play_at
+#define TIMED_CLIP_FRAMES       3000
+#define HELD_CLIP_FRAMES        (SAMPLE_RATE * 6 / 5)   // Still playing when the next voice is due
+#define SECOND_VOICE_US         600013
+#define LOOP_CLIP_FRAMES        3001    // Ends part way into a block
+#define LOOP_RESAMPLED_RATE     11025   // A loop clip at another rate than the sink's
+#define LOOP_RELEASE_MS         300     // Some passes of a loop that goes on until it is let go
+
+static sim_sink_t sim;
+static std::vector<int16_t> capture(2 * CAPTURE_FRAMES);
+
+/**
+ * A 16 bit stereo clip held in RAM, word backed for the 4 byte alignment the mixer needs.
+ */
+typedef struct {
+    std::vector<uint32_t> words;
+    wav_data_t clip;
+} test_clip_t;
+
+static void test_clip_init(test_clip_t* test, const std::vector<int16_t>& samples) {
+    test->words.assign((samples.size() * 2 + 3) / 4, 0);
+    memcpy(test->words.data(), samples.data(), samples.size() * 2);
+    memset(&test->clip, 0, sizeof(wav_data_t));
+    test->clip.data = (char*) test->words.data();
+    test->clip.nr_bytes = samples.size() * 2;
+    test->clip.sample_rate = SAMPLE_RATE;
+    test->clip.filename = (char*) "test";
+    test->clip.num_channels = 2;
+    test->clip.bits_per_sample = 16;
+}
+
+static uint32_t first_audible(const int16_t* frames, uint32_t nr_frames) {
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        if (frames[2 * i] != 0 || frames[2 * i + 1] != 0) {
+            return i;
+        }
+    }
+    return nr_frames;
+}
+
+/**
+ * Waits for every voice to finish, as a test would hang on a voice that never does.
+ */
+static bool wait_idle() {
+    for (int ms = 0; ms < DRAIN_TIMEOUT_MS; ms += 10) {
+        if (mixer_active_voices() == 0) {
+            return true;
+        }
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    return false;
+}
+
+static void test_sums_voices_at_their_gains() {
+    // A ramp on each channel, one opposite to the other, under a loud constant that pushes it over the top and bottom.
+    std::vector<int16_t> a(2 * CLIP_FRAMES), b(2 * CLIP_FRAMES);
+    for (uint32_t i = 0; i < CLIP_FRAMES; i++) {
+        a[2 * i] = (int16_t) (1001 + (i * 37) % 30000);
+        a[2 * i + 1] = (int16_t) -a[2 * i];
+        b[2 * i] = 20000;
+        b[2 * i + 1] = -20001;
+    }
+    test_clip_t clip_a, clip_b;
+    test_clip_init(&clip_a, a);
+    test_clip_init(&clip_b, b);
+    const int32_t gain_a = MIXER_GAIN_UNITY / 2 + 123;
+    const int32_t gain_b = MIXER_GAIN_UNITY;
+
+    mixer_stats_t before;
+    mixer_get_stats(&before);
+    sim_sink_start(&sim, SAMPLE_RATE);
+    const uint64_t start_frame = mixer_next_frame() + START_LEAD_FRAMES;
+    const mixer_start_t start_a = {gain_a, start_frame, 0, 0, 0, 0, MIXER_LOOP_AS_AUTHORED};
+    const mixer_start_t start_b = {gain_b, start_frame, 0, 0, 0, 0, MIXER_LOOP_AS_AUTHORED};
+    CHECK_OK(mixer_play_at(&clip_a.clip, &start_a, nullptr));
+    CHECK_OK(mixer_play_at(&clip_b.clip, &start_b, nullptr));
+    CHECK(wait_idle());
+    sim_sink_drain(&sim);
+
+    std::vector<int16_t> expected(2 * CLIP_FRAMES);
+    uint32_t nr_clipped = 0;
+    for (uint32_t i = 0; i < 2 * CLIP_FRAMES; i++) {
+        int32_t sum = ((a[i] * gain_a) >> 15) + ((b[i] * gain_b) >> 15);
+        if (sum > INT16_MAX || sum < INT16_MIN) {
+            sum = sum > INT16_MAX ? INT16_MAX : INT16_MIN;
+            nr_clipped++;
+        }
+        expected[i] = (int16_t) sum;
+    }
+    CHECK(nr_clipped > 0);
+    CHECK(nr_clipped < CLIP_FRAMES);
+
+    const uint32_t start = first_audible(capture.data(), sim.nr_captured);
+    CHECK(start + CLIP_FRAMES <= sim.nr_captured);
+    if (start + CLIP_FRAMES > sim.nr_captured) {
+        return;
+    }
+    CHECK(memcmp(&capture[2 * start], expected.data(), expected.size() * 2) == 0);
+    CHECK_EQ(first_audible(&capture[2 * (start + CLIP_FRAMES)], sim.nr_captured - start - CLIP_FRAMES),
+             sim.nr_captured - start - CLIP_FRAMES);
+
+    mixer_stats_t after;
+    mixer_get_stats(&after);
+    CHECK_EQ(after.clipped_samples - before.clipped_samples, nr_clipped);
+    CHECK_EQ(after.late_starts, before.late_starts);
+    CHECK(after.max_voices >= 2);
+    CHECK_EQ(sim.stats.nr_gaps, 0);
+}
+
+static void test_refuses_a_voice_past_the_last() {
+    std::vector<int16_t> tone(2 * CLIP_FRAMES, 1000);
+    test_clip_t clip;
+    test_clip_init(&clip, tone);
+
+    // Due well after they are all stopped, so the slots are busy without a sound being made.
+    const mixer_start_t start = {MIXER_GAIN_UNITY, mixer_next_frame() + START_LEAD_FRAMES, 0, 0, 0, 0,
+                                 MIXER_LOOP_AS_AUTHORED};
+    sim_sink_start(&sim, SAMPLE_RATE);
+    mixer_voice_t voices[MIXER_MAX_VOICES];
+    for (int i = 0; i < MIXER_MAX_VOICES; i++) {
+        CHECK_OK(mixer_play_at(&clip.clip, &start, &voices[i]));
+    }
+    CHECK_EQ(mixer_active_voices(), MIXER_MAX_VOICES);
+    CHECK_EQ(mixer_play_at(&clip.clip, &start, nullptr), ESP_ERR_NO_MEM);
+    for (int i = 0; i < MIXER_MAX_VOICES; i++) {
+        CHECK_OK(mixer_stop(voices[i]));
+    }
+    CHECK(wait_idle());
+    sim_sink_drain(&sim);
+    CHECK_EQ(sim.stats.first_audible_us, 0);
+
+    // Stale handles, the slots may already hold other voices.
+    for (int i = 0; i < MIXER_MAX_VOICES; i++) {
+        CHECK_EQ(mixer_stop(voices[i]), ESP_ERR_NOT_FOUND);
+    }
+}
+
+static test_clip_t short_clip;
+static SemaphoreHandle_t tasks_done;
+
+typedef struct {
+    uint32_t seed;
+    uint32_t nr_played;
+    uint32_t nr_busy;
+    uint32_t nr_failed;
+} player_task_t;
+
+/**
+ * Plays the short clip over and over, stopping some of the voices straight away and some part way through.
+ */
+static void player_task(void* arg) {
+    player_task_t* player = (player_task_t*) arg;
+    for (int i = 0; i < PLAYS_PER_TASK; i++) {
+        player->seed = player->seed * 1103515245 + 12345;
+        const uint32_t choice = (player->seed >> 16) % 4;
+        mixer_voice_t voice;
+        const esp_err_t err = mixer_play(&short_clip.clip, MIXER_GAIN_UNITY / NR_TASKS, 0, &voice);
+        if (err == ESP_OK) {
+            player->nr_played++;
+            if (choice == 0) {
+                mixer_stop(voice);
+            } else if (choice == 1) {
+                vTaskDelay(((player->seed >> 8) % 30) / portTICK_PERIOD_MS);
+                mixer_stop(voice);      // ESP_ERR_NOT_FOUND if it ended first
+            }
+        } else if (err == ESP_ERR_NO_MEM) {
+            player->nr_busy++;
+        } else {
+            player->nr_failed++;
+        }
+        vTaskDelay(((player->seed >> 4) % 20) / portTICK_PERIOD_MS);
+    }
+    xSemaphoreGive(tasks_done);
+    vTaskDelete(nullptr);
+}
+
+static void test_plays_and_stops_from_several_tasks() {
+    std::vector<int16_t> samples(2 * SHORT_CLIP_FRAMES);
+    for (uint32_t i = 0; i < samples.size(); i++) {
+        samples[i] = (int16_t) ((i * 523) % 8000 - 4000);
+    }
+    test_clip_init(&short_clip, samples);
+    tasks_done = xSemaphoreCreateCounting(NR_TASKS, 0);
+    sim_sink_start(&sim, SAMPLE_RATE);
+    mixer_stats_t before;
+    mixer_get_stats(&before);
+
+    player_task_t players[NR_TASKS];
+    for (int i = 0; i < NR_TASKS; i++) {
+        players[i] = {(uint32_t) (i + 1) * 7919, 0, 0, 0};
+        CHECK(xTaskCreate(player_task, "player", 4096, &players[i], 5, nullptr) == pdPASS);
+    }
+    for (int i = 0; i < NR_TASKS; i++) {
+        CHECK(xSemaphoreTake(tasks_done, portMAX_DELAY) == pdTRUE);
+    }
+    CHECK(wait_idle());
+    sim_sink_drain(&sim);
+
+    uint32_t nr_played = 0;
+    for (const player_task_t& player : players) {
+        CHECK_EQ(player.nr_failed, 0);
+        CHECK_EQ(player.nr_played + player.nr_busy, PLAYS_PER_TASK);
+        nr_played += player.nr_played;
+    }
+    CHECK(nr_played > 0);
+    mixer_stats_t after;
+    mixer_get_stats(&after);
+    CHECK(after.max_voices <= MIXER_MAX_VOICES);
+    CHECK(after.nr_blocks > before.nr_blocks);
+    CHECK(sim.stats.first_audible_us > 0);
+
+    // Everything is free again, a whole set of voices can start.
+    const mixer_start_t start = {MIXER_GAIN_UNITY, mixer_next_frame() + START_LEAD_FRAMES, 0, 0, 0, 0,
+                                 MIXER_LOOP_AS_AUTHORED};
+    mixer_voice_t voices[MIXER_MAX_VOICES];
+    for (int i = 0; i < MIXER_MAX_VOICES; i++) {
+        CHECK_OK(mixer_play_at(&short_clip.clip, &start, &voices[i]));
+    }
+    for (int i = 0; i < MIXER_MAX_VOICES; i++) {
+        CHECK_OK(mixer_stop(voices[i]));
+    }
+    CHECK(wait_idle());
+}
+
+/**
+ * When captured frame left the DAC, by the clock of the simulated DMA.
+ */
+static double capture_us(uint32_t frame) {
+    return sim.started_us + frame * FRAME_US;
+}
+
+/**
+ * First and last captured frames with the channel audible, or CAPTURE_FRAMES if it never is.
+ */
+static void audible_span(int channel, uint32_t* first, uint32_t* last) {
+    *first = CAPTURE_FRAMES;
+    *last = CAPTURE_FRAMES;
+    for (uint32_t i = 0; i < sim.nr_captured; i++) {
+        if (capture[2 * i + channel] != 0) {
+            *first = *first == CAPTURE_FRAMES ? i : *first;
+            *last = i;
+        }
+    }
+}
+
+/**
+ * Checks the voice on channel sounded from start_us for nr_frames, and reported the times it sounded at.
+ */
+static void check_timed_voice(mixer_voice_t voice, int channel, int64_t start_us, uint32_t nr_frames) {
+    uint32_t first, last;
+    audible_span(channel, &first, &last);
+    CHECK(first < CAPTURE_FRAMES);
+    if (first == CAPTURE_FRAMES) {
+        return;
+    }
+    CHECK_EQ(last - first + 1, nr_frames);
+    mixer_voice_times_t times;
+    CHECK_OK(mixer_get_voice_times(voice, &times));
+    CHECK(times.done);
+    const double error_us = capture_us(first) - start_us;
+    printf("channel %d: first sample %.1fus from its time, reported %.1fus and %.1fus from when it sounded\n", channel,
+           error_us, times.first_us - capture_us(first), times.last_us - capture_us(last));
+    CHECK(fabs(error_us) <= FRAME_US / 2 + CLOCK_ROUNDING_US);
+    CHECK(fabs(times.first_us - capture_us(first)) <= CLOCK_ROUNDING_US);
+    CHECK(fabs(times.last_us - capture_us(last)) <= CLOCK_ROUNDING_US);
+}
+
+/**
+ * nr_frames of a constant on one channel, silence on the other.
+ */
+static void timed_clip_init(test_clip_t* clip, int channel, uint32_t nr_frames) {
+    std::vector<int16_t> samples(2 * nr_frames, 0);
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        samples[2 * i + channel] = 3000;
+    }
+    test_clip_init(clip, samples);
+}
+
+static void test_starts_on_time_from_idle() {
+    test_clip_t clip;
+    timed_clip_init(&clip, 0, TIMED_CLIP_FRAMES);
+    // Times that fall part way through a frame and through a block, from the mixer sitting idle.
+    const int64_t leads_us[] = {IDLE_LEAD_US, IDLE_LEAD_US + 333331, IDLE_LEAD_US + 1000017};
+    for (int64_t lead_us : leads_us) {
+        mixer_stats_t before, after;
+        mixer_get_stats(&before);
+        sim_sink_start(&sim, SAMPLE_RATE);
+        const int64_t start_us = esp_timer_get_time() + lead_us;
+        const mixer_start_t start = {MIXER_GAIN_UNITY, 0, 0, 0, esp_timer_get_time(), start_us,
+                                     MIXER_LOOP_AS_AUTHORED};
+        mixer_voice_t voice;
+        CHECK_OK(mixer_play_at(&clip.clip, &start, &voice));
+        CHECK(wait_idle());
+        sim_sink_drain(&sim);
+        check_timed_voice(voice, 0, start_us, TIMED_CLIP_FRAMES);
+        mixer_get_stats(&after);
+        CHECK_EQ(after.late_starts, before.late_starts);
+    }
+}
+
+static void test_starts_on_time_while_playing() {
+    // The second voice is asked for while the first plays, with the output clock locked.
+    test_clip_t left, right;
+    timed_clip_init(&left, 0, HELD_CLIP_FRAMES);
+    timed_clip_init(&right, 1, TIMED_CLIP_FRAMES);
+    sim_sink_start(&sim, SAMPLE_RATE);
+    const int64_t left_us = esp_timer_get_time() + IDLE_LEAD_US;
+    const mixer_start_t start_left = {MIXER_GAIN_UNITY, 0, 0, 0, esp_timer_get_time(), left_us,
+                                      MIXER_LOOP_AS_AUTHORED};
+    mixer_voice_t left_voice, right_voice;
+    CHECK_OK(mixer_play_at(&left.clip, &start_left, &left_voice));
+    while (esp_timer_get_time() < left_us) {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    CHECK(mixer_frame_time(mixer_next_frame()) != 0);
+    const int64_t right_us = left_us + SECOND_VOICE_US;
+    const mixer_start_t start_right = {MIXER_GAIN_UNITY, 0, 0, 0, esp_timer_get_time(), right_us,
+                                       MIXER_LOOP_AS_AUTHORED};
+    CHECK_OK(mixer_play_at(&right.clip, &start_right, &right_voice));
+    CHECK(wait_idle());
+    sim_sink_drain(&sim);
+    check_timed_voice(left_voice, 0, left_us, HELD_CLIP_FRAMES);
+    check_timed_voice(right_voice, 1, right_us, TIMED_CLIP_FRAMES);
+}
+
+/**
+ * A clip counting up from 1 on the left and down from -1 on the right, so every frame says where it came from.
+ */
+static void loop_clip_init(test_clip_t* clip, uint32_t start_frame, uint32_t end_frame, uint32_t play_count) {
+    std::vector<int16_t> samples(2 * LOOP_CLIP_FRAMES);
+    for (uint32_t i = 0; i < LOOP_CLIP_FRAMES; i++) {
+        samples[2 * i] = (int16_t) (i + 1);
+        samples[2 * i + 1] = (int16_t) -(i + 1);
+    }
+    test_clip_init(clip, samples);
+    clip->clip.loop.start_frame = start_frame;
+    clip->clip.loop.end_frame = end_frame;
+    clip->clip.loop.play_count = play_count;
+}
+
+/**
+ * The clip as a voice playing its loop passes times sounds: up to the end of the loop, the loop again passes - 1
+ * times, then the rest of the clip.
+ */
+static std::vector<int16_t> unrolled(const test_clip_t& clip, uint32_t passes) {
+    const int16_t* samples = (const int16_t*) clip.clip.data;
+    const wav_loop_t& loop = clip.clip.loop;
+    std::vector<int16_t> out(samples, samples + 2 * loop.end_frame);
+    for (uint32_t i = 1; i < passes; i++) {
+        out.insert(out.end(), samples + 2 * loop.start_frame, samples + 2 * loop.end_frame);
+    }
+    out.insert(out.end(), samples + 2 * loop.end_frame, samples + 2 * LOOP_CLIP_FRAMES);
+    return out;
+}
+
+/**
+ * Plays the clip with loop_count and returns what was captured from its first audible frame to its last.
+ * A release_ms other than 0 lets the voice go that long after it was started, a stop_ms stops it.
+ */
+static std::vector<int16_t> play_loop(const test_clip_t& clip, uint32_t loop_count, uint32_t release_ms,
+                                      uint32_t stop_ms) {
+    sim_sink_start(&sim, SAMPLE_RATE);
+    const mixer_start_t start = {MIXER_GAIN_UNITY, 0, 0, 0, 0, 0, loop_count};
+    mixer_voice_t voice;
+    CHECK_OK(mixer_play_at(&clip.clip, &start, &voice));
+    if (release_ms > 0) {
+        vTaskDelay(release_ms / portTICK_PERIOD_MS);
+        CHECK_OK(mixer_release(voice));
+    }
+    if (stop_ms > 0) {
+        vTaskDelay(stop_ms / portTICK_PERIOD_MS);
+        CHECK_OK(mixer_stop(voice));
+    }
+    CHECK(wait_idle());
+    sim_sink_drain(&sim);
+    CHECK_EQ(sim.stats.nr_gaps, 0);
+
+    const uint32_t first = first_audible(capture.data(), sim.nr_captured);
+    uint32_t end = first;
+    for (uint32_t i = first; i < sim.nr_captured; i++) {
+        if (capture[2 * i] != 0 || capture[2 * i + 1] != 0) {
+            end = i + 1;
+        }
+    }
+    return std::vector<int16_t>(&capture[2 * first], &capture[2 * end]);
+}
+
+/**
+ * Checks played is the clip unrolled, printing the first frame that is not.
+ */
+static void check_unrolled(const std::vector<int16_t>& played, const std::vector<int16_t>& expected) {
+    CHECK_EQ(played.size() / 2, expected.size() / 2);
+    for (uint32_t i = 0; i < played.size() && i < expected.size(); i++) {
+        if (played[i] != expected[i]) {
+            printf("Differs at frame %d of %d, %d not %d\n", i / 2, (int) expected.size() / 2, played[i], expected[i]);
+            CHECK(false);
+            break;
+        }
+    }
+}
+
+/**
+ * Passes a loop that was let go made, from how long it played, or 0 if that is not a whole number of passes.
+ */
+static uint32_t passes_played(const test_clip_t& clip, const std::vector<int16_t>& played) {
+    const wav_loop_t& loop = clip.clip.loop;
+    const uint32_t loop_frames = loop.end_frame - loop.start_frame;
+    const uint32_t extra = played.size() / 2 - LOOP_CLIP_FRAMES;
+    return played.size() / 2 >= LOOP_CLIP_FRAMES && extra % loop_frames == 0 ? 1 + extra / loop_frames : 0;
+}
+
+static void test_loops_play_the_clip_unrolled() {
+    // Loops inside the clip, one ending on its last frame, the whole clip, and one frame long, each starting and
+    // ending part way into blocks.
+    const uint32_t loops[][2] = {{500, 1777}, {1001, LOOP_CLIP_FRAMES}, {0, LOOP_CLIP_FRAMES}, {2000, 2001}};
+    for (const uint32_t* loop : loops) {
+        test_clip_t clip;
+        loop_clip_init(&clip, loop[0], loop[1], 3);
+        check_unrolled(play_loop(clip, MIXER_LOOP_AS_AUTHORED, 0, 0), unrolled(clip, 3));
+        check_unrolled(play_loop(clip, 1, 0, 0), unrolled(clip, 1));
+        check_unrolled(play_loop(clip, 5, 0, 0), unrolled(clip, 5));
+    }
+}
+
+static void test_endless_loops_until_let_go_or_stopped() {
+    const uint32_t loops[][2] = {{500, 1777}, {1001, LOOP_CLIP_FRAMES}};
+    for (const uint32_t* loop : loops) {
+        // Let go, it finishes the pass it is in and plays on to the end of the clip.
+        test_clip_t clip;
+        loop_clip_init(&clip, loop[0], loop[1], 0);
+        std::vector<int16_t> played = play_loop(clip, MIXER_LOOP_AS_AUTHORED, LOOP_RELEASE_MS, 0);
+        uint32_t passes = passes_played(clip, played);
+        CHECK(passes > 1);
+        check_unrolled(played, unrolled(clip, passes));
+        played = play_loop(clip, MIXER_LOOP_FOREVER, LOOP_RELEASE_MS, 0);
+        passes = passes_played(clip, played);
+        CHECK(passes > 1);
+        check_unrolled(played, unrolled(clip, passes));
+
+        // Stopped, it plays the loop over and over up to where it stopped. Every frame of the clip is a zero crossing
+        // of the two channels, so with no abort ramp it stops dead.
+        played = play_loop(clip, MIXER_LOOP_FOREVER, 0, LOOP_RELEASE_MS);
+        const std::vector<int16_t> expected = unrolled(clip, played.size() / 2 / (loop[1] - loop[0]) + 1);
+        CHECK(played.size() / 2 > LOOP_CLIP_FRAMES);
+        check_unrolled(played, std::vector<int16_t>(expected.begin(), expected.begin() + played.size()));
+    }
+}
+
+static void test_resampled_loops_match_the_clip_unrolled() {
+    // The resampler carries on over the seam as it would over the same frames in one piece.
+    const uint32_t loops[][2] = {{500, 1777}, {1001, LOOP_CLIP_FRAMES}};
+    for (const uint32_t* loop : loops) {
+        test_clip_t clip, whole;
+        loop_clip_init(&clip, loop[0], loop[1], 4);
+        clip.clip.sample_rate = LOOP_RESAMPLED_RATE;
+        test_clip_init(&whole, unrolled(clip, 4));
+        whole.clip.sample_rate = LOOP_RESAMPLED_RATE;
+        const std::vector<int16_t> expected = play_loop(whole, MIXER_LOOP_AS_AUTHORED, 0, 0);
+        CHECK(expected.size() / 2 > 2 * mixer_clip_frames(&clip.clip));    // Four passes, not just the clip
+        check_unrolled(play_loop(clip, MIXER_LOOP_AS_AUTHORED, 0, 0), expected);
+    }
+}
+
+int main() {
+    host_test_init();
+    host_clock_simulate();  // The DMA, the mixer and the checks all on one clock, for timing to the sample every run
+    esp_log_level_set("mixer", ESP_LOG_ERROR);     // Each busy play is logged
+    // No ramps, so the output is the sum itself.
+    const pcm_ramp_config_t no_ramps = {0, 0, 0};
+    pcm_ramp_set_config(&no_ramps);
+    CHECK_OK(audio_pool_init(1));       // The mixer's output block
+    CHECK_OK(sim_sink_init(&sim, DMA_BUF_BYTES, DMA_BUF_COUNT));
+    sim.wait_until = host_clock_wait_until;
+    sim_sink_capture(&sim, capture.data(), CAPTURE_FRAMES);
+    sim_sink_start(&sim, SAMPLE_RATE);
+    CHECK_OK(mixer_init(&sim.sink));
+
+    RUN_TEST(test_sums_voices_at_their_gains);
+    RUN_TEST(test_refuses_a_voice_past_the_last);
+    RUN_TEST(test_plays_and_stops_from_several_tasks);
+    RUN_TEST(test_starts_on_time_from_idle);
+    RUN_TEST(test_starts_on_time_while_playing);
+    RUN_TEST(test_loops_play_the_clip_unrolled);
+    RUN_TEST(test_endless_loops_until_let_go_or_stopped);
+    RUN_TEST(test_resampled_loops_match_the_clip_unrolled);
+    return host_test_result();
+}
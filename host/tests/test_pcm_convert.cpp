@@ -0,0 +1,97 @@
+// The word wide conversion kernels against a sample at a time reference, for every format, in place and not, over
+// every tail length the word loops leave, without writing past the converted size.
+
+#include "host_test.h"
+#include "pcm_convert.h"
+
+#include <cstring>
+#include <vector>
+
+#define MAX_INPUT_BYTES         67      // A few words, and every remainder of them
+#define GUARD                   0x5a
+
+/**
+ * What pcm_convert_to_stereo16 must produce, one sample at a time.
+ */
+static std::vector<int16_t> reference(const uint8_t* src, uint32_t nr_bytes, uint16_t num_channels,
+                                      uint16_t bits_per_sample) {
+    std::vector<int16_t> out;
+    const uint32_t sample_bytes = bits_per_sample / 8;
+    for (uint32_t i = 0; i + sample_bytes <= nr_bytes; i += sample_bytes) {
+        const int16_t sample = bits_per_sample == 8 ? (int16_t) ((src[i] - 128) * 256)
+                                                    : (int16_t) (src[i] | (src[i + 1] << 8));
+        out.push_back(sample);
+        if (num_channels == 1) {
+            out.push_back(sample);
+        }
+    }
+    return out;
+}
+
+static void check_format(uint16_t num_channels, uint16_t bits_per_sample) {
+    const uint32_t expansion = pcm_expansion(num_channels, bits_per_sample);
+    const uint32_t sample_bytes = bits_per_sample / 8;
+    for (uint32_t nr_bytes = 0; nr_bytes <= MAX_INPUT_BYTES; nr_bytes += sample_bytes) {
+        std::vector<uint8_t> src(nr_bytes);
+        for (uint32_t i = 0; i < nr_bytes; i++) {
+            src[i] = (uint8_t) (i * 97 + 13);
+        }
+        const std::vector<int16_t> expected = reference(src.data(), nr_bytes, num_channels, bits_per_sample);
+        const uint32_t out_bytes = nr_bytes * expansion;
+        CHECK_EQ(expected.size() * 2, out_bytes);
+
+        // Separate buffers, uint32_t backed for the alignment the kernels need.
+        std::vector<uint32_t> in_words(MAX_INPUT_BYTES / 4 + 1);
+        std::vector<uint32_t> out_words(MAX_INPUT_BYTES * 4 / 4 + 2);
+        memcpy(in_words.data(), src.data(), nr_bytes);
+        memset(out_words.data(), GUARD, out_words.size() * 4);
+        char* out = (char*) out_words.data();
+        CHECK_EQ(pcm_convert_to_stereo16(out, (const char*) in_words.data(), nr_bytes, num_channels, bits_per_sample),
+                 out_bytes);
+        CHECK(memcmp(out, expected.data(), out_bytes) == 0);
+        CHECK_EQ((uint8_t) out[out_bytes], GUARD);
+        CHECK(memcmp(in_words.data(), src.data(), nr_bytes) == 0);
+
+        // In place, as the players convert in the player buffer.
+        memset(out_words.data(), GUARD, out_words.size() * 4);
+        memcpy(out, src.data(), nr_bytes);
+        CHECK_EQ(pcm_convert_to_stereo16(out, out, nr_bytes, num_channels, bits_per_sample), out_bytes);
+        CHECK(memcmp(out, expected.data(), out_bytes) == 0);
+        CHECK_EQ((uint8_t) out[out_bytes], GUARD);
+    }
+}
+
+static void test_converts_every_format() {
+    check_format(1, 8);
+    check_format(2, 8);
+    check_format(1, 16);
+    check_format(2, 16);
+}
+
+static void test_expansion() {
+    CHECK_EQ(pcm_expansion(2, 16), 1);
+    CHECK_EQ(pcm_expansion(1, 16), 2);
+    CHECK_EQ(pcm_expansion(2, 8), 2);
+    CHECK_EQ(pcm_expansion(1, 8), 4);
+}
+
+static void test_8_bit_range() {
+    // Unsigned 8 bit is centred on 0x80, and full scale both ways must map to the ends of the 16 bit range.
+    uint32_t word;
+    const uint8_t extremes[4] = {0x00, 0x80, 0xff, 0x7f};
+    memcpy(&word, extremes, 4);
+    int16_t out[8];
+    CHECK_EQ(pcm_convert_to_stereo16((char*) out, (const char*) &word, 4, 2, 8), 8);
+    CHECK_EQ(out[0], -32768);
+    CHECK_EQ(out[1], 0);
+    CHECK_EQ(out[2], 32512);
+    CHECK_EQ(out[3], -256);
+}
+
+int main() {
+    host_test_init();
+    RUN_TEST(test_converts_every_format);
+    RUN_TEST(test_expansion);
+    RUN_TEST(test_8_bit_range);
+    return host_test_result();
+}
@@ -0,0 +1,233 @@
+// The output chain against a floating point reference of the same gain, limiter and biquad: every sample of a loud
+// tone with noise must come out within rounding of it, whatever the blocks, and unity with no EQ must leave it alone.
+
+#include "host_test.h"
+#include "pcm_dsp.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#define SAMPLE_RATE             44100
+#define NR_FRAMES               (SAMPLE_RATE / 2)
+#define GAIN_TOLERANCE          2       // LSBs, the gain and the limiter each truncate where the reference does not
+#define EQ_TOLERANCE            3       // The filter output rounded as well
+#define TONE_FRAMES             8820    // 200ms of a sine through the filter, to measure its gain
+#define TONE_LEVEL              4000
+
+/**
+ * The limiter in doubles, see limit in pcm_dsp.cpp.
+ */
+static double reference_limit(double v, double knee) {
+    if (knee == 0) {
+        return v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+    }
+    if (fabs(v) <= knee) {
+        return v;
+    }
+    const double room = INT16_MAX - knee;
+    const double over = fabs(v) - knee;
+    const double magnitude = knee + room * over / (room + over);
+    return v < 0 ? -magnitude : magnitude;
+}
+
+/**
+ * The chain in doubles on the designed coefficients: the biquad, the gain, then the limiter.
+ */
+static std::vector<double> reference_chain(const std::vector<int16_t>& in, const pcm_dsp_config_t& config) {
+    const double scale = 1 << PCM_BIQUAD_SHIFT;
+    const pcm_biquad_t& c = config.biquad;
+    double x1[2] = {0, 0}, x2[2] = {0, 0}, y1[2] = {0, 0}, y2[2] = {0, 0};
+    std::vector<double> out(in.size());
+    for (size_t i = 0; i < in.size(); i++) {
+        const int ch = i & 1;
+        const double x = in[i];
+        double y = x;
+        if (config.eq) {
+            y = (c.b0 * x + c.b1 * x1[ch] + c.b2 * x2[ch] - c.a1 * y1[ch] - c.a2 * y2[ch]) / scale;
+            x2[ch] = x1[ch];
+            x1[ch] = x;
+            y2[ch] = y1[ch];
+            y1[ch] = y;
+        }
+        out[i] = reference_limit(y * config.gain / PCM_DSP_GAIN_UNITY, config.limiter_knee);
+    }
+    return out;
+}
+
+/**
+ * A loud 440Hz tone over a 60Hz hum with noise, the left channel the right inverted and halved.
+ */
+static std::vector<int16_t> test_signal() {
+    std::vector<int16_t> samples(2 * NR_FRAMES);
+    srand(1);
+    for (uint32_t i = 0; i < NR_FRAMES; i++) {
+        const double t = (double) i / SAMPLE_RATE;
+        const double v = 20000 * sin(2 * M_PI * 440 * t) + 8000 * sin(2 * M_PI * 60 * t) + (rand() % 2001 - 1000);
+        samples[2 * i] = (int16_t) (v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v);
+        samples[2 * i + 1] = (int16_t) (-samples[2 * i] / 2);
+    }
+    return samples;
+}
+
+/**
+ * Runs the chain with config in blocks of block_frames and returns the largest difference from the reference.
+ */
+static double max_error(const pcm_dsp_config_t& config, uint32_t block_frames, std::vector<int16_t>* out) {
+    const std::vector<int16_t> in = test_signal();
+    pcm_dsp_set_config(&config);
+    pcm_dsp_t dsp;
+    pcm_dsp_init(&dsp);
+    *out = in;
+    for (uint32_t position = 0; position < NR_FRAMES; position += block_frames) {
+        const uint32_t nr_frames = position + block_frames <= NR_FRAMES ? block_frames : NR_FRAMES - position;
+        pcm_dsp_process(&dsp, &(*out)[2 * position], nr_frames);
+    }
+    const std::vector<double> expected = reference_chain(in, *pcm_dsp_get_config());
+    double largest = 0;
+    for (size_t i = 0; i < in.size(); i++) {
+        largest = std::max(largest, fabs(expected[i] - (*out)[i]));
+    }
+    return largest;
+}
+
+static pcm_dsp_config_t chain(int32_t gain, int32_t limiter_knee) {
+    const pcm_dsp_config_t config = {gain, limiter_knee, false, {1 << PCM_BIQUAD_SHIFT, 0, 0, 0, 0}};
+    return config;
+}
+
+static pcm_dsp_config_t chain_eq(int32_t gain, pcm_eq_type_t type, float freq, float gain_db) {
+    pcm_dsp_config_t config = chain(gain, PCM_DSP_LIMITER_KNEE);
+    config.eq = true;
+    pcm_biquad_design(type, freq, 0.707f, gain_db, SAMPLE_RATE, &config.biquad);
+    return config;
+}
+
+static void test_unity_leaves_the_samples_alone() {
+    const pcm_dsp_config_t config = chain(PCM_DSP_GAIN_UNITY, PCM_DSP_LIMITER_KNEE);
+    std::vector<int16_t> out;
+    max_error(config, 1024, &out);
+    CHECK(out == test_signal());    // Peaks above the knee too, the limiter is skipped with the rest
+    pcm_dsp_t dsp;
+    pcm_dsp_init(&dsp);
+    CHECK(!pcm_dsp_active(&dsp));
+}
+
+static void test_gain_and_limiter_match_the_reference() {
+    const pcm_dsp_config_t configs[] = {
+            chain(PCM_DSP_GAIN_UNITY / 2, PCM_DSP_LIMITER_KNEE),
+            chain(PCM_DSP_GAIN_UNITY * 3 / 2, PCM_DSP_LIMITER_KNEE),
+            chain(PCM_DSP_GAIN_MAX, PCM_DSP_LIMITER_KNEE),
+            chain(PCM_DSP_GAIN_MAX, 0),
+            chain(PCM_DSP_GAIN_MAX, 8000),
+    };
+    for (const pcm_dsp_config_t& config : configs) {
+        std::vector<int16_t> out;
+        const double error = max_error(config, 1024, &out);
+        if (error > GAIN_TOLERANCE) {
+            printf("gain %d knee %d: %.2f LSB from the reference\n", config.gain, config.limiter_knee, error);
+        }
+        CHECK(error <= GAIN_TOLERANCE);
+    }
+}
+
+static void test_limiter_bends_peaks_under_full_scale() {
+    std::vector<int16_t> out;
+    max_error(chain(PCM_DSP_GAIN_MAX, PCM_DSP_LIMITER_KNEE), 1024, &out);
+    int32_t largest = 0;
+    for (int16_t sample : out) {
+        largest = std::max(largest, (int32_t) abs(sample));
+    }
+    // Twice the input's peaks would clip, the limiter keeps them short of full scale but above the knee.
+    CHECK(largest > PCM_DSP_LIMITER_KNEE);
+    CHECK(largest < INT16_MAX);
+
+    // Clipping instead reaches full scale.
+    max_error(chain(PCM_DSP_GAIN_MAX, 0), 1024, &out);
+    largest = 0;
+    for (int16_t sample : out) {
+        largest = std::max(largest, (int32_t) abs(sample));
+    }
+    CHECK_EQ(largest, 32768);
+}
+
+static void test_eq_matches_the_reference_in_any_blocks() {
+    const pcm_dsp_config_t configs[] = {
+            chain_eq(PCM_DSP_GAIN_UNITY, PCM_EQ_PEAKING, 1000, 6),
+            chain_eq(PCM_DSP_GAIN_UNITY, PCM_EQ_PEAKING, 440, -12),
+            chain_eq(PCM_DSP_GAIN_UNITY, PCM_EQ_HIGH_PASS, 100, 0),
+            chain_eq(PCM_DSP_GAIN_UNITY * 3 / 2, PCM_EQ_LOW_SHELF, 200, -6),
+            chain_eq(PCM_DSP_GAIN_UNITY, PCM_EQ_HIGH_SHELF, 4000, 4),
+            chain_eq(PCM_DSP_GAIN_MAX, PCM_EQ_LOW_SHELF, 100, 6),   // Into the limiter
+    };
+    const uint32_t block_sizes[] = {1, 333, 1024, NR_FRAMES};
+    for (const pcm_dsp_config_t& config : configs) {
+        std::vector<int16_t> whole;
+        for (uint32_t block_frames : block_sizes) {
+            std::vector<int16_t> out;
+            const double error = max_error(config, block_frames, &out);
+            if (error > EQ_TOLERANCE) {
+                printf("biquad %d %d %d %d %d, gain %d: %.2f LSB from the reference\n", config.biquad.b0,
+                       config.biquad.b1, config.biquad.b2, config.biquad.a1, config.biquad.a2, config.gain, error);
+            }
+            CHECK(error <= EQ_TOLERANCE);
+            if (whole.empty()) {
+                whole = out;
+            }
+            CHECK(out == whole);        // The history carries over from block to block
+        }
+    }
+}
+
+/**
+ * Gain in dB of the chain for a sine at freq, once the filter has settled.
+ */
+static double measured_gain_db(const pcm_dsp_config_t& config, double freq) {
+    std::vector<int16_t> samples(2 * TONE_FRAMES);
+    for (uint32_t i = 0; i < TONE_FRAMES; i++) {
+        samples[2 * i] = samples[2 * i + 1] = (int16_t) lrint(TONE_LEVEL * sin(2 * M_PI * freq * i / SAMPLE_RATE));
+    }
+    pcm_dsp_set_config(&config);
+    pcm_dsp_t dsp;
+    pcm_dsp_init(&dsp);
+    pcm_dsp_process(&dsp, samples.data(), TONE_FRAMES);
+    int32_t peak = 0;
+    for (uint32_t i = TONE_FRAMES / 2; i < TONE_FRAMES; i++) {
+        peak = std::max(peak, (int32_t) abs(samples[2 * i]));
+    }
+    return 20 * log10((double) peak / TONE_LEVEL);
+}
+
+static void test_designed_filters_have_their_gain() {
+    CHECK(fabs(measured_gain_db(chain_eq(PCM_DSP_GAIN_UNITY, PCM_EQ_PEAKING, 1000, 6), 1000) - 6) < 0.1);
+    CHECK(fabs(measured_gain_db(chain_eq(PCM_DSP_GAIN_UNITY, PCM_EQ_PEAKING, 1000, 6), 8000)) < 0.5);
+    CHECK(fabs(measured_gain_db(chain_eq(PCM_DSP_GAIN_UNITY, PCM_EQ_PEAKING, 1000, -12), 1000) + 12) < 0.2);
+    CHECK(measured_gain_db(chain_eq(PCM_DSP_GAIN_UNITY, PCM_EQ_HIGH_PASS, 400, 0), 50) < -30);
+    CHECK(fabs(measured_gain_db(chain_eq(PCM_DSP_GAIN_UNITY, PCM_EQ_HIGH_PASS, 400, 0), 5000)) < 0.1);
+    CHECK(fabs(measured_gain_db(chain_eq(PCM_DSP_GAIN_UNITY, PCM_EQ_LOW_SHELF, 300, -6), 30) + 6) < 0.2);
+    CHECK(fabs(measured_gain_db(chain_eq(PCM_DSP_GAIN_UNITY, PCM_EQ_HIGH_SHELF, 2000, 4), 15000) - 4) < 0.2);
+    // The gain folded into the filter.
+    CHECK(fabs(measured_gain_db(chain_eq(PCM_DSP_GAIN_UNITY / 2, PCM_EQ_PEAKING, 1000, 6), 1000)) < 0.1);
+}
+
+static void test_settings_are_clamped() {
+    pcm_dsp_config_t config = chain(PCM_DSP_GAIN_MAX * 4, 40000);
+    pcm_dsp_set_config(&config);
+    CHECK_EQ(pcm_dsp_get_config()->gain, PCM_DSP_GAIN_MAX);
+    CHECK_EQ(pcm_dsp_get_config()->limiter_knee, INT16_MAX);
+    config = chain(-1, -1);
+    pcm_dsp_set_config(&config);
+    CHECK_EQ(pcm_dsp_get_config()->gain, 0);
+    CHECK_EQ(pcm_dsp_get_config()->limiter_knee, 0);
+}
+
+int main() {
+    host_test_init();
+    RUN_TEST(test_unity_leaves_the_samples_alone);
+    RUN_TEST(test_gain_and_limiter_match_the_reference);
+    RUN_TEST(test_limiter_bends_peaks_under_full_scale);
+    RUN_TEST(test_eq_matches_the_reference_in_any_blocks);
+    RUN_TEST(test_designed_filters_have_their_gain);
+    RUN_TEST(test_settings_are_clamped);
+    return host_test_result();
+}
@@ -0,0 +1,216 @@
+// The click suppression ramps: the envelope must take a stream smoothly from and to exactly zero however it is cut
+// into blocks, and clips played or stopped on the simulated DMA ring must come out without a discontinuity.
+
+#include "host_test.h"
+#include "audio_pool.h"
+#include "clip_cache.h"
+#include "mixer.h"
+#include "pcm_ramp.h"
+#include "sim_sink.h"
+#include "wav_player.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdlib.h>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#define DMA_BUF_BYTES           4096    // As i2s_config in main.cpp
+#define DMA_BUF_COUNT           8
+#define SAMPLE_RATE             16000   // Of the sink and the test clips, so nothing is resampled
+#define LEVEL                   20000   // A constant this loud clicks wherever it starts or stops without a ramp
+#define STREAM_FRAMES           3000
+#define CLIP_FRAMES             5000
+#define SINE_HZ                 440     // Steps of up to 3456 at LEVEL, under SIM_CLICK_THRESHOLD
+#define TONE_FRAMES             (SAMPLE_RATE * 2)
+#define STOP_AFTER_MS           300
+
+static sim_sink_t sim;
+
+static const pcm_ramp_config_t default_ramps = {PCM_RAMP_FADE_IN_FRAMES, PCM_RAMP_FADE_OUT_FRAMES,
+                                                PCM_RAMP_ABORT_FRAMES};
+static const pcm_ramp_config_t no_ramps = {0, 0, 0};
+
+/**
+ * Largest sample to sample jump on either channel, from and back to silence at either end.
+ */
+static int32_t max_step(const std::vector<int16_t>& samples) {
+    int32_t largest = 0;
+    int32_t previous[2] = {0, 0};
+    for (size_t i = 0; i < samples.size(); i++) {
+        const int32_t step = abs(samples[i] - previous[i & 1]);
+        largest = step > largest ? step : largest;
+        previous[i & 1] = samples[i];
+    }
+    for (int32_t last : previous) {
+        largest = abs(last) > largest ? abs(last) : largest;
+    }
+    return largest;
+}
+
+/**
+ * A constant on the left and a loud sine on the right.
+ */
+static std::vector<int16_t> test_stream(uint32_t nr_frames) {
+    std::vector<int16_t> samples(2 * nr_frames);
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        samples[2 * i] = LEVEL;
+        samples[2 * i + 1] = (int16_t) lrint(LEVEL * sin(i * 0.05 + 1.0));
+    }
+    return samples;
+}
+
+static void test_envelope_is_smooth_in_any_blocks() {
+    const std::vector<int16_t> stream = test_stream(STREAM_FRAMES);
+    const uint32_t total_frames = STREAM_FRAMES - 100;      // The last 100 frames are past the end
+    const uint32_t block_sizes[] = {1, 63, 64, 700, 1024, STREAM_FRAMES};
+    std::vector<int16_t> whole;
+    for (uint32_t block_frames : block_sizes) {
+        std::vector<int16_t> out = stream;
+        for (uint32_t position = 0; position < STREAM_FRAMES; position += block_frames) {
+            const uint32_t nr_frames = position + block_frames <= STREAM_FRAMES ? block_frames : STREAM_FRAMES - position;
+            pcm_ramp_envelope(&out[2 * position], nr_frames, position, total_frames, PCM_RAMP_FADE_IN_FRAMES,
+                              PCM_RAMP_FADE_OUT_FRAMES);
+        }
+        if (whole.empty()) {
+            whole = out;
+        }
+        CHECK(out == whole);    // The same whichever blocks it came in
+    }
+
+    CHECK_EQ(whole[0], 0);
+    CHECK_EQ(whole[1], 0);
+    CHECK_EQ(whole[2 * (total_frames - 1)], 0);
+    CHECK_EQ(whole[2 * (total_frames - 1) + 1], 0);
+    for (uint32_t i = total_frames; i < STREAM_FRAMES; i++) {
+        CHECK(whole[2 * i] == 0 && whole[2 * i + 1] == 0);
+    }
+    // Untouched between the ramps.
+    CHECK(memcmp(&whole[2 * PCM_RAMP_FADE_IN_FRAMES], &stream[2 * PCM_RAMP_FADE_IN_FRAMES],
+                 (total_frames - PCM_RAMP_FADE_IN_FRAMES - PCM_RAMP_FADE_OUT_FRAMES) * 4) == 0);
+
+    // The constant rises and falls steadily, a step of no more than its level over the ramp.
+    int32_t largest = 0;
+    for (uint32_t i = 1; i < total_frames; i++) {
+        const int32_t step = abs(whole[2 * i] - whole[2 * (i - 1)]);
+        largest = step > largest ? step : largest;
+        if (i < PCM_RAMP_FADE_IN_FRAMES) {
+            CHECK(whole[2 * i] >= whole[2 * (i - 1)]);
+        } else if (i >= total_frames - PCM_RAMP_FADE_OUT_FRAMES) {
+            CHECK(whole[2 * i] <= whole[2 * (i - 1)]);
+        }
+    }
+    CHECK(largest <= LEVEL / PCM_RAMP_FADE_IN_FRAMES + 1);
+}
+
+static void test_short_stream_gets_both_ramps() {
+    // Shorter than the two ramps together, both apply and it still starts and ends on zero.
+    const uint32_t total_frames = PCM_RAMP_FADE_OUT_FRAMES / 2;
+    std::vector<int16_t> out = test_stream(total_frames);
+    pcm_ramp_envelope(out.data(), total_frames, 0, total_frames, PCM_RAMP_FADE_IN_FRAMES, PCM_RAMP_FADE_OUT_FRAMES);
+    CHECK_EQ(out[0], 0);
+    CHECK_EQ(out[2 * (total_frames - 1)], 0);
+    CHECK(max_step(out) < SIM_CLICK_THRESHOLD);
+    CHECK(!pcm_ramp_needed(PCM_RAMP_FADE_IN_FRAMES, 100, 1000, PCM_RAMP_FADE_IN_FRAMES, PCM_RAMP_FADE_OUT_FRAMES));
+    CHECK(pcm_ramp_needed(PCM_RAMP_FADE_IN_FRAMES - 1, 100, 1000, PCM_RAMP_FADE_IN_FRAMES, PCM_RAMP_FADE_OUT_FRAMES));
+    CHECK(pcm_ramp_needed(500, 1000 - PCM_RAMP_FADE_OUT_FRAMES - 499, 1000, PCM_RAMP_FADE_IN_FRAMES,
+                          PCM_RAMP_FADE_OUT_FRAMES));
+}
+
+static void test_finds_zero_crossings() {
+    const int16_t positive[] = {100, 100, 50, 60, 10, 20, 5, 5};
+    CHECK_EQ(pcm_zero_crossing(positive, 4), 4);
+    const int16_t crossing[] = {100, 100, 50, 60, -10, -200, 5, 5};
+    CHECK_EQ(pcm_zero_crossing(crossing, 4), 2);
+    const int16_t mid_zero[] = {-100, -100, 30, -30, 5, 5};
+    CHECK_EQ(pcm_zero_crossing(mid_zero, 3), 1);    // Left and right cancel
+    CHECK_EQ(pcm_zero_crossing(crossing, 0), 0);
+}
+
+/**
+ * A clip of samples in RAM, word backed for the alignment clips are played with.
+ */
+static wav_data_t ram_clip(std::vector<uint32_t>* words, const std::vector<int16_t>& samples) {
+    words->assign(samples.size() / 2, 0);
+    memcpy(words->data(), samples.data(), samples.size() * 2);
+    wav_data_t clip;
+    memset(&clip, 0, sizeof(wav_data_t));
+    clip.data = (char*) words->data();
+    clip.nr_bytes = samples.size() * 2;
+    clip.sample_rate = SAMPLE_RATE;
+    clip.filename = (char*) "test";
+    clip.num_channels = 2;
+    clip.bits_per_sample = 16;
+    return clip;
+}
+
+static void test_clip_cut_mid_wave_plays_without_a_click() {
+    // A loud sine cut off at either end part way up a cycle, as a trimmed recording is. Its own steps stay under the
+    // click threshold, so only the jumps from and to silence can click.
+    std::vector<int16_t> samples(2 * CLIP_FRAMES);
+    for (uint32_t i = 0; i < CLIP_FRAMES; i++) {
+        samples[2 * i] = samples[2 * i + 1] = (int16_t) lrint(LEVEL * sin(2 * M_PI * SINE_HZ * i / SAMPLE_RATE + 1.0));
+    }
+    std::vector<uint32_t> words;
+    const wav_data_t clip = ram_clip(&words, samples);
+
+    uint32_t nr_bytes_written;
+    pcm_ramp_set_config(&no_ramps);
+    sim_sink_start(&sim, SAMPLE_RATE);
+    CHECK_OK(clip_cache_stream(&clip, &sim.sink, 0, &nr_bytes_written));
+    sim_sink_drain(&sim);
+    CHECK_EQ(sim.stats.nr_clicks, 4);      // In and out, on both channels
+
+    pcm_ramp_set_config(&default_ramps);
+    sim_sink_start(&sim, SAMPLE_RATE);
+    CHECK_OK(clip_cache_stream(&clip, &sim.sink, 0, &nr_bytes_written));
+    sim_sink_drain(&sim);
+    CHECK_EQ(sim.stats.nr_clicks, 0);
+    CHECK(sim.stats.first_audible_us > 0);
+}
+
+/**
+ * Starts the clip through the mixer, stops it part way and returns the sink's largest step.
+ */
+static uint32_t max_step_stopping(const wav_data_t* clip) {
+    sim_sink_start(&sim, SAMPLE_RATE);
+    mixer_voice_t voice;
+    CHECK_OK(mixer_play(clip, MIXER_GAIN_UNITY, 0, &voice));
+    vTaskDelay(STOP_AFTER_MS / portTICK_PERIOD_MS);
+    CHECK_OK(mixer_stop(voice));
+    while (mixer_active_voices() > 0) {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    sim_sink_drain(&sim);
+    return sim.stats.max_step;
+}
+
+static void test_stop_ramps_down_without_a_click() {
+    // A constant has no zero crossing to wait for, the abort ramp alone has to take it down.
+    std::vector<uint32_t> words;
+    const wav_data_t tone = ram_clip(&words, std::vector<int16_t>(2 * TONE_FRAMES, LEVEL));
+
+    pcm_ramp_set_config(&no_ramps);
+    CHECK_EQ(max_step_stopping(&tone), LEVEL);
+    pcm_ramp_set_config(&default_ramps);
+    CHECK(max_step_stopping(&tone) <= LEVEL / PCM_RAMP_FADE_IN_FRAMES + 1);
+    CHECK_EQ(sim.stats.nr_clicks, 0);
+    CHECK(sim.stats.last_audible_us - sim.stats.first_audible_us < (STOP_AFTER_MS + 200) * 1000);    // It did stop
+}
+
+int main() {
+    host_test_init();
+    CHECK_OK(wav_player_init());
+    CHECK_OK(audio_pool_init(1));       // The mixer's output block
+    CHECK_OK(sim_sink_init(&sim, DMA_BUF_BYTES, DMA_BUF_COUNT));
+    sim_sink_start(&sim, SAMPLE_RATE);
+    CHECK_OK(mixer_init(&sim.sink));
+
+    RUN_TEST(test_envelope_is_smooth_in_any_blocks);
+    RUN_TEST(test_short_stream_gets_both_ramps);
+    RUN_TEST(test_finds_zero_crossings);
+    RUN_TEST(test_clip_cut_mid_wave_plays_without_a_click);
+    RUN_TEST(test_stop_ramps_down_without_a_click);
+    return host_test_result();
+}
@@ -0,0 +1,285 @@
+// The tone synthesiser against the waves computed in doubles: every wave must come out at its pitch and level to
+// within the table's interpolation, sweeps must start and end on their pitches, the envelope must reach each of its
+// levels on its frame, and a tone played through the pipeline must be the same samples rendered directly.
+
+#include "host_test.h"
+#include "audio_pool.h"
+#include "pcm_synth.h"
+#include "playback_pipeline.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#define SAMPLE_RATE             44100
+#define BLOCK_FRAMES            1024    // As PIPELINE_BLOCK_SIZE
+#define TONE_HZ                 1000
+#define SINE_TOLERANCE          5       // LSBs, linear interpolation between 256 entries, each rounded down
+#define WAVE_TOLERANCE          72      // The harmonics of the square and saw curve more sharply, up to 81 times
+#define LEVEL_TOLERANCE         0.01    // Of full scale, the peak of a 1kHz period can fall between two samples
+#define DMA_BUF_BYTES           4096    // As i2s_config in main.cpp
+#define DMA_BUF_COUNT           8
+
+/**
+ * Renders the whole tone in blocks of block_frames, one stereo frame after the other.
+ */
+static std::vector<int16_t> render_all(const pcm_tone_t& tone, uint32_t block_frames) {
+    pcm_synth_t synth;
+    CHECK_OK(pcm_synth_init(&synth, &tone, SAMPLE_RATE));
+    std::vector<int16_t> frames(2 * pcm_synth_frames(&synth));
+    uint32_t nr_frames = 0;
+    uint32_t nr_rendered;
+    std::vector<int16_t> block(2 * block_frames);
+    while ((nr_rendered = pcm_synth_render(&synth, block.data(), block_frames)) > 0) {
+        CHECK(nr_frames + nr_rendered <= frames.size() / 2);
+        if (nr_frames + nr_rendered > frames.size() / 2) {
+            break;
+        }
+        memcpy(&frames[2 * nr_frames], block.data(), 4 * nr_rendered);
+        nr_frames += nr_rendered;
+    }
+    CHECK_EQ(nr_frames, frames.size() / 2);
+    return frames;
+}
+
+static pcm_tone_t steady_tone(pcm_wave_t wave, uint32_t duration_ms) {
+    const pcm_tone_t tone = {wave, TONE_HZ, TONE_HZ, PCM_SYNTH_GAIN_UNITY, duration_ms, 0, 0, 0, PCM_SYNTH_GAIN_UNITY};
+    return tone;
+}
+
+/**
+ * The band limited wave at phase, in turns, as its Fourier series in pcm_synth.cpp, before it is scaled to full scale.
+ */
+static double series(pcm_wave_t wave, double phase) {
+    double value = 0;
+    for (int k = 1; k <= PCM_SYNTH_HARMONICS; k++) {
+        const double amplitude = wave == PCM_WAVE_SINE ? (k == 1 ? 1.0 : 0.0)
+                               : wave == PCM_WAVE_TRIANGLE ? (k % 2 == 0 ? 0.0 : (k % 4 == 1 ? 1.0 : -1.0) / (k * k))
+                               : wave == PCM_WAVE_SQUARE ? (k % 2 == 0 ? 0.0 : 1.0 / k)
+                               : (k % 2 == 0 ? -1.0 : 1.0) / k;
+        value += amplitude * sin(2 * M_PI * k * phase);
+    }
+    return value;
+}
+
+/**
+ * Largest difference between the samples and the wave at full scale, scaled by its peak over the table's entries.
+ */
+static double max_error(pcm_wave_t wave, const std::vector<int16_t>& frames, double hz) {
+    const uint32_t table_size = 1 << PCM_SYNTH_TABLE_BITS;
+    double peak = 0;
+    for (uint32_t i = 0; i < table_size; i++) {
+        peak = std::max(peak, fabs(series(wave, (double) i / table_size)));
+    }
+    double largest = 0;
+    for (uint32_t i = 0; i < frames.size() / 2; i++) {
+        const double phase = fmod(hz * i / SAMPLE_RATE, 1.0);
+        largest = std::max(largest, fabs(frames[2 * i] - 32767 * series(wave, phase) / peak));
+    }
+    return largest;
+}
+
+/**
+ * Rising zero crossings of the left channel over frames [first, last).
+ */
+static uint32_t rising_crossings(const std::vector<int16_t>& frames, uint32_t first, uint32_t last) {
+    uint32_t nr_crossings = 0;
+    for (uint32_t i = first > 0 ? first : 1; i < last; i++) {
+        if (frames[2 * (i - 1)] < 0 && frames[2 * i] >= 0) {
+            nr_crossings++;
+        }
+    }
+    return nr_crossings;
+}
+
+/**
+ * Largest magnitude of the left channel over frames [first, last), as a fraction of full scale.
+ */
+static double level(const std::vector<int16_t>& frames, uint32_t first, uint32_t last) {
+    int32_t largest = 0;
+    for (uint32_t i = first; i < last; i++) {
+        largest = std::max(largest, (int32_t) abs(frames[2 * i]));
+    }
+    return largest / 32768.0;
+}
+
+static uint32_t ms_to_frames(uint32_t ms) {
+    return ms * SAMPLE_RATE / 1000;
+}
+
+static void test_every_wave_matches_its_series() {
+    for (int wave = 0; wave < PCM_WAVE_COUNT; wave++) {
+        // Two seconds, long enough for any error in the phase increment to show as drift.
+        const std::vector<int16_t> frames = render_all(steady_tone((pcm_wave_t) wave, 2000), BLOCK_FRAMES);
+        const double error = max_error((pcm_wave_t) wave, frames, TONE_HZ);
+        printf("wave %d: %.2f LSB from the series\n", wave, error);
+        CHECK(error <= (wave == PCM_WAVE_SINE ? SINE_TOLERANCE : WAVE_TOLERANCE));
+        CHECK(level(frames, 0, frames.size() / 2) > 1 - LEVEL_TOLERANCE);
+
+        const uint32_t nr_frames = frames.size() / 2;
+        const double expected = (double) TONE_HZ * (nr_frames - 1) / SAMPLE_RATE;
+        CHECK(fabs(rising_crossings(frames, 0, nr_frames) - expected) <= 1);
+        for (uint32_t i = 0; i < nr_frames; i++) {
+            if (frames[2 * i] != frames[2 * i + 1]) {
+                printf("Channels differ at frame %d\n", i);
+                CHECK(false);
+                break;
+            }
+        }
+    }
+}
+
+static void test_any_blocks_render_the_same() {
+    const pcm_tone_t tone = {PCM_WAVE_TRIANGLE, 700, 2100, PCM_SYNTH_GAIN_UNITY / 2, 250, 7, 31, 53,
+                             PCM_SYNTH_GAIN_UNITY / 3};
+    const std::vector<int16_t> whole = render_all(tone, ms_to_frames(250));
+    CHECK_EQ(whole.size(), 2 * ms_to_frames(250));
+    const uint32_t block_sizes[] = {1, 333, BLOCK_FRAMES};
+    for (uint32_t block_frames : block_sizes) {
+        CHECK(render_all(tone, block_frames) == whole);
+    }
+
+    // Too short for its envelope, it is stretched to fit all of it.
+    pcm_tone_t shorter = tone;
+    shorter.duration_ms = 10;
+    CHECK_EQ(render_all(shorter, BLOCK_FRAMES).size(), 2 * (ms_to_frames(7) + ms_to_frames(31) + ms_to_frames(53)));
+
+    // Done once it has ended.
+    pcm_synth_t synth;
+    CHECK_OK(pcm_synth_init(&synth, &tone, SAMPLE_RATE));
+    std::vector<int16_t> block(2 * ms_to_frames(300));
+    CHECK_EQ(pcm_synth_render(&synth, block.data(), ms_to_frames(300)), ms_to_frames(250));
+    CHECK_EQ(pcm_synth_render(&synth, block.data(), ms_to_frames(300)), 0);
+}
+
+static void test_envelope_reaches_each_level() {
+    const pcm_tone_t tone = {PCM_WAVE_SINE, TONE_HZ, TONE_HZ, PCM_SYNTH_GAIN_UNITY / 2, 300, 10, 20, 40,
+                             PCM_SYNTH_GAIN_UNITY / 2};
+    const std::vector<int16_t> frames = render_all(tone, BLOCK_FRAMES);
+    const uint32_t period = SAMPLE_RATE / TONE_HZ + 1;
+    const uint32_t attack_end = ms_to_frames(10);
+    const uint32_t decay_end = ms_to_frames(30);
+    const uint32_t release_start = ms_to_frames(300 - 40);
+    const uint32_t nr_frames = frames.size() / 2;
+
+    CHECK_EQ(frames[0], 0);
+    CHECK(level(frames, 0, period) < 0.1 * 0.5);
+    CHECK(fabs(level(frames, attack_end - period / 2, attack_end + period / 2) - 0.5) < LEVEL_TOLERANCE);
+    CHECK(fabs(level(frames, decay_end, release_start) - 0.25) < LEVEL_TOLERANCE);
+    CHECK(level(frames, nr_frames - period, nr_frames) < 0.1 * 0.25);
+    CHECK(abs(frames[2 * (nr_frames - 1)]) <= 1);
+
+    // Up through the attack and down through the decay and the release, a period at a time.
+    for (uint32_t i = period; i + period <= attack_end; i += period) {
+        CHECK(level(frames, i, i + period) > level(frames, i - period, i));
+    }
+    for (uint32_t i = attack_end + period; i + period <= decay_end; i += period) {
+        CHECK(level(frames, i, i + period) < level(frames, i - period, i));
+    }
+    for (uint32_t i = release_start + period; i + period <= nr_frames; i += period) {
+        CHECK(level(frames, i, i + period) < level(frames, i - period, i));
+    }
+
+    // With no attack it starts at full level, with no decay either at the sustain level.
+    pcm_tone_t no_attack = tone;
+    no_attack.attack_ms = 0;
+    CHECK(fabs(level(render_all(no_attack, BLOCK_FRAMES), 0, period) - 0.5) < LEVEL_TOLERANCE);
+    no_attack.decay_ms = 0;
+    const std::vector<int16_t> held = render_all(no_attack, BLOCK_FRAMES);
+    CHECK(fabs(level(held, 0, period) - 0.25) < LEVEL_TOLERANCE);
+    CHECK(fabs(level(held, release_start - period, release_start) - 0.25) < LEVEL_TOLERANCE);
+}
+
+static void test_sweep_starts_and_ends_on_its_pitches() {
+    const pcm_tone_t tone = {PCM_WAVE_SINE, 500, 3000, PCM_SYNTH_GAIN_UNITY, 1000, 0, 0, 0, PCM_SYNTH_GAIN_UNITY};
+    const std::vector<int16_t> frames = render_all(tone, BLOCK_FRAMES);
+    const uint32_t nr_frames = frames.size() / 2;
+    // Crossings over a tenth of a second are the integral of the pitch over it.
+    const uint32_t tenth = SAMPLE_RATE / 10;
+    CHECK(fabs(rising_crossings(frames, 0, tenth) - (500 * 0.1 + 2500 * 0.01 / 2)) <= 1);
+    CHECK(fabs(rising_crossings(frames, nr_frames - tenth, nr_frames) - (3000 * 0.1 - 2500 * 0.01 / 2)) <= 1);
+
+    // Every frame against the sweep in doubles, the pitch stepping up at the end of each frame.
+    double largest = 0;
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        const double phase = (500.0 * i + 2500.0 * i * (i - 1.0) / 2 / nr_frames) / SAMPLE_RATE;
+        largest = std::max(largest, fabs(frames[2 * i] - 32767 * sin(2 * M_PI * phase)));
+    }
+    printf("sweep: %.2f LSB from the series\n", largest);
+    CHECK(largest <= SINE_TOLERANCE);
+}
+
+static void test_refuses_bad_tones() {
+    pcm_synth_t synth;
+    const pcm_tone_t good = steady_tone(PCM_WAVE_SINE, 100);
+    pcm_tone_t tone = good;
+    tone.gain = PCM_SYNTH_GAIN_UNITY + 1;
+    CHECK_EQ(pcm_synth_init(&synth, &tone, SAMPLE_RATE), ESP_ERR_INVALID_ARG);
+    tone.gain = -1;
+    CHECK_EQ(pcm_synth_init(&synth, &tone, SAMPLE_RATE), ESP_ERR_INVALID_ARG);
+    tone = good;
+    tone.sustain = PCM_SYNTH_GAIN_UNITY + 1;
+    CHECK_EQ(pcm_synth_init(&synth, &tone, SAMPLE_RATE), ESP_ERR_INVALID_ARG);
+    tone.sustain = -1;
+    CHECK_EQ(pcm_synth_init(&synth, &tone, SAMPLE_RATE), ESP_ERR_INVALID_ARG);
+    tone = good;
+    tone.end_hz = SAMPLE_RATE / 2;
+    CHECK_EQ(pcm_synth_init(&synth, &tone, SAMPLE_RATE), ESP_ERR_INVALID_ARG);
+    tone.start_hz = SAMPLE_RATE / 2;
+    tone.end_hz = TONE_HZ;
+    CHECK_EQ(pcm_synth_init(&synth, &tone, SAMPLE_RATE), ESP_ERR_INVALID_ARG);
+    tone = good;
+    tone.wave = PCM_WAVE_COUNT;
+    CHECK_EQ(pcm_synth_init(&synth, &tone, SAMPLE_RATE), ESP_ERR_INVALID_ARG);
+    CHECK_EQ(pcm_synth_init(&synth, &good, 0), ESP_ERR_INVALID_ARG);
+
+    // Just under the Nyquist frequency is fine.
+    tone = good;
+    tone.start_hz = tone.end_hz = SAMPLE_RATE / 2 - 1;
+    CHECK_OK(pcm_synth_init(&synth, &tone, SAMPLE_RATE));
+}
+
+static std::vector<int16_t> sunk;
+
+/**
+ * Keeps whatever it is given, at once.
+ */
+static esp_err_t capture_write(void* ctx, const char* data, size_t size, size_t* nr_bytes_written) {
+    const int16_t* samples = (const int16_t*) data;
+    sunk.insert(sunk.end(), samples, samples + size / 2);
+    *nr_bytes_written = size;
+    return ESP_OK;
+}
+
+static const pcm_sink_t capture_sink = {capture_write, nullptr, nullptr, DMA_BUF_BYTES, DMA_BUF_COUNT, SAMPLE_RATE};
+
+static void test_pipeline_plays_the_rendered_tone() {
+    const pcm_tone_t tone = {PCM_WAVE_SQUARE, 440, 880, PCM_SYNTH_GAIN_UNITY / 2, 300, 5, 50, 150,
+                             PCM_SYNTH_GAIN_UNITY / 2};
+    const std::vector<int16_t> expected = render_all(tone, BLOCK_FRAMES);
+    sunk.clear();
+    pipeline_stats_t stats;
+    CHECK_OK(pipeline_play_tone(&tone, &stats));
+    CHECK_EQ(stats.nr_bytes_read, 2 * expected.size());
+    CHECK_EQ(stats.nr_bytes_written, 2 * sunk.size());
+    CHECK(sunk.size() >= expected.size());
+    if (sunk.size() >= expected.size()) {
+        CHECK(std::vector<int16_t>(sunk.begin(), sunk.begin() + expected.size()) == expected);
+    }
+}
+
+int main() {
+    host_test_init();
+    esp_log_level_set("pcm_synth", ESP_LOG_NONE);      // The bad tones
+    esp_log_level_set("pipeline", ESP_LOG_WARN);
+    CHECK_OK(audio_pool_init(PIPELINE_MAX_BLOCKS + 2));     // As app_main
+    CHECK_OK(pipeline_init(&capture_sink));
+
+    RUN_TEST(test_every_wave_matches_its_series);
+    RUN_TEST(test_any_blocks_render_the_same);
+    RUN_TEST(test_envelope_reaches_each_level);
+    RUN_TEST(test_sweep_starts_and_ends_on_its_pitches);
+    RUN_TEST(test_refuses_bad_tones);
+    RUN_TEST(test_pipeline_plays_the_rendered_tone);
+    return host_test_result();
+}
@@ -0,0 +1,213 @@
+// Announcements: numbers and race times must come out as the right units in order, a phrase that would overflow must
+// be refused whole, and phrase_play must splice the units out of the clip store crossfaded by exactly
+// PHRASE_CROSSFADE_FRAMES, or say nothing at all if a unit is not recorded.
+
+#include "host_test.h"
+#include "audio_pool.h"
+#include "clip_store.h"
+#include "host_shim.h"
+#include "mixer.h"
+#include "pcm_ramp.h"
+#include "phrase.h"
+#include "sim_sink.h"
+#include "wav_player.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <cstring>
+#include <vector>
+
+#define CLIPS_PARTITION         "clips"
+#define DMA_BUF_BYTES           4096    // As i2s_config in main.cpp
+#define DMA_BUF_COUNT           8
+#define SAMPLE_RATE             16000   // The units' rate, so nothing is resampled
+#define CAPTURE_FRAMES          (SAMPLE_RATE * 4)
+#define UNIT                    "on_your_marks"     // The only unit recorded so far
+
+static sim_sink_t sim;
+static std::vector<int16_t> capture(2 * CAPTURE_FRAMES);
+
+/**
+ * Checks phrase holds exactly the nr_units of units.
+ */
+static void check_units(const phrase_t* phrase, const char* const* units, uint32_t nr_units) {
+    CHECK_EQ(phrase->nr_units, nr_units);
+    for (uint32_t i = 0; i < nr_units && i < phrase->nr_units; i++) {
+        if (strcmp(phrase->units[i], units[i]) != 0) {
+            printf("Unit %d is %s not %s\n", i, phrase->units[i], units[i]);
+            CHECK(false);
+        }
+    }
+}
+
+static void check_number(uint32_t number, const char* const* units, uint32_t nr_units) {
+    phrase_t phrase;
+    phrase_init(&phrase);
+    CHECK_OK(phrase_add_number(&phrase, number));
+    check_units(&phrase, units, nr_units);
+}
+
+static void check_time(uint32_t time_ms, const char* const* units, uint32_t nr_units) {
+    phrase_t phrase;
+    phrase_init(&phrase);
+    CHECK_OK(phrase_add_time(&phrase, time_ms));
+    check_units(&phrase, units, nr_units);
+}
+
+static uint32_t first_audible(const int16_t* frames, uint32_t nr_frames) {
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        if (frames[2 * i] != 0 || frames[2 * i + 1] != 0) {
+            return i;
+        }
+    }
+    return nr_frames;
+}
+
+static void test_says_numbers() {
+    const char* const zero[] = {"zero"};
+    const char* const thirteen[] = {"thirteen"};
+    const char* const twenty[] = {"twenty"};
+    const char* const forty_two[] = {"forty", "two"};
+    const char* const ninety_nine[] = {"ninety", "nine"};
+    check_number(0, zero, 1);
+    check_number(13, thirteen, 1);
+    check_number(20, twenty, 1);
+    check_number(42, forty_two, 2);
+    check_number(99, ninety_nine, 2);
+
+    phrase_t phrase;
+    phrase_init(&phrase);
+    CHECK_EQ(phrase_add_number(&phrase, PHRASE_MAX_NUMBER + 1), ESP_ERR_INVALID_ARG);
+    CHECK_EQ(phrase.nr_units, 0);
+}
+
+static void test_says_times() {
+    const char* const under_a_minute[] = {"twelve", "point", "three", "four", "seconds"};
+    const char* const one_minute[] = {"one", "minute", "five", "point", "zero", "six", "seconds"};
+    const char* const longest[] = {"ninety", "nine", "minutes", "fifty", "nine", "point", "nine", "nine", "seconds"};
+    check_time(12340, under_a_minute, 5);
+    check_time(65060, one_minute, 7);
+    check_time(99 * 60000 + 59990, longest, 9);     // Every one of the units a time can take
+
+    phrase_t phrase;
+    phrase_init(&phrase);
+    CHECK_EQ(phrase_add_time(&phrase, 100 * 60000), ESP_ERR_INVALID_ARG);
+    CHECK_EQ(phrase.nr_units, 0);
+}
+
+static void test_refuses_what_does_not_fit() {
+    phrase_t phrase;
+    phrase_init(&phrase);
+    for (uint32_t i = 0; i < PHRASE_MAX_UNITS - 1; i++) {
+        CHECK_OK(phrase_add(&phrase, UNIT));
+    }
+
+    // A number or a time that would run past the end adds none of its units.
+    CHECK_EQ(phrase_add_number(&phrase, 42), ESP_ERR_NO_MEM);
+    CHECK_EQ(phrase_add_time(&phrase, 12340), ESP_ERR_NO_MEM);
+    CHECK_EQ(phrase.nr_units, PHRASE_MAX_UNITS - 1);
+    CHECK_OK(phrase_add_number(&phrase, 7));
+    CHECK_EQ(phrase.nr_units, PHRASE_MAX_UNITS);
+    CHECK_EQ(phrase_add(&phrase, UNIT), ESP_ERR_NO_MEM);
+    CHECK_EQ(phrase.nr_units, PHRASE_MAX_UNITS);
+}
+
+static void test_splices_units_crossfaded() {
+    wav_data_t clip;
+    CHECK_OK(clip_store_find(UNIT, &clip));
+    const uint32_t clip_frames = mixer_clip_frames(&clip);
+    CHECK(clip_frames > PHRASE_CROSSFADE_FRAMES);
+
+    // Two of the unit, the second starting PHRASE_CROSSFADE_FRAMES before the first ends, each ramped over the overlap
+    // so the two gains add up to one, summed and saturated.
+    const uint32_t nr_frames = 2 * clip_frames - PHRASE_CROSSFADE_FRAMES;
+    std::vector<int16_t> first((const int16_t*) clip.data, (const int16_t*) clip.data + 2 * clip_frames);
+    std::vector<int16_t> second = first;
+    pcm_ramp_envelope(first.data(), clip_frames, 0, clip_frames, 0, PHRASE_CROSSFADE_FRAMES);
+    pcm_ramp_envelope(second.data(), clip_frames, 0, clip_frames, PHRASE_CROSSFADE_FRAMES, 0);
+    std::vector<int32_t> sum(2 * nr_frames, 0);
+    for (uint32_t i = 0; i < first.size(); i++) {
+        sum[i] += first[i];
+        sum[2 * (clip_frames - PHRASE_CROSSFADE_FRAMES) + i] += second[i];
+    }
+    std::vector<int16_t> expected(sum.size());
+    for (size_t i = 0; i < sum.size(); i++) {
+        expected[i] = (int16_t) (sum[i] > INT16_MAX ? INT16_MAX : sum[i] < INT16_MIN ? INT16_MIN : sum[i]);
+    }
+
+    phrase_t phrase;
+    phrase_init(&phrase);
+    CHECK_OK(phrase_add(&phrase, UNIT));
+    CHECK_OK(phrase_add(&phrase, UNIT));
+    sim_sink_start(&sim, SAMPLE_RATE);
+    sequence_stats_t stats;
+    CHECK_OK(phrase_play(&phrase, MIXER_GAIN_UNITY, &stats));
+    while (mixer_active_voices() > 0) {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    sim_sink_drain(&sim);
+    CHECK_EQ(stats.nr_clips, 2);
+    CHECK_EQ(stats.nr_frames, nr_frames);
+    CHECK_EQ(stats.late_starts, 0);
+    CHECK_EQ(sim.stats.nr_gaps, 0);
+
+    // The unit may open on silent frames, so line the two up on the first audible one.
+    const uint32_t lead = first_audible(expected.data(), nr_frames);
+    const uint32_t audible = first_audible(capture.data(), sim.nr_captured);
+    CHECK(audible >= lead && audible - lead + nr_frames <= sim.nr_captured);
+    if (audible < lead || audible - lead + nr_frames > sim.nr_captured) {
+        return;
+    }
+    const uint32_t start = audible - lead;
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        if (capture[2 * (start + i)] != expected[2 * i] || capture[2 * (start + i) + 1] != expected[2 * i + 1]) {
+            printf("Differs at frame %d of %d, %d not %d\n", i, nr_frames, capture[2 * (start + i)], expected[2 * i]);
+            CHECK(false);
+            break;
+        }
+    }
+    CHECK_EQ(first_audible(&capture[2 * (start + nr_frames)], sim.nr_captured - start - nr_frames),
+             sim.nr_captured - start - nr_frames);
+}
+
+static void test_says_nothing_with_a_unit_missing() {
+    // Units that are not recorded yet, see main/phrase_units.txt, one after a unit that is.
+    phrase_t phrase;
+    phrase_init(&phrase);
+    CHECK_OK(phrase_add(&phrase, UNIT));
+    CHECK_OK(phrase_find_units(&phrase));
+    CHECK_OK(phrase_add(&phrase, "lane"));
+    CHECK_OK(phrase_add_number(&phrase, 3));
+    CHECK_EQ(phrase_find_units(&phrase), ESP_ERR_NOT_FOUND);
+
+    sim_sink_start(&sim, SAMPLE_RATE);
+    CHECK_EQ(phrase_play(&phrase, MIXER_GAIN_UNITY, nullptr), ESP_ERR_NOT_FOUND);
+    CHECK_EQ(mixer_active_voices(), 0);
+    sim_sink_drain(&sim);
+    CHECK_EQ(first_audible(capture.data(), sim.nr_captured), sim.nr_captured);
+}
+
+int main() {
+    host_test_init();
+    esp_log_level_set("phrase", ESP_LOG_ERROR);     // Each refusal is logged
+    CHECK_OK(host_partition_add(CLIPS_PARTITION, ESP_PARTITION_TYPE_DATA,
+                                (esp_partition_subtype_t) CLIP_STORE_PARTITION_TYPE, HOST_CLIPS_IMAGE,
+                                HOST_CLIPS_PARTITION_SIZE));
+    CHECK_OK(clip_store_init(CLIPS_PARTITION));
+    // No ramps, so only the crossfade shapes the output.
+    const pcm_ramp_config_t no_ramps = {0, 0, 0};
+    pcm_ramp_set_config(&no_ramps);
+    CHECK_OK(wav_player_init());
+    CHECK_OK(audio_pool_init(1));       // The mixer's output block
+    CHECK_OK(sim_sink_init(&sim, DMA_BUF_BYTES, DMA_BUF_COUNT));
+    sim_sink_capture(&sim, capture.data(), CAPTURE_FRAMES);
+    sim_sink_start(&sim, SAMPLE_RATE);
+    CHECK_OK(mixer_init(&sim.sink));
+
+    RUN_TEST(test_says_numbers);
+    RUN_TEST(test_says_times);
+    RUN_TEST(test_refuses_what_does_not_fit);
+    RUN_TEST(test_splices_units_crossfaded);
+    RUN_TEST(test_says_nothing_with_a_unit_missing);
+    return host_test_result();
+}
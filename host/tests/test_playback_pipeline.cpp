@@ -0,0 +1,254 @@
+// The reader/writer pipeline against the simulated DMA ring: it has to keep the output fed in real time, play the
+// data bit for bit, from a file or from a pipe fed a little at a time, ride out source stalls shorter than the ring
+// and count the underruns when a stall is longer.
+
+#include "host_test.h"
+#include "audio_pool.h"
+#include "pcm_ramp.h"
+#include "playback_pipeline.h"
+#include "sim_sink.h"
+#include "wav_file.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <unistd.h>
+#include <cstring>
+#include <vector>
+
+#define DMA_BUF_BYTES           4096    // As i2s_config in main.cpp
+#define DMA_BUF_COUNT           8
+#define SAMPLE_RATE             16000   // The clip's own rate, so nothing is resampled and the output is the data
+#define FRAMES_PER_BUF          (DMA_BUF_BYTES / 4)
+#define CAPTURE_FRAMES          (SAMPLE_RATE * 6)
+#define TEST_FILE               "OYM-USA-male-1-16000.wav"
+#define RING_US                 ((int64_t) DMA_BUF_COUNT * FRAMES_PER_BUF * 1000000 / SAMPLE_RATE)
+#define BUFFERED_US             (2 * RING_US)   // The reader can be the pipeline's ring and the DMA ring ahead
+#define PIPE_FEED_CHUNK         512     // As app_main, about what a UART driver hands over
+#define PIPE_FEED_MS            5       // Between chunks, 100KB/s against the clip's 64KB/s
+
+/**
+ * A source that stops for stall_ms when its position first reaches each multiple of stall_every bytes past
+ * stall_from, as SPIFFS does while it garbage collects or another task holds the flash.
+ */
+typedef struct {
+    audio_source_t source;
+    const audio_source_t* inner;
+    uint32_t position;
+    uint32_t stall_from;
+    uint32_t stall_every;       // 0 for one stall only
+    uint32_t stall_ms;
+    uint32_t next_stall;
+    uint32_t nr_stalls;
+} stalling_source_t;
+
+static esp_err_t stalling_read(void* ctx, char* dst, size_t size, size_t* nr_bytes_read) {
+    stalling_source_t* stalling = (stalling_source_t*) ctx;
+    if (stalling->position >= stalling->next_stall) {
+        vTaskDelay(stalling->stall_ms / portTICK_PERIOD_MS);
+        stalling->nr_stalls++;
+        stalling->next_stall = stalling->stall_every > 0 ? stalling->next_stall + stalling->stall_every : UINT32_MAX;
+    }
+    const esp_err_t err = stalling->inner->read(stalling->inner->ctx, dst, size, nr_bytes_read);
+    stalling->position += *nr_bytes_read;
+    return err;
+}
+
+static void stalling_source_init(stalling_source_t* stalling, const audio_source_t* inner, uint32_t stall_from,
+                                 uint32_t stall_every, uint32_t stall_ms) {
+    stalling->source.read = stalling_read;
+    stalling->source.seek = nullptr;
+    stalling->source.ctx = stalling;
+    stalling->inner = inner;
+    stalling->position = 0;
+    stalling->stall_from = stall_from;
+    stalling->stall_every = stall_every;
+    stalling->stall_ms = stall_ms;
+    stalling->next_stall = stall_from;
+    stalling->nr_stalls = 0;
+}
+
+static sim_sink_t sim;
+static std::vector<int16_t> capture(2 * CAPTURE_FRAMES);
+
+/**
+ * Opens the test file at the start of its data, which is also read into data.
+ */
+static FILE* open_test_file(wav_header_t* header, std::vector<char>* data) {
+    FILE* f = fopen(TEST_FILE, "rb");
+    uint32_t data_offset;
+    CHECK_OK(wav_parse_header(f, header, &data_offset));
+    data->resize(header->data.chunk_size);
+    CHECK_EQ(fread(data->data(), 1, data->size(), f), data->size());
+    fseek(f, data_offset, SEEK_SET);
+    return f;
+}
+
+static uint32_t first_audible(const int16_t* frames, uint32_t nr_frames) {
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        if (frames[2 * i] != 0 || frames[2 * i + 1] != 0) {
+            return i;
+        }
+    }
+    return nr_frames;
+}
+
+/**
+ * True if the capture holds data as it is, lined up by the first audible frame of each.
+ */
+static bool played_exactly(const std::vector<char>& data) {
+    const uint32_t nr_frames = data.size() / 4;
+    const uint32_t lead = first_audible((const int16_t*) data.data(), nr_frames);
+    const uint32_t start = first_audible(capture.data(), sim.nr_captured) - lead;
+    return start % FRAMES_PER_BUF == 0 && start + nr_frames <= sim.nr_captured
+           && memcmp(&capture[2 * start], data.data(), data.size()) == 0;
+}
+
+static void test_plays_bit_for_bit_in_real_time() {
+    wav_header_t header;
+    std::vector<char> data;
+    FILE* f = open_test_file(&header, &data);
+    sim_sink_start(&sim, SAMPLE_RATE);
+
+    pipeline_stats_t stats;
+    CHECK_OK(pipeline_play(f, &header, &stats));
+    fclose(f);
+    sim_sink_drain(&sim);
+
+    CHECK_EQ(stats.nr_bytes_read, data.size());
+    CHECK_EQ(stats.nr_bytes_written, data.size());
+    CHECK_EQ(stats.underruns, 0);
+    CHECK(stats.high_water > 1);                 // The reader got ahead of the writer
+    CHECK(stats.high_water <= DMA_BUF_COUNT);
+
+    // The writer returns once the last block is queued, up to a ring ahead of the DMA.
+    const int64_t duration_us = (int64_t) data.size() / 4 * 1000000 / SAMPLE_RATE;
+    CHECK(stats.elapsed_us >= duration_us - RING_US - 10000);
+    CHECK(stats.elapsed_us < duration_us + 100000);
+
+    CHECK(played_exactly(data));
+    CHECK_EQ(sim.stats.nr_gaps, 0);
+    printf("%u bytes in %lld ms, high water %u of %u blocks\n", stats.nr_bytes_written,
+           (long long) stats.elapsed_us / 1000, stats.high_water, DMA_BUF_COUNT);
+}
+
+static void test_rides_out_stalls_shorter_than_the_ring() {
+    wav_header_t header;
+    std::vector<char> data;
+    file_source_t file;
+    file_source_wrap(&file, open_test_file(&header, &data));
+    // Every 4 blocks, 256ms of output, the source stops for 150ms. A reader on the writer's task would leave gaps.
+    stalling_source_t stalling;
+    stalling_source_init(&stalling, &file.source, 8 * DMA_BUF_BYTES, 4 * DMA_BUF_BYTES, 150);
+    sim_sink_start(&sim, SAMPLE_RATE);
+
+    pipeline_stats_t stats;
+    CHECK_OK(pipeline_play_source(&stalling.source, &header, &stats));
+    fclose(file.f);
+    sim_sink_drain(&sim);
+
+    CHECK(stalling.nr_stalls >= 3);
+    CHECK_EQ(stats.nr_bytes_written, data.size());
+    CHECK_EQ(stats.underruns, 0);
+    CHECK_EQ(sim.stats.nr_gaps, 0);
+    CHECK(played_exactly(data));
+}
+
+static void test_counts_underruns_on_a_stall_longer_than_the_ring() {
+    wav_header_t header;
+    std::vector<char> data;
+    file_source_t file;
+    file_source_wrap(&file, open_test_file(&header, &data));
+    stalling_source_t stalling;
+    stalling_source_init(&stalling, &file.source, 10 * DMA_BUF_BYTES, 0, BUFFERED_US / 1000 + 300);
+    sim_sink_start(&sim, SAMPLE_RATE);
+
+    pipeline_stats_t stats;
+    CHECK_OK(pipeline_play_source(&stalling.source, &header, &stats));
+    fclose(file.f);
+    sim_sink_drain(&sim);
+
+    CHECK_EQ(stalling.nr_stalls, 1);
+    CHECK_EQ(stats.nr_bytes_written, data.size());      // Late, but all of it
+    CHECK(stats.underruns >= 1);                        // More if the writer catches the reader up again after it
+    CHECK(sim.stats.nr_gaps >= 1);                      // And the listener heard it
+}
+
+typedef struct {
+    pipe_source_t pipe;
+    FILE* f;
+    SemaphoreHandle_t done;
+} pipe_feed_t;
+
+/**
+ * Copies the file into the pipe a chunk at a time, a little faster than it plays, as a UART might deliver it.
+ */
+static void pipe_feeder(void* arg) {
+    pipe_feed_t* feed = (pipe_feed_t*) arg;
+    char chunk[PIPE_FEED_CHUNK];
+    size_t nr_bytes_read;
+    while ((nr_bytes_read = fread(chunk, 1, sizeof(chunk), feed->f)) > 0) {
+        pipe_source_write(&feed->pipe, chunk, nr_bytes_read);
+        vTaskDelay(PIPE_FEED_MS / portTICK_PERIOD_MS);
+    }
+    pipe_source_close_write(&feed->pipe);
+    xSemaphoreGive(feed->done);
+    vTaskDelete(nullptr);
+}
+
+static void test_plays_from_a_pipe_in_real_time() {
+    wav_header_t header;
+    std::vector<char> data;
+    fclose(open_test_file(&header, &data));
+    pipe_feed_t feed;
+    feed.f = fopen(TEST_FILE, "rb");
+    feed.done = xSemaphoreCreateBinary();
+    CHECK_OK(pipe_source_init(&feed.pipe, DMA_BUF_BYTES * DMA_BUF_COUNT));     // Sized to the DMA ring, as app_main
+    CHECK(xTaskCreate(pipe_feeder, "pipe_feeder", 4096, &feed, 3, nullptr) == pdPASS);
+    sim_sink_start(&sim, SAMPLE_RATE);
+
+    // The header comes down the pipe too.
+    wav_header_t piped_header;
+    uint32_t data_offset;
+    CHECK_OK(wav_parse_source_header(&feed.pipe.source, &piped_header, &data_offset));
+    CHECK_EQ(piped_header.data.chunk_size, data.size());
+    pipeline_stats_t stats;
+    CHECK_OK(pipeline_play_source(&feed.pipe.source, &piped_header, &stats));
+    sim_sink_drain(&sim);
+
+    char discard[PIPE_FEED_CHUNK];
+    while (audio_source_read_fully(&feed.pipe.source, discard, sizeof(discard)) > 0) {
+    }
+    CHECK(xSemaphoreTake(feed.done, portMAX_DELAY) == pdTRUE);
+    vSemaphoreDelete(feed.done);
+    pipe_source_free(&feed.pipe);
+    fclose(feed.f);
+
+    CHECK_EQ(stats.nr_bytes_read, data.size());
+    CHECK_EQ(stats.nr_bytes_written, data.size());
+    // The writer can catch up with a source that only just keeps ahead, but the DMA ring never runs dry.
+    CHECK_EQ(sim.stats.nr_gaps, 0);
+    CHECK(played_exactly(data));
+}
+
+int main() {
+    host_test_init();
+    if (chdir(HOST_SPIFFS_DATA) != 0) {
+        printf("Cannot open %s\n", HOST_SPIFFS_DATA);
+        return 1;
+    }
+    // No ramps, so the output is the data itself.
+    const pcm_ramp_config_t no_ramps = {0, 0, 0};
+    pcm_ramp_set_config(&no_ramps);
+    CHECK_OK(audio_pool_init(PIPELINE_MAX_BLOCKS + 2));     // As app_main
+    CHECK_OK(sim_sink_init(&sim, DMA_BUF_BYTES, DMA_BUF_COUNT));
+    sim_sink_capture(&sim, capture.data(), CAPTURE_FRAMES);
+    sim_sink_start(&sim, SAMPLE_RATE);      // The pipeline takes the sink's rate when it starts
+    CHECK_OK(pipeline_init(&sim.sink));
+
+    RUN_TEST(test_plays_bit_for_bit_in_real_time);
+    RUN_TEST(test_plays_from_a_pipe_in_real_time);
+    RUN_TEST(test_rides_out_stalls_shorter_than_the_ring);
+    RUN_TEST(test_counts_underruns_on_a_stall_longer_than_the_ring);
+    return host_test_result();
+}
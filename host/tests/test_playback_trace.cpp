@@ -0,0 +1,231 @@
+// Playback tracing, built with PLAYBACK_TRACE on: a traced sink must record every write with how long it blocked, the
+// DMA fill estimate and the heap in use, note when the ring ran dry, and keep the counters in step. Records made by
+// several tasks at once must read back whole and in order, however many were overwritten before the reader got to them.
+
+#include "host_test.h"
+#include "host_shim.h"
+#include "playback_trace.h"
+#include "sim_sink.h"
+
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#define DMA_BUF_BYTES           4096    // As i2s_config in main.cpp
+#define DMA_BUF_COUNT           8
+#define SAMPLE_RATE             16000
+#define PERIOD_US               ((int64_t) DMA_BUF_BYTES / 4 * 1000000 / SAMPLE_RATE)
+#define NR_WRITES               (DMA_BUF_COUNT + 4)     // Past the ring, so every write waits on the DMA
+#define HELD_BYTES              10000   // Allocated while the writes are traced
+#define DRY_MS                  1000    // Pause long enough for the ring to run dry
+#define NR_PRODUCERS            4
+#define PRODUCER_RECORDS        20000   // Each, many times the ring
+#define READ_BATCH              64
+
+static_assert(PLAYBACK_TRACE_ENABLED, "test_playback_trace must be built with PLAYBACK_TRACE_ENABLED");
+
+static sim_sink_t sim;
+
+/**
+ * Everything recorded since *cursor.
+ */
+static std::vector<trace_record_t> read_all(uint32_t* cursor) {
+    std::vector<trace_record_t> records;
+    trace_record_t batch[READ_BATCH];
+    uint32_t nr_records;
+    while ((nr_records = trace_read(batch, READ_BATCH, cursor)) > 0) {
+        records.insert(records.end(), batch, batch + nr_records);
+    }
+    return records;
+}
+
+static void test_records_sink_writes() {
+    uint32_t cursor = 0;
+    read_all(&cursor);
+    trace_counters_t before, after;
+    trace_get_counters(&before);
+    void* held = heap_caps_malloc(HELD_BYTES, MALLOC_CAP_8BIT);
+    const size_t heap = host_heap_used();
+
+    sim_sink_start(&sim, SAMPLE_RATE);
+    const pcm_sink_t* sink = trace_sink(&sim.sink);
+    const std::vector<char> block(DMA_BUF_BYTES, 1);
+    size_t nr_bytes_written;
+    for (int i = 0; i < NR_WRITES; i++) {
+        CHECK_OK(sink->write(sink->ctx, block.data(), block.size(), &nr_bytes_written));
+    }
+
+    // The DMA starts out sending silence, so each write waits for one descriptor, exactly a period on this clock.
+    std::vector<trace_record_t> records = read_all(&cursor);
+    CHECK_EQ(records.size(), NR_WRITES);
+    for (uint32_t i = 0; i < records.size(); i++) {
+        const trace_record_t& record = records[i];
+        CHECK_EQ(record.event, TRACE_WRITE);
+        CHECK_EQ(record.sequence, records[0].sequence + i);
+        CHECK_EQ(record.nr_bytes, DMA_BUF_BYTES);
+        CHECK_EQ(record.duration_us, PERIOD_US);
+        CHECK_EQ(record.heap_used, heap);
+        CHECK(record.dma_fill > 0 && record.dma_fill <= DMA_BUF_BYTES * DMA_BUF_COUNT);
+    }
+
+    // Left alone the estimate drains, and the next write finds the ring ran dry once the last data had gone out.
+    const uint32_t fill = records.back().dma_fill;
+    const int64_t last_write_us = esp_timer_get_time();
+    vTaskDelay(DRY_MS / portTICK_PERIOD_MS);
+    CHECK_OK(sink->write(sink->ctx, block.data(), block.size(), &nr_bytes_written));
+    records = read_all(&cursor);
+    CHECK_EQ(records.size(), 2);
+    if (records.size() == 2) {
+        CHECK_EQ(records[0].event, TRACE_DMA_DRY);
+        const int64_t dry_us = last_write_us + (int64_t) fill * 1000000 / (SAMPLE_RATE * 4);
+        CHECK_EQ(records[0].duration_us, last_write_us + DRY_MS * 1000 - dry_us);
+        CHECK_EQ(records[1].event, TRACE_WRITE);
+        CHECK_EQ(records[1].dma_fill, DMA_BUF_BYTES);
+    }
+
+    trace_get_counters(&after);
+    CHECK_EQ(after.count[TRACE_WRITE] - before.count[TRACE_WRITE], NR_WRITES + 1);
+    CHECK_EQ(after.nr_bytes[TRACE_WRITE] - before.nr_bytes[TRACE_WRITE], (NR_WRITES + 1) * DMA_BUF_BYTES);
+    CHECK_EQ(after.count[TRACE_DMA_DRY] - before.count[TRACE_DMA_DRY], 1);
+    CHECK(after.max_us[TRACE_WRITE] >= PERIOD_US);
+    CHECK(after.max_heap_used >= heap);
+    heap_caps_free(held);
+
+    // The dump is the records as CSV, then the counters.
+    FILE* out = tmpfile();
+    trace_dump(out);
+    rewind(out);
+    char line[128];
+    CHECK(fgets(line, sizeof(line), out) != nullptr);
+    CHECK(strcmp(line, "sequence,event,timestamp_us,duration_us,nr_bytes,dma_fill,heap_used\n") == 0);
+    uint32_t nr_writes = 0;
+    bool have_heap = false;
+    while (fgets(line, sizeof(line), out) != nullptr) {
+        nr_writes += strstr(line, ",write,") != nullptr;
+        have_heap = have_heap || strncmp(line, "# max_heap_used=", 16) == 0;
+    }
+    CHECK_EQ(nr_writes, NR_WRITES + 1);
+    CHECK(have_heap);
+    fclose(out);
+}
+
+static void test_skips_overwritten_records() {
+    uint32_t cursor = 0;
+    read_all(&cursor);
+    const uint32_t first_sequence = cursor;
+    for (uint32_t i = 0; i < 3 * TRACE_RING_SIZE + 5; i++) {
+        TRACE_START(start_us);
+        TRACE(TRACE_READ, start_us, i);
+    }
+
+    // A reader that fell behind gets the last ring full, whole and in order, and its cursor jumps the rest.
+    const std::vector<trace_record_t> records = read_all(&cursor);
+    CHECK_EQ(records.size(), TRACE_RING_SIZE);
+    CHECK_EQ(cursor - first_sequence, 3 * TRACE_RING_SIZE + 5);
+    for (uint32_t i = 0; i < records.size(); i++) {
+        CHECK_EQ(records[i].sequence, cursor - TRACE_RING_SIZE + i);
+        CHECK_EQ(records[i].nr_bytes, 2 * TRACE_RING_SIZE + 5 + i);
+        CHECK_EQ(records[i].event, TRACE_READ);
+    }
+    CHECK_EQ(trace_read(nullptr, 0, &cursor), 0);
+}
+
+static SemaphoreHandle_t producers_done;
+static std::atomic<int> nr_producing(0);
+
+/**
+ * Records PRODUCER_RECORDS events, each saying which producer made it and which of its records it is in nr_bytes.
+ */
+static void producer_task(void* arg) {
+    const uint32_t producer = (uint32_t) (uintptr_t) arg;
+    for (uint32_t i = 0; i < PRODUCER_RECORDS; i++) {
+        TRACE_START(start_us);
+        TRACE((trace_event_t) (producer % TRACE_NR_EVENTS), start_us, (producer << 24) | i);
+    }
+    nr_producing--;
+    xSemaphoreGive(producers_done);
+    vTaskDelete(nullptr);
+}
+
+static void test_reads_whole_records_while_tasks_record() {
+    uint32_t cursor = 0;
+    read_all(&cursor);
+    const uint32_t first_sequence = cursor;
+    trace_counters_t before, after;
+    trace_get_counters(&before);
+
+    producers_done = xSemaphoreCreateCounting(NR_PRODUCERS, 0);
+    nr_producing = NR_PRODUCERS;
+    for (uint32_t i = 0; i < NR_PRODUCERS; i++) {
+        CHECK(xTaskCreate(producer_task, "producer", 4096, (void*) (uintptr_t) i, 5, nullptr) == pdPASS);
+    }
+
+    // Read as they go. A record read torn would pair one producer's index with another's event.
+    uint32_t nr_read = 0;
+    uint32_t nr_torn = 0;
+    uint32_t nr_out_of_order = 0;
+    int64_t last_sequence = (int64_t) first_sequence - 1;
+    int64_t last_index[NR_PRODUCERS];
+    for (int64_t& index : last_index) {
+        index = -1;
+    }
+    trace_record_t batch[READ_BATCH];
+    bool producing = true;
+    while (producing) {
+        producing = nr_producing > 0;   // Once they are done, one more read picks up the rest
+        uint32_t nr_records;
+        while ((nr_records = trace_read(batch, READ_BATCH, &cursor)) > 0) {
+            for (uint32_t i = 0; i < nr_records; i++) {
+                const trace_record_t& record = batch[i];
+                const uint32_t producer = record.nr_bytes >> 24;
+                const int64_t index = record.nr_bytes & 0xffffff;
+                if (producer >= NR_PRODUCERS || record.event != producer % TRACE_NR_EVENTS) {
+                    nr_torn++;
+                    continue;
+                }
+                if ((int64_t) record.sequence <= last_sequence || index <= last_index[producer]) {
+                    nr_out_of_order++;
+                }
+                last_sequence = record.sequence;
+                last_index[producer] = index;
+                nr_read++;
+            }
+        }
+    }
+    for (int i = 0; i < NR_PRODUCERS; i++) {
+        CHECK(xSemaphoreTake(producers_done, portMAX_DELAY) == pdTRUE);
+    }
+    vSemaphoreDelete(producers_done);
+
+    printf("%u of %u records read, the rest overwritten first\n", nr_read, NR_PRODUCERS * PRODUCER_RECORDS);
+    CHECK_EQ(nr_torn, 0);
+    CHECK_EQ(nr_out_of_order, 0);
+    CHECK(nr_read >= TRACE_RING_SIZE);          // At least the last ring full
+    CHECK(nr_read <= NR_PRODUCERS * PRODUCER_RECORDS);
+    CHECK_EQ(cursor - first_sequence, NR_PRODUCERS * PRODUCER_RECORDS);
+
+    trace_get_counters(&after);
+    uint32_t nr_counted = 0;
+    for (int i = 0; i < TRACE_NR_EVENTS; i++) {
+        nr_counted += after.count[i] - before.count[i];
+    }
+    CHECK_EQ(nr_counted, NR_PRODUCERS * PRODUCER_RECORDS);
+}
+
+int main() {
+    host_test_init();
+    host_clock_simulate();  // The DMA and the traced times on one clock, so the waits come out exact
+    CHECK_OK(sim_sink_init(&sim, DMA_BUF_BYTES, DMA_BUF_COUNT));
+    sim.wait_until = host_clock_wait_until;
+
+    RUN_TEST(test_records_sink_writes);
+    RUN_TEST(test_skips_overwritten_records);
+    RUN_TEST(test_reads_whole_records_while_tasks_record);
+    sim_sink_free(&sim);
+    return host_test_result();
+}
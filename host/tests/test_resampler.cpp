@@ -0,0 +1,224 @@
+// The fixed point polyphase resampler against a double precision windowed-sinc reference evaluated at the exact
+// position of every output frame, and against the tones it is fed: from every supported rate the error has to stay
+// far below 16 bit hearing, streams must come out the same however they are cut up and never drift.
+
+#include "host_test.h"
+#include "resampler.h"
+
+#include <cmath>
+#include <vector>
+
+#define OUTPUT_RATE             44100   // As i2s_config in main.cpp
+#define TEST_SECONDS            1
+#define DELAY_FRAMES            (RESAMPLER_TAPS / 2)    // Input frames the filter delays the output by
+#define MIN_REFERENCE_SNR_DB    66.0    // Q15 taps and phases interpolated from a table of 32, against exact ones
+#define MIN_TONE_SNR_DB         70.0
+#define AMPLITUDE               9000.0  // Per tone, three of them stay clear of the int16 limits
+#define CHUNK_FRAMES            97      // Odd, so chunks end at every phase
+
+static const uint32_t in_rates[] = {8000, 11025, 16000, 22050, 32000, 44100, 48000};
+
+static double blackman(double x) {
+    return 0.42 + 0.5 * cos(2 * M_PI * x / RESAMPLER_TAPS) + 0.08 * cos(4 * M_PI * x / RESAMPLER_TAPS);
+}
+
+static double sinc(double x) {
+    return x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+}
+
+/**
+ * Frequencies in the flat part of the pass band of both filters, the highest just short of where the window rolls
+ * it off.
+ */
+static void test_tones(uint32_t in_rate, double* tones) {
+    const double top = in_rate < OUTPUT_RATE ? in_rate / 2.0 : OUTPUT_RATE / 2.0;
+    tones[0] = 440.0;
+    tones[1] = 0.37 * top;
+    tones[2] = 0.6 * top;
+}
+
+static double tone_sum(const double* tones, double t) {
+    return AMPLITUDE * (sin(2 * M_PI * tones[0] * t) + sin(2 * M_PI * tones[1] * t + 1.0)
+                        + sin(2 * M_PI * tones[2] * t + 2.0));
+}
+
+/**
+ * nr_frames of the tones at in_rate, left as they are and right inverted.
+ */
+static std::vector<int16_t> make_input(uint32_t in_rate, uint32_t nr_frames) {
+    double tones[3];
+    test_tones(in_rate, tones);
+    std::vector<int16_t> in(2 * nr_frames);
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        const double v = tone_sum(tones, (double) i / in_rate);
+        in[2 * i] = (int16_t) lrint(v);
+        in[2 * i + 1] = (int16_t) lrint(-v);
+    }
+    return in;
+}
+
+/**
+ * The same filter as resampler.cpp, in double precision at exactly the position of each output frame: output k is
+ * the input at k * in_rate / out_rate - DELAY_FRAMES, the frames before the stream silent. One channel.
+ */
+static std::vector<double> reference(const std::vector<int16_t>& in, uint32_t channel, uint32_t in_rate,
+                                     uint32_t out_rate, uint32_t nr_out_frames) {
+    const double cutoff = in_rate > out_rate ? 0.9 * 44100.0 / 48000.0 : 0.9;
+    std::vector<double> out(nr_out_frames);
+    for (uint32_t k = 0; k < nr_out_frames; k++) {
+        const double centre = (double) k * in_rate / out_rate - DELAY_FRAMES;
+        const int64_t newest = (int64_t) ((uint64_t) k * in_rate / out_rate);
+        double sum = 0, weights = 0;
+        for (int64_t j = newest - RESAMPLER_TAPS + 1; j <= newest; j++) {
+            const double x = j - centre;
+            const double weight = cutoff * sinc(cutoff * x) * blackman(x);
+            weights += weight;
+            if (j >= 0 && j < (int64_t) in.size() / 2) {
+                sum += in[2 * j + channel] * weight;
+            }
+        }
+        out[k] = sum / weights;
+    }
+    return out;
+}
+
+static double snr_db(const std::vector<double>& expected, const std::vector<int16_t>& actual, uint32_t channel,
+                     uint32_t from, uint32_t to) {
+    double signal = 0, noise = 0;
+    for (uint32_t k = from; k < to; k++) {
+        const double error = actual[2 * k + channel] - expected[k];
+        signal += expected[k] * expected[k];
+        noise += error * error;
+    }
+    return 10 * log10(signal / (noise > 0 ? noise : 1e-9));
+}
+
+/**
+ * The whole of in through one resampler, in a single call.
+ */
+static std::vector<int16_t> resample(const std::vector<int16_t>& in, uint32_t in_rate, uint32_t out_rate) {
+    resampler_t resampler;
+    resampler_init(&resampler, in_rate, out_rate);
+    const uint32_t nr_in_frames = in.size() / 2;
+    std::vector<int16_t> out(2 * resampler_output_frames(&resampler, nr_in_frames) + 2);
+    uint32_t nr_in_used;
+    const uint32_t nr_out = resampler_process(&resampler, in.data(), nr_in_frames, out.data(), out.size() / 2,
+                                              &nr_in_used);
+    CHECK_EQ(nr_in_used, nr_in_frames);
+    CHECK_EQ(nr_out, resampler_output_frames(&resampler, nr_in_frames));
+    out.resize(2 * nr_out);
+    return out;
+}
+
+static void test_matches_the_reference() {
+    for (uint32_t in_rate : in_rates) {
+        const std::vector<int16_t> in = make_input(in_rate, in_rate * TEST_SECONDS);
+        const std::vector<int16_t> out = resample(in, in_rate, OUTPUT_RATE);
+        for (uint32_t channel = 0; channel < 2; channel++) {
+            const std::vector<double> expected = reference(in, channel, in_rate, OUTPUT_RATE, out.size() / 2);
+            const double snr = snr_db(expected, out, channel, 0, out.size() / 2);
+            if (snr < MIN_REFERENCE_SNR_DB) {
+                printf("%d to %d: %.1fdB against the reference\n", in_rate, OUTPUT_RATE, snr);
+            }
+            CHECK(snr >= MIN_REFERENCE_SNR_DB);
+        }
+    }
+}
+
+static void test_reproduces_the_tones() {
+    for (uint32_t in_rate : in_rates) {
+        const std::vector<int16_t> in = make_input(in_rate, in_rate * TEST_SECONDS);
+        const std::vector<int16_t> out = resample(in, in_rate, OUTPUT_RATE);
+        double tones[3];
+        test_tones(in_rate, tones);
+        std::vector<double> expected(out.size() / 2);
+        for (uint32_t k = 0; k < expected.size(); k++) {
+            expected[k] = tone_sum(tones, ((double) k * in_rate / OUTPUT_RATE - DELAY_FRAMES) / in_rate);
+        }
+        // Past the filter filling up at the start, and short of the frames still in it at the end.
+        const uint32_t margin = RESAMPLER_TAPS * OUTPUT_RATE / in_rate + 1;
+        const double snr = snr_db(expected, out, 0, margin, expected.size() - margin);
+        if (snr < MIN_TONE_SNR_DB) {
+            printf("%d to %d: %.1fdB against the tones\n", in_rate, OUTPUT_RATE, snr);
+        }
+        CHECK(snr >= MIN_TONE_SNR_DB);
+    }
+}
+
+static void test_chunks_do_not_change_the_output() {
+    for (uint32_t in_rate : in_rates) {
+        const std::vector<int16_t> in = make_input(in_rate, in_rate / 4);
+        const std::vector<int16_t> whole = resample(in, in_rate, OUTPUT_RATE);
+
+        // Output a block at a time, as the mixer asks for it, with the input it says it needs handed over in chunks.
+        resampler_t resampler;
+        resampler_init(&resampler, in_rate, OUTPUT_RATE);
+        std::vector<int16_t> out(whole.size());
+        uint32_t nr_in = 0, nr_out = 0;
+        const uint32_t nr_in_frames = in.size() / 2;
+        while (nr_in < nr_in_frames) {
+            const uint32_t want = CHUNK_FRAMES + nr_out % 13;
+            uint32_t needed = resampler_input_frames(&resampler, want);
+            const bool last = nr_in + needed >= nr_in_frames;
+            needed = last ? nr_in_frames - nr_in : needed;
+            uint32_t nr_in_used;
+            const uint32_t nr_written = resampler_process(&resampler, &in[2 * nr_in], needed, &out[2 * nr_out], want,
+                                                          &nr_in_used);
+            CHECK_EQ(nr_in_used, needed);
+            if (!last) {
+                CHECK_EQ(nr_written, want);
+            }
+            nr_in += nr_in_used;
+            nr_out += nr_written;
+            if (nr_in_used == 0 && nr_written == 0) {
+                break;
+            }
+        }
+        CHECK_EQ(nr_out, whole.size() / 2);
+        CHECK(out == whole);
+    }
+}
+
+static void test_holds_dc_at_every_phase() {
+    for (uint32_t in_rate : in_rates) {
+        const std::vector<int16_t> in(2 * in_rate / 10, 10000);
+        const std::vector<int16_t> out = resample(in, in_rate, OUTPUT_RATE);
+        const uint32_t settled = RESAMPLER_TAPS * OUTPUT_RATE / in_rate + 1;
+        int16_t low = INT16_MAX, high = INT16_MIN;
+        for (uint32_t k = settled; k < out.size() / 2; k++) {
+            low = out[2 * k] < low ? out[2 * k] : low;
+            high = out[2 * k] > high ? out[2 * k] : high;
+        }
+        CHECK(low >= 9998 && high <= 10002);
+    }
+}
+
+static void test_never_drifts() {
+    // An hour at 11025 to 44100 is exactly four times as many frames, and 48000 to 44100 exactly 147 / 160 of them.
+    resampler_t resampler;
+    resampler_init(&resampler, 11025, OUTPUT_RATE);
+    CHECK_EQ(resampler_output_frames(&resampler, 11025 * 3600), (uint32_t) OUTPUT_RATE * 3600);
+    resampler_init(&resampler, 48000, OUTPUT_RATE);
+    CHECK_EQ(resampler_output_frames(&resampler, 48000 * 3600), (uint32_t) OUTPUT_RATE * 3600);
+
+    // Fed a minute in blocks, the phase comes back to where it started.
+    std::vector<int16_t> in(2 * 48000, 0);
+    std::vector<int16_t> out(2 * OUTPUT_RATE + 2);
+    uint32_t nr_out = 0;
+    for (int second = 0; second < 60; second++) {
+        uint32_t nr_in_used;
+        nr_out += resampler_process(&resampler, in.data(), 48000, out.data(), out.size() / 2, &nr_in_used);
+        CHECK_EQ(nr_in_used, 48000);
+    }
+    CHECK_EQ(nr_out, OUTPUT_RATE * 60);
+}
+
+int main() {
+    host_test_init();
+    RUN_TEST(test_matches_the_reference);
+    RUN_TEST(test_reproduces_the_tones);
+    RUN_TEST(test_chunks_do_not_change_the_output);
+    RUN_TEST(test_holds_dc_at_every_phase);
+    RUN_TEST(test_never_drifts);
+    return host_test_result();
+}
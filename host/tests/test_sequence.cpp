@@ -0,0 +1,220 @@
+// Sequences on the simulated DMA ring: clips loaded through the clip cache while the one before plays must come out
+// back to back, apart by exactly their gap, or crossfaded over exactly their overlap, with every seam on its frame.
+
+#include "host_test.h"
+#include "audio_pool.h"
+#include "clip_cache.h"
+#include "mixer.h"
+#include "pcm_ramp.h"
+#include "sequence.h"
+#include "sim_sink.h"
+#include "wav_player.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define DMA_BUF_BYTES           4096    // As i2s_config in main.cpp
+#define DMA_BUF_COUNT           8
+#define SAMPLE_RATE             16000   // Of the sink and the test clips, so nothing is resampled
+#define CAPTURE_FRAMES          (SAMPLE_RATE * 4)
+#define CACHE_BUDGET            (64 * 1024)
+#define NR_CLIPS                3
+
+// Odd lengths, so the seams fall part way into blocks.
+static const uint32_t clip_frames[NR_CLIPS] = {1501, 777, 3001};
+static const char* const clip_names[NR_CLIPS] = {"a.wav", "b.wav", "c.wav"};
+
+static sim_sink_t sim;
+static std::vector<int16_t> capture(2 * CAPTURE_FRAMES);
+static std::vector<int16_t> clips[NR_CLIPS];
+
+/**
+ * 16 bit stereo at SAMPLE_RATE, never zero, so there is no silence for the cache to trim or index.
+ */
+static void write_clip(const char* path, const std::vector<int16_t>& samples) {
+    FILE* f = fopen(path, "wb");
+    const uint32_t data_size = samples.size() * 2;
+    const uint32_t riff_size = 4 + 24 + 8 + data_size;
+    const uint32_t fmt_size = 16;
+    const uint16_t format_id = WAV_FORMAT_PCM;
+    const uint16_t num_channels = 2;
+    const uint32_t sample_rate = SAMPLE_RATE;
+    const uint32_t byte_rate = SAMPLE_RATE * 4;
+    const uint16_t block_align = 4;
+    const uint16_t bits_per_sample = 16;
+    fwrite("RIFF", 1, 4, f);
+    fwrite(&riff_size, 4, 1, f);
+    fwrite("WAVEfmt ", 1, 8, f);
+    fwrite(&fmt_size, 4, 1, f);
+    fwrite(&format_id, 2, 1, f);
+    fwrite(&num_channels, 2, 1, f);
+    fwrite(&sample_rate, 4, 1, f);
+    fwrite(&byte_rate, 4, 1, f);
+    fwrite(&block_align, 2, 1, f);
+    fwrite(&bits_per_sample, 2, 1, f);
+    fwrite("data", 1, 4, f);
+    fwrite(&data_size, 4, 1, f);
+    fwrite(samples.data(), 2, samples.size(), f);
+    fclose(f);
+}
+
+static uint32_t first_audible(const int16_t* frames, uint32_t nr_frames) {
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        if (frames[2 * i] != 0 || frames[2 * i + 1] != 0) {
+            return i;
+        }
+    }
+    return nr_frames;
+}
+
+/**
+ * What the sequence must sound like: each clip at its frame, ramped over its overlaps with its neighbours as the
+ * mixer ramps it, summed and saturated.
+ */
+static std::vector<int16_t> expected_output(const sequence_item_t* items, const uint32_t* clip_ids, uint32_t nr_items) {
+    std::vector<int32_t> sum;
+    uint32_t start = 0;
+    for (uint32_t i = 0; i < nr_items; i++) {
+        const std::vector<int16_t>& clip = clips[clip_ids[i]];
+        const uint32_t nr_frames = clip.size() / 2;
+        if (i > 0) {
+            start += clips[clip_ids[i - 1]].size() / 2 + items[i].offset_frames;
+        }
+        const uint32_t fade_in = i > 0 && items[i].offset_frames < 0 ? -items[i].offset_frames : 0;
+        const uint32_t fade_out = i + 1 < nr_items && items[i + 1].offset_frames < 0 ? -items[i + 1].offset_frames : 0;
+        std::vector<int16_t> ramped = clip;
+        pcm_ramp_envelope(ramped.data(), nr_frames, 0, nr_frames, fade_in, fade_out);
+        if (sum.size() < 2 * (start + nr_frames)) {
+            sum.resize(2 * (start + nr_frames), 0);
+        }
+        for (uint32_t j = 0; j < ramped.size(); j++) {
+            sum[2 * start + j] += ramped[j];
+        }
+    }
+    std::vector<int16_t> out(sum.size());
+    for (size_t i = 0; i < sum.size(); i++) {
+        out[i] = (int16_t) (sum[i] > INT16_MAX ? INT16_MAX : sum[i] < INT16_MIN ? INT16_MIN : sum[i]);
+    }
+    return out;
+}
+
+/**
+ * Plays the clips with the offsets given and checks the sink got exactly the expected output, and silence after.
+ */
+static void check_sequence(const uint32_t* clip_ids, const int32_t* offsets, uint32_t nr_items) {
+    std::vector<sequence_item_t> items(nr_items);
+    for (uint32_t i = 0; i < nr_items; i++) {
+        items[i].filename = clip_names[clip_ids[i]];
+        items[i].offset_frames = offsets[i];
+    }
+    const std::vector<int16_t> expected = expected_output(items.data(), clip_ids, nr_items);
+    const uint32_t nr_frames = expected.size() / 2;
+
+    sim_sink_start(&sim, SAMPLE_RATE);
+    sequence_stats_t stats;
+    CHECK_OK(sequence_play(items.data(), nr_items, MIXER_GAIN_UNITY, &stats));
+    while (mixer_active_voices() > 0) {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    sim_sink_drain(&sim);
+    CHECK_EQ(stats.nr_clips, nr_items);
+    CHECK_EQ(stats.nr_frames, nr_frames);
+    CHECK_EQ(stats.late_starts, 0);
+    CHECK_EQ(sim.stats.nr_gaps, 0);
+
+    const uint32_t start = first_audible(capture.data(), sim.nr_captured);
+    CHECK(start + nr_frames <= sim.nr_captured);
+    if (start + nr_frames > sim.nr_captured) {
+        return;
+    }
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        if (capture[2 * (start + i)] != expected[2 * i] || capture[2 * (start + i) + 1] != expected[2 * i + 1]) {
+            printf("Differs at frame %d of %d, %d not %d\n", i, nr_frames, capture[2 * (start + i)], expected[2 * i]);
+            CHECK(false);
+            break;
+        }
+    }
+    CHECK_EQ(first_audible(&capture[2 * (start + nr_frames)], sim.nr_captured - start - nr_frames),
+             sim.nr_captured - start - nr_frames);
+}
+
+static void test_clips_back_to_back() {
+    const uint32_t clip_ids[] = {0, 1, 2, 1};
+    const int32_t offsets[] = {0, 0, 0, 0};
+    check_sequence(clip_ids, offsets, 4);
+}
+
+static void test_gaps_exact_to_the_frame() {
+    const uint32_t clip_ids[] = {0, 1, 2};
+    const int32_t offsets[] = {0, 1, 1000};
+    check_sequence(clip_ids, offsets, 3);
+}
+
+static void test_crossfades_exact_to_the_frame() {
+    // An overlap inside a block, one across a block boundary, and a short clip inside a crossfade at each end. Each
+    // clip starts in a later block than the one two before it ends, see sequence_item_t.
+    const uint32_t clip_ids[] = {1, 2, 0, 2};
+    const int32_t offsets[] = {0, -100, -700, -300};
+    check_sequence(clip_ids, offsets, 4);
+}
+
+static void test_stops_at_a_missing_clip() {
+    const sequence_item_t items[] = {{clip_names[1], 0}, {"missing.wav", 0}, {clip_names[0], 0}};
+    sequence_stats_t stats;
+    sim_sink_start(&sim, SAMPLE_RATE);
+    CHECK_EQ(sequence_play(items, 3, MIXER_GAIN_UNITY, &stats), ESP_ERR_NOT_FOUND);
+    CHECK_EQ(stats.nr_clips, 1);
+    CHECK_EQ(stats.nr_frames, clip_frames[1]);
+    while (mixer_active_voices() > 0) {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    sim_sink_drain(&sim);
+}
+
+int main() {
+    host_test_init();
+    char dir_template[] = "/tmp/test_sequence_XXXXXX";
+    if (mkdtemp(dir_template) == nullptr || chdir(dir_template) != 0) {
+        printf("Cannot open %s\n", dir_template);
+        return 1;
+    }
+    // Each clip a different level with a ripple, one channel the negative of the other, loud enough that the
+    // crossfades would show any rounding.
+    for (uint32_t i = 0; i < NR_CLIPS; i++) {
+        clips[i].resize(2 * clip_frames[i]);
+        for (uint32_t j = 0; j < clip_frames[i]; j++) {
+            clips[i][2 * j] = (int16_t) (8000 * (i + 1) + (j * 37) % 1000 + 1);
+            clips[i][2 * j + 1] = (int16_t) -clips[i][2 * j];
+        }
+        write_clip(clip_names[i], clips[i]);
+    }
+
+    esp_log_level_set("sequence", ESP_LOG_ERROR);
+    esp_log_level_set("clip_cache", ESP_LOG_WARN);
+    esp_log_level_set("wav_file", ESP_LOG_NONE);       // The missing clip
+    // No ramps, so only the crossfades shape the output.
+    const pcm_ramp_config_t no_ramps = {0, 0, 0};
+    pcm_ramp_set_config(&no_ramps);
+    CHECK_OK(wav_player_init());
+    CHECK_OK(clip_cache_init(CACHE_BUDGET));
+    CHECK_OK(audio_pool_init(1));       // The mixer's output block
+    CHECK_OK(sim_sink_init(&sim, DMA_BUF_BYTES, DMA_BUF_COUNT));
+    sim_sink_capture(&sim, capture.data(), CAPTURE_FRAMES);
+    sim_sink_start(&sim, SAMPLE_RATE);
+    CHECK_OK(mixer_init(&sim.sink));
+
+    RUN_TEST(test_clips_back_to_back);
+    RUN_TEST(test_gaps_exact_to_the_frame);
+    RUN_TEST(test_crossfades_exact_to_the_frame);
+    RUN_TEST(test_stops_at_a_missing_clip);
+    for (const char* name : clip_names) {
+        unlink(name);
+    }
+    rmdir(dir_template);
+    return host_test_result();
+}
@@ -0,0 +1,124 @@
+// The simulated DMA ring the other tests and the benchmarks judge playback by: it must send exactly what was written,
+// in real time, and count the gaps and clicks a listener would hear.
+
+#include "host_test.h"
+#include "sim_sink.h"
+
+#include <esp_timer.h>
+#include <cmath>
+#include <vector>
+
+#define DMA_BUF_BYTES           4096    // As i2s_config in main.cpp
+#define DMA_BUF_COUNT           8
+#define SAMPLE_RATE             44100
+#define FRAMES_PER_BUF          (DMA_BUF_BYTES / 4)
+
+/**
+ * A quiet 440Hz tone, nr_frames of 16 bit stereo starting and ending near zero, no step anywhere near a click.
+ */
+static std::vector<int16_t> tone(uint32_t nr_frames) {
+    std::vector<int16_t> frames(2 * nr_frames);
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        const int16_t sample = (int16_t) lround(2000 * sin(2 * M_PI * 440 * i / SAMPLE_RATE));
+        frames[2 * i] = sample;
+        frames[2 * i + 1] = (int16_t) -sample;
+    }
+    frames[0] = frames[1] = 1;      // So the first frame is audible
+    return frames;
+}
+
+static uint32_t first_audible(const std::vector<int16_t>& capture, uint32_t nr_frames) {
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        if (capture[2 * i] != 0 || capture[2 * i + 1] != 0) {
+            return i;
+        }
+    }
+    return nr_frames;
+}
+
+static void test_output_is_exactly_what_was_written() {
+    sim_sink_t sim;
+    CHECK_OK(sim_sink_init(&sim, DMA_BUF_BYTES, DMA_BUF_COUNT));
+    std::vector<int16_t> capture(2 * FRAMES_PER_BUF * 40);
+    sim_sink_capture(&sim, capture.data(), capture.size() / 2);
+    sim_sink_start(&sim, SAMPLE_RATE);
+
+    // Not a whole number of descriptors, the last one goes out part written and zeroed after the data.
+    const uint32_t nr_frames = FRAMES_PER_BUF * 5 / 2 + 7;
+    const std::vector<int16_t> data = tone(nr_frames);
+    size_t nr_bytes_written;
+    CHECK_OK(sim.sink.write(sim.sink.ctx, (const char*) data.data(), data.size() * 2, &nr_bytes_written));
+    CHECK_EQ(nr_bytes_written, data.size() * 2);
+    sim_sink_drain(&sim);
+
+    const uint32_t start = first_audible(capture, sim.nr_captured);
+    CHECK(start % FRAMES_PER_BUF == 0);     // Data starts at a descriptor
+    CHECK(start + nr_frames <= sim.nr_captured);
+    bool same = true;
+    for (uint32_t i = 0; i < 2 * nr_frames && same; i++) {
+        same = capture[2 * start + i] == data[i];
+    }
+    CHECK(same);
+    bool silent_after = true;
+    for (uint32_t i = 2 * (start + nr_frames); i < 2 * sim.nr_captured; i++) {
+        silent_after = silent_after && capture[i] == 0;
+    }
+    CHECK(silent_after);
+    CHECK_EQ(sim.stats.nr_gaps, 0);
+    CHECK_EQ(sim.stats.nr_clicks, 0);
+    CHECK_EQ(sim.stats.nr_writes, 1);
+    sim_sink_free(&sim);
+}
+
+static void test_runs_in_real_time() {
+    sim_sink_t sim;
+    CHECK_OK(sim_sink_init(&sim, DMA_BUF_BYTES, DMA_BUF_COUNT));
+    sim_sink_start(&sim, SAMPLE_RATE);
+    const int64_t start_us = esp_timer_get_time();
+    sim_sink_drain(&sim);
+    const int64_t elapsed_us = esp_timer_get_time() - start_us;
+
+    // Draining sends the ring twice, 16 descriptors of 1024 frames.
+    const int64_t expected_us = (int64_t) sim.stats.nr_descriptors * FRAMES_PER_BUF * 1000000 / SAMPLE_RATE;
+    CHECK_EQ(sim.stats.nr_descriptors, 2 * DMA_BUF_COUNT);
+    CHECK(elapsed_us >= expected_us - 1000);
+    CHECK(elapsed_us < expected_us + 50000);
+    CHECK_EQ(sim.stats.first_audible_us, 0);
+    sim_sink_free(&sim);
+}
+
+static void test_counts_clicks_and_gaps() {
+    sim_sink_t sim;
+    CHECK_OK(sim_sink_init(&sim, DMA_BUF_BYTES, DMA_BUF_COUNT));
+    sim_sink_start(&sim, SAMPLE_RATE);
+
+    // A descriptor of full scale DC, one jump up at the start and one down after it.
+    std::vector<int16_t> loud(2 * FRAMES_PER_BUF, 20000);
+    size_t nr_bytes_written;
+    CHECK_OK(sim.sink.write(sim.sink.ctx, (const char*) loud.data(), DMA_BUF_BYTES, &nr_bytes_written));
+    CHECK_OK(sim.sink.wait_sent(sim.sink.ctx, DMA_BUF_COUNT + 2));
+    // The loud descriptor went out last but two, so at least two silent ones sit between it and the next write.
+    CHECK_OK(sim.sink.write(sim.sink.ctx, (const char*) loud.data(), DMA_BUF_BYTES, &nr_bytes_written));
+    sim_sink_drain(&sim);
+
+    CHECK_EQ(sim.stats.nr_clicks, 4 * 2);   // Up and down twice, on both channels
+    CHECK_EQ(sim.stats.max_step, 20000);
+    CHECK(sim.stats.nr_gaps >= 2);
+    CHECK(sim.stats.last_audible_us > sim.stats.first_audible_us);
+    sim_sink_free(&sim);
+}
+
+static void test_rejects_unsupported_geometry() {
+    sim_sink_t sim;
+    CHECK_EQ(sim_sink_init(&sim, DMA_BUF_BYTES, 17), ESP_ERR_INVALID_ARG);
+    CHECK_EQ(sim_sink_init(&sim, 4094, DMA_BUF_COUNT), ESP_ERR_INVALID_ARG);
+}
+
+int main() {
+    host_test_init();
+    RUN_TEST(test_output_is_exactly_what_was_written);
+    RUN_TEST(test_runs_in_real_time);
+    RUN_TEST(test_counts_clicks_and_gaps);
+    RUN_TEST(test_rejects_unsupported_geometry);
+    return host_test_result();
+}
@@ -0,0 +1,340 @@
+// The RIFF chunk walker: the bundled WAVs and hand built ones with awkward chunks must parse to the right header and
+// data offset, malformed ones must be refused, truncated ones must be cut to the data there is, mutated ones must never
+// make it read out of bounds or report a data section outside the file, and a header seen before must be reopened
+// from the cache, unless the file has been rewritten since.
+
+#include "host_test.h"
+#include "audio_source.h"
+#include "wav_file.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#define FUZZ_RUNS               20000
+#define FUZZ_HEADER_BYTES       200     // Mutations land in the chunk headers, not the samples
+#define TRUNCATED_SIZE          1001    // Cut off part way into a frame of a bundled WAV's samples
+
+typedef std::vector<uint8_t> bytes_t;
+
+static void put_u16(bytes_t* out, uint16_t value) {
+    out->push_back(value & 0xff);
+    out->push_back(value >> 8);
+}
+
+static void put_u32(bytes_t* out, uint32_t value) {
+    put_u16(out, value & 0xffff);
+    put_u16(out, value >> 16);
+}
+
+static void put_chunk(bytes_t* out, const char* id, const bytes_t& body) {
+    out->insert(out->end(), id, id + 4);
+    put_u32(out, body.size());
+    out->insert(out->end(), body.begin(), body.end());
+    if (body.size() & 1) {
+        out->push_back(0);      // Pad byte
+    }
+}
+
+static bytes_t fmt_body(uint16_t format_id, uint16_t num_channels, uint32_t sample_rate, uint16_t bits_per_sample) {
+    bytes_t body;
+    put_u16(&body, format_id);
+    put_u16(&body, num_channels);
+    put_u32(&body, sample_rate);
+    put_u32(&body, sample_rate * num_channels * bits_per_sample / 8);
+    put_u16(&body, num_channels * bits_per_sample / 8);
+    put_u16(&body, bits_per_sample);
+    return body;
+}
+
+/**
+ * A WAVE_FORMAT_EXTENSIBLE fmt body whose SubFormat GUID names format_id.
+ */
+static bytes_t extensible_body(uint16_t format_id, uint16_t num_channels, uint32_t sample_rate, uint16_t bits_per_sample) {
+    bytes_t body = fmt_body(WAV_FORMAT_EXTENSIBLE, num_channels, sample_rate, bits_per_sample);
+    put_u16(&body, 22);                 // cbSize
+    put_u16(&body, bits_per_sample);    // wValidBitsPerSample
+    put_u32(&body, 3);                  // dwChannelMask
+    put_u16(&body, format_id);
+    const uint8_t guid_rest[14] = {0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71};
+    body.insert(body.end(), guid_rest, guid_rest + sizeof(guid_rest));
+    return body;
+}
+
+static bytes_t smpl_body(uint32_t start_frame, uint32_t last_frame) {
+    bytes_t body(28, 0);
+    put_u32(&body, 1);                  // Loops
+    put_u32(&body, 0);                  // Sampler data
+    put_u32(&body, 0);                  // Cue point id
+    put_u32(&body, WAV_SMPL_LOOP_FORWARD);
+    put_u32(&body, start_frame);
+    put_u32(&body, last_frame);
+    put_u32(&body, 0);                  // Fraction
+    put_u32(&body, 2);                  // Play count
+    return body;
+}
+
+static bytes_t riff(const bytes_t& chunks) {
+    bytes_t out = {'R', 'I', 'F', 'F'};
+    put_u32(&out, 4 + chunks.size());
+    out.insert(out.end(), {'W', 'A', 'V', 'E'});
+    out.insert(out.end(), chunks.begin(), chunks.end());
+    return out;
+}
+
+static esp_err_t parse(const bytes_t& wav, wav_header_t* header, uint32_t* data_offset) {
+    FILE* f = fmemopen((void*) wav.data(), wav.size(), "rb");
+    const esp_err_t err = wav_parse_header(f, header, data_offset);
+    fclose(f);
+    return err;
+}
+
+static bytes_t read_file(const char* path) {
+    FILE* f = fopen(path, "rb");
+    bytes_t bytes;
+    int c;
+    while ((c = fgetc(f)) != EOF) {
+        bytes.push_back(c);
+    }
+    fclose(f);
+    return bytes;
+}
+
+static void test_parses_the_bundled_wavs() {
+    const char* const names[] = {"OYM-USA-male-1-16000.wav", "OYM-USA-male-1-NoMiddle.wav"};
+    for (const char* name : names) {
+        const bytes_t wav = read_file(name);
+        // The data section starts after the first "data" chunk header, past the LIST chunk in the 16kHz one.
+        const uint8_t* data_id = (const uint8_t*) memmem(wav.data(), wav.size(), "data", 4);
+        wav_header_t header;
+        uint32_t data_offset;
+        CHECK_OK(parse(wav, &header, &data_offset));
+        CHECK_EQ(data_offset, data_id - wav.data() + 8);
+        CHECK_EQ(header.FormatID, WAV_FORMAT_PCM);
+        CHECK_EQ(header.NumChannels, 2);
+        CHECK_EQ(header.SampleRate, 16000);
+        CHECK_EQ(header.BitsPerSample, 16);
+        CHECK(validate_wav_data(&header));
+    }
+}
+
+static void test_parses_awkward_chunks() {
+    const bytes_t samples(400, 1);
+
+    // Odd sized chunks before the data, an extensible fmt, a second fmt and a smpl loop after the data.
+    bytes_t chunks;
+    put_chunk(&chunks, "LIST", bytes_t(27, 'x'));
+    put_chunk(&chunks, "fmt ", extensible_body(WAV_FORMAT_PCM, 1, 22050, 16));
+    put_chunk(&chunks, "junk", bytes_t(3, 'y'));
+    put_chunk(&chunks, "fmt ", fmt_body(WAV_FORMAT_PCM, 2, 8000, 8));
+    put_chunk(&chunks, "data", samples);
+    put_chunk(&chunks, "smpl", smpl_body(10, 99));
+    const bytes_t wav = riff(chunks);
+
+    wav_header_t header;
+    uint32_t data_offset;
+    CHECK_OK(parse(wav, &header, &data_offset));
+    CHECK_EQ(header.FormatID, WAV_FORMAT_PCM);     // From the SubFormat
+    CHECK_EQ(header.FormatSize, WAV_FMT_EXTENSIBLE_SIZE);
+    CHECK_EQ(header.NumChannels, 1);               // The second fmt is ignored
+    CHECK_EQ(header.SampleRate, 22050);
+    CHECK_EQ(header.BitsPerSample, 16);
+    CHECK_EQ(header.data.chunk_size, samples.size());
+    CHECK_EQ(data_offset, 12 + (8 + 28) + (8 + WAV_FMT_EXTENSIBLE_SIZE) + (8 + 4) + (8 + 16) + 8);
+    CHECK_EQ(header.loop.start_frame, 10);
+    CHECK_EQ(header.loop.end_frame, 100);
+    CHECK_EQ(header.loop.play_count, 2);
+    CHECK(validate_wav_data(&header));
+
+    // Read in order, with no seeking back, it stops at the data and has no loop.
+    memory_source_t memory;
+    memory_source_init(&memory, wav.data(), wav.size());
+    memory.source.seek = nullptr;
+    CHECK_OK(wav_parse_source_header(&memory.source, &header, &data_offset));
+    CHECK_EQ(memory.position, data_offset);
+    CHECK_EQ(header.loop.end_frame, 0);
+}
+
+static void test_refuses_malformed_wavs() {
+    const bytes_t samples(64, 1);
+    wav_header_t header;
+    uint32_t data_offset;
+
+    bytes_t chunks;
+    put_chunk(&chunks, "data", samples);
+    put_chunk(&chunks, "fmt ", fmt_body(WAV_FORMAT_PCM, 2, 16000, 16));
+    CHECK_EQ(parse(riff(chunks), &header, &data_offset), ESP_FAIL);    // Data before the format
+
+    chunks.clear();
+    bytes_t short_fmt = fmt_body(WAV_FORMAT_PCM, 2, 16000, 16);
+    short_fmt.resize(14);
+    put_chunk(&chunks, "fmt ", short_fmt);
+    put_chunk(&chunks, "data", samples);
+    CHECK_EQ(parse(riff(chunks), &header, &data_offset), ESP_FAIL);
+
+    chunks.clear();
+    put_chunk(&chunks, "fmt ", fmt_body(WAV_FORMAT_PCM, 2, 16000, 16));
+    put_chunk(&chunks, "LIST", bytes_t(100, 'x'));
+    bytes_t truncated = riff(chunks);
+    truncated.resize(truncated.size() - 50);
+    CHECK_EQ(parse(truncated, &header, &data_offset), ESP_FAIL);        // No data, LIST runs off the end
+
+    bytes_t not_riff = riff(chunks);
+    not_riff[0] = 'X';
+    CHECK_EQ(parse(not_riff, &header, &data_offset), ESP_FAIL);
+    CHECK_EQ(parse(bytes_t(not_riff.begin(), not_riff.begin() + 10), &header, &data_offset), ESP_FAIL);
+
+    chunks.clear();
+    put_chunk(&chunks, "fmt ", fmt_body(3, 2, 16000, 32));             // IEEE float
+    put_chunk(&chunks, "data", samples);
+    CHECK_OK(parse(riff(chunks), &header, &data_offset));
+    CHECK(!validate_wav_data(&header));
+}
+
+static void test_cuts_data_to_the_file() {
+    wav_header_t header;
+    uint32_t data_offset;
+
+    // A bundled WAV cut off a little way into its samples plays what is left of them, in whole frames.
+    bytes_t wav = read_file("OYM-USA-male-1-16000.wav");
+    wav.resize(TRUNCATED_SIZE);
+    CHECK_OK(parse(wav, &header, &data_offset));
+    CHECK_EQ(header.data.chunk_size, (TRUNCATED_SIZE - data_offset) / 4 * 4);
+    CHECK(header.data_truncated);
+
+    // The same through a source that refuses to seek past its end, rather than reading nothing there as a file does.
+    memory_source_t memory;
+    memory_source_init(&memory, wav.data(), wav.size());
+    CHECK_OK(wav_parse_source_header(&memory.source, &header, &data_offset));
+    CHECK_EQ(header.data.chunk_size, (TRUNCATED_SIZE - data_offset) / 4 * 4);
+    CHECK_EQ(memory.position, data_offset);
+
+    // A data size past the end of the RIFF section, the file running on with something else.
+    const bytes_t samples(400, 1);
+    bytes_t chunks;
+    put_chunk(&chunks, "fmt ", fmt_body(WAV_FORMAT_PCM, 2, 16000, 16));
+    put_chunk(&chunks, "data", samples);
+    wav = riff(chunks);
+    wav[wav.size() - samples.size() - 4] = 0xff;    // Low byte of the data size, 511 bytes now
+    wav.insert(wav.end(), 100, 'x');
+    CHECK_OK(parse(wav, &header, &data_offset));
+    CHECK_EQ(header.data.chunk_size, samples.size());
+    CHECK(header.data_truncated);
+
+    // Read in order the source cannot be measured, but the RIFF section still bounds it.
+    memory_source_init(&memory, wav.data(), wav.size());
+    memory.source.seek = nullptr;
+    CHECK_OK(wav_parse_source_header(&memory.source, &header, &data_offset));
+    CHECK_EQ(header.data.chunk_size, samples.size());
+}
+
+static void test_survives_mutated_wavs() {
+    std::mt19937 random(1);
+    const char* const names[] = {"OYM-USA-male-1-16000.wav", "OYM-USA-male-1-NoMiddle.wav"};
+    uint32_t nr_parsed = 0;
+    for (const char* name : names) {
+        const bytes_t original = read_file(name);
+        for (int run = 0; run < FUZZ_RUNS; run++) {
+            bytes_t wav = original;
+            const int nr_mutations = 1 + random() % 4;
+            for (int i = 0; i < nr_mutations; i++) {
+                wav[random() % FUZZ_HEADER_BYTES] = random();
+            }
+            // Mostly whole, sometimes cut off in the headers or the samples.
+            const uint32_t size = random() % 4 == 0 ? random() % wav.size() : wav.size();
+            wav.resize(size);
+            wav.shrink_to_fit();
+
+            wav_header_t header;
+            uint32_t data_offset = UINT32_MAX;
+            const esp_err_t err = parse(wav, &header, &data_offset);
+            if (err == ESP_OK) {
+                nr_parsed++;
+                CHECK(data_offset <= size);
+                CHECK((uint64_t) data_offset + header.data.chunk_size <= size);
+                CHECK(memcmp(header.data.chunkID, "data", 4) == 0);
+                CHECK(header.FormatSize >= WAV_FMT_PCM_SIZE);
+                CHECK(header.loop.end_frame == 0 || header.loop.end_frame * header.BlockAlign <= header.data.chunk_size);
+            } else {
+                CHECK_EQ(err, ESP_FAIL);
+            }
+        }
+    }
+    CHECK(nr_parsed > 0);
+    CHECK(nr_parsed < 2 * FUZZ_RUNS);
+    printf("%u of %u mutated WAVs parsed\n", nr_parsed, 2 * FUZZ_RUNS);
+}
+
+static void test_reopens_from_the_header_cache() {
+    char path[] = "/tmp/test_wav_file_XXXXXX";
+    close(mkstemp(path));
+    bytes_t chunks;
+    put_chunk(&chunks, "LIST", bytes_t(27, 'x'));
+    put_chunk(&chunks, "fmt ", fmt_body(WAV_FORMAT_PCM, 2, 16000, 16));
+    put_chunk(&chunks, "data", bytes_t(64, 1));
+    bytes_t wav = riff(chunks);
+    FILE* f = fopen(path, "wb");
+    fwrite(wav.data(), 1, wav.size(), f);
+    fclose(f);
+
+    wav_header_t header;
+    CHECK_OK(load_wav_header(path, &header, &f));
+    CHECK_EQ(ftell(f), wav.size() - 64);
+    fclose(f);
+
+    // Wreck the headers in place, keeping the size and time. Only a reopen that skips parsing and seeks straight to
+    // the data can still succeed.
+    struct stat st;
+    stat(path, &st);
+    f = fopen(path, "r+b");
+    fwrite("XXXXXXXXXXXXXXXX", 1, 16, f);
+    fclose(f);
+    const struct utimbuf written = {st.st_atime, st.st_mtime};
+    utime(path, &written);
+    wav_header_t cached;
+    CHECK_OK(load_wav_header(path, &cached, &f));
+    CHECK(memcmp(&cached, &header, sizeof(header)) == 0);
+    CHECK_EQ(ftell(f), wav.size() - 64);
+    fclose(f);
+
+    // Rewritten later, the same size, it is parsed again and found wrecked.
+    const struct utimbuf rewritten = {st.st_atime, st.st_mtime + 1};
+    utime(path, &rewritten);
+    CHECK_EQ(load_wav_header(path, &cached, &f), ESP_FAIL);
+
+    // Rewritten at the same time with another size, the new header is read.
+    chunks.clear();
+    put_chunk(&chunks, "fmt ", fmt_body(WAV_FORMAT_PCM, 1, 8000, 8));
+    put_chunk(&chunks, "data", bytes_t(200, 1));
+    wav = riff(chunks);
+    f = fopen(path, "wb");
+    fwrite(wav.data(), 1, wav.size(), f);
+    fclose(f);
+    utime(path, &written);
+    CHECK_OK(load_wav_header(path, &header, &f));
+    CHECK_EQ(header.SampleRate, 8000);
+    CHECK_EQ(header.data.chunk_size, 200);
+    CHECK_EQ(ftell(f), wav.size() - 200);
+    fclose(f);
+    unlink(path);
+}
+
+int main() {
+    host_test_init();
+    esp_log_level_set("wav_file", ESP_LOG_NONE);    // The fuzzing makes it complain a lot
+    if (chdir(HOST_SPIFFS_DATA) != 0) {
+        printf("Cannot open %s\n", HOST_SPIFFS_DATA);
+        return 1;
+    }
+    RUN_TEST(test_parses_the_bundled_wavs);
+    RUN_TEST(test_parses_awkward_chunks);
+    RUN_TEST(test_refuses_malformed_wavs);
+    RUN_TEST(test_cuts_data_to_the_file);
+    RUN_TEST(test_survives_mutated_wavs);
+    RUN_TEST(test_reopens_from_the_header_cache);
+    return host_test_result();
+}
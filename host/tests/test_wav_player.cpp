@@ -0,0 +1,221 @@
+// wav_player_stream against the play_wav_file1..9 experiments it replaced: each legacy policy has to hand the sink the
+// same writes, byte for byte, as the original loop did, for the bundled clips and for data ending on and off a block.
+
+#include "host_test.h"
+#include "pcm_sink.h"
+#include "wav_file.h"
+#include "wav_player.h"
+
+#include <unistd.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define SILENCE_SIZE            8096    // As app_main
+#define DMA_BUF_BYTES           4096
+#define DMA_BUF_COUNT           8
+
+static char silence[SILENCE_SIZE];
+
+/**
+ * Every write a player makes, in order.
+ */
+typedef struct {
+    pcm_sink_t sink;
+    std::vector<std::vector<char>> writes;
+} recording_sink_t;
+
+static esp_err_t recording_write(void* ctx, const char* src, size_t size, size_t* nr_bytes_written) {
+    recording_sink_t* recording = (recording_sink_t*) ctx;
+    recording->writes.push_back(std::vector<char>(src, src + size));
+    *nr_bytes_written = size;
+    return ESP_OK;
+}
+
+static esp_err_t recording_wait_sent(void* ctx, uint32_t nr_buffers) {
+    return ESP_OK;
+}
+
+static void recording_sink_init(recording_sink_t* recording) {
+    recording->sink.write = recording_write;
+    recording->sink.wait_sent = recording_wait_sent;
+    recording->sink.ctx = recording;
+    recording->sink.dma_buf_bytes = DMA_BUF_BYTES;
+    recording->sink.dma_buf_count = DMA_BUF_COUNT;
+    recording->sink.sample_rate = 0;
+    recording->writes.clear();
+}
+
+// The loops of play_wav_file1..5 and 9 as they were, with i2s_write going to the recording sink.
+static void legacy_play_whole_blocks(FILE* f, recording_sink_t* out, const uint32_t WAV_DATA_BUFFER_SIZE,
+                                     bool write_whole_block, uint32_t nr_silence_writes) {
+    char* data = (char*) malloc(WAV_DATA_BUFFER_SIZE);
+    size_t nr_bytes_written;
+    while (true) {
+        memset(data, 0, WAV_DATA_BUFFER_SIZE); // Clear buffer.
+        const uint32_t nr_bytes = fread(data, sizeof(char), WAV_DATA_BUFFER_SIZE, f);
+        if (nr_bytes == 0) {
+            break;
+        }
+        recording_write(out, data, write_whole_block ? WAV_DATA_BUFFER_SIZE : nr_bytes, &nr_bytes_written);
+        if (nr_bytes != WAV_DATA_BUFFER_SIZE) {
+            break;
+        }
+    }
+    for (uint32_t i = 0; i < nr_silence_writes; i++) {
+        recording_write(out, silence, SILENCE_SIZE, &nr_bytes_written);
+    }
+    free(data);
+}
+
+// The loop of play_wav_file6..8, first block read and dropped, as they were.
+static void legacy_play_skip_first(FILE* f, recording_sink_t* out, bool pad_to_silence_size,
+                                   uint32_t nr_silence_writes) {
+    const uint32_t WAV_DATA_BUFFER_SIZE = 8096;
+    char* data = (char*) malloc(WAV_DATA_BUFFER_SIZE);
+    size_t nr_bytes_written;
+    uint32_t nr_bytes_read = fread(data, sizeof(char), WAV_DATA_BUFFER_SIZE, f);
+    while (true) {
+        memset(data, 0, WAV_DATA_BUFFER_SIZE); // Clear buffer.
+        nr_bytes_read = fread(data, sizeof(char), WAV_DATA_BUFFER_SIZE, f);
+        if (nr_bytes_read == 0) {
+            break;
+        }
+        recording_write(out, data, nr_bytes_read, &nr_bytes_written);
+        if (nr_bytes_read != WAV_DATA_BUFFER_SIZE) {
+            break;
+        }
+    }
+    if (pad_to_silence_size) {
+        recording_write(out, silence, SILENCE_SIZE - nr_bytes_read, &nr_bytes_written);
+    }
+    for (uint32_t i = 0; i < nr_silence_writes; i++) {
+        recording_write(out, silence, SILENCE_SIZE, &nr_bytes_written);
+    }
+    free(data);
+}
+
+static void legacy_play(int variant, FILE* f, recording_sink_t* out) {
+    switch (variant) {
+        case 1: legacy_play_whole_blocks(f, out, 1024, true, 0); break;
+        case 2: legacy_play_whole_blocks(f, out, 1024, true, 1); break;
+        case 3: legacy_play_whole_blocks(f, out, 1024, true, 2); break;
+        case 4: legacy_play_whole_blocks(f, out, 8096, true, 0); break;
+        case 5: legacy_play_whole_blocks(f, out, 8096, false, 0); break;
+        case 6: legacy_play_skip_first(f, out, true, 0); break;
+        case 7: legacy_play_skip_first(f, out, true, 1); break;
+        case 8: legacy_play_skip_first(f, out, false, 2); break;
+        case 9: legacy_play_whole_blocks(f, out, 8096, true, 2); break;
+    }
+}
+
+template <typename Policy>
+static void check_policy(int variant, const std::vector<char>& data) {
+    FILE* f = tmpfile();
+    fwrite(data.data(), 1, data.size(), f);
+
+    recording_sink_t legacy;
+    recording_sink_init(&legacy);
+    rewind(f);
+    legacy_play(variant, f, &legacy);
+
+    recording_sink_t player;
+    recording_sink_init(&player);
+    // Leave junk in the shared buffer, as the last play would, to catch a policy relying on a cleared buffer.
+    memset(wav_player_buffer(), 0x5a, PLAYER_BUFFER_SIZE);
+    rewind(f);
+    CHECK_OK(wav_player_stream<Policy>(f, &player.sink, silence, SILENCE_SIZE));
+    fclose(f);
+
+    CHECK_EQ(player.writes.size(), legacy.writes.size());
+    bool same = player.writes.size() == legacy.writes.size();
+    for (size_t i = 0; i < player.writes.size() && same; i++) {
+        same = player.writes[i] == legacy.writes[i];
+    }
+    if (!same) {
+        printf("legacy_policy_%d differs from play_wav_file%d on %zu bytes of data\n", variant, variant, data.size());
+    }
+    CHECK(same);
+}
+
+static void check_all_policies(const std::vector<char>& data) {
+    check_policy<legacy_policy_1>(1, data);
+    check_policy<legacy_policy_2>(2, data);
+    check_policy<legacy_policy_3>(3, data);
+    check_policy<legacy_policy_4>(4, data);
+    check_policy<legacy_policy_5>(5, data);
+    check_policy<legacy_policy_6>(6, data);
+    check_policy<legacy_policy_7>(7, data);
+    check_policy<legacy_policy_8>(8, data);
+    check_policy<legacy_policy_9>(9, data);
+}
+
+/**
+ * Noise, so a byte written from the wrong place or left stale cannot pass for the right one.
+ */
+static std::vector<char> noise(size_t size) {
+    std::vector<char> data(size);
+    uint32_t state = 12345;
+    for (size_t i = 0; i < size; i++) {
+        state = state * 1103515245 + 12345;
+        data[i] = (char) (state >> 16);
+    }
+    return data;
+}
+
+static std::vector<char> clip_data(const char* filename) {
+    FILE* f = fopen(filename, "rb");
+    wav_header_t header;
+    uint32_t data_offset;
+    CHECK_OK(wav_parse_header(f, &header, &data_offset));
+    std::vector<char> data(header.data.chunk_size);
+    CHECK_EQ(fread(data.data(), 1, data.size(), f), data.size());
+    fclose(f);
+    return data;
+}
+
+static void test_bundled_clips_match_legacy() {
+    check_all_policies(clip_data("OYM-USA-male-1-16000.wav"));
+    check_all_policies(clip_data("OYM-USA-male-1-NoMiddle.wav"));
+}
+
+static void test_block_boundaries_match_legacy() {
+    // Ending on a 1024 and an 8096 byte block, just after one, and data shorter than the block the 6..8 drop.
+    const size_t sizes[] = {1024 * 79, 8096 * 10, 8096 * 10 + 4, 8096 + 1, 4000, 0};
+    for (size_t size : sizes) {
+        check_all_policies(noise(size));
+    }
+}
+
+static void test_gapless_ends_on_a_descriptor() {
+    const std::vector<char> data = noise(DMA_BUF_BYTES * 3 + 100);
+    FILE* f = tmpfile();
+    fwrite(data.data(), 1, data.size(), f);
+    rewind(f);
+    recording_sink_t player;
+    recording_sink_init(&player);
+    CHECK_OK(wav_player_stream<gapless_policy>(f, &player.sink, silence, SILENCE_SIZE));
+    fclose(f);
+
+    std::vector<char> out;
+    for (const std::vector<char>& write : player.writes) {
+        out.insert(out.end(), write.begin(), write.end());
+    }
+    CHECK_EQ(out.size(), DMA_BUF_BYTES * 4);
+    CHECK(memcmp(out.data(), data.data(), data.size()) == 0);
+    CHECK(std::vector<char>(out.begin() + data.size(), out.end()) == std::vector<char>(out.size() - data.size(), 0));
+}
+
+int main() {
+    host_test_init();
+    if (chdir(HOST_SPIFFS_DATA) != 0) {
+        printf("Cannot open %s\n", HOST_SPIFFS_DATA);
+        return 1;
+    }
+    CHECK_OK(wav_player_init());
+
+    RUN_TEST(test_bundled_clips_match_legacy);
+    RUN_TEST(test_block_boundaries_match_legacy);
+    RUN_TEST(test_gapless_ends_on_a_descriptor);
+    return host_test_result();
+}
@@ -0,0 +1,121 @@
+#include "adpcm.h"
+
+#define ADPCM_GROUP_FRAMES  8       // Frames in 4 bytes of one channel
+#define ADPCM_MAX_INDEX     88
+
+static const int16_t step_table[ADPCM_MAX_INDEX + 1] = {
+        7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97,
+        107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+        876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871,
+        5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623,
+        27086, 29794, 32767};
+
+static const int8_t index_table[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+/**
+ * One sample. The reference adds step >> 3, step >> 2, step >> 1 and step for the set magnitude bits one branch at a
+ * time, here each bit becomes a mask so the sum comes out the same with no branches.
+ */
+static inline int32_t decode_nibble(int32_t* predictor, int32_t* index, uint32_t nibble) {
+    const int32_t step = step_table[*index];
+    int32_t diff = step >> 3;
+    diff += step & -(int32_t) ((nibble >> 2) & 1);
+    diff += (step >> 1) & -(int32_t) ((nibble >> 1) & 1);
+    diff += (step >> 2) & -(int32_t) (nibble & 1);
+    const int32_t sign = -(int32_t) (nibble >> 3);      // 0 or -1
+    int32_t p = *predictor + ((diff ^ sign) - sign);
+    p = p > INT16_MAX ? INT16_MAX : p < INT16_MIN ? INT16_MIN : p;
+    *predictor = p;
+    const int32_t i = *index + index_table[nibble];
+    *index = i < 0 ? 0 : i > ADPCM_MAX_INDEX ? ADPCM_MAX_INDEX : i;
+    return p;
+}
+
+bool adpcm_valid_block_align(uint16_t num_channels, uint16_t block_align) {
+    const uint32_t header_bytes = 4 * num_channels;
+    return (num_channels == 1 || num_channels == 2) && block_align > header_bytes && block_align % header_bytes == 0;
+}
+
+void adpcm_init(adpcm_decoder_t* decoder, uint16_t num_channels, uint16_t block_align) {
+    decoder->num_channels = num_channels;
+    decoder->block_align = block_align;
+    decoder->frames_per_block = (block_align / num_channels - 4) * 2 + 1;
+    decoder->frame = 0;
+    decoder->predictor[0] = decoder->predictor[1] = 0;
+    decoder->index[0] = decoder->index[1] = 0;
+}
+
+uint32_t adpcm_stream_frames(const adpcm_decoder_t* decoder, uint32_t nr_bytes) {
+    const uint32_t group_bytes = 4 * decoder->num_channels;
+    const uint32_t rest = nr_bytes % decoder->block_align;
+    const uint32_t nr_frames = nr_bytes / decoder->block_align * decoder->frames_per_block;
+    return rest < group_bytes ? nr_frames : nr_frames + 1 + (rest - group_bytes) / group_bytes * ADPCM_GROUP_FRAMES;
+}
+
+uint32_t adpcm_input_bytes(const adpcm_decoder_t* decoder, uint32_t nr_out_frames) {
+    const uint32_t group_bytes = 4 * decoder->num_channels;
+    uint32_t frame = decoder->frame;
+    uint32_t nr_frames = 0;
+    uint32_t nr_bytes = 0;
+    while (nr_frames < nr_out_frames) {
+        const uint32_t size = frame == 0 ? 1 : ADPCM_GROUP_FRAMES;
+        if (nr_frames + size > nr_out_frames) {
+            break;
+        }
+        nr_bytes += group_bytes;
+        nr_frames += size;
+        frame = frame + size == decoder->frames_per_block ? 0 : frame + size;
+    }
+    return nr_bytes;
+}
+
+uint32_t adpcm_decode(adpcm_decoder_t* decoder, const uint8_t* src, uint32_t nr_bytes, int16_t* dst, uint32_t max_frames,
+                      uint32_t* nr_used) {
+    const uint32_t nr_channels = decoder->num_channels;
+    const uint32_t group_bytes = 4 * nr_channels;
+    uint32_t used = 0;
+    uint32_t nr_frames = 0;
+
+    while (nr_bytes - used >= group_bytes) {
+        const uint8_t* p = src + used;
+        if (decoder->frame == 0) {
+            if (nr_frames == max_frames) {
+                break;
+            }
+            for (uint32_t ch = 0; ch < nr_channels; ch++) {
+                decoder->predictor[ch] = (int16_t) (p[4 * ch] | (p[4 * ch + 1] << 8));
+                decoder->index[ch] = p[4 * ch + 2] > ADPCM_MAX_INDEX ? ADPCM_MAX_INDEX : p[4 * ch + 2];
+            }
+            dst[2 * nr_frames] = (int16_t) decoder->predictor[0];
+            dst[2 * nr_frames + 1] = (int16_t) decoder->predictor[nr_channels - 1];
+            decoder->frame = 1;
+            nr_frames++;
+        } else {
+            if (max_frames - nr_frames < ADPCM_GROUP_FRAMES) {
+                break;
+            }
+            // Each channel's 4 bytes hold its next 8 samples, low nibble first. Mono goes to both sides.
+            int16_t* out = &dst[2 * nr_frames];
+            for (uint32_t ch = 0; ch < nr_channels; ch++) {
+                const uint8_t* bytes = p + 4 * ch;
+                for (int i = 0; i < ADPCM_GROUP_FRAMES; i++) {
+                    const uint32_t nibble = (bytes[i >> 1] >> ((i & 1) * 4)) & 0xF;
+                    out[2 * i + ch] = (int16_t) decode_nibble(&decoder->predictor[ch], &decoder->index[ch], nibble);
+                }
+            }
+            if (nr_channels == 1) {
+                for (int i = 0; i < ADPCM_GROUP_FRAMES; i++) {
+                    out[2 * i + 1] = out[2 * i];
+                }
+            }
+            decoder->frame += ADPCM_GROUP_FRAMES;
+            if (decoder->frame == decoder->frames_per_block) {
+                decoder->frame = 0;
+            }
+            nr_frames += ADPCM_GROUP_FRAMES;
+        }
+        used += group_bytes;
+    }
+    *nr_used = used;
+    return nr_frames;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Streaming IMA-ADPCM (WAV FormatID 0x11) decoder. Each block starts with a 4 byte header per channel, whose sample
+ * is the first frame, followed by groups of 4 bytes per channel that each hold 8 frames. The decoder keeps its place
+ * in the block between calls, so the data can be fed in pieces of any number of whole groups.
+ */
+typedef struct {
+    uint16_t num_channels;
+    uint16_t block_align;
+    uint32_t frames_per_block;
+    uint32_t frame;             // Frames decoded from the current block, 0 when a block header is next
+    int32_t predictor[2];
+    int32_t index[2];           // Into the step table
+} adpcm_decoder_t;
+
+/**
+ * True if block_align is a whole number of 8 frame groups after the headers, for mono or stereo.
+ */
+bool adpcm_valid_block_align(uint16_t num_channels, uint16_t block_align);
+
+/**
+ * Starts a new stream at the start of a block.
+ */
+void adpcm_init(adpcm_decoder_t* decoder, uint16_t num_channels, uint16_t block_align);
+
+/**
+ * Number of frames nr_bytes of data decode to, from the start of a stream. A partial group at the end decodes to nothing.
+ */
+uint32_t adpcm_stream_frames(const adpcm_decoder_t* decoder, uint32_t nr_bytes);
+
+/**
+ * Number of bytes holding the next nr_out_frames frames, or fewer frames if nr_out_frames ends part way through a group.
+ * Passing this many to adpcm_decode with max_frames = nr_out_frames always uses all of them.
+ */
+uint32_t adpcm_input_bytes(const adpcm_decoder_t* decoder, uint32_t nr_out_frames);
+
+/**
+ * Decodes whole headers and groups from src into dst as 16 bit stereo, mono being written to both channels.
+ * Stops when either src or max_frames runs out. Returns the number of frames written, nr_used says how much of src
+ * was taken.
+ */
+uint32_t adpcm_decode(adpcm_decoder_t* decoder, const uint8_t* src, uint32_t nr_bytes, int16_t* dst, uint32_t max_frames,
+                      uint32_t* nr_used);
@@ -0,0 +1,98 @@
+#include "audio_pool.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <atomic>
+
+static const char *TAG = "audio_pool";
+
+// Free list as a lock-free stack. head holds 1 + the index of the top block in its low 16 bits, 0 when empty, and a
+// tag bumped on every change in the high 16 bits, so a pop that raced with a pop and push of the same block fails its
+// CAS instead of linking in a stale next.
+#define HEAD_INDEX(h)           ((h) & 0xFFFF)
+#define HEAD_TAG(h)             ((h) >> 16)
+#define MAKE_HEAD(tag, index)   ((((tag) & 0xFFFF) << 16) | (index))
+
+static char* pool = nullptr;
+static uint32_t pool_nr_blocks = 0;
+static std::atomic<uint16_t> next_free[AUDIO_POOL_MAX_BLOCKS];     // 1 + index of the block below, 0 at the bottom
+static std::atomic<uint32_t> head(0);
+
+static std::atomic<uint32_t> nr_free(0);
+static std::atomic<uint32_t> min_free(0);
+static std::atomic<uint32_t> nr_acquired(0);
+static std::atomic<uint32_t> nr_exhausted(0);
+
+esp_err_t audio_pool_init(uint32_t nr_blocks) {
+    if (pool != nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (nr_blocks == 0 || nr_blocks > AUDIO_POOL_MAX_BLOCKS) {
+        ESP_LOGE(TAG, "%d blocks, must be 1 to %d", nr_blocks, AUDIO_POOL_MAX_BLOCKS);
+        return ESP_ERR_INVALID_ARG;
+    }
+    pool = (char*) heap_caps_malloc(nr_blocks * AUDIO_POOL_BLOCK_SIZE, MALLOC_CAP_DMA);
+    if (pool == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %d DMA capable blocks of %d bytes", nr_blocks, AUDIO_POOL_BLOCK_SIZE);
+        return ESP_ERR_NO_MEM;
+    }
+
+    pool_nr_blocks = nr_blocks;
+    for (uint32_t i = 0; i < nr_blocks; i++) {
+        next_free[i].store(i, std::memory_order_relaxed);     // Block i sits on block i - 1
+    }
+    nr_free.store(nr_blocks, std::memory_order_relaxed);
+    min_free.store(nr_blocks, std::memory_order_relaxed);
+    head.store(MAKE_HEAD(0, nr_blocks), std::memory_order_release);
+    ESP_LOGI(TAG, "%d blocks of %d bytes", nr_blocks, AUDIO_POOL_BLOCK_SIZE);
+    return ESP_OK;
+}
+
+char* audio_pool_acquire() {
+    uint32_t current = head.load(std::memory_order_acquire);
+    while (true) {
+        const uint32_t index = HEAD_INDEX(current);
+        if (index == 0) {
+            nr_exhausted.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        const uint32_t next = next_free[index - 1].load(std::memory_order_relaxed);
+        if (head.compare_exchange_weak(current, MAKE_HEAD(HEAD_TAG(current) + 1, next), std::memory_order_acquire)) {
+            break;
+        }
+    }
+
+    nr_acquired.fetch_add(1, std::memory_order_relaxed);
+    const uint32_t free_now = nr_free.fetch_sub(1, std::memory_order_relaxed) - 1;
+    uint32_t lowest = min_free.load(std::memory_order_relaxed);
+    while (free_now < lowest && !min_free.compare_exchange_weak(lowest, free_now, std::memory_order_relaxed)) {
+    }
+    return pool + (HEAD_INDEX(current) - 1) * AUDIO_POOL_BLOCK_SIZE;
+}
+
+void audio_pool_release(char* block) {
+    if (block == nullptr) {
+        return;
+    }
+    const uint32_t index = (block - pool) / AUDIO_POOL_BLOCK_SIZE;
+    if (block < pool || index >= pool_nr_blocks || block != pool + index * AUDIO_POOL_BLOCK_SIZE) {
+        ESP_LOGE(TAG, "%p is not a pool block", block);
+        return;
+    }
+
+    uint32_t current = head.load(std::memory_order_relaxed);
+    do {
+        next_free[index].store(HEAD_INDEX(current), std::memory_order_relaxed);
+    } while (!head.compare_exchange_weak(current, MAKE_HEAD(HEAD_TAG(current) + 1, index + 1), std::memory_order_release));
+    nr_free.fetch_add(1, std::memory_order_relaxed);
+}
+
+void audio_pool_get_stats(audio_pool_stats_t* stats) {
+    stats->nr_blocks = pool_nr_blocks;
+    stats->nr_free = nr_free.load(std::memory_order_relaxed);
+    stats->min_free = min_free.load(std::memory_order_relaxed);
+    stats->nr_acquired = nr_acquired.load(std::memory_order_relaxed);
+    stats->nr_exhausted = nr_exhausted.load(std::memory_order_relaxed);
+    stats->dma_free = heap_caps_get_free_size(MALLOC_CAP_DMA);
+    stats->dma_largest_free = heap_caps_get_largest_free_block(MALLOC_CAP_DMA);
+}
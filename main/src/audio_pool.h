@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <esp_err.h>
+
+#define AUDIO_POOL_BLOCK_SIZE   4096    // One DMA descriptor, ie dma_buf_len (1024) frames of 16 bit stereo
+#define AUDIO_POOL_MAX_BLOCKS   32
+
+typedef struct {
+    uint32_t nr_blocks;
+    uint32_t nr_free;
+    uint32_t min_free;              // Fewest ever free at once, nr_blocks - min_free is the high water mark
+    uint32_t nr_acquired;           // Successful audio_pool_acquire calls
+    uint32_t nr_exhausted;          // audio_pool_acquire calls that found the pool empty
+    uint32_t dma_free;              // Free DMA capable heap, outside the pool
+    uint32_t dma_largest_free;      // Largest free DMA capable block, far below dma_free means the heap is fragmented
+} audio_pool_stats_t;
+
+/**
+ * Allocates nr_blocks of AUDIO_POOL_BLOCK_SIZE from DMA capable memory, in one piece so the pool itself can never
+ * fragment the heap. Must be called once, before anything takes a block. The pool is never freed.
+ */
+esp_err_t audio_pool_init(uint32_t nr_blocks);
+
+/**
+ * Takes a free block, 4 byte aligned and DMA capable. Returns nullptr if there is none.
+ * Never blocks or takes a lock, safe from any task.
+ */
+char* audio_pool_acquire();
+
+/**
+ * Gives back a block from audio_pool_acquire. Never blocks or takes a lock, safe from any task.
+ */
+void audio_pool_release(char* block);
+
+void audio_pool_get_stats(audio_pool_stats_t* stats);
@@ -0,0 +1,205 @@
+#include "audio_service.h"
+#include "clip_cache.h"
+#include "clip_store.h"
+#include "mixer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <atomic>
+#include <cstring>
+
+static const char *TAG = "audio_service";
+
+#define SERVICE_TASK_PRIORITY   6       // Above the mixer and the pipeline, a command is dispatched as soon as it is sent
+#define SERVICE_TASK_STACK      3072
+#define SERVICE_POLL_MS         10      // How often queued clips check whether the sound before them has finished
+
+static_assert((AUDIO_SERVICE_QUEUE_SIZE & (AUDIO_SERVICE_QUEUE_SIZE - 1)) == 0, "AUDIO_SERVICE_QUEUE_SIZE must be a power of 2");
+
+typedef struct {
+    uint8_t type;               // audio_command_type_t
+    audio_clip_id_t clip;
+    int32_t gain;
+    int64_t request_us;
+} audio_command_t;
+
+// Bounded multiple producer, single consumer ring. A producer claims a position with one CAS on enqueue_pos, then
+// publishes the slot by setting its seq to position + 1. The consumer hands the slot back for the next lap by setting
+// seq to position + AUDIO_SERVICE_QUEUE_SIZE. A full ring is seen from seq without touching the consumer's position.
+typedef struct {
+    std::atomic<uint32_t> seq;
+    audio_command_t command;
+} command_slot_t;
+
+static command_slot_t queue[AUDIO_SERVICE_QUEUE_SIZE];
+static std::atomic<uint32_t> enqueue_pos(0);
+static uint32_t dequeue_pos = 0;                        // Service task only
+
+// Service task only from here on.
+static wav_data_t clips[AUDIO_SERVICE_MAX_CLIPS];
+static uint32_t nr_clips = 0;
+static audio_command_t pending[AUDIO_SERVICE_MAX_PENDING];
+static uint32_t pending_head = 0;
+static uint32_t nr_pending = 0;
+static struct {
+    mixer_voice_t voice;
+    audio_clip_id_t clip;
+} playing[MIXER_MAX_VOICES];                            // By mixer slot, the low 8 bits of the voice handle
+static bool playing_valid[MIXER_MAX_VOICES];
+
+static TaskHandle_t service_task = nullptr;
+static audio_service_stats_t service_stats;
+static std::atomic<uint32_t> nr_dropped(0);
+
+static bool pop(audio_command_t* command) {
+    command_slot_t* slot = &queue[dequeue_pos & (AUDIO_SERVICE_QUEUE_SIZE - 1)];
+    if (slot->seq.load(std::memory_order_acquire) != dequeue_pos + 1) {
+        return false;
+    }
+    *command = slot->command;
+    slot->seq.store(dequeue_pos + AUDIO_SERVICE_QUEUE_SIZE, std::memory_order_release);
+    dequeue_pos++;
+    return true;
+}
+
+static void start(const audio_command_t* command) {
+    mixer_voice_t voice;
+    const int64_t dispatch_us = esp_timer_get_time() - command->request_us;
+    if (mixer_play(&clips[command->clip], command->gain, command->request_us, &voice) != ESP_OK) {
+        service_stats.nr_failed++;
+        return;
+    }
+    playing[voice & 0xFF].voice = voice;
+    playing[voice & 0xFF].clip = command->clip;
+    playing_valid[voice & 0xFF] = true;
+
+    service_stats.last_dispatch_us = dispatch_us;
+    if (dispatch_us > service_stats.max_dispatch_us) {
+        service_stats.max_dispatch_us = dispatch_us;
+    }
+}
+
+/**
+ * Stops every voice this service started for clip, or all of them. Handles of voices that already ended are harmless.
+ */
+static void stop(const audio_command_t* command, bool all) {
+    for (int i = 0; i < MIXER_MAX_VOICES; i++) {
+        if (playing_valid[i] && (all || playing[i].clip == command->clip)) {
+            mixer_stop(playing[i].voice);
+            playing_valid[i] = false;
+        }
+    }
+}
+
+static void handle(const audio_command_t* command) {
+    switch ((audio_command_type_t) command->type) {
+        case AUDIO_CMD_PLAY:
+            start(command);
+            break;
+        case AUDIO_CMD_STOP:
+            stop(command, false);
+            break;
+        case AUDIO_CMD_PREEMPT:
+            stop(command, true);
+            nr_pending = 0;
+            start(command);
+            break;
+        case AUDIO_CMD_QUEUE:
+            if (nr_pending == AUDIO_SERVICE_MAX_PENDING) {
+                ESP_LOGW(TAG, "%d clips already queued, dropping clip %d", AUDIO_SERVICE_MAX_PENDING, command->clip);
+                nr_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            pending[(pending_head + nr_pending) % AUDIO_SERVICE_MAX_PENDING] = *command;
+            nr_pending++;
+            break;
+    }
+    service_stats.nr_commands++;
+}
+
+static void service_loop(void*) {
+    while (true) {
+        // Only wake on a timer while a queued clip is waiting for the sound before it to end.
+        ulTaskNotifyTake(pdTRUE, nr_pending > 0 ? SERVICE_POLL_MS / portTICK_PERIOD_MS : portMAX_DELAY);
+
+        audio_command_t command;
+        while (pop(&command)) {
+            handle(&command);
+        }
+
+        if (nr_pending > 0 && mixer_active_voices() == 0) {
+            start(&pending[pending_head]);
+            pending_head = (pending_head + 1) % AUDIO_SERVICE_MAX_PENDING;
+            nr_pending--;
+        }
+    }
+}
+
+esp_err_t audio_service_init(const char* const* filenames, uint32_t nr_filenames) {
+    if (nr_filenames > AUDIO_SERVICE_MAX_CLIPS) {
+        ESP_LOGE(TAG, "%d clips, at most %d are supported", nr_filenames, AUDIO_SERVICE_MAX_CLIPS);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (uint32_t i = 0; i < nr_filenames; i++) {
+        if (clip_store_find(filenames[i], &clips[i]) == ESP_OK) {
+            continue;
+        }
+        const wav_data_t* cached = clip_cache_get(filenames[i]);
+        if (cached == nullptr) {
+            ESP_LOGE(TAG, "Could not load clip %d, %s", i, filenames[i]);
+            return ESP_ERR_NOT_FOUND;
+        }
+        clips[i] = *cached;
+    }
+    nr_clips = nr_filenames;
+
+    for (uint32_t i = 0; i < AUDIO_SERVICE_QUEUE_SIZE; i++) {
+        queue[i].seq.store(i, std::memory_order_relaxed);
+    }
+    memset(&service_stats, 0, sizeof(service_stats));
+
+    if (xTaskCreatePinnedToCore(service_loop, "audio_service", SERVICE_TASK_STACK, nullptr, SERVICE_TASK_PRIORITY,
+                                &service_task, AUDIO_SERVICE_CORE) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t audio_service_send(audio_command_type_t type, audio_clip_id_t clip, int32_t gain) {
+    if (clip >= nr_clips) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint32_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    command_slot_t* slot;
+    while (true) {
+        slot = &queue[pos & (AUDIO_SERVICE_QUEUE_SIZE - 1)];
+        const int32_t lap = (int32_t) (slot->seq.load(std::memory_order_acquire) - pos);
+        if (lap < 0) {
+            nr_dropped.fetch_add(1, std::memory_order_relaxed);
+            return ESP_ERR_NO_MEM;      // The consumer has not freed this slot since the last lap
+        }
+        if (lap == 0 && enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            break;
+        }
+        if (lap > 0) {
+            pos = enqueue_pos.load(std::memory_order_relaxed);  // Another producer took it
+        }
+    }
+
+    slot->command.type = (uint8_t) type;
+    slot->command.clip = clip;
+    slot->command.gain = gain;
+    slot->command.request_us = esp_timer_get_time();
+    slot->seq.store(pos + 1, std::memory_order_release);
+    xTaskNotifyGive(service_task);
+    return ESP_OK;
+}
+
+void audio_service_get_stats(audio_service_stats_t* stats) {
+    *stats = service_stats;
+    stats->nr_dropped = nr_dropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <esp_err.h>
+
+#define AUDIO_SERVICE_QUEUE_SIZE    16      // Commands waiting for the service task, power of 2
+#define AUDIO_SERVICE_MAX_PENDING   8       // AUDIO_CMD_QUEUE clips waiting for the sound before them
+#define AUDIO_SERVICE_MAX_CLIPS     32
+#define AUDIO_SERVICE_CORE          1       // APP_CPU, away from the WiFi and BT stacks on PRO_CPU
+
+typedef uint16_t audio_clip_id_t;           // Index into the clip list given to audio_service_init
+
+typedef enum {
+    AUDIO_CMD_PLAY,         // Start the clip now, mixed over whatever is playing
+    AUDIO_CMD_STOP,         // Ramp down every voice playing the clip
+    AUDIO_CMD_PREEMPT,      // Ramp down everything, forget the queued clips, then start the clip
+    AUDIO_CMD_QUEUE,        // Start the clip once everything playing or queued before it has finished
+} audio_command_type_t;
+
+typedef struct {
+    uint32_t nr_commands;           // Commands carried out
+    uint32_t nr_dropped;            // Sends refused because the command queue or the pending queue was full
+    uint32_t nr_failed;             // Commands that could not start their clip, eg all mixer voices busy
+    int64_t last_dispatch_us;       // Send to mixer_play, for the last clip started
+    int64_t max_dispatch_us;
+} audio_service_stats_t;
+
+/**
+ * Resolves every clip in filenames, from the clip store if it is there and otherwise by preloading it into the clip
+ * cache, then starts the service task pinned to AUDIO_SERVICE_CORE. Clip IDs are indexes into filenames.
+ * mixer_init must have been called. The cache budget must hold every cached clip, nothing may evict them after this.
+ */
+esp_err_t audio_service_init(const char* const* filenames, uint32_t nr_clips);
+
+/**
+ * Queues a command for the service task and returns at once, it never blocks or takes a lock.
+ * Safe to call from any task, not from an ISR. gain is Q15 as for mixer_play and only used by the commands that
+ * start a clip. Returns ESP_ERR_NO_MEM if the command queue is full.
+ *
+ * The command to first sample latency is in the mixer stats, the command to mixer_play part of it in the service's.
+ */
+esp_err_t audio_service_send(audio_command_type_t type, audio_clip_id_t clip, int32_t gain);
+
+void audio_service_get_stats(audio_service_stats_t* stats);
@@ -0,0 +1,148 @@
+#include "audio_source.h"
+
+#include <esp_log.h>
+#include <errno.h>
+#include <cstring>
+
+static const char *TAG = "audio_source";
+
+#define SKIP_CHUNK_SIZE         64      // Bytes read into nothing at a time by audio_source_skip, on the stack
+
+size_t audio_source_read_fully(const audio_source_t* source, char* dst, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        size_t nr_bytes_read;
+        if (source->read(source->ctx, dst + total, size - total, &nr_bytes_read) != ESP_OK || nr_bytes_read == 0) {
+            break;
+        }
+        total += nr_bytes_read;
+    }
+    return total;
+}
+
+esp_err_t audio_source_skip(const audio_source_t* source, uint32_t position, uint32_t nr_bytes) {
+    if (source->seek != nullptr) {
+        return source->seek(source->ctx, position + nr_bytes);
+    }
+    char discard[SKIP_CHUNK_SIZE];
+    while (nr_bytes > 0) {
+        const size_t chunk = nr_bytes < sizeof(discard) ? nr_bytes : sizeof(discard);
+        if (audio_source_read_fully(source, discard, chunk) != chunk) {
+            return ESP_FAIL;
+        }
+        nr_bytes -= chunk;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t file_read(void* ctx, char* dst, size_t size, size_t* nr_bytes_read) {
+    file_source_t* file = (file_source_t*) ctx;
+    *nr_bytes_read = fread(dst, sizeof(char), size, file->f);
+    return *nr_bytes_read > 0 || feof(file->f) ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t file_seek(void* ctx, uint32_t offset) {
+    file_source_t* file = (file_source_t*) ctx;
+    return fseek(file->f, offset, SEEK_SET) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+void file_source_wrap(file_source_t* file, FILE* f) {
+    file->source.read = file_read;
+    file->source.seek = file_seek;
+    file->source.ctx = file;
+    file->f = f;
+    file->owned = false;
+}
+
+esp_err_t file_source_open(file_source_t* file, const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == nullptr) {
+        ESP_LOGE(TAG, "Failed to open %s errno=%d err=str=%s", path, errno, strerror(errno));
+        return ESP_FAIL;
+    }
+    setvbuf(f, nullptr, _IONBF, 0);     // Must precede any other use of f
+    file_source_wrap(file, f);
+    file->owned = true;
+    return ESP_OK;
+}
+
+void file_source_close(file_source_t* file) {
+    if (file->owned && file->f != nullptr) {
+        fclose(file->f);
+    }
+    file->f = nullptr;
+}
+
+static esp_err_t memory_read(void* ctx, char* dst, size_t size, size_t* nr_bytes_read) {
+    memory_source_t* memory = (memory_source_t*) ctx;
+    const size_t left = memory->size - memory->position;
+    *nr_bytes_read = size < left ? size : left;
+    memcpy(dst, memory->data + memory->position, *nr_bytes_read);
+    memory->position += *nr_bytes_read;
+    return ESP_OK;
+}
+
+static esp_err_t memory_seek(void* ctx, uint32_t offset) {
+    memory_source_t* memory = (memory_source_t*) ctx;
+    if (offset > memory->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memory->position = offset;
+    return ESP_OK;
+}
+
+void memory_source_init(memory_source_t* memory, const void* data, size_t size) {
+    memory->source.read = memory_read;
+    memory->source.seek = memory_seek;
+    memory->source.ctx = memory;
+    memory->data = (const char*) data;
+    memory->size = size;
+    memory->position = 0;
+}
+
+static esp_err_t partition_read(void* ctx, char* dst, size_t size, size_t* nr_bytes_read) {
+    partition_source_t* part = (partition_source_t*) ctx;
+    const size_t left = part->size - part->position;
+    *nr_bytes_read = size < left ? size : left;
+    if (*nr_bytes_read == 0) {
+        return ESP_OK;
+    }
+    const esp_err_t err = esp_partition_read(part->partition, part->offset + part->position, dst, *nr_bytes_read);
+    if (err != ESP_OK) {
+        *nr_bytes_read = 0;
+        return err;
+    }
+    part->position += *nr_bytes_read;
+    return ESP_OK;
+}
+
+static esp_err_t partition_seek(void* ctx, uint32_t offset) {
+    partition_source_t* part = (partition_source_t*) ctx;
+    if (offset > part->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    part->position = offset;
+    return ESP_OK;
+}
+
+esp_err_t partition_source_open(partition_source_t* part, const char* partition_label, uint32_t offset, uint32_t size) {
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                                                partition_label);
+    if (partition == nullptr) {
+        ESP_LOGE(TAG, "No partition '%s'", partition_label);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (offset > partition->size || size > partition->size - offset) {
+        ESP_LOGE(TAG, "%d bytes at %d run past the end of partition '%s', %d bytes", size, offset, partition_label,
+                 partition->size);
+        return ESP_ERR_INVALID_ARG;
+    }
+    part->source.read = partition_read;
+    part->source.seek = partition_seek;
+    part->source.ctx = part;
+    part->partition = partition;
+    part->offset = offset;
+    part->size = size;
+    part->position = 0;
+    return ESP_OK;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <esp_err.h>
+#include <esp_partition.h>
+
+/**
+ * Where the players pull WAV files from, the counterpart of pcm_sink_t.
+ * On the ESP32 this wraps a VFS file on SPIFFS or FAT, a buffer in RAM or a pipe fed by another task, eg from a UART.
+ * On the host the file source reads ordinary files.
+ *
+ * The helpers, file, memory and partition sources use no FreeRTOS or drivers and build on the host as they are, the
+ * pipe source and FAT mount are in audio_source_esp32.cpp.
+ *
+ * A source only has to deliver bytes in order. pipeline_play_source reads it from its reader task a whole DMA ring
+ * ahead of the output, so however slow or bursty the source, the writer never waits on it mid play.
+ */
+typedef struct {
+    /**
+     * Reads up to size bytes into dst, blocking until at least one is available. 0 bytes means the end.
+     */
+    esp_err_t (*read)(void* ctx, char* dst, size_t size, size_t* nr_bytes_read);
+
+    /**
+     * Moves to offset bytes from the start. nullptr if the source can only be read in order.
+     */
+    esp_err_t (*seek)(void* ctx, uint32_t offset);
+
+    void* ctx;
+} audio_source_t;
+
+/**
+ * Reads size bytes into dst, fewer only at the end of the source or on an error. Returns the number read.
+ */
+size_t audio_source_read_fully(const audio_source_t* source, char* dst, size_t size);
+
+/**
+ * Skips nr_bytes from position, seeking if the source can and reading them into nothing if it cannot.
+ */
+esp_err_t audio_source_skip(const audio_source_t* source, uint32_t position, uint32_t nr_bytes);
+
+/**
+ * A stdio file: SPIFFS, a mounted FAT partition or SD card, or an ordinary file on the host.
+ */
+typedef struct {
+    audio_source_t source;      // Hand this to the players, ctx points back here
+    FILE* f;
+    bool owned;                 // Opened by file_source_open, closed by file_source_close
+} file_source_t;
+
+/**
+ * Opens path, unbuffered as load_wav_header does, so every read goes straight to the file system.
+ */
+esp_err_t file_source_open(file_source_t* file, const char* path);
+
+/**
+ * Reads from f, which stays the caller's to close.
+ */
+void file_source_wrap(file_source_t* file, FILE* f);
+
+void file_source_close(file_source_t* file);
+
+/**
+ * A WAV file already in memory, eg received over the network or embedded in the firmware.
+ */
+typedef struct {
+    audio_source_t source;      // Hand this to the players, ctx points back here
+    const char* data;           // Must stay valid while the source is read
+    size_t size;
+    size_t position;
+} memory_source_t;
+
+void memory_source_init(memory_source_t* memory, const void* data, size_t size);
+
+/**
+ * A range of a raw data partition, eg a clip in the clips partition or a WAV flashed to a partition of its own.
+ * Each read is one esp_partition_read straight into the caller's buffer, with no VFS, file system pages or FILE buffer
+ * in between.
+ */
+typedef struct {
+    audio_source_t source;      // Hand this to the players, ctx points back here
+    const esp_partition_t* partition;
+    uint32_t offset;            // Start of the range in the partition
+    uint32_t size;
+    uint32_t position;          // From offset
+} partition_source_t;
+
+/**
+ * Reads size bytes from offset in the data partition with the given label, of any subtype.
+ * ESP_ERR_NOT_FOUND if there is no such partition, ESP_ERR_INVALID_ARG if the range runs past its end.
+ */
+esp_err_t partition_source_open(partition_source_t* part, const char* partition_label, uint32_t offset, uint32_t size);
+
+/**
+ * A byte stream written by another task, eg one reading a UART, and read in order by the players. The writer can run
+ * up to the buffer size ahead, size it to the DMA ring so a whole ring of data can be waiting.
+ */
+typedef struct {
+    audio_source_t source;      // Hand this to the players, ctx points back here
+    void* buffer;               // FreeRTOS stream buffer
+    std::atomic<bool> closed;   // Set by pipe_source_close_write, the end of the stream once the buffer is empty
+} pipe_source_t;
+
+esp_err_t pipe_source_init(pipe_source_t* pipe, size_t size);
+
+/**
+ * Writes all of data, blocking while the buffer is full.
+ */
+esp_err_t pipe_source_write(pipe_source_t* pipe, const void* data, size_t size);
+
+/**
+ * Ends the stream, the reader sees the end once it has read everything written before.
+ */
+void pipe_source_close_write(pipe_source_t* pipe);
+
+void pipe_source_free(pipe_source_t* pipe);
+
+/**
+ * Mounts the wear levelled FAT partition with the given label at base_path, after which file_source_open reads its
+ * files. ESP_ERR_NOT_FOUND if the partition table has no such partition.
+ */
+esp_err_t audio_source_mount_fat(const char* partition_label, const char* base_path, int max_files);
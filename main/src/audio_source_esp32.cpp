@@ -0,0 +1,76 @@
+#include "audio_source.h"
+
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_vfs_fat.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/stream_buffer.h>
+
+static const char *TAG = "audio_source";
+
+#define PIPE_POLL_MS            10      // How often a reader waiting on an empty pipe checks whether it has been closed
+
+static esp_err_t pipe_read(void* ctx, char* dst, size_t size, size_t* nr_bytes_read) {
+    pipe_source_t* pipe = (pipe_source_t*) ctx;
+    while (true) {
+        // Closed is read first, so everything written before the close has been taken once the buffer is found empty.
+        // Acquire pairs with the release in pipe_source_close_write, the writer's last bytes are in the buffer by then.
+        const bool closed = pipe->closed.load(std::memory_order_acquire);
+        *nr_bytes_read = xStreamBufferReceive((StreamBufferHandle_t) pipe->buffer, dst, size,
+                                              closed ? 0 : PIPE_POLL_MS / portTICK_PERIOD_MS);
+        if (*nr_bytes_read > 0 || closed) {
+            return ESP_OK;
+        }
+    }
+}
+
+esp_err_t pipe_source_init(pipe_source_t* pipe, size_t size) {
+    pipe->buffer = xStreamBufferCreate(size, 1);
+    if (pipe->buffer == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate a %d byte pipe", size);
+        return ESP_ERR_NO_MEM;
+    }
+    pipe->source.read = pipe_read;
+    pipe->source.seek = nullptr;
+    pipe->source.ctx = pipe;
+    pipe->closed.store(false, std::memory_order_relaxed);
+    return ESP_OK;
+}
+
+esp_err_t pipe_source_write(pipe_source_t* pipe, const void* data, size_t size) {
+    const char* bytes = (const char*) data;
+    while (size > 0) {
+        const size_t nr_bytes_sent = xStreamBufferSend((StreamBufferHandle_t) pipe->buffer, bytes, size, portMAX_DELAY);
+        bytes += nr_bytes_sent;
+        size -= nr_bytes_sent;
+    }
+    return ESP_OK;
+}
+
+void pipe_source_close_write(pipe_source_t* pipe) {
+    pipe->closed.store(true, std::memory_order_release);
+}
+
+void pipe_source_free(pipe_source_t* pipe) {
+    vStreamBufferDelete((StreamBufferHandle_t) pipe->buffer);
+    pipe->buffer = nullptr;
+}
+
+esp_err_t audio_source_mount_fat(const char* partition_label, const char* base_path, int max_files) {
+    if (esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_FAT, partition_label) == nullptr) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_vfs_fat_mount_config_t config = {
+            .format_if_mount_failed = false,
+            .max_files = max_files,
+            .allocation_unit_size = 0
+    };
+    wl_handle_t wl_handle;
+    const esp_err_t err = esp_vfs_fat_spiflash_mount(base_path, partition_label, &config, &wl_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to mount FAT partition %s err=%s", partition_label, esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "Mounted FAT partition %s at %s", partition_label, base_path);
+    return ESP_OK;
+}
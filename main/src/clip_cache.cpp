@@ -0,0 +1,394 @@
+#include "clip_cache.h"
+#include "clip_index.h"
+#include "pcm_convert.h"
+#include "pcm_dsp.h"
+#include "pcm_ramp.h"
+#include "pcm_silence.h"
+#include "playback_trace.h"
+#include "resampler.h"
+#include "wav_player.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <cstring>
+#include <stdlib.h>
+
+static const char *TAG = "clip_cache";
+
+// Resampling splits the player buffer: output blocks at the front, the converted input behind them.
+#define RESAMPLE_OUT_FRAMES     1024
+#define RESAMPLE_IN_FRAMES      ((PLAYER_BUFFER_SIZE - RESAMPLE_OUT_FRAMES * 4) / 4)
+
+typedef struct {
+    wav_data_t clip;
+    pcm_silence_index_t silence;
+    uint32_t last_used;     // Value of use_counter when last hit, 0 when the slot is empty
+} cache_entry_t;
+
+static cache_entry_t entries[CLIP_CACHE_MAX_CLIPS];
+static uint32_t use_counter = 0;
+static clip_cache_stats_t cache_stats;
+
+static cache_entry_t* find_entry(const char* filename) {
+    for (int i = 0; i < CLIP_CACHE_MAX_CLIPS; i++) {
+        if (entries[i].last_used != 0 && strcmp(entries[i].clip.filename, filename) == 0) {
+            return &entries[i];
+        }
+    }
+    return nullptr;
+}
+
+static void evict(cache_entry_t* entry) {
+    ESP_LOGI(TAG, "Evicting %s, %d bytes", entry->clip.filename, entry->clip.nr_bytes);
+    cache_stats.bytes_used -= entry->clip.nr_bytes;
+    cache_stats.evictions++;
+    heap_caps_free(entry->clip.data);
+    free(entry->clip.filename);
+    memset(entry, 0, sizeof(cache_entry_t));
+}
+
+/**
+ * Evicts least recently used clips until nr_bytes fit in the budget and a slot is free. Returns the free slot.
+ */
+static cache_entry_t* make_room(uint32_t nr_bytes) {
+    while (true) {
+        cache_entry_t* lru = nullptr;
+        cache_entry_t* empty = nullptr;
+        for (int i = 0; i < CLIP_CACHE_MAX_CLIPS; i++) {
+            if (entries[i].last_used == 0) {
+                empty = &entries[i];
+            } else if (lru == nullptr || entries[i].last_used < lru->last_used) {
+                lru = &entries[i];
+            }
+        }
+        if (empty != nullptr && cache_stats.bytes_used + nr_bytes <= cache_stats.budget) {
+            return empty;
+        }
+        if (lru == nullptr) {
+            return nullptr;
+        }
+        evict(lru);
+    }
+}
+
+static cache_entry_t* load(const char* filename) {
+
+    const int64_t start_ms = esp_timer_get_time() / 1000;
+
+    FILE* f;
+    wav_header_t wav_header;
+    if (load_wav_header((char*) filename, &wav_header, &f) != ESP_OK) {
+        return nullptr;
+    }
+
+    if (wav_header.FormatID != WAV_FORMAT_PCM) {
+        ESP_LOGW(TAG, "%s is not PCM, stream it with pipeline_play", filename);
+        fclose(f);
+        return nullptr;
+    }
+
+    const uint32_t nr_bytes = wav_header.data.chunk_size;
+    if (nr_bytes > cache_stats.budget) {
+        ESP_LOGW(TAG, "%s needs %d bytes, larger than the whole budget of %d", filename, nr_bytes, cache_stats.budget);
+        fclose(f);
+        return nullptr;
+    }
+
+    cache_entry_t* entry = make_room(nr_bytes);
+    uint32_t caps = MALLOC_CAP_SPIRAM;
+    char* data = (char*) heap_caps_malloc(nr_bytes, caps);
+    if (data == nullptr) {
+        caps = MALLOC_CAP_8BIT;
+        data = (char*) heap_caps_malloc(nr_bytes, caps);
+    }
+    char* name = strdup(filename);
+    if (entry == nullptr || data == nullptr || name == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %d bytes for %s", nr_bytes, filename);
+        heap_caps_free(data);
+        free(name);
+        fclose(f);
+        return nullptr;
+    }
+
+    TRACE_START(read_us);
+    const uint32_t nr_bytes_read = fread(data, sizeof(char), nr_bytes, f);
+    TRACE(TRACE_READ, read_us, nr_bytes_read);
+    fclose(f);
+    if (nr_bytes_read != nr_bytes) {
+        ESP_LOGE(TAG, "%s is truncated, read %d of %d bytes", filename, nr_bytes_read, nr_bytes);
+        heap_caps_free(data);
+        free(name);
+        return nullptr;
+    }
+    // The whole data section is in RAM, so an unchecked clip can be verified without reading it again.
+    const esp_err_t integrity = clip_index_verify_data(filename, data, nr_bytes);
+    if (integrity != ESP_OK && integrity != ESP_ERR_NOT_FOUND) {
+        ESP_LOGE(TAG, "%s failed its integrity check err=%s", filename, esp_err_to_name(integrity));
+        heap_caps_free(data);
+        free(name);
+        return nullptr;
+    }
+
+    // Drop the silence at either end, so it is neither held nor clocked out, then index the runs left inside.
+    uint32_t leading, trailing;
+    pcm_silence_trim(data, nr_bytes, wav_header.NumChannels, wav_header.BitsPerSample, &leading, &trailing);
+    wav_loop_t loop = wav_header.loop;
+    if (loop.end_frame != 0) {
+        // Never into the loop, a silent pass of it is still part of the clip. Leading stays a multiple of 4 bytes.
+        const uint32_t frame_bytes = wav_header.NumChannels * wav_header.BitsPerSample / 8;
+        const uint32_t before = (loop.start_frame * frame_bytes) & ~3u;
+        const uint32_t after = nr_bytes - loop.end_frame * frame_bytes;
+        leading = leading < before ? leading : before;
+        trailing = trailing < after ? trailing : after;
+        loop.start_frame -= leading / frame_bytes;
+        loop.end_frame -= leading / frame_bytes;
+    }
+    const uint32_t nr_kept = nr_bytes - leading - trailing;
+    if (nr_kept != nr_bytes) {
+        memmove(data, data + leading, nr_kept);
+        char* shrunk = (char*) heap_caps_realloc(data, nr_kept, caps);
+        data = shrunk != nullptr ? shrunk : data;
+    }
+    pcm_silence_index(data, nr_kept, wav_header.NumChannels, wav_header.BitsPerSample, &entry->silence);
+
+    entry->clip.data = data;
+    entry->clip.sample_rate = wav_header.SampleRate;
+    entry->clip.nr_bytes = nr_kept;
+    entry->clip.filename = name;
+    entry->clip.num_channels = wav_header.NumChannels;
+    entry->clip.bits_per_sample = wav_header.BitsPerSample;
+    entry->clip.silence = &entry->silence;
+    entry->clip.loop = loop;
+    entry->last_used = ++use_counter;
+    cache_stats.bytes_used += nr_kept;
+    cache_stats.nr_bytes_trimmed += leading + trailing;
+    cache_stats.nr_bytes_silent += entry->silence.nr_bytes;
+
+    ESP_LOGI(TAG, "Cached %s, %d bytes, trimmed %d+%d, %d silent in %d runs. Elapsed time=%lldms used=%d/%d", filename,
+             nr_kept, leading, trailing, entry->silence.nr_bytes, entry->silence.nr_runs,
+             (esp_timer_get_time() / 1000 - start_ms), cache_stats.bytes_used, cache_stats.budget);
+    return entry;
+}
+
+esp_err_t clip_cache_init(uint32_t budget) {
+    memset(entries, 0, sizeof(entries));
+    memset(&cache_stats, 0, sizeof(cache_stats));
+    cache_stats.budget = budget;
+    return ESP_OK;
+}
+
+esp_err_t clip_cache_preload(const char* filename) {
+    if (find_entry(filename) != nullptr) {
+        return ESP_OK;
+    }
+    return load(filename) != nullptr ? ESP_OK : ESP_FAIL;
+}
+
+const wav_data_t* clip_cache_get(const char* filename) {
+    cache_entry_t* entry = find_entry(filename);
+    if (entry != nullptr) {
+        cache_stats.hits++;
+        entry->last_used = ++use_counter;
+        return &entry->clip;
+    }
+
+    cache_stats.misses++;
+    entry = load(filename);
+    return entry != nullptr ? &entry->clip : nullptr;
+}
+
+static void record_first_sample(int64_t request_us) {
+    cache_stats.last_first_sample_us = esp_timer_get_time() - request_us;
+    if (cache_stats.last_first_sample_us > cache_stats.max_first_sample_us) {
+        cache_stats.max_first_sample_us = cache_stats.last_first_sample_us;
+    }
+}
+
+/**
+ * Converts and resamples clip to the sink rate, through the player buffer a block at a time.
+ */
+static esp_err_t stream_resampled(const wav_data_t* clip, const pcm_sink_t* sink, pcm_dsp_t* dsp, int64_t request_us,
+                                  uint32_t* nr_bytes_written) {
+    int16_t* out = (int16_t*) wav_player_buffer();
+    char* in = (char*) (out + RESAMPLE_OUT_FRAMES * 2);
+    const uint32_t frame_bytes = clip->num_channels * clip->bits_per_sample / 8;
+
+    resampler_t resampler;
+    resampler_init(&resampler, clip->sample_rate, sink->sample_rate);
+    const uint32_t nr_out_frames = resampler_output_frames(&resampler, clip->nr_bytes / frame_bytes);
+    const pcm_ramp_config_t* ramp = pcm_ramp_get_config();
+
+    uint32_t offset = 0;
+    uint32_t frame = 0;
+    bool first = true;
+    while (clip->nr_bytes - offset >= frame_bytes) {
+        // Only what the next output block needs, so resampler_process uses all of it.
+        uint32_t nr_frames = (clip->nr_bytes - offset) / frame_bytes;
+        const uint32_t nr_needed = resampler_input_frames(&resampler, RESAMPLE_OUT_FRAMES);
+        nr_frames = nr_frames < nr_needed ? nr_frames : nr_needed;
+        nr_frames = nr_frames < RESAMPLE_IN_FRAMES ? nr_frames : RESAMPLE_IN_FRAMES;
+
+        // The offset can be any frame, copy first so the conversion kernels get aligned words.
+        memcpy(in, clip->data + offset, nr_frames * frame_bytes);
+        pcm_convert_to_stereo16(in, in, nr_frames * frame_bytes, clip->num_channels, clip->bits_per_sample);
+
+        uint32_t nr_used;
+        const uint32_t nr_out = resampler_process(&resampler, (const int16_t*) in, nr_frames, out, RESAMPLE_OUT_FRAMES, &nr_used);
+        offset += nr_used * frame_bytes;
+        pcm_ramp_envelope(out, nr_out, frame, nr_out_frames, ramp->fade_in_frames, ramp->fade_out_frames);
+        pcm_dsp_process(dsp, out, nr_out);
+        frame += nr_out;
+
+        size_t written;
+        const esp_err_t err = sink->write(sink->ctx, (const char*) out, nr_out * 4, &written);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (first) {
+            record_first_sample(request_us);
+            first = false;
+        }
+        *nr_bytes_written += written;
+    }
+    return ESP_OK;
+}
+
+/**
+ * Writes nr_bytes of 16 bit stereo clip data, starting at offset, through the player buffer with the ramps and the
+ * DSP chain applied.
+ */
+static esp_err_t write_ramped(const wav_data_t* clip, const pcm_sink_t* sink, pcm_dsp_t* dsp, uint32_t offset,
+                              uint32_t nr_bytes, uint32_t* nr_bytes_written) {
+    char* buffer = wav_player_buffer();
+    const pcm_ramp_config_t* ramp = pcm_ramp_get_config();
+    const uint32_t end = offset + nr_bytes;
+    while (offset < end) {
+        const uint32_t chunk = end - offset < (PLAYER_BUFFER_SIZE & ~3u) ? end - offset : (PLAYER_BUFFER_SIZE & ~3u);
+        memcpy(buffer, clip->data + offset, chunk);
+        pcm_ramp_envelope((int16_t*) buffer, chunk / 4, offset / 4, clip->nr_bytes / 4, ramp->fade_in_frames, ramp->fade_out_frames);
+        pcm_dsp_process(dsp, (int16_t*) buffer, chunk / 4);
+        size_t written;
+        const esp_err_t err = sink->write(sink->ctx, buffer, chunk, &written);
+        if (err != ESP_OK) {
+            return err;
+        }
+        *nr_bytes_written += written;
+        offset += chunk;
+    }
+    return ESP_OK;
+}
+
+/**
+ * Writes nr_bytes of zeros through the player buffer.
+ */
+static esp_err_t write_zeros(const pcm_sink_t* sink, uint32_t nr_bytes, uint32_t* nr_bytes_written) {
+    char* buffer = wav_player_buffer();
+    const uint32_t size = nr_bytes < (PLAYER_BUFFER_SIZE & ~3u) ? nr_bytes : (PLAYER_BUFFER_SIZE & ~3u);
+    memset(buffer, 0, size);
+    while (nr_bytes > 0) {
+        const uint32_t chunk = nr_bytes < size ? nr_bytes : size;
+        size_t written;
+        const esp_err_t err = sink->write(sink->ctx, buffer, chunk, &written);
+        if (err != ESP_OK) {
+            return err;
+        }
+        *nr_bytes_written += written;
+        nr_bytes -= chunk;
+    }
+    return ESP_OK;
+}
+
+/**
+ * Writes nr_bytes of 16 bit stereo clip data, starting at offset, straight from the clip, except for the indexed
+ * silent runs, which are written as zeros so they are never read.
+ */
+static esp_err_t write_direct(const wav_data_t* clip, const pcm_sink_t* sink, uint32_t offset, uint32_t nr_bytes,
+                              uint32_t* nr_bytes_written) {
+    const uint32_t end = offset + nr_bytes;
+    while (offset < end) {
+        const pcm_silence_run_t* run = pcm_silence_next(clip->silence, offset);
+        const uint32_t run_start = run != nullptr && run->offset < end ? run->offset : end;
+        if (run_start > offset) {
+            size_t written;
+            const esp_err_t err = sink->write(sink->ctx, clip->data + offset, run_start - offset, &written);
+            *nr_bytes_written += written;
+            if (err != ESP_OK) {
+                return err;
+            }
+            offset = run_start;
+        }
+        if (offset < end) {
+            const uint32_t run_end = run->offset + run->nr_bytes < end ? run->offset + run->nr_bytes : end;
+            const esp_err_t err = write_zeros(sink, run_end - offset, nr_bytes_written);
+            if (err != ESP_OK) {
+                return err;
+            }
+            offset = run_end;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t clip_cache_stream(const wav_data_t* clip, const pcm_sink_t* sink, int64_t request_us, uint32_t* nr_bytes_written) {
+    size_t written;
+    esp_err_t err;
+    *nr_bytes_written = 0;
+    pcm_dsp_t dsp;
+    pcm_dsp_init(&dsp);
+
+    if (sink->sample_rate != 0 && clip->sample_rate != sink->sample_rate) {
+        return stream_resampled(clip, sink, &dsp, request_us, nr_bytes_written);
+    }
+
+    const uint32_t expansion = pcm_expansion(clip->num_channels, clip->bits_per_sample);
+    if (expansion == 1) {
+        // Hand over the first descriptor on its own so the first sample latency can be measured. It is copied anyway,
+        // for the fade in, as is the fade out. Only the middle goes straight from the clip.
+        const uint32_t nr_bytes = clip->nr_bytes & ~3u;
+        const pcm_ramp_config_t* ramp = pcm_ramp_get_config();
+        uint32_t head = sink->dma_buf_bytes > ramp->fade_in_frames * 4 ? sink->dma_buf_bytes : ramp->fade_in_frames * 4;
+        head = head != 0 && head < nr_bytes ? head : nr_bytes;
+        // With the DSP chain on every sample changes, so there is no middle and the tail is the rest of the clip.
+        const uint32_t tail_max = pcm_dsp_active(&dsp) ? nr_bytes - head : ramp->fade_out_frames * 4;
+        const uint32_t tail = tail_max < nr_bytes - head ? tail_max : nr_bytes - head;
+
+        err = write_ramped(clip, sink, &dsp, 0, head, nr_bytes_written);
+        if (err != ESP_OK) {
+            return err;
+        }
+        record_first_sample(request_us);
+
+        const uint32_t middle = nr_bytes - head - tail;
+        err = write_direct(clip, sink, head, middle, nr_bytes_written);
+        if (err != ESP_OK) {
+            return err;
+        }
+        return write_ramped(clip, sink, &dsp, head + middle, tail, nr_bytes_written);
+    }
+
+    // Convert through the player buffer, a block at a time, so the clip is never expanded as a whole.
+    char* buffer = wav_player_buffer();
+    const pcm_ramp_config_t* ramp = pcm_ramp_get_config();
+    const uint32_t nr_frames = clip->nr_bytes * expansion / 4;
+    const uint32_t block = (PLAYER_BUFFER_SIZE / expansion) & ~3u;
+    for (uint32_t offset = 0; offset < clip->nr_bytes; offset += block) {
+        const uint32_t nr_bytes = clip->nr_bytes - offset < block ? clip->nr_bytes - offset : block;
+        const uint32_t converted = pcm_convert_to_stereo16(buffer, clip->data + offset, nr_bytes, clip->num_channels, clip->bits_per_sample);
+        pcm_ramp_envelope((int16_t*) buffer, converted / 4, offset * expansion / 4, nr_frames, ramp->fade_in_frames, ramp->fade_out_frames);
+        pcm_dsp_process(&dsp, (int16_t*) buffer, converted / 4);
+        err = sink->write(sink->ctx, buffer, converted, &written);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (offset == 0) {
+            record_first_sample(request_us);
+        }
+        *nr_bytes_written += written;
+    }
+    return ESP_OK;
+}
+
+void clip_cache_get_stats(clip_cache_stats_t* stats) {
+    *stats = cache_stats;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <esp_err.h>
+
+#include "pcm_sink.h"
+#include "wav_file.h"
+
+#define CLIP_CACHE_MAX_CLIPS    8       // Most clips held at once, whatever the budget
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t bytes_used;            // PCM bytes currently held
+    uint32_t budget;                // Most PCM bytes the cache may hold
+    uint32_t nr_bytes_trimmed;      // Silence cut from either end of the clips loaded, never held or played
+    uint32_t nr_bytes_silent;       // Silent runs indexed inside the clips loaded, played from zeros
+    int64_t last_first_sample_us;   // Request to first block accepted by the sink, for the last clip_cache_stream
+    int64_t max_first_sample_us;
+} clip_cache_stats_t;
+
+/**
+ * Sets the memory budget in bytes of PCM data. Clips are placed in PSRAM when available, otherwise internal RAM.
+ */
+esp_err_t clip_cache_init(uint32_t budget);
+
+/**
+ * Loads the data section of filename into the cache, evicting least recently used clips to stay in budget.
+ * Silence at either end is trimmed off and the silent runs inside are indexed, see pcm_silence.h.
+ * Does nothing if the clip is already cached.
+ */
+esp_err_t clip_cache_preload(const char* filename);
+
+/**
+ * Returns the cached clip, loading it first on a miss. Returns nullptr if it cannot be loaded.
+ * The returned clip stays valid until the next clip_cache_get or clip_cache_preload, which may evict it.
+ */
+const wav_data_t* clip_cache_get(const char* filename);
+
+/**
+ * Writes the whole clip straight from the cache to sink, with no copy if it is already 16 bit stereo at the sink rate
+ * apart from the pcm_ramp fade in and fade out, which go through the player buffer, and the indexed silent runs,
+ * which are written from zeros instead of being read from the clip. An active pcm_dsp chain sends it all through
+ * the player buffer.
+ * Other formats and rates are converted block by block through the player buffer, and ramped and processed there.
+ * request_us is the esp_timer_get_time() at which the play was requested, used for the first sample latency.
+ * nr_bytes_written returns the bytes handed to sink, after conversion.
+ */
+esp_err_t clip_cache_stream(const wav_data_t* clip, const pcm_sink_t* sink, int64_t request_us, uint32_t* nr_bytes_written);
+
+void clip_cache_get_stats(clip_cache_stats_t* stats);
@@ -0,0 +1,350 @@
+#include "clip_index.h"
+#include "wav_file.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+#include <nvs.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <stdio.h>
+
+static const char *TAG = "clip_index";
+
+#define VERIFY_TASK_PRIORITY    1       // Below every audio task, it only uses what they leave
+#define VERIFY_TASK_STACK       3072
+#define CRC_CHUNK_SIZE          1024    // Short reads, so the SPIFFS lock is never held long against the pipeline
+#define PATH_SIZE               (CLIP_INDEX_NAME_SIZE + 32)
+#define NVS_KEY                 "index"
+
+typedef struct {
+    uint32_t version;
+    uint32_t image_id;          // CLIP_IMAGE_ID of the SPIFFS image the entries were made from
+    uint32_t nr_clips;
+    clip_index_entry_t entries[CLIP_INDEX_MAX_CLIPS];
+} stored_index_t;
+
+// Written by clip_index_init before the verify task starts, read only after that.
+static stored_index_t index_data;
+static char index_dir[PATH_SIZE - CLIP_INDEX_NAME_SIZE];
+// The verify task, players and the clip cache all move clips out of CLIP_UNVERIFIED.
+static std::atomic<uint8_t> states[CLIP_INDEX_MAX_CLIPS];
+static std::atomic<uint32_t> nr_verified(0);
+static std::atomic<uint32_t> nr_bad(0);
+static bool index_warm = false;
+static int64_t init_us = 0;
+static std::atomic<int64_t> verify_us(0);
+
+static void make_path(char* path, const char* name) {
+    const size_t dir_len = strlen(index_dir);
+    snprintf(path, PATH_SIZE, "%s%s%s", index_dir, dir_len > 0 && index_dir[dir_len - 1] == '/' ? "" : "/", name);
+}
+
+static bool is_wav(const char* name) {
+    const size_t len = strlen(name);
+    return len > 4 && strcasecmp(name + len - 4, ".wav") == 0;
+}
+
+/**
+ * CRCs nr_bytes of f from its current position into *crc. Returns false if the file ends first.
+ */
+static bool crc_file(FILE* f, uint32_t nr_bytes, char* buffer, uint32_t* crc) {
+    *crc = 0;
+    while (nr_bytes > 0) {
+        const uint32_t chunk = nr_bytes < CRC_CHUNK_SIZE ? nr_bytes : CRC_CHUNK_SIZE;
+        if (fread(buffer, 1, chunk, f) != chunk) {
+            return false;
+        }
+        *crc = esp_rom_crc32_le(*crc, (const uint8_t*) buffer, chunk);
+        nr_bytes -= chunk;
+    }
+    return true;
+}
+
+/**
+ * Parses the header and CRCs the data section of entry->name, filling in the rest of the entry.
+ */
+static void scan_file(clip_index_entry_t* entry, char* buffer) {
+    char path[PATH_SIZE];
+    make_path(path, entry->name);
+    entry->scanned_state = CLIP_INVALID;
+    FILE* f = fopen(path, "r");
+    if (f == nullptr) {
+        return;
+    }
+    setvbuf(f, nullptr, _IONBF, 0);
+
+    wav_header_t header;
+    if (wav_parse_header(f, &header, &entry->data_offset) == ESP_OK && validate_wav_data(&header)) {
+        entry->nr_bytes = header.data.chunk_size;
+        entry->sample_rate = header.SampleRate;
+        entry->format_id = header.FormatID;
+        entry->num_channels = header.NumChannels;
+        entry->bits_per_sample = header.BitsPerSample;
+        entry->block_align = header.BlockAlign;
+        const bool whole = !header.data_truncated && crc_file(f, entry->nr_bytes, buffer, &entry->crc32);
+        entry->scanned_state = whole ? CLIP_OK : CLIP_TRUNCATED;
+    }
+    fclose(f);
+}
+
+/**
+ * Re-reads the data section of a clip from an earlier boot and compares its CRC.
+ */
+static clip_state_t verify_file(const clip_index_entry_t* entry, char* buffer) {
+    char path[PATH_SIZE];
+    make_path(path, entry->name);
+    FILE* f = fopen(path, "r");
+    if (f == nullptr) {
+        return CLIP_TRUNCATED;
+    }
+    setvbuf(f, nullptr, _IONBF, 0);
+    uint32_t crc;
+    clip_state_t state = CLIP_TRUNCATED;
+    if (fseek(f, entry->data_offset, SEEK_SET) == 0 && crc_file(f, entry->nr_bytes, buffer, &crc)) {
+        state = crc == entry->crc32 ? CLIP_OK : CLIP_CORRUPT;
+    }
+    fclose(f);
+    return state;
+}
+
+static void set_state(uint32_t i, clip_state_t state) {
+    uint8_t expected = CLIP_UNVERIFIED;
+    if (!states[i].compare_exchange_strong(expected, (uint8_t) state)) {
+        return;     // Someone else got there first, with the same answer
+    }
+    nr_verified.fetch_add(1, std::memory_order_relaxed);
+    if (state != CLIP_OK) {
+        nr_bad.fetch_add(1, std::memory_order_relaxed);
+        ESP_LOGE(TAG, "%s failed its check, state=%d", index_data.entries[i].name, state);
+    }
+}
+
+static void verify_loop(void* buffer) {
+    const int64_t start_us = esp_timer_get_time();
+    for (uint32_t i = 0; i < index_data.nr_clips; i++) {
+        if (states[i].load(std::memory_order_relaxed) == CLIP_UNVERIFIED) {
+            set_state(i, verify_file(&index_data.entries[i], (char*) buffer));
+        }
+    }
+    verify_us.store(esp_timer_get_time() - start_us, std::memory_order_relaxed);
+    ESP_LOGI(TAG, "Verified %d clips, %d bad. Elapsed time=%lldms", index_data.nr_clips,
+             nr_bad.load(std::memory_order_relaxed), verify_us.load(std::memory_order_relaxed) / 1000);
+    heap_caps_free(buffer);
+    vTaskDelete(nullptr);
+}
+
+/**
+ * Lists the WAV files in the directory with their sizes. Returns false if it cannot be read.
+ */
+static bool list_files(stored_index_t* listing) {
+    memset(listing, 0, sizeof(stored_index_t));
+    listing->version = CLIP_INDEX_VERSION;
+    DIR* dir = opendir(index_dir);
+    if (dir == nullptr) {
+        ESP_LOGE(TAG, "Cannot open %s", index_dir);
+        return false;
+    }
+    const struct dirent* item;
+    while ((item = readdir(dir)) != nullptr) {
+        if (!is_wav(item->d_name) || strlen(item->d_name) >= CLIP_INDEX_NAME_SIZE) {
+            continue;
+        }
+        if (listing->nr_clips == CLIP_INDEX_MAX_CLIPS) {
+            ESP_LOGW(TAG, "More than %d clips, %s and later are not indexed", CLIP_INDEX_MAX_CLIPS, item->d_name);
+            break;
+        }
+        clip_index_entry_t* entry = &listing->entries[listing->nr_clips++];
+        strcpy(entry->name, item->d_name);
+        char path[PATH_SIZE];
+        make_path(path, entry->name);
+        struct stat st;
+        entry->file_size = stat(path, &st) == 0 ? (uint32_t) st.st_size : 0;
+    }
+    closedir(dir);
+    return true;
+}
+
+/**
+ * Returns the stored entry for a file of this name and size, or nullptr if it is new or has changed.
+ */
+static const clip_index_entry_t* find_stored(const stored_index_t* stored, const clip_index_entry_t* listed) {
+    for (uint32_t i = 0; i < stored->nr_clips; i++) {
+        if (strcmp(stored->entries[i].name, listed->name) == 0 && stored->entries[i].file_size == listed->file_size) {
+            return &stored->entries[i];
+        }
+    }
+    return nullptr;
+}
+
+static size_t stored_size(uint32_t nr_clips) {
+    return offsetof(stored_index_t, entries) + nr_clips * sizeof(clip_index_entry_t);
+}
+
+static bool load_stored(nvs_handle_t nvs, stored_index_t* stored) {
+    size_t size = sizeof(stored_index_t);
+    if (nvs_get_blob(nvs, NVS_KEY, stored, &size) != ESP_OK || size < offsetof(stored_index_t, entries)) {
+        return false;
+    }
+    return stored->nr_clips <= CLIP_INDEX_MAX_CLIPS && size == stored_size(stored->nr_clips);
+}
+
+esp_err_t clip_index_init(const char* dir, uint32_t image_id) {
+    const int64_t start_us = esp_timer_get_time();
+    if (strlen(dir) >= sizeof(index_dir)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    strcpy(index_dir, dir);
+    nr_verified.store(0, std::memory_order_relaxed);
+    nr_bad.store(0, std::memory_order_relaxed);
+    verify_us.store(0, std::memory_order_relaxed);
+
+    char* buffer = (char*) heap_caps_malloc(CRC_CHUNK_SIZE, MALLOC_CAP_8BIT);
+    if (buffer == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    stored_index_t* listing = (stored_index_t*) heap_caps_malloc(sizeof(stored_index_t), MALLOC_CAP_8BIT);
+    if (listing == nullptr || !list_files(listing)) {
+        heap_caps_free(listing);
+        heap_caps_free(buffer);
+        return listing == nullptr ? ESP_ERR_NO_MEM : ESP_ERR_NOT_FOUND;
+    }
+    listing->image_id = image_id;
+
+    nvs_handle_t nvs;
+    const esp_err_t nvs_err = nvs_open(CLIP_INDEX_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (nvs_err != ESP_OK) {
+        ESP_LOGW(TAG, "NVS not available err=%s, the index will not be kept", esp_err_to_name(nvs_err));
+    }
+
+    // Files the stored index already knows keep the CRC taken when they were first indexed, so a corruption since is
+    // caught rather than adopted. Only new and changed files are scanned. After a reflash a file can change and keep
+    // its size, so nothing stored for another image is trusted.
+    stored_index_t* stored = &index_data;
+    if (nvs_err != ESP_OK || !load_stored(nvs, stored) || stored->version != CLIP_INDEX_VERSION) {
+        stored->nr_clips = 0;
+    } else if (stored->image_id != image_id) {
+        ESP_LOGI(TAG, "SPIFFS image %08x replaced by %08x, rescanning", stored->image_id, image_id);
+        stored->nr_clips = 0;
+    }
+    bool reused[CLIP_INDEX_MAX_CLIPS];
+    uint32_t nr_scanned = 0;
+    for (uint32_t i = 0; i < listing->nr_clips; i++) {
+        const clip_index_entry_t* known = find_stored(stored, &listing->entries[i]);
+        reused[i] = known != nullptr;
+        if (reused[i]) {
+            listing->entries[i] = *known;
+        } else {
+            scan_file(&listing->entries[i], buffer);
+            nr_scanned++;
+        }
+    }
+    index_warm = nr_scanned == 0;
+    const bool changed = nr_scanned > 0 || stored->nr_clips != listing->nr_clips || stored->image_id != image_id;
+    index_data = *listing;
+
+    if (changed && nvs_err == ESP_OK) {
+        esp_err_t err = nvs_set_blob(nvs, NVS_KEY, &index_data, stored_size(index_data.nr_clips));
+        err = err == ESP_OK ? nvs_commit(nvs) : err;
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Could not store the index err=%s", esp_err_to_name(err));
+        }
+    }
+    if (nvs_err == ESP_OK) {
+        nvs_close(nvs);
+    }
+    heap_caps_free(listing);
+
+    // A scan has just checked its files. A stored entry only vouches for what was there when it was made.
+    uint32_t nr_unverified = 0;
+    for (uint32_t i = 0; i < index_data.nr_clips; i++) {
+        const uint8_t scanned = index_data.entries[i].scanned_state;
+        states[i].store(reused[i] && scanned == CLIP_OK ? (uint8_t) CLIP_UNVERIFIED : scanned, std::memory_order_relaxed);
+        if (states[i].load(std::memory_order_relaxed) == CLIP_UNVERIFIED) {
+            nr_unverified++;
+        } else {
+            nr_verified.fetch_add(1, std::memory_order_relaxed);
+            if (scanned != CLIP_OK) {
+                nr_bad.fetch_add(1, std::memory_order_relaxed);
+                ESP_LOGE(TAG, "%s failed its check, state=%d", index_data.entries[i].name, scanned);
+            }
+        }
+    }
+
+    init_us = esp_timer_get_time() - start_us;
+    ESP_LOGI(TAG, "Index of %d clips, %d scanned, %d to verify. Elapsed time=%lldms", index_data.nr_clips, nr_scanned,
+             nr_unverified, init_us / 1000);
+
+    if (nr_unverified == 0) {
+        heap_caps_free(buffer);
+        return ESP_OK;
+    }
+    if (xTaskCreate(verify_loop, "clip_verify", VERIFY_TASK_STACK, buffer, VERIFY_TASK_PRIORITY, nullptr) != pdPASS) {
+        heap_caps_free(buffer);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+static int32_t find_index(const char* filename) {
+    if (filename[0] == '/') {
+        filename++;
+    }
+    for (uint32_t i = 0; i < index_data.nr_clips; i++) {
+        if (strcmp(index_data.entries[i].name, filename) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static esp_err_t state_to_err(uint8_t state) {
+    switch (state) {
+        case CLIP_CORRUPT:
+            return ESP_ERR_INVALID_CRC;
+        case CLIP_TRUNCATED:
+            return ESP_ERR_INVALID_SIZE;
+        case CLIP_INVALID:
+            return ESP_ERR_NOT_SUPPORTED;
+        default:
+            return ESP_OK;
+    }
+}
+
+esp_err_t clip_index_check(const char* filename) {
+    const int32_t i = find_index(filename);
+    return i < 0 ? ESP_ERR_NOT_FOUND : state_to_err(states[i].load(std::memory_order_acquire));
+}
+
+esp_err_t clip_index_verify_data(const char* filename, const char* data, uint32_t nr_bytes) {
+    const int32_t i = find_index(filename);
+    if (i < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    const clip_index_entry_t* entry = &index_data.entries[i];
+    if (states[i].load(std::memory_order_acquire) == CLIP_UNVERIFIED && nr_bytes == entry->nr_bytes) {
+        const uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*) data, nr_bytes);
+        set_state(i, crc == entry->crc32 ? CLIP_OK : CLIP_CORRUPT);
+    }
+    return state_to_err(states[i].load(std::memory_order_acquire));
+}
+
+const clip_index_entry_t* clip_index_find(const char* filename) {
+    const int32_t i = find_index(filename);
+    return i < 0 ? nullptr : &index_data.entries[i];
+}
+
+void clip_index_get_stats(clip_index_stats_t* stats) {
+    stats->nr_clips = index_data.nr_clips;
+    stats->nr_verified = nr_verified.load(std::memory_order_relaxed);
+    stats->nr_bad = nr_bad.load(std::memory_order_relaxed);
+    stats->warm = index_warm;
+    stats->init_us = init_us;
+    stats->verify_us = verify_us.load(std::memory_order_relaxed);
+}
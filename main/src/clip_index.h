@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <esp_err.h>
+
+#define CLIP_INDEX_MAX_CLIPS        16
+#define CLIP_INDEX_NAME_SIZE        32      // CONFIG_SPIFFS_OBJ_NAME_LEN
+#define CLIP_INDEX_VERSION          2       // Bump when clip_index_entry_t changes, older stored indexes are rescanned
+#define CLIP_INDEX_NVS_NAMESPACE    "clip_index"
+
+typedef enum {
+    CLIP_UNVERIFIED,            // Loaded from NVS, the background check has not reached it yet
+    CLIP_OK,                    // Data matches its CRC
+    CLIP_CORRUPT,               // Data no longer matches the CRC taken when it was indexed
+    CLIP_TRUNCATED,             // File ends before the data section does
+    CLIP_INVALID,               // Header does not parse or describes data the players cannot play
+} clip_state_t;
+
+/**
+ * What the scan learnt about one file, as persisted in NVS.
+ */
+typedef struct {
+    char name[CLIP_INDEX_NAME_SIZE];    // File name, no leading '/'
+    uint32_t file_size;                 // To spot a file replaced since the index was stored
+    uint32_t data_offset;
+    uint32_t nr_bytes;                  // Data section size from the header
+    uint32_t crc32;                     // esp_rom_crc32_le of the data section when indexed
+    uint32_t sample_rate;
+    uint16_t format_id;
+    uint16_t num_channels;
+    uint16_t bits_per_sample;
+    uint16_t block_align;
+    uint8_t scanned_state;              // clip_state_t found by the scan, CLIP_OK unless the file was already bad
+} clip_index_entry_t;
+
+typedef struct {
+    uint32_t nr_clips;
+    uint32_t nr_verified;       // Checked this boot, by the scan, the background task or a cache load
+    uint32_t nr_bad;            // Found corrupt, truncated or invalid
+    bool warm;                  // Every entry came from NVS, no file had to be scanned
+    int64_t init_us;            // Time spent in clip_index_init, ie added to the boot
+    int64_t verify_us;          // Time the background check took, 0 until it has finished
+} clip_index_stats_t;
+
+/**
+ * Lists the WAV files in dir. Files already in the index stored in NVS, by name and size, keep their entry and a low
+ * priority task re-checks their CRCs while playback goes on. New and changed files are scanned and CRC'd now, and the
+ * updated index is stored. NVS must already be initialised.
+ *
+ * image_id identifies the flashed SPIFFS image, CLIP_IMAGE_ID from the generated clip_image_id.h. An index stored for
+ * another image is dropped and every file scanned, as a reflashed file of the same size would otherwise look corrupt.
+ *
+ * Called again, as a reboot would, it starts the stats afresh. The background check of the last call must be done.
+ */
+esp_err_t clip_index_init(const char* dir, uint32_t image_id);
+
+/**
+ * Whether filename may be played. A leading '/' is ignored.
+ * ESP_OK if it is fine or not checked yet, ESP_ERR_NOT_FOUND if it is not indexed, ESP_ERR_INVALID_CRC if corrupt,
+ * ESP_ERR_INVALID_SIZE if truncated, ESP_ERR_NOT_SUPPORTED if its header is invalid.
+ */
+esp_err_t clip_index_check(const char* filename);
+
+/**
+ * Verifies an unchecked clip against data already in memory, eg the whole data section read by the clip cache,
+ * so it costs no flash reads. Returns as clip_index_check does afterwards.
+ */
+esp_err_t clip_index_verify_data(const char* filename, const char* data, uint32_t nr_bytes);
+
+/**
+ * Returns the entry for filename, or nullptr. A leading '/' is ignored.
+ */
+const clip_index_entry_t* clip_index_find(const char* filename);
+
+void clip_index_get_stats(clip_index_stats_t* stats);
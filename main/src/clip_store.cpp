@@ -0,0 +1,110 @@
+#include "clip_store.h"
+#include "pcm_silence.h"
+
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <cstring>
+
+static const char *TAG = "clip_store";
+
+static const char* store_base = nullptr;
+static size_t store_size = 0;
+static const clip_table_entry_t* store_entries = nullptr;
+static uint16_t store_nr_clips = 0;
+
+static spi_flash_mmap_handle_t store_mmap_handle;
+
+esp_err_t clip_store_open(const void* base, size_t size) {
+
+    const clip_table_header_t* header = (const clip_table_header_t*) base;
+    if (size < sizeof(clip_table_header_t) || memcmp(header->magic, CLIP_TABLE_MAGIC, 4) != 0) {
+        ESP_LOGW(TAG, "Invalid data - no clip table found");
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (header->version != CLIP_TABLE_VERSION) {
+        ESP_LOGW(TAG, "Invalid data - clip table version %d, expected %d", header->version, CLIP_TABLE_VERSION);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (sizeof(clip_table_header_t) + header->nr_clips * sizeof(clip_table_entry_t) > size) {
+        ESP_LOGW(TAG, "Invalid data - %d clip entries do not fit in %d bytes", header->nr_clips, size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    const clip_table_entry_t* entries = (const clip_table_entry_t*) (header + 1);
+    for (int i = 0; i < header->nr_clips; i++) {
+        if (entries[i].offset > size || entries[i].nr_bytes > size - entries[i].offset
+                || entries[i].name[CLIP_TABLE_NAME_SIZE - 1] != '\0') {
+            ESP_LOGW(TAG, "Invalid data - clip entry %d is corrupt", i);
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+
+    store_base = (const char*) base;
+    store_size = size;
+    store_entries = entries;
+    store_nr_clips = header->nr_clips;
+    ESP_LOGI(TAG, "Opened clip table, %d clips in %d bytes", store_nr_clips, store_size);
+    return ESP_OK;
+}
+
+esp_err_t clip_store_init(const char* partition_label) {
+
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                                (esp_partition_subtype_t) CLIP_STORE_PARTITION_TYPE,
+                                                                partition_label);
+    if (partition == nullptr) {
+        ESP_LOGW(TAG, "No clips partition '%s'", partition_label);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // Flash is mapped through the cache into the data address space, so reads need no copy and no filesystem.
+    const void* base;
+    esp_err_t err = esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &base, &store_mmap_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map clips partition err=%s", esp_err_to_name(err));
+        return err;
+    }
+
+    err = clip_store_open(base, partition->size);
+    if (err != ESP_OK) {
+        spi_flash_munmap(store_mmap_handle);
+    }
+    return err;
+}
+
+const clip_table_entry_t* clip_store_find_entry(const char* name) {
+    if (name[0] == '/') {
+        name++;
+    }
+    for (int i = 0; i < store_nr_clips; i++) {
+        if (strcmp(store_entries[i].name, name) == 0) {
+            return &store_entries[i];
+        }
+    }
+    return nullptr;
+}
+
+esp_err_t clip_store_find(const char* name, wav_data_t* clip) {
+    const clip_table_entry_t* entry = clip_store_find_entry(name);
+    if (entry == nullptr) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (entry->format_id != WAV_FORMAT_PCM) {
+        ESP_LOGW(TAG, "%s is not PCM, format %d", entry->name, entry->format_id);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    // Silence at either end is left in flash rather than clocked out. Only the ends are scanned, internal runs are not
+    // indexed for mapped clips as that would read the whole clip on every find.
+    const char* data = store_base + entry->offset;
+    uint32_t leading, trailing;
+    pcm_silence_trim(data, entry->nr_bytes, entry->num_channels, entry->bits_per_sample, &leading, &trailing);
+    clip->data = (char*) data + leading;        // Read only, it is flash
+    clip->sample_rate = entry->sample_rate;
+    clip->nr_bytes = entry->nr_bytes - leading - trailing;
+    clip->filename = (char*) entry->name;
+    clip->num_channels = entry->num_channels;
+    clip->bits_per_sample = entry->bits_per_sample;
+    clip->silence = nullptr;
+    memset(&clip->loop, 0, sizeof(clip->loop));  // pack_clips.py does not carry smpl chunks over
+    return ESP_OK;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+#include "wav_file.h"
+
+// Layout of the raw clips partition, written by tools/pack_clips.py. All fields little endian.
+//
+//   clip_table_header_t
+//   clip_table_entry_t[nr_clips]
+//   PCM data of each clip, 4 byte aligned
+//
+#define CLIP_TABLE_MAGIC            "CLPS"
+#define CLIP_TABLE_VERSION          1
+#define CLIP_TABLE_NAME_SIZE        32
+#define CLIP_STORE_PARTITION_TYPE   0x40    // First custom data partition subtype
+
+typedef struct {
+    char magic[4];              // Letters "CLPS"
+    uint16_t version;
+    uint16_t nr_clips;
+} clip_table_header_t;
+
+typedef struct {
+    char name[CLIP_TABLE_NAME_SIZE];    // File name the clip was packed from, nul terminated, no leading '/'
+    uint32_t offset;                    // Start of the PCM data from the start of the partition
+    uint32_t nr_bytes;                  // Size of the PCM data
+    uint32_t sample_rate;
+    uint16_t format_id;                 // As wav_header_t.FormatID
+    uint16_t num_channels;
+    uint16_t bits_per_sample;
+    uint16_t block_align;
+} clip_table_entry_t;
+
+/**
+ * Checks and adopts a packed clip table that is already in memory, eg memory mapped flash or a file read on the host.
+ * base must stay valid for as long as clips are played from it.
+ */
+esp_err_t clip_store_open(const void* base, size_t size);
+
+/**
+ * Memory maps the clips partition with the given label and opens the clip table in it.
+ */
+esp_err_t clip_store_init(const char* partition_label);
+
+/**
+ * Fills clip with a pointer straight into the clip table for name. A leading '/' in name is ignored so the
+ * SPIFFS file names can be used unchanged. Silence at either end of the clip is trimmed off, see pcm_silence.h.
+ * Returns ESP_ERR_NOT_SUPPORTED for IMA-ADPCM clips, only pipeline_play decodes those.
+ */
+esp_err_t clip_store_find(const char* name, wav_data_t* clip);
+
+/**
+ * Returns the entry for name, or nullptr.
+ */
+const clip_table_entry_t* clip_store_find_entry(const char* name);
@@ -0,0 +1,39 @@
+#pragma once
+
+// Compile time maths for building tables. C++11 constexpr functions are a single return, hence the recursion.
+
+static constexpr double PI = 3.14159265358979323846;
+
+static constexpr double wrap_pi(double x) {
+    return x > PI ? wrap_pi(x - 2 * PI) : x < -PI ? wrap_pi(x + 2 * PI) : x;
+}
+
+/**
+ * Taylor series, term is x^n / n!, accurate to double precision for |x| <= PI.
+ */
+static constexpr double sin_series(double x2, double term, int n, double sum) {
+    return n > 31 ? sum : sin_series(x2, -term * x2 / ((n + 1) * (n + 2)), n + 2, sum + term);
+}
+
+static constexpr double const_sin(double x) {
+    return sin_series(wrap_pi(x) * wrap_pi(x), wrap_pi(x), 1, 0.0);
+}
+
+static constexpr double const_cos(double x) {
+    return const_sin(x + PI / 2);
+}
+
+template <int... I> struct index_list {};
+
+template <typename A, typename B> struct concat_index_list;
+template <int... A, int... B> struct concat_index_list<index_list<A...>, index_list<B...>> {
+    typedef index_list<A..., (int) sizeof...(A) + B...> type;
+};
+
+// Built by halves, a linear recursion would pass the compiler's template depth limit.
+template <int N> struct make_index_list {
+    typedef typename concat_index_list<typename make_index_list<N / 2>::type,
+                                       typename make_index_list<N - N / 2>::type>::type type;
+};
+template <> struct make_index_list<0> { typedef index_list<> type; };
+template <> struct make_index_list<1> { typedef index_list<0> type; };
@@ -1,9 +1,33 @@
 #include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
 #include <esp_spiffs.h>
+#include <nvs_flash.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <driver/i2s.h>                       // Library of I2S routines, comes with ESP32 standard install
 #include <cstring>
 #include <errno.h>
 
+#include "audio_pool.h"
+#include "audio_source.h"
+#include "audio_service.h"
+#include "clip_cache.h"
+#include "clip_index.h"
+#include "clip_store.h"
+#include "mixer.h"
+#include "pcm_dsp.h"
+#include "pcm_ramp.h"
+#include "pcm_synth.h"
+#include "phrase.h"
+#include "playback_bench.h"
+#include "playback_pipeline.h"
+#include "playback_trace.h"
+#include "sequence.h"
+#include "wav_file.h"
+#include "wav_player.h"
+#include "clip_image_id.h"                     // Generated from spiffs_data by tools/clip_image_id.py
+
 extern "C" {
     void app_main();
 }
@@ -19,7 +43,7 @@ static const i2s_port_t i2s_num = I2S_NUM_0;  // i2s port number
 
 static const i2s_config_t i2s_config = {
         .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX),
-        .sample_rate = 44100,                            // Note, this will be changed later
+        .sample_rate = 44100,                            // Fixed, clips are resampled to it. Only the legacy play_wav_file<> policies change it
         .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
         .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT, // ie Stereo
         .communication_format = (i2s_comm_format_t) I2S_COMM_FORMAT_STAND_I2S,
@@ -33,6 +57,12 @@ static const i2s_config_t i2s_config = {
         .bits_per_chan = I2S_BITS_PER_CHAN_DEFAULT
 };
 
+#define I2S_FRAME_BYTES         4       // 16 bit stereo
+#define I2S_EVENT_QUEUE_SIZE    8       // One event per DMA descriptor, the driver drops the oldest when full
+#define I2S_EVENT_TIMEOUT_MS    1000    // Far longer than any DMA descriptor takes to send
+
+static QueueHandle_t i2s_event_queue = nullptr;
+
 static const i2s_pin_config_t pin_config = {
         .mck_io_num = I2S_PIN_NO_CHANGE,
         .bck_io_num = SPEAKER_BIT_CLOCK,                  // The bit clock connection, goes to pin 27 of ESP32
@@ -41,45 +71,89 @@ static const i2s_pin_config_t pin_config = {
         .data_in_num = I2S_PIN_NO_CHANGE                  // we are not interested in I2S data into the ESP32
 };
 
-typedef struct {
-    // Data Section
-    char chunkID[4];            // The letters "data" (if it is a data section), otherwise LIST or similar)
-    uint32_t chunk_size;        // Size of the data that follows
-} wav_chunk_t;
-
-typedef struct {
-    //   RIFF Section
-    char RIFFSectionID[4];      // Letters "RIFF"
-    uint32_t Size;              // Size of entire file less 8
-    char RiffFormat[4];         // Letters "WAVE"
-
-    //   Format Section
-    char FormatSectionID[4];    // letters "fmt"
-    uint32_t FormatSize;        // Size of format section less 8
-    uint16_t FormatID;          // 1=uncompressed PCM
-    uint16_t NumChannels;       // 1=mono,2=stereo
-    uint32_t SampleRate;        // 44100, 16000, 8000 etc.
-    uint32_t ByteRate;          // =SampleRate * Channels * (BitsPerSample/8)
-    uint16_t BlockAlign;        // =Channels * (BitsPerSample/8)
-    uint16_t BitsPerSample;     // 8,16,24 or 32
-    wav_chunk_t data;
-} wav_header_t;
-
-typedef struct {
-    char* data;
-    uint32_t sample_rate;
-    uint32_t nr_bytes;
-    char* filename;
-} wav_data_t;
+#define AUDIO_POOL_BLOCKS       (PIPELINE_MAX_BLOCKS + 2)   // Pipeline ring while it plays, the mixer output and a spare
 
-#define WAV_HEADER_SIZE sizeof(wav_header_t)
 #define SILENCE_SIZE 8096
 char* SILENCE;
 
-// NB All WAV files must be stereo because that is the channel_format we provide in i2s_config
+// NB The legacy play_wav_file<> policies need stereo 16 bit files because that is the channel_format we provide in i2s_config,
+// and they reprogram the I2S clock to each file's rate. The pipelined, cached, mapped and mixed players convert mono and
+// 8 bit files on the fly and resample everything to i2s_config.sample_rate, so the clock is never touched.
+// IMA-ADPCM files, 4 times smaller in SPIFFS, can only be played with play_wav_file_pipelined.
 #define FILE_ON_YOUR_MARKS              "/OYM-USA-male-1-16000.wav"
 #define FILE_ON_YOUR_MARKS_NO_MIDDLE    "/OYM-USA-male-1-NoMiddle.wav"
 
+#define CLIP_INDEX_DIR          "/"             // SPIFFS is mounted at the root, see init_sound
+#define CLIP_CACHE_BUDGET       (128 * 1024)    // PCM bytes kept in RAM, enough for both clips above
+#define CLIP_STORE_PARTITION    "clips"         // Raw partition packed by tools/pack_clips.py
+#define FAT_PARTITION           "audio_fat"     // Optional wear levelled FAT partition, not in partitions.csv as shipped
+#define FAT_BASE_PATH           "/fat"          // Where file_source_open finds the FAT partition's files
+#define FAT_MAX_FILES           5
+#define PIPE_FEED_CHUNK         512             // Bytes per write into the pipe, about what a UART driver hands over
+#define PIPE_FEED_TASK_STACK    3072
+#define PIPE_FEED_TASK_PRIORITY 3               // Below the pipeline reader, like any other producer of data
+#define MIXER_CUE_GAIN          (MIXER_GAIN_UNITY / 2)  // Beep level under the voice
+#define MIXER_CUE_DELAY_MS      500             // Second cue starts while the first is still playing
+
+// Clip IDs for audio_service_send, indexes into AUDIO_CUES.
+#define CUE_ON_YOUR_MARKS               0
+#define CUE_ON_YOUR_MARKS_NO_MIDDLE     1
+static const char* const AUDIO_CUES[] = {FILE_ON_YOUR_MARKS, FILE_ON_YOUR_MARKS_NO_MIDDLE};
+
+#define SEQUENCE_GAP_FRAMES     4410            // 100ms at 44.1kHz from the end of one cue to the start of the next
+static const sequence_item_t CUE_SEQUENCE[] = {{FILE_ON_YOUR_MARKS, 0}, {FILE_ON_YOUR_MARKS_NO_MIDDLE, SEQUENCE_GAP_FRAMES}};
+
+// Announcements assembled from the speech units in main/phrase_units.txt, no WAV per variant. Only on_your_marks is
+// recorded so far, so ON_YOUR_MARKS_PHRASE is the only one that plays or can be benchmarked.
+static const phrase_t ON_YOUR_MARKS_PHRASE = {{"on_your_marks"}, 1};
+#define ANNOUNCE_LANE           3               // Example result for announce_result
+#define ANNOUNCE_TIME_MS        12340
+
+// Countdown pips and the start tone, rendered by pcm_synth rather than stored in SPIFFS.
+#define COUNTDOWN_PIPS          3
+#define COUNTDOWN_PIP_MS        1000            // From the start of one pip to the start of the next
+static const pcm_tone_t COUNTDOWN_PIP = {PCM_WAVE_SINE, 1000, 1000, PCM_SYNTH_GAIN_UNITY / 2, 150, 5, 20, 40,
+                                         PCM_SYNTH_GAIN_UNITY * 3 / 4};
+static const pcm_tone_t START_TONE = {PCM_WAVE_TRIANGLE, 1000, 1500, PCM_SYNTH_GAIN_UNITY / 2, 600, 5, 50, 150,
+                                      PCM_SYNTH_GAIN_UNITY / 2};
+
+/**
+ * pcm_sink_t that blocks until the data has been copied into the I2S DMA buffers.
+ */
+static esp_err_t i2s_sink_write(void* ctx, const char* data, size_t size, size_t* nr_bytes_written) {
+    return i2s_write(i2s_num, data, size, nr_bytes_written, portMAX_DELAY);
+}
+
+/**
+ * Counts I2S_EVENT_TX_DONE events, one per DMA descriptor sent, until nr_buffers have gone out.
+ */
+static esp_err_t i2s_sink_wait_sent(void* ctx, uint32_t nr_buffers) {
+    // Events from before the last write are stale. Discarding them may cost one extra descriptor of waiting, never less.
+    xQueueReset(i2s_event_queue);
+    while (nr_buffers > 0) {
+        i2s_event_t event;
+        if (xQueueReceive(i2s_event_queue, &event, I2S_EVENT_TIMEOUT_MS / portTICK_PERIOD_MS) != pdTRUE) {
+            ESP_LOGW(TAG, "Timed out waiting for I2S TX done with %d buffers outstanding", nr_buffers);
+            return ESP_ERR_TIMEOUT;
+        }
+        if (event.type == I2S_EVENT_TX_DONE) {
+            nr_buffers--;
+        }
+    }
+    return ESP_OK;
+}
+
+static const pcm_sink_t i2s_sink = {
+        .write = i2s_sink_write,
+        .wait_sent = i2s_sink_wait_sent,
+        .ctx = nullptr,
+        .dma_buf_bytes = (uint32_t) i2s_config.dma_buf_len * I2S_FRAME_BYTES,
+        .dma_buf_count = (uint32_t) i2s_config.dma_buf_count,
+        .sample_rate = (uint32_t) i2s_config.sample_rate
+};
+
+static const pcm_sink_t* sink = &i2s_sink;    // i2s_sink, or wrapped by trace_sink when PLAYBACK_TRACE is on
+
 static void init_sound() {
 
     // Configure SPIFFS for reading WAV file
@@ -91,135 +165,77 @@ static void init_sound() {
     };
     ESP_ERROR_CHECK(esp_vfs_spiffs_register(&conf));
 
+    // Optional, only there if a FAT partition labelled FAT_PARTITION has been added to partitions.csv.
+    if (audio_source_mount_fat(FAT_PARTITION, FAT_BASE_PATH, FAT_MAX_FILES) != ESP_OK) {
+        ESP_LOGI(TAG, "No FAT partition, files only play from SPIFFS");
+    }
+
+    // NVS keeps the clip index from one boot to the next.
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        err = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(err);
+
+    // Scans and CRCs every clip on the first boot. After that the stored index is checked in the background.
+    if (clip_index_init(CLIP_INDEX_DIR, CLIP_IMAGE_ID) != ESP_OK) {
+        ESP_LOGW(TAG, "Clip index not available, clips will play unchecked");
+    }
+
     // Initialise i2s sound pins.
-    ESP_ERROR_CHECK(i2s_driver_install(i2s_num, &i2s_config, 0, nullptr));   // Allocate resources to run I2S. NB not using an event queue TODO Try using an event queue!!!
+    ESP_ERROR_CHECK(i2s_driver_install(i2s_num, &i2s_config, I2S_EVENT_QUEUE_SIZE, &i2s_event_queue));   // Allocate resources to run I2S. The event queue reports when DMA descriptors have been sent
     ESP_ERROR_CHECK(i2s_set_pin(i2s_num, &pin_config));                      // Tell it the pins you will be using
 
     SILENCE = (char*) malloc(SILENCE_SIZE);
     memset(SILENCE, 0, SILENCE_SIZE);
-}
 
+    ESP_ERROR_CHECK(audio_pool_init(AUDIO_POOL_BLOCKS));                      // Every DMA capable audio block, allocated once
 
-static bool validate_wav_data(wav_header_t* Wav) {
+    // Loudness and tone for the venue, applied to every stream before it goes to the DMA. Left at unity gain with no
+    // EQ the clips play bit for bit.
+    //pcm_dsp_config_t dsp = *pcm_dsp_get_config();
+    //dsp.gain = PCM_DSP_GAIN_UNITY * 3 / 2;
+    //dsp.eq = true;
+    //pcm_biquad_design(PCM_EQ_HIGH_PASS, 150, 0.707f, 0, i2s_config.sample_rate, &dsp.biquad);
+    //pcm_dsp_set_config(&dsp);
 
-    if (memcmp(Wav->RIFFSectionID, "RIFF", 4) != 0) {
-        ESP_LOGW(TAG, "Invalid data - Not RIFF format");
-        return false;
-    }
-    if (memcmp(Wav->RiffFormat, "WAVE", 4) != 0) {
-        ESP_LOGW(TAG, "Invalid data - Not Wave file");
-        return false;
-    }
-    if (memcmp(Wav->FormatSectionID, "fmt", 3) != 0) {
-        ESP_LOGW(TAG, "Invalid data - No format section found");
-        return false;
-    }
-    if (memcmp(Wav->data.chunkID, "data", 4) != 0) {
-        ESP_LOGW(TAG, "Invalid data - data section not found");
-        return false;
-    }
-    if (Wav->FormatID != 1) {
-        ESP_LOGW(TAG, "Invalid data - format Id must be 1");
-        return false;
-    }
-    if (Wav->FormatSize!=16) {
-        ESP_LOGW(TAG, "Invalid data - format section size must be 16.");
-        return false;
-    }
-    if ((Wav->NumChannels != 1) && (Wav->NumChannels != 2)) {
-        ESP_LOGW(TAG, "Invalid data - only mono or stereo permitted.");
-        return false;
-    }
-    if (Wav->SampleRate > 48000) {
-        ESP_LOGW(TAG, "Invalid data - Sample rate cannot be greater than 48000");
-        return false;
-    }
-    if ((Wav->BitsPerSample != 8) && (Wav->BitsPerSample != 16)) {
-        ESP_LOGW(TAG, "Invalid data - Only 8 or 16 bits per sample permitted.");
-        return false;
-    }
-    return true;
-}
+    sink = trace_sink(&i2s_sink);                                             // Times every write when PLAYBACK_TRACE is on
 
-static void log_wav_header(wav_header_t* Wav) {
-    if (memcmp(Wav->RIFFSectionID, "RIFF", 4) != 0) {
-        ESP_LOGE(TAG, "Not a RIFF format file - '%s'", Wav->RIFFSectionID);
-        return;
-    }
-    if (memcmp(Wav->RiffFormat, "WAVE", 4) != 0) {
-        ESP_LOGE(TAG, "Not a WAVE file -  '%s'", Wav->RiffFormat);
-        return;
-    }
-    if (memcmp(Wav->FormatSectionID, "fmt", 3) != 0) {
-        ESP_LOGE(TAG, "fmt ID not present - '%s'", Wav->FormatSectionID);
-        return;
-    }
-    if (memcmp(Wav->data.chunkID, "data", 4) != 0) {
-        ESP_LOGE(TAG, "data ID not present - '%s'", Wav->data.chunkID);
-        return;
-    }
-    // All looks good, dump the data
-    ESP_LOGI(TAG, "Total size : %d", Wav->Size);
-    ESP_LOGI(TAG, "Format section size : %d", Wav->FormatSize);
-    ESP_LOGI(TAG, "Wave format : %d", Wav->FormatID);
-    ESP_LOGI(TAG, "Channels : %d", Wav->NumChannels);
-    ESP_LOGI(TAG, "Sample Rate : %d", Wav->SampleRate);
-    ESP_LOGI(TAG, "Byte Rate : %d", Wav->ByteRate);
-    ESP_LOGI(TAG, "Block Align : %d", Wav->BlockAlign);
-    ESP_LOGI(TAG, "Bits Per Sample : %d", Wav->BitsPerSample);
-    ESP_LOGI(TAG, "Data Size : %d", Wav->data.chunk_size);
-}
-
-/**
- * Loads the wav file and populates the pointer to the header and the pointer to the opened File.
- */
-static esp_err_t load_wav_header(char* filename, wav_header_t* wav_header, FILE** f) {
+    ESP_ERROR_CHECK(wav_player_init());                                       // One DMA capable block buffer for every play
+    ESP_ERROR_CHECK(pipeline_init(sink));                                // Start the reader and writer tasks
 
-    const int64_t start_ms = esp_timer_get_time() / 1000;
-
-    // Use POSIX and C standard library functions to work with files.
-    // Open the file for reading.
-    ESP_LOGI(TAG, "Opening file");
-    *f = fopen(filename, "r");
-    if (*f == nullptr) {
-        ESP_LOGE(TAG, "Failed to open file for reading errno=%d err=str=%s", errno, strerror(errno));
-        return ESP_FAIL;
+    // Preload the cues so they can start without touching SPIFFS. One the clip index refuses stays out of the cache,
+    // and playing it reports the error, rather than the board rebooting over one bad file.
+    ESP_ERROR_CHECK(clip_cache_init(CLIP_CACHE_BUDGET));
+    for (const char* cue : AUDIO_CUES) {
+        const esp_err_t preload_err = clip_cache_preload(cue);
+        if (preload_err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to preload %s err=%s", cue, esp_err_to_name(preload_err));
+        }
     }
 
-    // Read Wav header
-    char buffer[WAV_HEADER_SIZE];
-    fread(buffer, WAV_HEADER_SIZE, 1, *f);
-
-    // Validate it.
-    memcpy(wav_header, &buffer, WAV_HEADER_SIZE);  // Copy the header part of the wav data into our structure
+    ESP_ERROR_CHECK(mixer_init(sink));                                   // Mixer task sleeps until the first voice
 
-    // If we have NOT found the data chunk then keep reading chunks until we find it.
-    while (memcmp(wav_header->data.chunkID, "data", 4) != 0) {
-        ESP_LOGI(TAG, "Skipping past WAV chunk %s", wav_header->data.chunkID);
-        fread(buffer, wav_header->data.chunk_size, 1, *f); // read past these data for this chunk.
-        fread(buffer, sizeof(wav_chunk_t), 1, *f); // read the start of the next chunk.
-        memcpy(&wav_header->data, &buffer, sizeof(wav_chunk_t));  // Copy the data chunk header into the data header
+    // Optional, only there if the clips partition has been flashed.
+    if (clip_store_init(CLIP_STORE_PARTITION) != ESP_OK) {
+        ESP_LOGW(TAG, "Clip store not available, play_mapped_clip will not work");
     }
 
-    log_wav_header(wav_header);                // Dump the header data to serial, optional!
-    if (!validate_wav_data(wav_header)) {
-        ESP_LOGW(TAG, "Could not validate the Sound");
-        return ESP_FAIL;
-    }
-
-    ESP_LOGI(TAG, "Loaded wav header - Finish. filename=%s Elapsed time=%lldms free_heap=%d", filename, (esp_timer_get_time() / 1000 - start_ms), heap_caps_get_free_size(MALLOC_CAP_8BIT));
-
-    return ESP_OK;
+    ESP_ERROR_CHECK(audio_service_init(AUDIO_CUES, sizeof(AUDIO_CUES) / sizeof(AUDIO_CUES[0])));  // Task that plays cues on command
 }
 
+
 /**
  * Loop
- * - Read WAV_DATA_BUFFER_SIZE
- * - Write all WAV_DATA_BUFFER_SIZE
+ * - Read Policy::block_size
+ * - Write all of it, or just the bytes that were read for the last block (Policy::tail)
  *
- * No appended SILENCE.
+ * Then flush with SILENCE as described by the Policy. See legacy_policy_1..9 in wav_player.h for the
+ * play_wav_file1..9 experiments this replaces.
  */
-static void play_wav_file1(char* filename) {
+template <typename Policy>
+static void play_wav_file(char* filename) {
 
     FILE* f;
     wav_header_t wav_header;
@@ -229,423 +245,356 @@ static void play_wav_file1(char* filename) {
     ESP_ERROR_CHECK(i2s_set_sample_rates(i2s_num, wav_header.SampleRate));   //set sample rate
 
     // Read the data and send it to I2S to play
-    const uint32_t WAV_DATA_BUFFER_SIZE = 1024;
-    ESP_LOGI(TAG, "play_wav_file - Start sample_rate=%d free_heap=%d", wav_header.SampleRate, heap_caps_get_free_size(MALLOC_CAP_8BIT));
-    char* data = (char*) malloc(WAV_DATA_BUFFER_SIZE);
+    ESP_LOGI(TAG, "play_wav_file - Start sample_rate=%d block_size=%d free_heap=%d", wav_header.SampleRate, Policy::block_size, heap_caps_get_free_size(MALLOC_CAP_8BIT));
 
     const int64_t start_ms = esp_timer_get_time() / 1000;
-    uint32_t nr_bytes_written;
-    //ESP_ERROR_CHECK(i2s_start(i2s_num));
-    while (true) {
-        memset(data, 0, WAV_DATA_BUFFER_SIZE); // Clear buffer.
-        const uint32_t nr_bytes = fread(data, sizeof(char), WAV_DATA_BUFFER_SIZE, f);
-        if (nr_bytes == 0) {
-            break;
-        }
-        ESP_ERROR_CHECK(i2s_write(i2s_num, data, WAV_DATA_BUFFER_SIZE, &nr_bytes_written, portMAX_DELAY));
-        if (nr_bytes != WAV_DATA_BUFFER_SIZE) {
-            ESP_LOGI(TAG, "play_wav_file - last chunk read nr_bytes_read=%d bytes_written=%d. Ceasing playback now", nr_bytes, nr_bytes_written);
-            break;
-        }
-    }
+    ESP_ERROR_CHECK(wav_player_stream<Policy>(f, sink, SILENCE, SILENCE_SIZE));
     fclose(f);
     //ESP_ERROR_CHECK(i2s_set_dac_mode(I2S_DAC_CHANNEL_DISABLE)); // Disable channel at end of playback to avoid clicking noise. Taken from https://github.com/earlephilhower/ESP8266Audio/issues/406
-    //ESP_ERROR_CHECK(i2s_zero_dma_buffer(i2s_num)); // Fill dma buffer with zeroes until it is full.
-    //ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
-    //ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
     //ESP_ERROR_CHECK(i2s_stop(i2s_num)); // Stop i2s at end of playback to avoid clicking noise
-    free(data);
 
     ESP_LOGI(TAG, "play_wav_file - Finish. filename=%s Elapsed time=%lldms free_heap=%d", filename, (esp_timer_get_time() / 1000 - start_ms), heap_caps_get_free_size(MALLOC_CAP_8BIT));
 }
 
+typedef struct {
+    file_source_t file;
+    pipe_source_t pipe;
+} pipe_feed_t;
+
 /**
- * Loop
- * - Read WAV_DATA_BUFFER_SIZE
- * - Write all WAV_DATA_BUFFER_SIZE
- *
- * Write full SILENCE buffer.
+ * Copies a file into a pipe a little at a time, standing in for a task that receives the WAV over a UART.
  */
-static void play_wav_file2(char* filename) {
-
-    FILE* f;
-    wav_header_t wav_header;
-    ESP_ERROR_CHECK(load_wav_header(filename, &wav_header, &f));
-
-    // Set sample rate
-    ESP_ERROR_CHECK(i2s_set_sample_rates(i2s_num, wav_header.SampleRate));   //set sample rate
-
-    // Read the data and send it to I2S to play
-    const uint32_t WAV_DATA_BUFFER_SIZE = 1024;
-    ESP_LOGI(TAG, "play_wav_file - Start sample_rate=%d free_heap=%d", wav_header.SampleRate, heap_caps_get_free_size(MALLOC_CAP_8BIT));
-    char* data = (char*) malloc(WAV_DATA_BUFFER_SIZE);
+static void pipe_feeder(void* arg) {
+    pipe_feed_t* feed = (pipe_feed_t*) arg;
+    char chunk[PIPE_FEED_CHUNK];
+    size_t nr_bytes_read;
+    while (feed->file.source.read(feed->file.source.ctx, chunk, sizeof(chunk), &nr_bytes_read) == ESP_OK
+           && nr_bytes_read > 0) {
+        pipe_source_write(&feed->pipe, chunk, nr_bytes_read);
+    }
+    pipe_source_close_write(&feed->pipe);
+    vTaskDelete(nullptr);
+}
 
-    const int64_t start_ms = esp_timer_get_time() / 1000;
-    uint32_t nr_bytes_written;
-    //ESP_ERROR_CHECK(i2s_start(i2s_num));
-    while (true) {
-        memset(data, 0, WAV_DATA_BUFFER_SIZE); // Clear buffer.
-        const uint32_t nr_bytes_read = fread(data, sizeof(char), WAV_DATA_BUFFER_SIZE, f);
-        if (nr_bytes_read == 0) {
-            break;
-        }
-        ESP_ERROR_CHECK(i2s_write(i2s_num, data, WAV_DATA_BUFFER_SIZE, &nr_bytes_written, portMAX_DELAY));
-        if (nr_bytes_read != WAV_DATA_BUFFER_SIZE) {
-            ESP_LOGI(TAG, "play_wav_file - last chunk read nr_bytes_read=%d bytes_written=%d. Ceasing playback now", nr_bytes_read, nr_bytes_written);
-            break;
-        }
+/**
+ * Opens filename and starts a pipe_feeder copying it into a pipe sized to the DMA ring.
+ */
+static esp_err_t start_pipe_feed(pipe_feed_t* feed, const char* filename) {
+    esp_err_t err = file_source_open(&feed->file, filename);
+    if (err != ESP_OK) {
+        return err;
     }
-    fclose(f);
-    //ESP_ERROR_CHECK(i2s_set_dac_mode(I2S_DAC_CHANNEL_DISABLE)); // Disable channel at end of playback to avoid clicking noise. Taken from https://github.com/earlephilhower/ESP8266Audio/issues/406
-    //ESP_ERROR_CHECK(i2s_zero_dma_buffer(i2s_num)); // Fill dma buffer with zeroes until it is full.
-    //ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
-    ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
-    //ESP_ERROR_CHECK(i2s_stop(i2s_num)); // Stop i2s at end of playback to avoid clicking noise
-    free(data);
+    err = pipe_source_init(&feed->pipe, sink->dma_buf_bytes * sink->dma_buf_count);
+    if (err != ESP_OK) {
+        file_source_close(&feed->file);
+        return err;
+    }
+    xTaskCreate(pipe_feeder, "pipe_feeder", PIPE_FEED_TASK_STACK, feed, PIPE_FEED_TASK_PRIORITY, nullptr);
+    return ESP_OK;
+}
 
-    ESP_LOGI(TAG, "play_wav_file - Finish. filename=%s Elapsed time=%lldms free_heap=%d", filename, (esp_timer_get_time() / 1000 - start_ms), heap_caps_get_free_size(MALLOC_CAP_8BIT));
+/**
+ * Takes whatever the reader left in the pipe, the feeder is done once the pipe reports its end, then frees it all.
+ */
+static void finish_pipe_feed(pipe_feed_t* feed) {
+    char discard[PIPE_FEED_CHUNK];
+    while (audio_source_read_fully(&feed->pipe.source, discard, sizeof(discard)) > 0) {
+    }
+    pipe_source_free(&feed->pipe);
+    file_source_close(&feed->file);
 }
 
 /**
- * Loop
- * - Read WAV_DATA_BUFFER_SIZE
- * - Write all WAV_DATA_BUFFER_SIZE
+ * Streams the WAV file from source through the reader/writer pipeline, the pipeline's ring being the read ahead.
  *
- * Write full SILENCE buffer.
- * Write full SILENCE buffer.
+ * Write SILENCE to the end of the current DMA descriptor, then wait until it has been sent.
  */
-static void play_wav_file3(char* filename) {
+static void play_source_pipelined(const audio_source_t* source, const char* name) {
 
-    FILE* f;
+    const int64_t start_ms = esp_timer_get_time() / 1000;
     wav_header_t wav_header;
-    ESP_ERROR_CHECK(load_wav_header(filename, &wav_header, &f));
+    uint32_t data_offset;
+    if (wav_parse_source_header(source, &wav_header, &data_offset) != ESP_OK || !validate_wav_data(&wav_header)) {
+        ESP_LOGW(TAG, "play_source_pipelined - %s is not a WAV file the port can play", name);
+        return;
+    }
 
-    // Set sample rate
-    ESP_ERROR_CHECK(i2s_set_sample_rates(i2s_num, wav_header.SampleRate));   //set sample rate
+    pipeline_stats_t stats;
+    ESP_ERROR_CHECK(pipeline_play_source(source, &wav_header, &stats));
+    ESP_ERROR_CHECK(wav_player_flush_to_dma_boundary(sink, stats.nr_bytes_written, SILENCE, SILENCE_SIZE, true));
 
-    // Read the data and send it to I2S to play
-    const uint32_t WAV_DATA_BUFFER_SIZE = 1024;
-            ESP_LOGI(TAG, "play_wav_file - Start sample_rate=%d free_heap=%d", wav_header.SampleRate, heap_caps_get_free_size(MALLOC_CAP_8BIT));
-    char* data = (char*) malloc(WAV_DATA_BUFFER_SIZE);
+    ESP_LOGI(TAG, "play_source_pipelined - Finish. name=%s underruns=%d high_water=%d Elapsed time=%lldms", name,
+             stats.underruns, stats.high_water, (esp_timer_get_time() / 1000 - start_ms));
+}
 
-    const int64_t start_ms = esp_timer_get_time() / 1000;
-    uint32_t nr_bytes_written;
-    //ESP_ERROR_CHECK(i2s_start(i2s_num));
-    while (true) {
-        memset(data, 0, WAV_DATA_BUFFER_SIZE); // Clear buffer.
-        const uint32_t nr_bytes_read = fread(data, sizeof(char), WAV_DATA_BUFFER_SIZE, f);
-        if (nr_bytes_read == 0) {
-            break;
-        }
-        ESP_ERROR_CHECK(i2s_write(i2s_num, data, WAV_DATA_BUFFER_SIZE, &nr_bytes_written, portMAX_DELAY));
-        if (nr_bytes_read != WAV_DATA_BUFFER_SIZE) {
-            ESP_LOGI(TAG, "play_wav_file - last chunk read nr_bytes_read=%d bytes_written=%d. Ceasing playback now", nr_bytes_read, nr_bytes_written);
-            break;
-        }
-    }
-    fclose(f);
-    //ESP_ERROR_CHECK(i2s_set_dac_mode(I2S_DAC_CHANNEL_DISABLE)); // Disable channel at end of playback to avoid clicking noise. Taken from https://github.com/earlephilhower/ESP8266Audio/issues/406
-    //ESP_ERROR_CHECK(i2s_zero_dma_buffer(i2s_num)); // Fill dma buffer with zeroes until it is full.
-    ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
-    ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
-    //ESP_ERROR_CHECK(i2s_stop(i2s_num)); // Stop i2s at end of playback to avoid clicking noise
-    free(data);
+/**
+ * Plays filename as if it were arriving over a byte stream: a task copies it into a pipe sized to the DMA ring and
+ * the pipeline reads the pipe.
+ */
+static void play_wav_file_piped(const char* filename) {
 
-    ESP_LOGI(TAG, "play_wav_file - Finish. filename=%s Elapsed time=%lldms free_heap=%d", filename, (esp_timer_get_time() / 1000 - start_ms), heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    pipe_feed_t feed;
+    if (start_pipe_feed(&feed, filename) != ESP_OK) {
+        return;
+    }
+    play_source_pipelined(&feed.pipe.source, filename);
+    finish_pipe_feed(&feed);
 }
 
-
 /**
- * Loop
- * - Read WAV_DATA_BUFFER_SIZE
- * - Write all WAV_DATA_BUFFER_SIZE
- *
- * No appended SILENCE.
- *
- * Sames as 1 except WAV_BUFFER 8096
+ * Benchmarks reading filename from SPIFFS, through a buffered FILE in 1 KB reads as the first players did and
+ * unbuffered a descriptor at a time, from the clips partition with no file system, from a copy in RAM and through a
+ * pipe, see playback_bench_source.
  */
-static void play_wav_file4(char* filename) {
+static void bench_sources(const char* filename) {
 
-    FILE* f;
+    FILE* f = fopen(filename, "rb");
     wav_header_t wav_header;
-    ESP_ERROR_CHECK(load_wav_header(filename, &wav_header, &f));
-
-    // Set sample rate
-    ESP_ERROR_CHECK(i2s_set_sample_rates(i2s_num, wav_header.SampleRate));   //set sample rate
+    uint32_t data_offset;
+    if (f != nullptr && wav_parse_header(f, &wav_header, &data_offset) == ESP_OK) {
+        file_source_t buffered;
+        file_source_wrap(&buffered, f);
+        playback_bench_read(&buffered.source, "spiffs 1K", wav_header.data.chunk_size, 1024, sink->dma_buf_bytes,
+                            wav_header.ByteRate);
+    }
+    if (f != nullptr) {
+        fclose(f);
+    }
 
-    // Read the data and send it to I2S to play
-    const uint32_t WAV_DATA_BUFFER_SIZE = 8096;
-    ESP_LOGI(TAG, "play_wav_file - Start sample_rate=%d free_heap=%d", wav_header.SampleRate, heap_caps_get_free_size(MALLOC_CAP_8BIT));
-    char* data = (char*) malloc(WAV_DATA_BUFFER_SIZE);
+    const clip_table_entry_t* entry = clip_store_find_entry(filename);
+    partition_source_t part;
+    if (entry != nullptr && partition_source_open(&part, CLIP_STORE_PARTITION, entry->offset, entry->nr_bytes) == ESP_OK) {
+        playback_bench_read(&part.source, "partition", entry->nr_bytes, sink->dma_buf_bytes, sink->dma_buf_bytes,
+                            entry->sample_rate * entry->block_align);
+    }
 
-    const int64_t start_ms = esp_timer_get_time() / 1000;
-    uint32_t nr_bytes_written;
-    //ESP_ERROR_CHECK(i2s_start(i2s_num));
-    while (true) {
-        memset(data, 0, WAV_DATA_BUFFER_SIZE); // Clear buffer.
-        const uint32_t nr_bytes_read = fread(data, sizeof(char), WAV_DATA_BUFFER_SIZE, f);
-        if (nr_bytes_read == 0) {
-            break;
-        }
-        ESP_ERROR_CHECK(i2s_write(i2s_num, data, WAV_DATA_BUFFER_SIZE, &nr_bytes_written, portMAX_DELAY));
-        if (nr_bytes_read != WAV_DATA_BUFFER_SIZE) {
-            ESP_LOGI(TAG, "play_wav_file - last chunk read nr_bytes_read=%d bytes_written=%d. Ceasing playback now", nr_bytes_read, nr_bytes_written);
-            break;
-        }
+    file_source_t file;
+    ESP_ERROR_CHECK(file_source_open(&file, filename));
+    ESP_ERROR_CHECK(playback_bench_source(&file.source, "spiffs", sink->dma_buf_bytes));
+
+    // The same file again from a copy in RAM.
+    fseek(file.f, 0, SEEK_END);
+    const size_t size = ftell(file.f);
+    ESP_ERROR_CHECK(file.source.seek(file.source.ctx, 0));
+    char* copy = (char*) heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    if (copy != nullptr) {
+        memory_source_t memory;
+        memory_source_init(&memory, copy, audio_source_read_fully(&file.source, copy, size));
+        ESP_ERROR_CHECK(playback_bench_source(&memory.source, "ram", sink->dma_buf_bytes));
+        heap_caps_free(copy);
     }
-    fclose(f);
-    //ESP_ERROR_CHECK(i2s_set_dac_mode(I2S_DAC_CHANNEL_DISABLE)); // Disable channel at end of playback to avoid clicking noise. Taken from https://github.com/earlephilhower/ESP8266Audio/issues/406
-    //ESP_ERROR_CHECK(i2s_zero_dma_buffer(i2s_num)); // Fill dma buffer with zeroes until it is full.
-    //ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
-    //ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
-    //ESP_ERROR_CHECK(i2s_stop(i2s_num)); // Stop i2s at end of playback to avoid clicking noise
-    free(data);
+    file_source_close(&file);
 
-    ESP_LOGI(TAG, "play_wav_file - Finish. filename=%s Elapsed time=%lldms free_heap=%d", filename, (esp_timer_get_time() / 1000 - start_ms), heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    pipe_feed_t feed;
+    ESP_ERROR_CHECK(start_pipe_feed(&feed, filename));
+    ESP_ERROR_CHECK(playback_bench_source(&feed.pipe.source, "pipe", sink->dma_buf_bytes));
+    finish_pipe_feed(&feed);
 }
 
 /**
- * Loop
- * - Read WAV_DATA_BUFFER_SIZE
- * - Write just bytes that were read
+ * The data section is streamed through the reader/writer pipeline so that SPIFFS reads overlap with the I2S DMA draining.
  *
- * No appended SILENCE.
+ * Write SILENCE to the end of the current DMA descriptor, then wait until it has been sent.
  */
-static void play_wav_file5(char* filename) {
+static void play_wav_file_pipelined(char* filename) {
 
     FILE* f;
     wav_header_t wav_header;
     ESP_ERROR_CHECK(load_wav_header(filename, &wav_header, &f));
 
-    // Set sample rate
-    ESP_ERROR_CHECK(i2s_set_sample_rates(i2s_num, wav_header.SampleRate));   //set sample rate
-
-    // Read the data and send it to I2S to play
-    const uint32_t WAV_DATA_BUFFER_SIZE = 8096;
     ESP_LOGI(TAG, "play_wav_file - Start sample_rate=%d free_heap=%d", wav_header.SampleRate, heap_caps_get_free_size(MALLOC_CAP_8BIT));
-    char* data = (char*) malloc(WAV_DATA_BUFFER_SIZE);
-
     const int64_t start_ms = esp_timer_get_time() / 1000;
-    uint32_t nr_bytes_written;
-    //ESP_ERROR_CHECK(i2s_start(i2s_num));
-    while (true) {
-        memset(data, 0, WAV_DATA_BUFFER_SIZE); // Clear buffer.
-        const uint32_t nr_bytes = fread(data, sizeof(char), WAV_DATA_BUFFER_SIZE, f);
-        if (nr_bytes == 0) {
-            break;
-        }
-        ESP_ERROR_CHECK(i2s_write(i2s_num, data, nr_bytes, &nr_bytes_written, portMAX_DELAY));
-        if (nr_bytes != WAV_DATA_BUFFER_SIZE) {
-            ESP_LOGI(TAG, "play_wav_file - last chunk read nr_bytes_read=%d bytes_written=%d. Ceasing playback now", nr_bytes, nr_bytes_written);
-            break;
-        }
-    }
+
+    pipeline_stats_t stats;
+    ESP_ERROR_CHECK(pipeline_play(f, &wav_header, &stats));
     fclose(f);
-    //ESP_ERROR_CHECK(i2s_set_dac_mode(I2S_DAC_CHANNEL_DISABLE)); // Disable channel at end of playback to avoid clicking noise. Taken from https://github.com/earlephilhower/ESP8266Audio/issues/406
-    //ESP_ERROR_CHECK(i2s_zero_dma_buffer(i2s_num)); // Fill dma buffer with zeroes until it is full.
-    //ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
-    //ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
-    //ESP_ERROR_CHECK(i2s_stop(i2s_num)); // Stop i2s at end of playback to avoid clicking noise
-    free(data);
 
-    ESP_LOGI(TAG, "play_wav_file - Finish. filename=%s Elapsed time=%lldms free_heap=%d", filename, (esp_timer_get_time() / 1000 - start_ms), heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    const int64_t tail_start_us = esp_timer_get_time();
+    ESP_ERROR_CHECK(wav_player_flush_to_dma_boundary(sink, stats.nr_bytes_written, SILENCE, SILENCE_SIZE, true));
+    ESP_LOGI(TAG, "play_wav_file - tail latency=%lldms", (esp_timer_get_time() - tail_start_us) / 1000);
+
+    ESP_LOGI(TAG, "play_wav_file - Finish. filename=%s underruns=%d Elapsed time=%lldms free_heap=%d", filename, stats.underruns, (esp_timer_get_time() / 1000 - start_ms), heap_caps_get_free_size(MALLOC_CAP_8BIT));
 }
 
 /**
- * Loop
- * - Read WAV_DATA_BUFFER_SIZE
- * - Write just bytes that were read
+ * Pips COUNTDOWN_PIPS times, then sounds the start tone, all synthesised in the pipeline reader task.
  *
- * Write SILENCE until end of next 8K block
+ * Each tone is padded to the DMA descriptor boundary, only the last one waits for it to be sent.
  */
-static void play_wav_file6(char* filename) {
-
-    FILE* f;
-    wav_header_t wav_header;
-    ESP_ERROR_CHECK(load_wav_header(filename, &wav_header, &f));
-
-    // Set sample rate
-    ESP_ERROR_CHECK(i2s_set_sample_rates(i2s_num, wav_header.SampleRate));   //set sample rate
-
-    // Read the data and send it to I2S to play
-    const uint32_t WAV_DATA_BUFFER_SIZE = 8096;
-    ESP_LOGI(TAG, "play_wav_file - Start sample_rate=%d free_heap=%d", wav_header.SampleRate, heap_caps_get_free_size(MALLOC_CAP_8BIT));
-    char* data = (char*) malloc(WAV_DATA_BUFFER_SIZE);
+static void play_countdown() {
 
     const int64_t start_ms = esp_timer_get_time() / 1000;
-    uint32_t nr_bytes_written;
-    uint32_t nr_bytes_read = fread(data, sizeof(char), WAV_DATA_BUFFER_SIZE, f);
-    //ESP_ERROR_CHECK(i2s_start(i2s_num));
-    while (true) {
-        memset(data, 0, WAV_DATA_BUFFER_SIZE); // Clear buffer.
-        nr_bytes_read = fread(data, sizeof(char), WAV_DATA_BUFFER_SIZE, f);
-        if (nr_bytes_read == 0) {
-            break;
-        }
-        ESP_ERROR_CHECK(i2s_write(i2s_num, data, nr_bytes_read, &nr_bytes_written, portMAX_DELAY));
-        if (nr_bytes_read != WAV_DATA_BUFFER_SIZE) {
-            ESP_LOGI(TAG, "play_wav_file - last chunk read nr_bytes_read=%d bytes_written=%d. Ceasing playback now", nr_bytes_read, nr_bytes_written);
-            break;
+    for (int i = 0; i <= COUNTDOWN_PIPS; i++) {
+        const int64_t pip_us = esp_timer_get_time();
+        const bool last = i == COUNTDOWN_PIPS;
+        pipeline_stats_t stats;
+        ESP_ERROR_CHECK(pipeline_play_tone(last ? &START_TONE : &COUNTDOWN_PIP, &stats));
+        ESP_ERROR_CHECK(wav_player_flush_to_dma_boundary(sink, stats.nr_bytes_written, SILENCE, SILENCE_SIZE, last));
+        if (!last) {
+            const int64_t wait_ms = (pip_us / 1000 + COUNTDOWN_PIP_MS) - esp_timer_get_time() / 1000;
+            vTaskDelay(wait_ms > 0 ? wait_ms / portTICK_PERIOD_MS : 0);
         }
     }
-    fclose(f);
-    //ESP_ERROR_CHECK(i2s_set_dac_mode(I2S_DAC_CHANNEL_DISABLE)); // Disable channel at end of playback to avoid clicking noise. Taken from https://github.com/earlephilhower/ESP8266Audio/issues/406
-    //ESP_ERROR_CHECK(i2s_zero_dma_buffer(i2s_num)); // Fill dma buffer with zeroes until it is full.
-    ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE - nr_bytes_read, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
-    //ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
-    //ESP_ERROR_CHECK(i2s_stop(i2s_num)); // Stop i2s at end of playback to avoid clicking noise
-    free(data);
 
-    ESP_LOGI(TAG, "play_wav_file - Finish. filename=%s Elapsed time=%lldms free_heap=%d", filename, (esp_timer_get_time() / 1000 - start_ms), heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    ESP_LOGI(TAG, "play_countdown - Finish. Elapsed time=%lldms", (esp_timer_get_time() / 1000 - start_ms));
 }
 
-
 /**
- * Loop
- * - Read WAV_DATA_BUFFER_SIZE
- * - Write just bytes that were read
+ * Plays the clip straight out of the RAM clip cache, no file open or header parse on a hit.
  *
- * Write SILENCE until end of next 8K block
- * Write full SILENCE buffer.
+ * Write SILENCE to the end of the current DMA descriptor, then wait until it has been sent.
  */
-static void play_wav_file7(char* filename) {
-
-    FILE* f;
-    wav_header_t wav_header;
-    ESP_ERROR_CHECK(load_wav_header(filename, &wav_header, &f));
+static void play_cached_clip(const char* filename) {
 
-    // Set sample rate
-    ESP_ERROR_CHECK(i2s_set_sample_rates(i2s_num, wav_header.SampleRate));   //set sample rate
-
-    // Read the data and send it to I2S to play
-    const uint32_t WAV_DATA_BUFFER_SIZE = 8096;
-    ESP_LOGI(TAG, "play_wav_file - Start sample_rate=%d free_heap=%d", wav_header.SampleRate, heap_caps_get_free_size(MALLOC_CAP_8BIT));
-    char* data = (char*) malloc(WAV_DATA_BUFFER_SIZE);
-
-    const int64_t start_ms = esp_timer_get_time() / 1000;
-    uint32_t nr_bytes_written;
-    uint32_t nr_bytes_read = fread(data, sizeof(char), WAV_DATA_BUFFER_SIZE, f);
-    //ESP_ERROR_CHECK(i2s_start(i2s_num));
-    while (true) {
-        memset(data, 0, WAV_DATA_BUFFER_SIZE); // Clear buffer.
-        nr_bytes_read = fread(data, sizeof(char), WAV_DATA_BUFFER_SIZE, f);
-        if (nr_bytes_read == 0) {
-            break;
-        }
-        ESP_ERROR_CHECK(i2s_write(i2s_num, data, nr_bytes_read, &nr_bytes_written, portMAX_DELAY));
-        if (nr_bytes_read != WAV_DATA_BUFFER_SIZE) {
-            ESP_LOGI(TAG, "play_wav_file - last chunk read nr_bytes_read=%d bytes_written=%d. Ceasing playback now", nr_bytes_read, nr_bytes_written);
-            break;
-        }
+    const int64_t request_us = esp_timer_get_time();
+    const wav_data_t* clip = clip_cache_get(filename);
+    if (clip == nullptr) {
+        ESP_LOGW(TAG, "play_cached_clip - Could not load %s", filename);
+        return;
     }
-    fclose(f);
-    //ESP_ERROR_CHECK(i2s_set_dac_mode(I2S_DAC_CHANNEL_DISABLE)); // Disable channel at end of playback to avoid clicking noise. Taken from https://github.com/earlephilhower/ESP8266Audio/issues/406
-    //ESP_ERROR_CHECK(i2s_zero_dma_buffer(i2s_num)); // Fill dma buffer with zeroes until it is full.
-    ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE - nr_bytes_read, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
-    ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
-    //ESP_ERROR_CHECK(i2s_stop(i2s_num)); // Stop i2s at end of playback to avoid clicking noise
-    free(data);
 
-    ESP_LOGI(TAG, "play_wav_file - Finish. filename=%s Elapsed time=%lldms free_heap=%d", filename, (esp_timer_get_time() / 1000 - start_ms), heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    uint32_t nr_bytes_written;
+    ESP_ERROR_CHECK(clip_cache_stream(clip, sink, request_us, &nr_bytes_written));
+    ESP_ERROR_CHECK(wav_player_flush_to_dma_boundary(sink, nr_bytes_written, SILENCE, SILENCE_SIZE, true));
+
+    clip_cache_stats_t stats;
+    clip_cache_get_stats(&stats);
+    ESP_LOGI(TAG, "play_cached_clip - Finish. filename=%s first_sample=%lldus (max %lldus) hits=%d misses=%d trimmed=%d silent=%d Elapsed time=%lldms",
+             filename, stats.last_first_sample_us, stats.max_first_sample_us, stats.hits, stats.misses,
+             stats.nr_bytes_trimmed, stats.nr_bytes_silent, (esp_timer_get_time() - request_us) / 1000);
 }
 
 /**
- * Loop
- * - Read WAV_DATA_BUFFER_SIZE
- * - Write just bytes that were read
+ * Plays the clip straight out of memory mapped flash in the clips partition. No filesystem, no copies.
  *
- * Write full SILENCE buffer.
- * Write full SILENCE buffer.
+ * Write SILENCE to the end of the current DMA descriptor, then wait until it has been sent.
  */
-static void play_wav_file8(char* filename) {
+static void play_mapped_clip(const char* filename) {
 
-    FILE* f;
-    wav_header_t wav_header;
-    ESP_ERROR_CHECK(load_wav_header(filename, &wav_header, &f));
+    const int64_t request_us = esp_timer_get_time();
+    wav_data_t clip;
+    if (clip_store_find(filename, &clip) != ESP_OK) {
+        ESP_LOGW(TAG, "play_mapped_clip - %s is not in the clip store", filename);
+        return;
+    }
 
-    // Set sample rate
-    ESP_ERROR_CHECK(i2s_set_sample_rates(i2s_num, wav_header.SampleRate));   //set sample rate
+    uint32_t nr_bytes_written;
+    ESP_ERROR_CHECK(clip_cache_stream(&clip, sink, request_us, &nr_bytes_written));
+    ESP_ERROR_CHECK(wav_player_flush_to_dma_boundary(sink, nr_bytes_written, SILENCE, SILENCE_SIZE, true));
 
-    // Read the data and send it to I2S to play
-    const uint32_t WAV_DATA_BUFFER_SIZE = 8096;
-    ESP_LOGI(TAG, "play_wav_file - Start sample_rate=%d free_heap=%d", wav_header.SampleRate, heap_caps_get_free_size(MALLOC_CAP_8BIT));
-    char* data = (char*) malloc(WAV_DATA_BUFFER_SIZE);
+    ESP_LOGI(TAG, "play_mapped_clip - Finish. filename=%s Elapsed time=%lldms", filename, (esp_timer_get_time() - request_us) / 1000);
+}
+
+/**
+ * Plays both cues through the mixer, the second one starting over the first, MIXER_CUE_DELAY_MS after the first
+ * by the output clock. Both stay in the clip cache while they play because nothing else is loaded into it.
+ */
+static void play_mixed_cues() {
+
+    const wav_data_t* voice = clip_cache_get(FILE_ON_YOUR_MARKS);
+    const wav_data_t* cue = clip_cache_get(FILE_ON_YOUR_MARKS_NO_MIDDLE);
+    if (voice == nullptr || cue == nullptr) {
+        ESP_LOGW(TAG, "play_mixed_cues - Could not load the cues");
+        return;
+    }
 
     const int64_t start_ms = esp_timer_get_time() / 1000;
-    uint32_t nr_bytes_written;
-    uint32_t nr_bytes_read = fread(data, sizeof(char), WAV_DATA_BUFFER_SIZE, f);
-    //ESP_ERROR_CHECK(i2s_start(i2s_num));
-    while (true) {
-        memset(data, 0, WAV_DATA_BUFFER_SIZE); // Clear buffer.
-        nr_bytes_read = fread(data, sizeof(char), WAV_DATA_BUFFER_SIZE, f);
-        if (nr_bytes_read == 0) {
-            break;
-        }
-        ESP_ERROR_CHECK(i2s_write(i2s_num, data, nr_bytes_read, &nr_bytes_written, portMAX_DELAY));
-        if (nr_bytes_read != WAV_DATA_BUFFER_SIZE) {
-            ESP_LOGI(TAG, "play_wav_file - last chunk read nr_bytes_read=%d bytes_written=%d. Ceasing playback now", nr_bytes_read, nr_bytes_written);
-            break;
-        }
+    mixer_voice_t first;
+    esp_err_t err = mixer_play(voice, MIXER_GAIN_UNITY, esp_timer_get_time(), &first);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "play_mixed_cues - Could not play %s err=%s", FILE_ON_YOUR_MARKS, esp_err_to_name(err));
+        return;
+    }
+    mixer_voice_times_t first_times;
+    do {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    } while (mixer_get_voice_times(first, &first_times) == ESP_OK && first_times.first_us == 0);
+
+    const pcm_ramp_config_t* ramp = pcm_ramp_get_config();
+    const int64_t cue_us = first_times.first_us + MIXER_CUE_DELAY_MS * 1000;
+    mixer_start_t start;
+    start.gain = MIXER_CUE_GAIN;
+    start.start_frame = 0;
+    start.fade_in_frames = ramp->fade_in_frames;
+    start.fade_out_frames = ramp->fade_out_frames;
+    start.request_us = esp_timer_get_time();
+    start.start_us = cue_us;
+    start.loop_count = MIXER_LOOP_AS_AUTHORED;
+    mixer_voice_t second;
+    err = mixer_play_at(cue, &start, &second);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "play_mixed_cues - Could not play %s err=%s", FILE_ON_YOUR_MARKS_NO_MIDDLE, esp_err_to_name(err));
+    }
+    while (mixer_active_voices() > 0) {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    mixer_voice_times_t times;
+    if (err == ESP_OK && mixer_get_voice_times(second, &times) == ESP_OK) {
+        ESP_LOGI(TAG, "play_mixed_cues - Cue due at %lldus, first sample %+lldus, last sample %+lldus", cue_us,
+                 times.first_us - cue_us, times.last_us - cue_us);
     }
-    fclose(f);
-    //ESP_ERROR_CHECK(i2s_set_dac_mode(I2S_DAC_CHANNEL_DISABLE)); // Disable channel at end of playback to avoid clicking noise. Taken from https://github.com/earlephilhower/ESP8266Audio/issues/406
-    //ESP_ERROR_CHECK(i2s_zero_dma_buffer(i2s_num)); // Fill dma buffer with zeroes until it is full.
-    ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
-    ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
-    //ESP_ERROR_CHECK(i2s_stop(i2s_num)); // Stop i2s at end of playback to avoid clicking noise
-    free(data);
 
-    ESP_LOGI(TAG, "play_wav_file - Finish. filename=%s Elapsed time=%lldms free_heap=%d", filename, (esp_timer_get_time() / 1000 - start_ms), heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    mixer_stats_t stats;
+    mixer_get_stats(&stats);
+    ESP_LOGI(TAG, "play_mixed_cues - Finish. blocks=%d max_voices=%d clipped=%d max_block_mix=%lldus Elapsed time=%lldms",
+             stats.nr_blocks, stats.max_voices, stats.clipped_samples, stats.max_block_mix_us,
+             (esp_timer_get_time() / 1000 - start_ms));
 }
 
 /**
- * Loop
- * - Read WAV_DATA_BUFFER_SIZE
- * - Write all WAV_DATA_BUFFER_SIZE
- *
- * Write full SILENCE buffer.
- * Write full SILENCE buffer.
- *
- * Sames as 3 except WAV_DATA_BUFFER = 8096.
+ * Announces a lane's result, eg "lane three twelve point three four seconds", as one stream of speech units. Does
+ * nothing until "lane", the numbers and the time words are recorded, see main/phrase_units.txt.
  */
-static void play_wav_file9(char* filename) {
+static void announce_result(uint32_t lane, uint32_t time_ms) {
+
+    phrase_t phrase;
+    phrase_init(&phrase);
+    ESP_ERROR_CHECK(phrase_add(&phrase, "lane"));
+    ESP_ERROR_CHECK(phrase_add_number(&phrase, lane));
+    ESP_ERROR_CHECK(phrase_add_time(&phrase, time_ms));
+    if (phrase_find_units(&phrase) != ESP_OK) {
+        ESP_LOGW(TAG, "announce_result - Inert, its speech units are not recorded yet");
+        return;
+    }
 
-    FILE* f;
-    wav_header_t wav_header;
-    ESP_ERROR_CHECK(load_wav_header(filename, &wav_header, &f));
+    sequence_stats_t stats;
+    if (phrase_play(&phrase, MIXER_GAIN_UNITY, &stats) != ESP_OK) {
+        ESP_LOGW(TAG, "announce_result - Could not play the announcement");
+        return;
+    }
+    ESP_LOGI(TAG, "announce_result - Finish. units=%d frames=%lld max_preroll=%lldus late_starts=%d", stats.nr_clips,
+             stats.nr_frames, stats.max_preroll_us, stats.late_starts);
+}
 
-    // Set sample rate
-    ESP_ERROR_CHECK(i2s_set_sample_rates(i2s_num, wav_header.SampleRate));   //set sample rate
+/**
+ * Logs the command to first sample latency of the audio service, the mixer does the last part of the work.
+ */
+static void log_audio_service_stats() {
+
+    audio_service_stats_t stats;
+    audio_service_get_stats(&stats);
+    mixer_stats_t mixer;
+    mixer_get_stats(&mixer);
+    ESP_LOGI(TAG, "audio_service - commands=%d dropped=%d failed=%d dispatch=%lldus (max %lldus) first_sample=%lldus (max %lldus)",
+             stats.nr_commands, stats.nr_dropped, stats.nr_failed, stats.last_dispatch_us, stats.max_dispatch_us,
+             mixer.last_first_sample_us, mixer.max_first_sample_us);
+}
 
-    // Read the data and send it to I2S to play
-    const uint32_t WAV_DATA_BUFFER_SIZE = 8096;
-    ESP_LOGI(TAG, "play_wav_file - Start sample_rate=%d free_heap=%d", wav_header.SampleRate, heap_caps_get_free_size(MALLOC_CAP_8BIT));
-    char* data = (char*) malloc(WAV_DATA_BUFFER_SIZE);
+static void log_clip_index_stats() {
 
-    const int64_t start_ms = esp_timer_get_time() / 1000;
-    uint32_t nr_bytes_written;
-    //ESP_ERROR_CHECK(i2s_start(i2s_num));
-    while (true) {
-        memset(data, 0, WAV_DATA_BUFFER_SIZE); // Clear buffer.
-        const uint32_t nr_bytes = fread(data, sizeof(char), WAV_DATA_BUFFER_SIZE, f);
-        if (nr_bytes == 0) {
-            break;
-        }
-        ESP_ERROR_CHECK(i2s_write(i2s_num, data, WAV_DATA_BUFFER_SIZE, &nr_bytes_written, portMAX_DELAY));
-        if (nr_bytes != WAV_DATA_BUFFER_SIZE) {
-            ESP_LOGI(TAG, "play_wav_file - last chunk read nr_bytes_read=%d bytes_written=%d. Ceasing playback now", nr_bytes, nr_bytes_written);
-            break;
-        }
-    }
-    fclose(f);
-    //ESP_ERROR_CHECK(i2s_set_dac_mode(I2S_DAC_CHANNEL_DISABLE)); // Disable channel at end of playback to avoid clicking noise. Taken from https://github.com/earlephilhower/ESP8266Audio/issues/406
-    //ESP_ERROR_CHECK(i2s_zero_dma_buffer(i2s_num)); // Fill dma buffer with zeroes until it is full.
-    ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
-    ESP_ERROR_CHECK(i2s_write(i2s_num, SILENCE, SILENCE_SIZE, &nr_bytes_written, portMAX_DELAY)); // Write zero bytes to try to flush the remaining sound before we stop the channel
-    //ESP_ERROR_CHECK(i2s_stop(i2s_num)); // Stop i2s at end of playback to avoid clicking noise
-    free(data);
+    clip_index_stats_t stats;
+    clip_index_get_stats(&stats);
+    ESP_LOGI(TAG, "clip_index - %s clips=%d verified=%d bad=%d init=%lldms verify=%lldms", stats.warm ? "warm" : "cold",
+             stats.nr_clips, stats.nr_verified, stats.nr_bad, stats.init_us / 1000, stats.verify_us / 1000);
+}
 
-    ESP_LOGI(TAG, "play_wav_file - Finish. filename=%s Elapsed time=%lldms free_heap=%d", filename, (esp_timer_get_time() / 1000 - start_ms), heap_caps_get_free_size(MALLOC_CAP_8BIT));
+static void log_audio_pool_stats() {
+
+    audio_pool_stats_t stats;
+    audio_pool_get_stats(&stats);
+    ESP_LOGI(TAG, "audio_pool - free=%d/%d high_water=%d acquired=%d exhausted=%d dma_free=%d dma_largest_free=%d",
+             stats.nr_free, stats.nr_blocks, stats.nr_blocks - stats.min_free, stats.nr_acquired, stats.nr_exhausted,
+             stats.dma_free, stats.dma_largest_free);
 }
 
 void app_main(void) {
@@ -656,6 +605,18 @@ void app_main(void) {
     // Normal start up.
     ESP_LOGI(TAG, "Finished setup");
 
+    // Compare every playback strategy against a simulated DMA ring, no speaker needed.
+    //ESP_ERROR_CHECK(playback_bench_run(FILE_ON_YOUR_MARKS, i2s_sink.dma_buf_bytes, i2s_sink.dma_buf_count,
+    //                                   i2s_sink.sample_rate, SILENCE, SILENCE_SIZE));
+    //ESP_ERROR_CHECK(playback_bench_convert(1000));
+    //ESP_ERROR_CHECK(playback_bench_adpcm(1000));
+    //ESP_ERROR_CHECK(playback_bench_dsp(i2s_sink.sample_rate, CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ, 1000));
+    //ESP_ERROR_CHECK(playback_bench_synth(i2s_sink.sample_rate, 1000));
+    //ESP_ERROR_CHECK(playback_bench_resample(i2s_sink.sample_rate, 1000));
+    //ESP_ERROR_CHECK(playback_bench_mix(FILE_ON_YOUR_MARKS, i2s_sink.dma_buf_bytes, i2s_sink.dma_buf_count, 100));
+    //ESP_ERROR_CHECK(playback_bench_phrase(&ON_YOUR_MARKS_PHRASE, FILE_ON_YOUR_MARKS_NO_MIDDLE, 100));
+    //bench_sources(FILE_ON_YOUR_MARKS);
+
     // loop playing WAV then pause for 3 seconds, then play again.
 
     while (true) {
@@ -669,7 +630,7 @@ void app_main(void) {
          *
          * No appended SILENCE.
          */
-        //play_wav_file1((char*) FILE_ON_YOUR_MARKS); // Plays "OnYourMark Mar" in each cycle
+        //play_wav_file<legacy_policy_1>((char*) FILE_ON_YOUR_MARKS); // Plays "OnYourMark Mar" in each cycle
 
         /**
          * Loop
@@ -678,7 +639,7 @@ void app_main(void) {
          *
          * Write full SILENCE buffer.
          */
-        //play_wav_file2((char*) FILE_ON_YOUR_MARKS); // Plays "OnYourMark (soft click)" in each cycle
+        //play_wav_file<legacy_policy_2>((char*) FILE_ON_YOUR_MARKS); // Plays "OnYourMark (soft click)" in each cycle
 
         /**
          * Loop
@@ -689,9 +650,69 @@ void app_main(void) {
          * Write full SILENCE buffer.
          */
         // THIS IS THE ONLY ONE THAT WORKS
-        play_wav_file3((char*) FILE_ON_YOUR_MARKS); // Plays OnYourMark cleanly, no buzzes, clicks or trimmed sound bytes.
+        //play_wav_file<legacy_policy_3>((char*) FILE_ON_YOUR_MARKS); // Plays OnYourMark cleanly, no buzzes, clicks or trimmed sound bytes.
+        //vTaskDelay(3000 / portTICK_PERIOD_MS);
+        //play_wav_file<legacy_policy_3>((char*) FILE_ON_YOUR_MARKS_NO_MIDDLE); // click at end
+
+        /**
+         * Reading and writing run on separate tasks through a ring of PCM blocks.
+         * Only pads to the next DMA descriptor boundary instead of writing SILENCE twice.
+         */
+        //play_wav_file_pipelined((char*) FILE_ON_YOUR_MARKS);
+        //vTaskDelay(3000 / portTICK_PERIOD_MS);
+        //play_wav_file_pipelined((char*) FILE_ON_YOUR_MARKS_NO_MIDDLE);
+
+        /**
+         * The same pipeline reading a byte stream, as a WAV arriving over a UART would, a DMA ring of it buffered.
+         */
+        //play_wav_file_piped(FILE_ON_YOUR_MARKS);
+
+        /**
+         * Countdown pips and start tone through the same pipeline, synthesised so nothing is read from flash.
+         */
+        //play_countdown();
+
+        /**
+         * Plays from the clip cache filled by init_sound, so there is no file I/O at all.
+         */
+        //play_cached_clip(FILE_ON_YOUR_MARKS);
+        //vTaskDelay(3000 / portTICK_PERIOD_MS);
+        //play_cached_clip(FILE_ON_YOUR_MARKS_NO_MIDDLE);
+
+        /**
+         * Sends the cues to the audio service task, which plays them through the mixer. Nothing here waits on the sound,
+         * any other task could send them just the same.
+         */
+        ESP_ERROR_CHECK(audio_service_send(AUDIO_CMD_PLAY, CUE_ON_YOUR_MARKS, MIXER_GAIN_UNITY));
         vTaskDelay(3000 / portTICK_PERIOD_MS);
-        play_wav_file3((char*) FILE_ON_YOUR_MARKS_NO_MIDDLE); // click at end
+        ESP_ERROR_CHECK(audio_service_send(AUDIO_CMD_PLAY, CUE_ON_YOUR_MARKS_NO_MIDDLE, MIXER_GAIN_UNITY));
+        log_audio_service_stats();
+        log_audio_pool_stats();
+        log_clip_index_stats();
+
+        /**
+         * Plays from the memory mapped clips partition, no RAM copy of the clip at all.
+         */
+        //play_mapped_clip(FILE_ON_YOUR_MARKS);
+        //vTaskDelay(3000 / portTICK_PERIOD_MS);
+        //play_mapped_clip(FILE_ON_YOUR_MARKS_NO_MIDDLE);
+
+        /**
+         * Both cues at once through the software mixer, the second at half gain.
+         */
+        //play_mixed_cues();
+
+        /**
+         * Both cues as one stream through the mixer, the gap between them exact to the frame and the second loaded
+         * while the first plays.
+         */
+        //ESP_ERROR_CHECK(sequence_play(CUE_SEQUENCE, sizeof(CUE_SEQUENCE) / sizeof(CUE_SEQUENCE[0]), MIXER_GAIN_UNITY, nullptr));
+
+        /**
+         * The cue and a result assembled from speech units in the clip store, the units crossfaded into one stream.
+         */
+        //ESP_ERROR_CHECK(phrase_play(&ON_YOUR_MARKS_PHRASE, MIXER_GAIN_UNITY, nullptr));
+        //announce_result(ANNOUNCE_LANE, ANNOUNCE_TIME_MS);
 
         /**
          * Loop
@@ -702,7 +723,7 @@ void app_main(void) {
          *
          * Sames as 1 except WAV_BUFFER 8096
          */
-        //play_wav_file4((char*) FILE_ON_YOUR_MARKS); // Plays "OnYourMark (hard click)" in each cycle
+        //play_wav_file<legacy_policy_4>((char*) FILE_ON_YOUR_MARKS); // Plays "OnYourMark (hard click)" in each cycle
 
         /**
          * Loop
@@ -711,7 +732,7 @@ void app_main(void) {
          *
          * No appended SILENCE.
          */
-        //play_wav_file5((char*) FILE_ON_YOUR_MARKS); // Plays "OnYourMark (double-click)" in each cycle
+        //play_wav_file<legacy_policy_5>((char*) FILE_ON_YOUR_MARKS); // Plays "OnYourMark (double-click)" in each cycle
 
         /**
          * Loop
@@ -720,7 +741,7 @@ void app_main(void) {
          *
          * Write SILENCE until end of next 8K block
          */
-        //play_wav_file6((char*) FILE_ON_YOUR_MARKS); // Plays "(soft click) OnYourMark (hard click)" in each cycle
+        //play_wav_file<legacy_policy_6>((char*) FILE_ON_YOUR_MARKS); // Plays "(soft click) OnYourMark (hard click)" in each cycle
 
         /**
          * Loop
@@ -730,7 +751,7 @@ void app_main(void) {
          * Write SILENCE until end of next 8K block
          * Write full SILENCE buffer.
          */
-        //play_wav_file7((char*) FILE_ON_YOUR_MARKS); // Plays "(soft click) OnYourMark" in each cycle
+        //play_wav_file<legacy_policy_7>((char*) FILE_ON_YOUR_MARKS); // Plays "(soft click) OnYourMark" in each cycle
 
         /**
          * Loop
@@ -740,7 +761,7 @@ void app_main(void) {
          * Write full SILENCE buffer.
          * Write full SILENCE buffer.
          */
-        //play_wav_file8((char*) FILE_ON_YOUR_MARKS); // Plays "(soft click) OnYourMark" in each cycle
+        //play_wav_file<legacy_policy_8>((char*) FILE_ON_YOUR_MARKS); // Plays "(soft click) OnYourMark" in each cycle
 
         /**
          * Loop
@@ -752,7 +773,18 @@ void app_main(void) {
          *
          * Sames as 3 except WAV_DATA_BUFFER = 8096.
          */
-        //play_wav_file9((char*) FILE_ON_YOUR_MARKS); // Plays "(soft click) OnYourMark" in each cycle
+        //play_wav_file<legacy_policy_9>((char*) FILE_ON_YOUR_MARKS); // Plays "(soft click) OnYourMark" in each cycle
+
+        /**
+         * Loop
+         * - Read one DMA descriptor (4096 bytes)
+         * - Write just bytes that were read
+         *
+         * Write SILENCE to the end of the current DMA descriptor, then wait for the I2S TX done event.
+         */
+        //play_wav_file<dma_aligned_policy>((char*) FILE_ON_YOUR_MARKS);
+
+        trace_dump(stdout);     // Per block timings as CSV, nothing unless built with PLAYBACK_TRACE
 
         vTaskDelay(3000 / portTICK_PERIOD_MS);
     }
@@ -0,0 +1,666 @@
+#include "mixer.h"
+#include "audio_pool.h"
+#include "pcm_convert.h"
+#include "pcm_dsp.h"
+#include "pcm_ramp.h"
+#include "pcm_silence.h"
+#include "playback_trace.h"
+#include "resampler.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <atomic>
+#include <cstring>
+
+static const char *TAG = "mixer";
+
+#define MIXER_TASK_PRIORITY     5       // Same as the pipeline writer, it feeds the DMA
+#define MIXER_TASK_STACK        3072
+
+// Slot state, in the low 2 bits of voice_t::state. The rest of the word is the generation, bumped on every claim,
+// so a stale mixer_voice_t can never stop the next voice to use the slot.
+#define VOICE_FREE              0       // Any task may claim it
+#define VOICE_CLAIMED           1       // Being filled in by mixer_play, the mixer task skips it
+#define VOICE_ACTIVE            2       // Being mixed
+#define VOICE_STOPPING          3       // mixer_stop was called, the mixer task ramps it down and frees it
+
+#define VOICE_STATE(s)          ((s) & 3)
+#define VOICE_GENERATION(s)     ((s) >> 2)
+#define VOICE_HANDLE_SLOT(v)    ((v) & 0xFF)
+#define VOICE_HANDLE_GEN(v)     ((v) >> 8)
+
+#define FRAME_PENDING           UINT64_MAX  // start_frame of a timed voice whose frame is not known yet
+#define CLOCK_UNLOCKED          INT64_MIN
+#define CLOCK_WINDOW            16      // Readings of the output clock it takes the earliest of, about a second
+
+typedef struct {
+    std::atomic<uint32_t> state;
+    // Written by mixer_play while CLAIMED, then only read or written by the mixer task while ACTIVE.
+    const char* data;
+    uint32_t nr_bytes;
+    uint32_t position;          // Bytes of data already mixed
+    int32_t gain;
+    uint16_t num_channels;
+    uint16_t bits_per_sample;
+    const pcm_silence_index_t* silence;     // Runs of data that need not be read, nullptr if none
+    bool resample;              // Clip is not at the sink rate
+    resampler_t resampler;
+    uint32_t frame;             // Output frames mixed
+    uint32_t nr_frames;         // Output frames in the clip, brought forward when it is stopped
+    uint32_t fade_in;           // Ramp lengths, see pcm_ramp.h
+    uint32_t fade_out;
+    bool aborting;              // The stop has been seen and nr_frames moved
+    int64_t request_us;         // For the first sample latency
+    uint64_t start_frame;       // Mixer frame of the first sample, 0 for the next block
+    int64_t start_us;           // Output time of the first sample, 0 if start_frame was given
+    uint64_t first_frame;       // Mixer frames of the first sample and the one after the last
+    uint64_t end_frame;
+    std::atomic<int64_t> first_us;  // Output times, see mixer_get_voice_times
+    std::atomic<int64_t> last_us;
+    uint32_t loop_start;        // Byte offsets of the loop region in data
+    uint32_t loop_end;
+    uint32_t loops_left;        // Times position goes back to loop_start from loop_end, MIXER_LOOP_FOREVER for ever
+    std::atomic<uint32_t> release;  // Generation mixer_release was called for, so it cannot hit the slot's next voice
+} voice_t;
+
+static voice_t voices[MIXER_MAX_VOICES];
+
+static pcm_sink_t sink;
+static uint32_t block_frames;           // One DMA descriptor
+static int32_t* mix_acc;                // block_frames * 2 samples, summed at 32 bits so nothing clips until the end
+static char* scratch;                   // One block of a voice converted to 16 bit stereo
+static int16_t* resampled;              // One block of a voice resampled to the sink rate
+static int16_t* out;                    // DMA capable, handed to the sink
+static TaskHandle_t mixer_task = nullptr;
+static mixer_stats_t mixer_stats;
+static pcm_dsp_t output_dsp;            // Chain over the mixed output, restarted each time the mixer wakes
+static std::atomic<uint64_t> mixed_frames(0);   // Frames of every block mixed, ie the mixer frame of the next block
+
+// Output clock, as the esp_timer time of mixer frame 0. Only the mixer task writes the estimate, clock_origin
+// publishes it once it can be trusted.
+static uint32_t period_us;              // One block at the sink rate
+static int64_t clock_estimate;
+static int64_t clock_readings[CLOCK_WINDOW];
+static uint32_t writes_since_wake;
+static std::atomic<int64_t> clock_origin(CLOCK_UNLOCKED);
+
+/**
+ * acc += src * gain, gain in Q15. Unity gain skips the multiply.
+ */
+static void accumulate(int32_t* acc, const int16_t* src, uint32_t nr_samples, int32_t gain) {
+    if (gain == MIXER_GAIN_UNITY) {
+        for (uint32_t i = 0; i < nr_samples; i++) {
+            acc[i] += src[i];
+        }
+        return;
+    }
+    for (uint32_t i = 0; i < nr_samples; i++) {
+        acc[i] += (src[i] * gain) >> 15;
+    }
+}
+
+/**
+ * Clamps the accumulator to int16 and returns the number of samples that had to be clamped.
+ */
+static uint32_t saturate(int16_t* dst, const int32_t* acc, uint32_t nr_samples) {
+    uint32_t nr_clipped = 0;
+    for (uint32_t i = 0; i < nr_samples; i++) {
+        int32_t s = acc[i];
+        if (s > INT16_MAX) {
+            s = INT16_MAX;
+            nr_clipped++;
+        } else if (s < INT16_MIN) {
+            s = INT16_MIN;
+            nr_clipped++;
+        }
+        dst[i] = (int16_t) s;
+    }
+    return nr_clipped;
+}
+
+/**
+ * Takes the voice back to the start of its loop if it has reached the end of it with passes left.
+ */
+static void wrap_loop(voice_t* voice) {
+    if (voice->loops_left > 0 && voice->position >= voice->loop_end) {
+        voice->position = voice->loop_start;
+        if (voice->loops_left != MIXER_LOOP_FOREVER) {
+            voice->loops_left--;
+        }
+    }
+}
+
+/**
+ * Where the data to play next ends: the end of the loop while it has passes left, otherwise the end of the clip.
+ */
+static uint32_t read_end(const voice_t* voice) {
+    return voice->loops_left > 0 ? voice->loop_end : voice->nr_bytes;
+}
+
+/**
+ * Output frames for nr_in_frames of the voice's clip.
+ */
+static uint32_t voice_output_frames(const voice_t* voice, uint64_t nr_in_frames) {
+    nr_in_frames = nr_in_frames < UINT32_MAX - 1 ? nr_in_frames : UINT32_MAX - 1;
+    return voice->resample ? resampler_output_frames(&voice->resampler, (uint32_t) nr_in_frames) : (uint32_t) nr_in_frames;
+}
+
+/**
+ * True once the voice has played all its frames, or all its data with no loop passes left. A loop may end on the last
+ * frame of the clip, so the end of the data alone is not the end of the voice.
+ */
+static bool voice_finished(const voice_t* voice) {
+    return voice->frame >= voice->nr_frames || (voice->loops_left == 0 && voice->position >= voice->nr_bytes);
+}
+
+/**
+ * Fills resampled with up to max_frames of voice at the sink rate. Returns the number of frames, short at the end.
+ */
+static uint32_t resample_voice(voice_t* voice, uint32_t max_frames) {
+    const uint32_t src_frame_bytes = voice->num_channels * voice->bits_per_sample / 8;
+    uint32_t nr_out = 0;
+    while (nr_out < max_frames) {
+        // The resampler history runs on across the seam, so the loop is as smooth resampled as it is in the clip.
+        wrap_loop(voice);
+        if (voice->position >= voice->nr_bytes) {
+            break;
+        }
+        uint32_t nr_frames = (read_end(voice) - voice->position) / src_frame_bytes;
+        if (nr_frames == 0) {
+            voice->position = voice->nr_bytes;  // Trailing part frame
+            break;
+        }
+        // Just what the rest of the block needs, so all of it is used and the position stays exact.
+        const uint32_t nr_needed = resampler_input_frames(&voice->resampler, max_frames - nr_out);
+        nr_frames = nr_frames < nr_needed ? nr_frames : nr_needed;
+        nr_frames = nr_frames < block_frames ? nr_frames : block_frames;
+
+        // The position can be any frame, copy first so the conversion kernels get aligned words.
+        const uint32_t nr_src_bytes = nr_frames * src_frame_bytes;
+        memcpy(scratch, voice->data + voice->position, nr_src_bytes);
+        pcm_convert_to_stereo16(scratch, scratch, nr_src_bytes, voice->num_channels, voice->bits_per_sample);
+
+        uint32_t nr_used;
+        nr_out += resampler_process(&voice->resampler, (const int16_t*) scratch, nr_frames,
+                                    &resampled[nr_out * 2], max_frames - nr_out, &nr_used);
+        voice->position += nr_used * src_frame_bytes;
+    }
+    return nr_out;
+}
+
+/**
+ * Brings the end of a stopped voice forward to the first zero crossing in its next block, plus the abort ramp.
+ * A voice already in its fade out just finishes it.
+ */
+static void begin_abort(voice_t* voice, const int16_t* samples, uint32_t nr_frames) {
+    voice->aborting = true;
+    if ((uint64_t) voice->frame + voice->fade_out >= voice->nr_frames) {
+        return;
+    }
+    const uint32_t search = nr_frames < PCM_RAMP_ZERO_SEARCH_FRAMES ? nr_frames : PCM_RAMP_ZERO_SEARCH_FRAMES;
+    const uint32_t abort_frames = pcm_ramp_get_config()->abort_frames;
+    const uint32_t end = voice->frame + pcm_zero_crossing(samples, search) + abort_frames;
+    if (end < voice->nr_frames) {
+        voice->nr_frames = end;
+        voice->fade_out = abort_frames;
+    }
+}
+
+/**
+ * Adds up to max_frames of voice to acc, ramped if it is starting, ending or stopping. Stops short at the end of the
+ * loop. Returns the number of frames.
+ */
+static uint32_t mix_span(voice_t* voice, bool stopping, int32_t* acc, uint32_t max_frames) {
+    const int16_t* samples;
+    uint32_t nr_frames;
+    bool writable = true;
+    if (voice->resample) {
+        nr_frames = resample_voice(voice, max_frames);
+        samples = resampled;
+    } else {
+        const uint32_t src_frame_bytes = voice->num_channels * voice->bits_per_sample / 8;
+        uint32_t nr_src_bytes = read_end(voice) - voice->position;
+        if (nr_src_bytes > max_frames * src_frame_bytes) {
+            nr_src_bytes = max_frames * src_frame_bytes;
+        }
+
+        if (pcm_silence_covers(voice->silence, voice->position, nr_src_bytes)) {
+            // Nothing to add. A stop here needs no ramp, the voice is already silent.
+            voice->position += nr_src_bytes;
+            voice->frame += nr_src_bytes / src_frame_bytes;
+            if (stopping) {
+                voice->nr_frames = voice->frame;
+            }
+            return nr_src_bytes / src_frame_bytes;
+        }
+
+        samples = (const int16_t*) (voice->data + voice->position);
+        uint32_t nr_bytes = nr_src_bytes;
+        if (pcm_expansion(voice->num_channels, voice->bits_per_sample) != 1) {
+            nr_bytes = pcm_convert_to_stereo16(scratch, voice->data + voice->position, nr_src_bytes, voice->num_channels, voice->bits_per_sample);
+            samples = (const int16_t*) scratch;
+        } else {
+            writable = false;   // Straight from the clip
+        }
+        nr_frames = nr_bytes / 4;
+        voice->position += nr_src_bytes;
+    }
+
+    if (stopping && !voice->aborting) {
+        begin_abort(voice, samples, nr_frames);
+    }
+    if (pcm_ramp_needed(voice->frame, nr_frames, voice->nr_frames, voice->fade_in, voice->fade_out)) {
+        // Only the first and last blocks of a clip get here, copying them costs nothing.
+        if (!writable) {
+            memcpy(scratch, samples, nr_frames * 4);
+            samples = (const int16_t*) scratch;
+        }
+        pcm_ramp_envelope((int16_t*) samples, nr_frames, voice->frame, voice->nr_frames, voice->fade_in, voice->fade_out);
+    }
+    accumulate(acc, samples, nr_frames * 2, voice->gain);
+
+    voice->frame += nr_frames;
+    return nr_frames;
+}
+
+/**
+ * Adds up to max_frames of voice to acc, a span at a time as a loop seam ends a span.
+ * Returns true once the voice has run out of data.
+ */
+static bool mix_voice(voice_t* voice, bool stopping, int32_t* acc, uint32_t max_frames) {
+    uint32_t nr_mixed = 0;
+    while (nr_mixed < max_frames && !voice_finished(voice)) {
+        wrap_loop(voice);
+        const uint32_t nr_frames = mix_span(voice, stopping, &acc[nr_mixed * 2], max_frames - nr_mixed);
+        if (nr_frames == 0) {
+            break;  // Trailing part frame
+        }
+        nr_mixed += nr_frames;
+    }
+    return voice_finished(voice);
+}
+
+/**
+ * Ends the loop at the end of the current pass and brings the end of the voice in to match, see mixer_release.
+ */
+static void leave_loop(voice_t* voice) {
+    const uint32_t src_frame_bytes = voice->num_channels * voice->bits_per_sample / 8;
+    voice->loops_left = 0;
+    const uint32_t end = voice->frame + voice_output_frames(voice, (voice->nr_bytes - voice->position) / src_frame_bytes);
+    voice->nr_frames = end < voice->nr_frames ? end : voice->nr_frames;
+}
+
+static int64_t frame_time(int64_t origin, uint64_t frame) {
+    return sink.sample_rate != 0 ? origin + (int64_t) (frame * 1000000 / sink.sample_rate) : origin;
+}
+
+/**
+ * Nearest mixer frame to output time us, 0 (the next block) if it is before frame 0.
+ */
+static uint64_t frame_at(int64_t origin, int64_t us) {
+    return us > origin ? ((uint64_t) (us - origin) * sink.sample_rate + 500000) / 1000000 : 0;
+}
+
+/**
+ * Takes a reading of the output clock from the block at block_frame, accepted by the sink at written_us.
+ *
+ * The driver hands out descriptors as the DMA finishes with them, so a write that had to wait got the descriptor that
+ * has just been sent, and the DMA reaches it again after the other dma_buf_count - 1. A write that did not wait got
+ * one that comes round no later than that. Either way the reading is never early, only late by however long the task
+ * took to run, so the clock is the earliest of the last CLOCK_WINDOW readings. One late wake up, eg the mixer held off
+ * by a higher priority task, then moves it not at all, where following it even part of the way would start the next
+ * timed voice early. The window still lets the clock follow the DAC's drift against esp_timer.
+ */
+static void update_clock(uint64_t block_frame, int64_t written_us) {
+    // From the frame count rather than period_us, which is rounded down to the microsecond at most rates.
+    const int64_t sent_us = written_us + frame_time(0, (uint64_t) (sink.dma_buf_count - 1) * block_frames);
+    clock_readings[writes_since_wake % CLOCK_WINDOW] = sent_us - frame_time(0, block_frame);
+    const uint32_t nr_readings = writes_since_wake < CLOCK_WINDOW ? writes_since_wake + 1 : CLOCK_WINDOW;
+    clock_estimate = clock_readings[0];
+    for (uint32_t i = 1; i < nr_readings; i++) {
+        clock_estimate = clock_readings[i] < clock_estimate ? clock_readings[i] : clock_estimate;
+    }
+    // The first dma_buf_count writes after idle can all fill descriptors without waiting, the next one cannot.
+    if (++writes_since_wake > sink.dma_buf_count) {
+        clock_origin.store(clock_estimate, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * Lead a timed voice needs from idle: a ring of writes before the clock locks, then a ring of latency.
+ */
+static int64_t wake_lead_us() {
+    return (int64_t) (2 * sink.dma_buf_count + 2) * period_us + portTICK_PERIOD_MS * 1000;
+}
+
+static void mixer_loop(void*) {
+    const uint32_t nr_samples = block_frames * 2;
+    while (true) {
+        const int64_t start_us = esp_timer_get_time();
+        memset(mix_acc, 0, nr_samples * sizeof(int32_t));
+        const uint64_t block_frame = mixed_frames.load(std::memory_order_relaxed);
+
+        const bool clock_locked = writes_since_wake > sink.dma_buf_count;
+
+        uint32_t nr_voices = 0;
+        uint32_t nr_started = 0;
+        int64_t started_us[MIXER_MAX_VOICES];   // request_us of voices starting in this block, they may end in it too
+        uint32_t started = 0;                   // Slot bits, for the output times once the block has been written
+        uint32_t finished = 0;
+        int64_t wake_us = INT64_MAX;            // When a timed voice too far off to keep the DMA running for is due
+        for (int i = 0; i < MIXER_MAX_VOICES; i++) {
+            voice_t* voice = &voices[i];
+            const uint32_t state = voice->state.load(std::memory_order_acquire);
+            if (VOICE_STATE(state) != VOICE_ACTIVE && VOICE_STATE(state) != VOICE_STOPPING) {
+                continue;
+            }
+            const bool stopping = VOICE_STATE(state) == VOICE_STOPPING;
+            if (voice->loops_left > 0
+                && voice->release.load(std::memory_order_relaxed) == (VOICE_GENERATION(state) & 0xFFFFFF)) {
+                leave_loop(voice);
+            }
+            if (voice->start_frame == FRAME_PENDING && !stopping) {
+                if (voice->start_us - start_us > wake_lead_us()) {
+                    const int64_t due_us = voice->start_us - wake_lead_us();
+                    wake_us = due_us < wake_us ? due_us : wake_us;
+                    continue;   // The mixer may sleep until then
+                }
+                if (clock_locked) {
+                    voice->start_frame = frame_at(clock_estimate, voice->start_us);
+                }
+            }
+            nr_voices++;
+            bool done;
+            if (voice->frame == 0 && voice->start_frame >= block_frame + block_frames) {
+                done = stopping;    // Due in a later block. Mixing silence until then keeps the frame count running
+            } else {
+                // A scheduled voice starts part way into its first block, so it lands on its exact frame.
+                uint32_t offset = 0;
+                if (voice->frame == 0) {
+                    if (voice->start_frame > block_frame) {
+                        offset = (uint32_t) (voice->start_frame - block_frame);
+                    } else if (voice->start_frame != 0 && voice->start_frame < block_frame) {
+                        mixer_stats.late_starts++;
+                    }
+                    started_us[nr_started++] = voice->request_us;
+                    voice->first_frame = block_frame + offset;
+                    started |= 1u << i;
+                }
+                const uint32_t frame = voice->frame;
+                done = mix_voice(voice, stopping, &mix_acc[offset * 2], block_frames - offset);
+                voice->end_frame = block_frame + offset + (voice->frame - frame);
+            }
+            if (done) {
+                finished |= 1u << i;    // Freed once the block is written, so the times are in place first
+            }
+        }
+
+        if (nr_voices == 0) {
+            // The DMA clocks out zeros once it runs dry (tx_desc_auto_clear), so just sleep until mixer_play, or until
+            // a timed voice is close enough to start the DMA for. The output clock stops with the frames.
+            clock_origin.store(CLOCK_UNLOCKED, std::memory_order_relaxed);
+            writes_since_wake = 0;
+            const int64_t tick_us = portTICK_PERIOD_MS * 1000;
+            const int64_t wait_us = wake_us - esp_timer_get_time();
+            const TickType_t wait_ticks = wake_us == INT64_MAX ? portMAX_DELAY
+                    : wait_us > 0 ? (TickType_t) ((wait_us + tick_us - 1) / tick_us) : 0;
+            ulTaskNotifyTake(pdTRUE, wait_ticks);
+            pcm_dsp_init(&output_dsp);
+            continue;
+        }
+
+        mixer_stats.clipped_samples += saturate(out, mix_acc, nr_samples);
+        pcm_dsp_process(&output_dsp, out, block_frames);
+        mixed_frames.store(block_frame + block_frames, std::memory_order_relaxed);
+        const int64_t mix_us = esp_timer_get_time() - start_us;
+        mixer_stats.mix_us += mix_us;
+        if (mix_us > mixer_stats.max_block_mix_us) {
+            mixer_stats.max_block_mix_us = mix_us;
+        }
+        TRACE(TRACE_MIX, start_us, nr_samples * sizeof(int16_t));
+        if (nr_voices > mixer_stats.max_voices) {
+            mixer_stats.max_voices = nr_voices;
+        }
+
+        // Always a whole descriptor, so the output stays aligned to the DMA ring and never needs padding.
+        size_t nr_bytes_written;
+        const esp_err_t err = sink.write(sink.ctx, (const char*) out, nr_samples * sizeof(int16_t), &nr_bytes_written);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Sink write failed err=%s", esp_err_to_name(err));
+        }
+        update_clock(block_frame, esp_timer_get_time());
+        mixer_stats.nr_blocks++;
+        for (uint32_t i = 0; i < nr_started; i++) {
+            mixer_stats.last_first_sample_us = esp_timer_get_time() - started_us[i];
+            if (mixer_stats.last_first_sample_us > mixer_stats.max_first_sample_us) {
+                mixer_stats.max_first_sample_us = mixer_stats.last_first_sample_us;
+            }
+        }
+
+        for (int i = 0; i < MIXER_MAX_VOICES; i++) {
+            voice_t* voice = &voices[i];
+            if (started & (1u << i)) {
+                voice->first_us.store(frame_time(clock_estimate, voice->first_frame), std::memory_order_relaxed);
+            }
+            if (finished & (1u << i)) {
+                if (voice->end_frame > voice->first_frame) {
+                    voice->last_us.store(frame_time(clock_estimate, voice->end_frame - 1), std::memory_order_relaxed);
+                }
+                // Only this task moves a slot out of ACTIVE or STOPPING, a racing mixer_stop just fails its CAS.
+                const uint32_t state = voice->state.load(std::memory_order_relaxed);
+                voice->state.store((VOICE_GENERATION(state) << 2) | VOICE_FREE, std::memory_order_release);
+            }
+        }
+    }
+}
+
+esp_err_t mixer_init(const pcm_sink_t* pcm_sink) {
+    sink = *pcm_sink;
+    block_frames = sink.dma_buf_bytes / 4;
+    period_us = sink.sample_rate != 0 ? (uint32_t) ((uint64_t) block_frames * 1000000 / sink.sample_rate) : 0;
+    memset(&mixer_stats, 0, sizeof(mixer_stats));
+    pcm_dsp_init(&output_dsp);
+    for (int i = 0; i < MIXER_MAX_VOICES; i++) {
+        voices[i].state.store(VOICE_FREE, std::memory_order_relaxed);
+    }
+
+    mix_acc = (int32_t*) heap_caps_malloc(block_frames * 2 * sizeof(int32_t), MALLOC_CAP_8BIT);
+    scratch = (char*) heap_caps_malloc(block_frames * 4, MALLOC_CAP_8BIT);
+    resampled = (int16_t*) heap_caps_malloc(block_frames * 4, MALLOC_CAP_8BIT);
+    out = block_frames * 4 <= AUDIO_POOL_BLOCK_SIZE ? (int16_t*) audio_pool_acquire() : nullptr;
+    if (block_frames == 0 || mix_acc == nullptr || scratch == nullptr || resampled == nullptr || out == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate mix buffers for %d frames", block_frames);
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(mixer_loop, "mixer", MIXER_TASK_STACK, nullptr, MIXER_TASK_PRIORITY, &mixer_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+/**
+ * Output frames for nr_in_frames of clip, capped just short of a voice that never ends.
+ */
+static uint32_t clip_output_frames(const wav_data_t* clip, uint64_t nr_in_frames) {
+    nr_in_frames = nr_in_frames < UINT32_MAX - 1 ? nr_in_frames : UINT32_MAX - 1;
+    if (sink.sample_rate == 0 || clip->sample_rate == sink.sample_rate) {
+        return (uint32_t) nr_in_frames;
+    }
+    resampler_t resampler;
+    resampler_init(&resampler, clip->sample_rate, sink.sample_rate);
+    return resampler_output_frames(&resampler, (uint32_t) nr_in_frames);
+}
+
+uint32_t mixer_clip_frames(const wav_data_t* clip) {
+    return clip_output_frames(clip, clip->nr_bytes / (clip->num_channels * clip->bits_per_sample / 8));
+}
+
+uint64_t mixer_next_frame() {
+    // The block at mixed_frames may be being mixed right now, the one after it cannot start before the sink has
+    // taken the current one, a whole block's time away.
+    return mixed_frames.load(std::memory_order_relaxed) + block_frames;
+}
+
+uint64_t mixer_frames_mixed() {
+    return mixed_frames.load(std::memory_order_relaxed);
+}
+
+int64_t mixer_frame_time(uint64_t frame) {
+    const int64_t origin = clock_origin.load(std::memory_order_relaxed);
+    return origin != CLOCK_UNLOCKED ? frame_time(origin, frame) : 0;
+}
+
+esp_err_t mixer_play(const wav_data_t* clip, int32_t gain, int64_t request_us, mixer_voice_t* voice) {
+    const pcm_ramp_config_t* ramp = pcm_ramp_get_config();
+    const mixer_start_t start = {gain, 0, ramp->fade_in_frames, ramp->fade_out_frames, request_us, 0,
+                                 MIXER_LOOP_AS_AUTHORED};
+    return mixer_play_at(clip, &start, voice);
+}
+
+/**
+ * Sets up the loop region of a voice for passes of it, MIXER_LOOP_AS_AUTHORED being the smpl chunk's play count,
+ * and makes the voice long enough to hold them.
+ */
+static void set_loop(voice_t* voice, const wav_data_t* clip, uint32_t passes) {
+    const uint32_t frame_bytes = clip->num_channels * clip->bits_per_sample / 8;
+    const wav_loop_t* loop = &clip->loop;
+    voice->loops_left = 0;
+    if (loop->end_frame <= loop->start_frame || (uint64_t) loop->end_frame * frame_bytes > clip->nr_bytes) {
+        return;     // No loop, or not one within this clip
+    }
+    if (passes == MIXER_LOOP_AS_AUTHORED) {
+        passes = loop->play_count == 0 ? MIXER_LOOP_FOREVER : loop->play_count;
+    }
+    voice->loop_start = loop->start_frame * frame_bytes;
+    voice->loop_end = loop->end_frame * frame_bytes;
+    voice->loops_left = passes == MIXER_LOOP_FOREVER ? MIXER_LOOP_FOREVER : passes - 1;
+    const uint64_t nr_in_frames = clip->nr_bytes / frame_bytes
+                                  + (uint64_t) voice->loops_left * (loop->end_frame - loop->start_frame);
+    voice->nr_frames = passes == MIXER_LOOP_FOREVER ? UINT32_MAX : clip_output_frames(clip, nr_in_frames);
+}
+
+esp_err_t mixer_play_at(const wav_data_t* clip, const mixer_start_t* start, mixer_voice_t* voice) {
+    const bool resample = sink.sample_rate != 0 && clip->sample_rate != sink.sample_rate;
+    if (!resample && ((uintptr_t) clip->data & 3) != 0) {
+        ESP_LOGW(TAG, "%s data is not 4 byte aligned", clip->filename);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (start->start_us != 0 && sink.sample_rate == 0) {
+        ESP_LOGW(TAG, "Timed start needs a fixed sink rate, dropping %s", clip->filename);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    for (int i = 0; i < MIXER_MAX_VOICES; i++) {
+        voice_t* slot = &voices[i];
+        uint32_t state = slot->state.load(std::memory_order_relaxed);
+        if (VOICE_STATE(state) != VOICE_FREE) {
+            continue;
+        }
+        const uint32_t generation = VOICE_GENERATION(state) + 1;
+        if (!slot->state.compare_exchange_strong(state, (generation << 2) | VOICE_CLAIMED, std::memory_order_acquire)) {
+            continue;   // Another task got there first
+        }
+
+        slot->data = clip->data;
+        slot->nr_bytes = clip->nr_bytes;
+        slot->position = 0;
+        slot->gain = start->gain;
+        slot->num_channels = clip->num_channels;
+        slot->bits_per_sample = clip->bits_per_sample;
+        slot->silence = resample ? nullptr : clip->silence;     // Skipping input would leave the resampler history stale
+        slot->resample = resample;
+        slot->frame = 0;
+        slot->nr_frames = mixer_clip_frames(clip);
+        set_loop(slot, clip, start->loop_count);
+        slot->release.store(UINT32_MAX, std::memory_order_relaxed);    // Matches no generation
+        if (resample) {
+            resampler_init(&slot->resampler, clip->sample_rate, sink.sample_rate);
+        }
+        slot->fade_in = start->fade_in_frames;
+        slot->fade_out = start->fade_out_frames;
+        slot->aborting = false;
+        slot->request_us = start->request_us;
+        slot->start_frame = start->start_us != 0 ? FRAME_PENDING : start->start_frame;
+        slot->start_us = start->start_us;
+        slot->first_frame = slot->end_frame = 0;
+        slot->first_us.store(0, std::memory_order_relaxed);
+        slot->last_us.store(0, std::memory_order_relaxed);
+        slot->state.store((generation << 2) | VOICE_ACTIVE, std::memory_order_release);
+        xTaskNotifyGive(mixer_task);
+
+        if (voice != nullptr) {
+            *voice = (generation << 8) | i;
+        }
+        return ESP_OK;
+    }
+
+    ESP_LOGW(TAG, "All %d voices busy, dropping %s", MIXER_MAX_VOICES, clip->filename);
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t mixer_stop(mixer_voice_t voice) {
+    if (VOICE_HANDLE_SLOT(voice) >= MIXER_MAX_VOICES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    voice_t* slot = &voices[VOICE_HANDLE_SLOT(voice)];
+    uint32_t state = slot->state.load(std::memory_order_relaxed);
+    if (VOICE_STATE(state) != VOICE_ACTIVE || (VOICE_GENERATION(state) & 0xFFFFFF) != VOICE_HANDLE_GEN(voice)) {
+        return ESP_ERR_NOT_FOUND;   // Already finished
+    }
+    if (!slot->state.compare_exchange_strong(state, (VOICE_GENERATION(state) << 2) | VOICE_STOPPING)) {
+        return ESP_ERR_NOT_FOUND;   // Finished while we looked
+    }
+    xTaskNotifyGive(mixer_task);    // A timed voice that is not due yet may have left the mixer asleep
+    return ESP_OK;
+}
+
+esp_err_t mixer_release(mixer_voice_t voice) {
+    if (VOICE_HANDLE_SLOT(voice) >= MIXER_MAX_VOICES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    voice_t* slot = &voices[VOICE_HANDLE_SLOT(voice)];
+    const uint32_t state = slot->state.load(std::memory_order_relaxed);
+    if (VOICE_STATE(state) == VOICE_FREE || (VOICE_GENERATION(state) & 0xFFFFFF) != VOICE_HANDLE_GEN(voice)) {
+        return ESP_ERR_NOT_FOUND;   // Already finished
+    }
+    // The mixer task only acts on it while the generation matches, so a late store cannot touch another voice.
+    slot->release.store(VOICE_HANDLE_GEN(voice), std::memory_order_relaxed);
+    return ESP_OK;
+}
+
+esp_err_t mixer_get_voice_times(mixer_voice_t voice, mixer_voice_times_t* times) {
+    if (VOICE_HANDLE_SLOT(voice) >= MIXER_MAX_VOICES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const voice_t* slot = &voices[VOICE_HANDLE_SLOT(voice)];
+    const uint32_t state = slot->state.load(std::memory_order_acquire);
+    times->first_us = slot->first_us.load(std::memory_order_relaxed);
+    times->last_us = slot->last_us.load(std::memory_order_relaxed);
+    times->done = VOICE_STATE(state) == VOICE_FREE;
+    // The generation is bumped before a new voice resets the times, so an unchanged one means they were this voice's.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint32_t generation = VOICE_GENERATION(slot->state.load(std::memory_order_relaxed)) & 0xFFFFFF;
+    if ((VOICE_GENERATION(state) & 0xFFFFFF) != VOICE_HANDLE_GEN(voice) || generation != VOICE_HANDLE_GEN(voice)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+uint32_t mixer_active_voices() {
+    uint32_t nr_voices = 0;
+    for (int i = 0; i < MIXER_MAX_VOICES; i++) {
+        const uint32_t state = VOICE_STATE(voices[i].state.load(std::memory_order_relaxed));
+        if (state != VOICE_FREE) {      // A stopping voice is still fading out, its slot is not free yet
+            nr_voices++;
+        }
+    }
+    return nr_voices;
+}
+
+void mixer_get_stats(mixer_stats_t* stats) {
+    *stats = mixer_stats;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stdint.h>
+#include <esp_err.h>
+
+#include "pcm_sink.h"
+#include "wav_file.h"
+
+#define MIXER_MAX_VOICES    8           // Voices that can sound at once
+#define MIXER_GAIN_UNITY    32768       // Q15 gain of 1.0
+#define MIXER_LOOP_AS_AUTHORED  0           // mixer_start_t::loop_count, the play count in the clip's smpl chunk
+#define MIXER_LOOP_FOREVER  UINT32_MAX      // mixer_start_t::loop_count, until mixer_release or mixer_stop
+
+/**
+ * Handle of a playing voice: slot index in the low 8 bits, the slot's generation above that.
+ * A stale handle, for a voice that has already finished, is harmless.
+ */
+typedef uint32_t mixer_voice_t;
+
+typedef struct {
+    uint32_t nr_blocks;         // Blocks of mixed output handed to the sink
+    uint32_t max_voices;        // Most voices ever mixed into one block
+    uint32_t clipped_samples;   // Output samples that saturated at the int16 limits
+    int64_t mix_us;             // Time spent mixing, excluding the sink write
+    int64_t max_block_mix_us;   // Slowest single block
+    int64_t last_first_sample_us;   // Request to the sink accepting the voice's first block, for the last voice started
+    int64_t max_first_sample_us;
+    uint32_t late_starts;           // Scheduled voices that started after their start_frame had already been mixed
+} mixer_stats_t;
+
+/**
+ * How a voice starts, for mixer_play_at.
+ */
+typedef struct {
+    int32_t gain;               // Q15, MIXER_GAIN_UNITY is 1.0
+    uint64_t start_frame;       // Mixer frame of the first sample, see mixer_next_frame. 0 starts with the next block
+    uint32_t fade_in_frames;    // Ramps as in pcm_ramp.h, eg the overlap of a crossfade
+    uint32_t fade_out_frames;
+    int64_t request_us;         // esp_timer_get_time() at which the sound was asked for, for the first sample latency
+    int64_t start_us;           // esp_timer_get_time() at which the first sample should leave the DAC, see
+                                // mixer_frame_time. Overrides start_frame, 0 to go by start_frame
+    uint32_t loop_count;        // Passes of the clip's loop region, or one of MIXER_LOOP_. Ignored if it has none
+} mixer_start_t;
+
+/**
+ * When a voice's first and last samples leave the DAC, by the mixer's output clock.
+ */
+typedef struct {
+    int64_t first_us;           // 0 until the first sample has been handed to the sink
+    int64_t last_us;            // 0 until the voice has finished
+    bool done;                  // Finished, both times are final
+} mixer_voice_times_t;
+
+/**
+ * Allocates the mix buffers, one DMA descriptor (sink->dma_buf_bytes) in size, and starts the mixer task.
+ * The output buffer is taken from the audio pool for good, so the descriptor must fit in AUDIO_POOL_BLOCK_SIZE.
+ * Voices at any other rate than sink->sample_rate are resampled to it, so clips at different rates can overlap.
+ * The pcm_dsp chain runs over the mixed output, with the settings current when the mixer last woke from idle.
+ * While voices are playing the mixer owns the sink, nothing else may write to it.
+ */
+esp_err_t mixer_init(const pcm_sink_t* sink);
+
+/**
+ * Starts clip as a new voice at the Q15 gain (MIXER_GAIN_UNITY is 1.0), mixed over whatever is already playing.
+ * The voice fades in and out over the pcm_ramp lengths set when it starts, and plays the clip's loop as authored.
+ * A loop is seamless, the frame after the last of the loop is its first, and all of it comes from RAM or mapped flash.
+ * Safe to call from any task. clip->data must stay valid until the voice ends, eg a mapped clip_store clip.
+ * request_us is the esp_timer_get_time() at which the sound was asked for, used for the first sample latency.
+ * Returns ESP_ERR_NO_MEM if all MIXER_MAX_VOICES are busy.
+ */
+esp_err_t mixer_play(const wav_data_t* clip, int32_t gain, int64_t request_us, mixer_voice_t* voice);
+
+/**
+ * As mixer_play, but the voice starts on exactly start->start_frame of the mixer output, part way into a block if need
+ * be, with its own ramps. The mixer mixes silence until then. A start frame that has already been mixed starts with the
+ * next block and counts as a late start.
+ * With start->start_us the frame is worked out from the output clock once the voice is due: the mixer wakes a couple
+ * of DMA rings early, mixes silence until its clock has locked, then starts the voice on the frame nearest start_us.
+ * Returns ESP_ERR_NOT_SUPPORTED for start_us if the sink has no fixed rate.
+ */
+esp_err_t mixer_play_at(const wav_data_t* clip, const mixer_start_t* start, mixer_voice_t* voice);
+
+/**
+ * Output clock: the esp_timer_get_time() at which mixer frame leaves the DAC, or 0 while the clock is not locked.
+ * The clock locks once the mixer has filled the DMA ring and its writes block on descriptors being sent, it is
+ * unlocked while the mixer is idle. Accurate to the wake up latency of the mixer task, well under a frame.
+ */
+int64_t mixer_frame_time(uint64_t frame);
+
+/**
+ * Copies out when the voice's first and last samples leave the DAC. Times of a voice that started while the clock was
+ * not locked are estimates that may be late by up to a DMA ring.
+ * Returns ESP_ERR_NOT_FOUND once the voice's slot has been reused by another voice.
+ */
+esp_err_t mixer_get_voice_times(mixer_voice_t voice, mixer_voice_times_t* times);
+
+/**
+ * Earliest mixer frame a voice handed to mixer_play_at now is sure to start on. Mixer frames count every frame the
+ * mixer has written to the sink, they stand still while it is idle.
+ */
+uint64_t mixer_next_frame();
+
+/**
+ * Mixer frames mixed so far, the last block of them may still be on its way to the sink.
+ */
+uint64_t mixer_frames_mixed();
+
+/**
+ * Length of clip in frames once resampled to the sink rate, ie how long its voice lasts when the loop plays once.
+ */
+uint32_t mixer_clip_frames(const wav_data_t* clip);
+
+/**
+ * Stops the voice: from its next zero crossing it ramps down over the abort ramp, see pcm_ramp.h.
+ * Safe to call from any task.
+ */
+esp_err_t mixer_stop(mixer_voice_t voice);
+
+/**
+ * Lets a looping voice finish the pass of its loop it is in, then play on through the rest of the clip.
+ * Safe to call from any task. Returns ESP_ERR_NOT_FOUND if the voice has already finished.
+ */
+esp_err_t mixer_release(mixer_voice_t voice);
+
+/**
+ * Number of voices playing or about to play, including stopped ones still fading out.
+ */
+uint32_t mixer_active_voices();
+
+void mixer_get_stats(mixer_stats_t* stats);
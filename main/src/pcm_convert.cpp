@@ -0,0 +1,87 @@
+#include "pcm_convert.h"
+
+#include <cstring>
+
+// All kernels walk from the last input word to the first, reading each input word before writing its outputs,
+// which always lie at or above it. That is what makes dst == src safe.
+// They work a 32 bit word at a time: the ESP32 has no packed SIMD for this, but a word load and a couple of
+// shifts and masks per pair of samples is much cheaper than byte loads and stores.
+
+/**
+ * 16 bit mono to 16 bit stereo. Each input word holds two samples, each becomes an L=R output word.
+ */
+static uint32_t mono16_to_stereo16(uint32_t* dst, const uint32_t* src, uint32_t nr_bytes) {
+    const uint32_t nr_samples = nr_bytes / 2;
+    const uint16_t* src16 = (const uint16_t*) src;
+
+    // Odd trailing sample first.
+    if (nr_samples & 1) {
+        const uint32_t s = src16[nr_samples - 1];
+        dst[nr_samples - 1] = s | (s << 16);
+    }
+    for (int32_t i = nr_samples / 2 - 1; i >= 0; i--) {
+        const uint32_t w = src[i];
+        const uint32_t lo = w & 0xFFFF;
+        const uint32_t hi = w >> 16;
+        dst[2 * i + 1] = hi | (hi << 16);
+        dst[2 * i] = lo | (lo << 16);
+    }
+    return nr_samples * 4;
+}
+
+/**
+ * 8 bit unsigned to 16 bit signed, channel layout unchanged. Four input samples per word become two output words.
+ */
+static uint32_t u8_to_s16(uint32_t* dst, const uint32_t* src, uint32_t nr_bytes) {
+    const uint8_t* src8 = (const uint8_t*) src;
+    uint16_t* dst16 = (uint16_t*) dst;
+
+    for (int32_t i = nr_bytes - 1; i >= (int32_t) (nr_bytes & ~3u); i--) {
+        dst16[i] = (uint16_t) ((src8[i] ^ 0x80) << 8);
+    }
+    for (int32_t i = nr_bytes / 4 - 1; i >= 0; i--) {
+        const uint32_t x = src[i] ^ 0x80808080;     // Flip the sign bits, 0x80 is silence in 8 bit WAV
+        dst[2 * i + 1] = ((x >> 8) & 0x0000FF00) | (x & 0xFF000000);
+        dst[2 * i] = ((x << 8) & 0x0000FF00) | ((x << 16) & 0xFF000000);
+    }
+    return nr_bytes * 2;
+}
+
+/**
+ * 8 bit unsigned mono to 16 bit signed stereo. Every input byte becomes one L=R output word.
+ */
+static uint32_t mono8_to_stereo16(uint32_t* dst, const uint32_t* src, uint32_t nr_bytes) {
+    const uint8_t* src8 = (const uint8_t*) src;
+
+    for (int32_t i = nr_bytes - 1; i >= (int32_t) (nr_bytes & ~3u); i--) {
+        dst[i] = (uint32_t) (src8[i] ^ 0x80) * 0x01000100;
+    }
+    for (int32_t i = nr_bytes / 4 - 1; i >= 0; i--) {
+        const uint32_t x = src[i] ^ 0x80808080;
+        dst[4 * i + 3] = (x >> 24) * 0x01000100;
+        dst[4 * i + 2] = ((x >> 16) & 0xFF) * 0x01000100;
+        dst[4 * i + 1] = ((x >> 8) & 0xFF) * 0x01000100;
+        dst[4 * i] = (x & 0xFF) * 0x01000100;
+    }
+    return nr_bytes * 4;
+}
+
+uint32_t pcm_expansion(uint16_t num_channels, uint16_t bits_per_sample) {
+    return (bits_per_sample == 8 ? 2 : 1) * (num_channels == 1 ? 2 : 1);
+}
+
+uint32_t pcm_convert_to_stereo16(char* dst, const char* src, uint32_t nr_bytes, uint16_t num_channels, uint16_t bits_per_sample) {
+    if (bits_per_sample == 8) {
+        if (num_channels == 1) {
+            return mono8_to_stereo16((uint32_t*) dst, (const uint32_t*) src, nr_bytes);
+        }
+        return u8_to_s16((uint32_t*) dst, (const uint32_t*) src, nr_bytes);
+    }
+    if (num_channels == 1) {
+        return mono16_to_stereo16((uint32_t*) dst, (const uint32_t*) src, nr_bytes);
+    }
+    if (dst != src) {
+        memmove(dst, src, nr_bytes);
+    }
+    return nr_bytes;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * How many times larger the data gets when converted to 16 bit stereo, ie the I2S port format.
+ * 1 for 16 bit stereo, 2 for 16 bit mono or 8 bit stereo, 4 for 8 bit mono.
+ */
+uint32_t pcm_expansion(uint16_t num_channels, uint16_t bits_per_sample);
+
+/**
+ * Converts nr_bytes of src to 16 bit signed stereo in dst and returns the number of bytes written,
+ * ie nr_bytes * pcm_expansion(). 8 bit WAV data is unsigned, it is re-centred on zero.
+ *
+ * dst may be the same buffer as src, as long as it holds the expanded size: the kernels work from the end
+ * backwards so no input is overwritten before it is read. Both buffers must be 4 byte aligned.
+ */
+uint32_t pcm_convert_to_stereo16(char* dst, const char* src, uint32_t nr_bytes, uint16_t num_channels, uint16_t bits_per_sample);
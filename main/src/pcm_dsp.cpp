@@ -0,0 +1,155 @@
+#include "pcm_dsp.h"
+
+#include <cmath>
+#include <cstring>
+
+static const double PI = 3.14159265358979323846;
+
+static pcm_dsp_config_t dsp_config = {PCM_DSP_GAIN_UNITY, PCM_DSP_LIMITER_KNEE, false, {1 << PCM_BIQUAD_SHIFT, 0, 0, 0, 0}};
+
+void pcm_dsp_set_config(const pcm_dsp_config_t* config) {
+    dsp_config = *config;
+    dsp_config.gain = config->gain < 0 ? 0 : config->gain < PCM_DSP_GAIN_MAX ? config->gain : PCM_DSP_GAIN_MAX;
+    dsp_config.limiter_knee = config->limiter_knee < 0 ? 0 : config->limiter_knee < INT16_MAX ? config->limiter_knee : INT16_MAX;
+}
+
+const pcm_dsp_config_t* pcm_dsp_get_config() {
+    return &dsp_config;
+}
+
+static int32_t to_q27(double value) {
+    return (int32_t) lround(value * (1 << PCM_BIQUAD_SHIFT));
+}
+
+void pcm_biquad_design(pcm_eq_type_t type, float freq, float q, float gain_db, uint32_t sample_rate, pcm_biquad_t* biquad) {
+    const double a = pow(10.0, gain_db / 40.0);
+    const double w0 = 2.0 * PI * freq / sample_rate;
+    const double cos_w0 = cos(w0);
+    const double alpha = sin(w0) / (2.0 * q);
+    const double shelf = 2.0 * sqrt(a) * alpha;
+
+    double b0, b1, b2, a0, a1, a2;
+    switch (type) {
+        case PCM_EQ_LOW_SHELF:
+            b0 = a * ((a + 1) - (a - 1) * cos_w0 + shelf);
+            b1 = 2 * a * ((a - 1) - (a + 1) * cos_w0);
+            b2 = a * ((a + 1) - (a - 1) * cos_w0 - shelf);
+            a0 = (a + 1) + (a - 1) * cos_w0 + shelf;
+            a1 = -2 * ((a - 1) + (a + 1) * cos_w0);
+            a2 = (a + 1) + (a - 1) * cos_w0 - shelf;
+            break;
+        case PCM_EQ_HIGH_SHELF:
+            b0 = a * ((a + 1) + (a - 1) * cos_w0 + shelf);
+            b1 = -2 * a * ((a - 1) + (a + 1) * cos_w0);
+            b2 = a * ((a + 1) + (a - 1) * cos_w0 - shelf);
+            a0 = (a + 1) - (a - 1) * cos_w0 + shelf;
+            a1 = 2 * ((a - 1) - (a + 1) * cos_w0);
+            a2 = (a + 1) - (a - 1) * cos_w0 - shelf;
+            break;
+        case PCM_EQ_HIGH_PASS:
+            b0 = (1 + cos_w0) / 2;
+            b1 = -(1 + cos_w0);
+            b2 = (1 + cos_w0) / 2;
+            a0 = 1 + alpha;
+            a1 = -2 * cos_w0;
+            a2 = 1 - alpha;
+            break;
+        case PCM_EQ_PEAKING:
+        default:
+            b0 = 1 + alpha * a;
+            b1 = -2 * cos_w0;
+            b2 = 1 - alpha * a;
+            a0 = 1 + alpha / a;
+            a1 = -2 * cos_w0;
+            a2 = 1 - alpha / a;
+            break;
+    }
+    biquad->b0 = to_q27(b0 / a0);
+    biquad->b1 = to_q27(b1 / a0);
+    biquad->b2 = to_q27(b2 / a0);
+    biquad->a1 = to_q27(a1 / a0);
+    biquad->a2 = to_q27(a2 / a0);
+}
+
+void pcm_dsp_init(pcm_dsp_t* dsp) {
+    memset(dsp, 0, sizeof(pcm_dsp_t));
+    dsp->config = dsp_config;
+    dsp->folded = dsp_config.biquad;
+    dsp->folded.b0 = (int32_t) (((int64_t) dsp_config.biquad.b0 * dsp_config.gain) >> 15);
+    dsp->folded.b1 = (int32_t) (((int64_t) dsp_config.biquad.b1 * dsp_config.gain) >> 15);
+    dsp->folded.b2 = (int32_t) (((int64_t) dsp_config.biquad.b2 * dsp_config.gain) >> 15);
+}
+
+bool pcm_dsp_active(const pcm_dsp_t* dsp) {
+    return dsp->config.gain != PCM_DSP_GAIN_UNITY || dsp->config.eq;
+}
+
+/**
+ * Clamps to int16. Below the knee the signal is untouched. Above it the excess d is bent to room * d / (room + d),
+ * which leaves the knee with a slope of 1 and only approaches full scale, so peaks are rounded off rather than clipped.
+ */
+static inline int32_t limit(int32_t v, int32_t knee) {
+    if (v >= -knee && v <= knee) {
+        return v;
+    }
+    if (knee == 0) {
+        return v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+    }
+    const int32_t room = INT16_MAX - knee;
+    const int64_t over = (v < 0 ? -(int64_t) v : v) - knee;
+    const int32_t magnitude = knee + (int32_t) ((int64_t) room * over / ((int64_t) room + over));
+    return v < 0 ? -magnitude : magnitude;
+}
+
+/**
+ * Gain and limiter only. A stereo frame is one 32 bit word, so each frame costs one load and one store.
+ */
+static void process_gain(const pcm_dsp_t* dsp, uint32_t* frames, uint32_t nr_frames) {
+    const int32_t gain = dsp->config.gain;
+    const int32_t knee = dsp->config.limiter_knee;
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        const uint32_t frame = frames[i];
+        const int32_t left = limit(((int32_t) (int16_t) frame * gain) >> 15, knee);
+        const int32_t right = limit(((int32_t) (int16_t) (frame >> 16) * gain) >> 15, knee);
+        frames[i] = (uint16_t) left | ((uint32_t) right << 16);
+    }
+}
+
+/**
+ * Direct form I biquad with the gain folded in, then the limiter. The history keeps the filter output from before the
+ * limiter, so limiting never feeds back into the filter. It also keeps fraction bits, as a low cut or shelf, with its
+ * poles close to 1, would otherwise amplify the rounding of the fed back output into hundreds of LSBs of error.
+ */
+static void process_eq(pcm_dsp_t* dsp, uint32_t* frames, uint32_t nr_frames) {
+    const pcm_biquad_t* c = &dsp->folded;
+    const int32_t knee = dsp->config.limiter_knee;
+    const int64_t round = (int64_t) 1 << (PCM_BIQUAD_SHIFT - 1);
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        const uint32_t frame = frames[i];
+        int32_t out[2];
+        for (int ch = 0; ch < 2; ch++) {
+            const int32_t x = (int16_t) (ch == 0 ? frame : frame >> 16);
+            const int64_t acc = (((int64_t) c->b0 * x + (int64_t) c->b1 * dsp->x1[ch] + (int64_t) c->b2 * dsp->x2[ch])
+                                 << PCM_BIQUAD_FRACTION_BITS)
+                                - (int64_t) c->a1 * dsp->y1[ch] - (int64_t) c->a2 * dsp->y2[ch];
+            const int32_t y = (int32_t) ((acc + round) >> PCM_BIQUAD_SHIFT);
+            dsp->x2[ch] = dsp->x1[ch];
+            dsp->x1[ch] = x;
+            dsp->y2[ch] = dsp->y1[ch];
+            dsp->y1[ch] = y;
+            out[ch] = limit((y + (1 << (PCM_BIQUAD_FRACTION_BITS - 1))) >> PCM_BIQUAD_FRACTION_BITS, knee);
+        }
+        frames[i] = (uint16_t) out[0] | ((uint32_t) out[1] << 16);
+    }
+}
+
+void pcm_dsp_process(pcm_dsp_t* dsp, int16_t* samples, uint32_t nr_frames) {
+    if (!pcm_dsp_active(dsp)) {
+        return;
+    }
+    if (dsp->config.eq) {
+        process_eq(dsp, (uint32_t*) samples, nr_frames);
+    } else {
+        process_gain(dsp, (uint32_t*) samples, nr_frames);
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+
+#define PCM_DSP_GAIN_UNITY      32768   // Q15 gain of 0dB
+#define PCM_DSP_GAIN_MAX        65536   // +6dB, louder than that and the limiter does all the work
+#define PCM_DSP_LIMITER_KNEE    24576   // -2.5dBFS, soft limiting starts here
+#define PCM_BIQUAD_SHIFT        27      // Coefficients are Q27, room for +-16 once the gain is folded in
+#define PCM_BIQUAD_FRACTION_BITS 8      // Extra precision of the filter output fed back
+
+/**
+ * Biquad coefficients with a0 normalised to 1:
+ * y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2] - a1 y[n-1] - a2 y[n-2]
+ */
+typedef struct {
+    int32_t b0;
+    int32_t b1;
+    int32_t b2;
+    int32_t a1;
+    int32_t a2;
+} pcm_biquad_t;
+
+typedef enum {
+    PCM_EQ_PEAKING,         // Boost or cut around freq, q sets the width
+    PCM_EQ_LOW_SHELF,       // Boost or cut below freq
+    PCM_EQ_HIGH_SHELF,      // Boost or cut above freq
+    PCM_EQ_HIGH_PASS,       // Cut below freq, eg rumble or what a small speaker cannot reproduce. gain_db is ignored
+} pcm_eq_type_t;
+
+/**
+ * Output chain, applied in place to every block of 16 bit stereo before it goes to the DMA: EQ, gain, then limiter.
+ * Sets the loudness and tone for a venue without re-encoding the clips.
+ */
+typedef struct {
+    int32_t gain;               // Q15, up to PCM_DSP_GAIN_MAX
+    int32_t limiter_knee;       // Peaks above this are bent smoothly towards full scale. 0 hard clips instead
+    bool eq;                    // Run the biquad
+    pcm_biquad_t biquad;        // From pcm_biquad_design, at the sink rate
+} pcm_dsp_config_t;
+
+/**
+ * One stream's chain: its settings, taken when it starts, and its filter history.
+ */
+typedef struct {
+    pcm_dsp_config_t config;
+    pcm_biquad_t folded;        // biquad with the gain folded into b0, b1 and b2
+    int32_t x1[2];              // Filter history per channel
+    int32_t x2[2];
+    int32_t y1[2];              // Output history keeps PCM_BIQUAD_FRACTION_BITS below the LSB
+    int32_t y2[2];
+} pcm_dsp_t;
+
+/**
+ * Replaces the chain settings, which start as unity gain, the limiter at PCM_DSP_LIMITER_KNEE and no EQ.
+ * Streams already running keep the settings they started with.
+ */
+void pcm_dsp_set_config(const pcm_dsp_config_t* config);
+
+const pcm_dsp_config_t* pcm_dsp_get_config();
+
+/**
+ * Designs an RBJ cookbook filter for a stream at sample_rate. Floating point, call it when setting up, not per block.
+ */
+void pcm_biquad_design(pcm_eq_type_t type, float freq, float q, float gain_db, uint32_t sample_rate, pcm_biquad_t* biquad);
+
+/**
+ * Starts a stream's chain with the current settings and clear history.
+ */
+void pcm_dsp_init(pcm_dsp_t* dsp);
+
+/**
+ * False at unity gain with no EQ. The whole chain, limiter included, can then be skipped and clips play bit for bit,
+ * which keeps the zero copy paths open.
+ */
+bool pcm_dsp_active(const pcm_dsp_t* dsp);
+
+/**
+ * Runs the chain in place over nr_frames of 16 bit stereo. samples must be 4 byte aligned.
+ */
+void pcm_dsp_process(pcm_dsp_t* dsp, int16_t* samples, uint32_t nr_frames);
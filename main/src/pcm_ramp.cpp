@@ -0,0 +1,72 @@
+#include "pcm_ramp.h"
+
+#include <cstring>
+
+#define GAIN_UNITY  65536   // Q16
+
+static pcm_ramp_config_t ramp_config = {PCM_RAMP_FADE_IN_FRAMES, PCM_RAMP_FADE_OUT_FRAMES, PCM_RAMP_ABORT_FRAMES};
+
+static uint32_t cap(uint32_t nr_frames) {
+    return nr_frames < PCM_RAMP_MAX_FRAMES ? nr_frames : PCM_RAMP_MAX_FRAMES;
+}
+
+void pcm_ramp_set_config(const pcm_ramp_config_t* config) {
+    ramp_config.fade_in_frames = cap(config->fade_in_frames);
+    ramp_config.fade_out_frames = cap(config->fade_out_frames);
+    ramp_config.abort_frames = cap(config->abort_frames);
+}
+
+const pcm_ramp_config_t* pcm_ramp_get_config() {
+    return &ramp_config;
+}
+
+void pcm_ramp_apply(int16_t* samples, uint32_t nr_frames, int32_t gain, int32_t step) {
+    // One gain per frame for both channels. 32767 * 65536 would overflow, but the gain never reaches unity.
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        samples[2 * i] = (int16_t) ((samples[2 * i] * gain) >> 16);
+        samples[2 * i + 1] = (int16_t) ((samples[2 * i + 1] * gain) >> 16);
+        gain += step;
+    }
+}
+
+bool pcm_ramp_needed(uint32_t position, uint32_t nr_frames, uint32_t total_frames, uint32_t fade_in, uint32_t fade_out) {
+    return position < fade_in || (uint64_t) position + nr_frames + fade_out > total_frames;
+}
+
+void pcm_ramp_envelope(int16_t* samples, uint32_t nr_frames, uint32_t position, uint32_t total_frames,
+                       uint32_t fade_in, uint32_t fade_out) {
+    const uint32_t end = position + nr_frames;
+
+    // Gain f / fade_in at stream frame f.
+    if (position < fade_in) {
+        const int32_t step = GAIN_UNITY / fade_in;
+        const uint32_t last = end < fade_in ? end : fade_in;
+        pcm_ramp_apply(samples, last - position, position * step, step);
+    }
+
+    // Gain (total_frames - 1 - f) / fade_out. A clip shorter than both ramps gets both, the product is still smooth.
+    const uint32_t fade_start = total_frames > fade_out ? total_frames - fade_out : 0;
+    if (fade_out > 0 && end > fade_start && position < total_frames) {
+        const int32_t step = GAIN_UNITY / fade_out;
+        const uint32_t first = position > fade_start ? position : fade_start;
+        const uint32_t last = end < total_frames ? end : total_frames;
+        pcm_ramp_apply(samples + (first - position) * 2, last - first, (total_frames - 1 - first) * step, -step);
+    }
+
+    if (end > total_frames) {
+        const uint32_t first = position > total_frames ? position : total_frames;
+        memset(samples + (first - position) * 2, 0, (end - first) * 4);
+    }
+}
+
+uint32_t pcm_zero_crossing(const int16_t* samples, uint32_t nr_frames) {
+    int32_t previous = 0;
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        const int32_t mid = samples[2 * i] + samples[2 * i + 1];
+        if (mid == 0 || (i > 0 && (mid ^ previous) < 0)) {
+            return i;
+        }
+        previous = mid;
+    }
+    return nr_frames;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+#define PCM_RAMP_FADE_IN_FRAMES     64      // 1.5ms at 44.1kHz, too short to hear as a fade
+#define PCM_RAMP_FADE_OUT_FRAMES    256     // 5.8ms
+#define PCM_RAMP_ABORT_FRAMES       256
+#define PCM_RAMP_ZERO_SEARCH_FRAMES 256     // How far a stop looks for a zero crossing to start its ramp at
+#define PCM_RAMP_MAX_FRAMES         65536   // Gains are Q16, a longer ramp would have no step
+
+/**
+ * Lengths of the gain ramps every clip gets, in frames at the output rate. 0 turns a ramp off.
+ */
+typedef struct {
+    uint32_t fade_in_frames;    // Up from silence at the start of a clip
+    uint32_t fade_out_frames;   // Down to silence over the end of a clip
+    uint32_t abort_frames;      // Down to silence when a clip is stopped early
+} pcm_ramp_config_t;
+
+/**
+ * Replaces the ramp lengths, which start as the PCM_RAMP_ defaults. Lengths are capped at PCM_RAMP_MAX_FRAMES.
+ * Plays already running keep the lengths they started with.
+ */
+void pcm_ramp_set_config(const pcm_ramp_config_t* config);
+
+const pcm_ramp_config_t* pcm_ramp_get_config();
+
+/**
+ * Multiplies nr_frames of 16 bit stereo by a Q16 gain that starts at gain and moves by step every frame.
+ */
+void pcm_ramp_apply(int16_t* samples, uint32_t nr_frames, int32_t gain, int32_t step);
+
+/**
+ * True if frames [position, position + nr_frames) of a stream of total_frames overlap either ramp or run past the end,
+ * ie if pcm_ramp_envelope would change them.
+ */
+bool pcm_ramp_needed(uint32_t position, uint32_t nr_frames, uint32_t total_frames, uint32_t fade_in, uint32_t fade_out);
+
+/**
+ * Applies the fade in over the first fade_in frames and the fade out over the last fade_out frames of a stream of
+ * total_frames 16 bit stereo frames to the block of nr_frames that starts at frame position of the stream.
+ * The first and last frames come out as exactly zero, frames past total_frames are zeroed. A block clear of both ramps
+ * is not touched, so this can be called on every block.
+ */
+void pcm_ramp_envelope(int16_t* samples, uint32_t nr_frames, uint32_t position, uint32_t total_frames,
+                       uint32_t fade_in, uint32_t fade_out);
+
+/**
+ * Returns the first frame at which the mid (left + right) signal is zero or has changed sign, ie the cleanest place
+ * to cut. Returns nr_frames if there is none.
+ */
+uint32_t pcm_zero_crossing(const int16_t* samples, uint32_t nr_frames);
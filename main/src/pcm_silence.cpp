@@ -0,0 +1,134 @@
+#include "pcm_silence.h"
+
+#include <cstring>
+
+static pcm_silence_config_t silence_config = {true, PCM_SILENCE_THRESHOLD, PCM_SILENCE_MIN_RUN_FRAMES};
+
+void pcm_silence_set_config(const pcm_silence_config_t* config) {
+    silence_config = *config;
+}
+
+const pcm_silence_config_t* pcm_silence_get_config() {
+    return &silence_config;
+}
+
+/**
+ * True if every sample of the frame is within the threshold. 8 bit samples are unsigned, 128 is silence.
+ */
+static bool frame_silent(const char* frame, uint16_t num_channels, uint16_t bits_per_sample) {
+    const int32_t threshold = silence_config.threshold;
+    for (uint16_t ch = 0; ch < num_channels; ch++) {
+        int32_t sample;
+        if (bits_per_sample == 8) {
+            sample = ((int32_t) (uint8_t) frame[ch] - 128) << 8;
+        } else {
+            int16_t s;
+            memcpy(&s, frame + 2 * ch, sizeof(s));     // Mapped flash or an odd frame, may not be aligned
+            sample = s;
+        }
+        if (sample > threshold || sample < -threshold) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void pcm_silence_trim(const char* data, uint32_t nr_bytes, uint16_t num_channels, uint16_t bits_per_sample,
+                      uint32_t* leading, uint32_t* trailing) {
+    *leading = 0;
+    *trailing = 0;
+    const uint32_t frame_bytes = num_channels * bits_per_sample / 8;
+    if (!silence_config.enabled || frame_bytes == 0) {
+        return;
+    }
+
+    const uint32_t nr_frames = nr_bytes / frame_bytes;
+    uint32_t first = 0;
+    while (first < nr_frames && frame_silent(data + first * frame_bytes, num_channels, bits_per_sample)) {
+        first++;
+    }
+    if (first == nr_frames) {
+        return;
+    }
+    uint32_t end = nr_frames;
+    while (end > first && frame_silent(data + (end - 1) * frame_bytes, num_channels, bits_per_sample)) {
+        end--;
+    }
+
+    *leading = (first * frame_bytes) & ~3u;     // Frames are 1, 2 or 4 bytes, so this is still whole frames
+    *trailing = nr_bytes - end * frame_bytes;
+}
+
+/**
+ * Adds the run to index, dropping the shortest run if it is full. Runs are found in order, so they stay in order.
+ */
+static void add_run(pcm_silence_index_t* index, uint32_t start, uint32_t end) {
+    start = (start + 3) & ~3u;
+    end &= ~3u;
+    if (end <= start) {
+        return;
+    }
+    if (index->nr_runs == PCM_SILENCE_MAX_RUNS) {
+        uint32_t shortest = 0;
+        for (uint32_t i = 1; i < index->nr_runs; i++) {
+            if (index->runs[i].nr_bytes < index->runs[shortest].nr_bytes) {
+                shortest = i;
+            }
+        }
+        if (index->runs[shortest].nr_bytes >= end - start) {
+            return;
+        }
+        index->nr_bytes -= index->runs[shortest].nr_bytes;
+        memmove(&index->runs[shortest], &index->runs[shortest + 1], (index->nr_runs - shortest - 1) * sizeof(pcm_silence_run_t));
+        index->nr_runs--;
+    }
+    index->runs[index->nr_runs].offset = start;
+    index->runs[index->nr_runs].nr_bytes = end - start;
+    index->nr_runs++;
+    index->nr_bytes += end - start;
+}
+
+void pcm_silence_index(const char* data, uint32_t nr_bytes, uint16_t num_channels, uint16_t bits_per_sample,
+                       pcm_silence_index_t* index) {
+    memset(index, 0, sizeof(pcm_silence_index_t));
+    const uint32_t frame_bytes = num_channels * bits_per_sample / 8;
+    if (!silence_config.enabled || frame_bytes == 0 || silence_config.min_run_frames == 0) {
+        return;
+    }
+
+    const uint32_t nr_frames = nr_bytes / frame_bytes;
+    uint32_t run_start = 0;
+    uint32_t run_frames = 0;
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        if (frame_silent(data + i * frame_bytes, num_channels, bits_per_sample)) {
+            if (run_frames++ == 0) {
+                run_start = i;
+            }
+            continue;
+        }
+        if (run_frames >= silence_config.min_run_frames) {
+            add_run(index, run_start * frame_bytes, i * frame_bytes);
+        }
+        run_frames = 0;
+    }
+    if (run_frames >= silence_config.min_run_frames) {
+        add_run(index, run_start * frame_bytes, nr_frames * frame_bytes);
+    }
+}
+
+const pcm_silence_run_t* pcm_silence_next(const pcm_silence_index_t* index, uint32_t offset) {
+    if (index == nullptr) {
+        return nullptr;
+    }
+    for (uint32_t i = 0; i < index->nr_runs; i++) {
+        if (index->runs[i].offset + index->runs[i].nr_bytes > offset) {
+            return &index->runs[i];
+        }
+    }
+    return nullptr;
+}
+
+bool pcm_silence_covers(const pcm_silence_index_t* index, uint32_t offset, uint32_t nr_bytes) {
+    const pcm_silence_run_t* run = pcm_silence_next(index, offset);
+    return run != nullptr && offset >= run->offset && offset + nr_bytes <= run->offset + run->nr_bytes;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+
+#define PCM_SILENCE_THRESHOLD       0       // Largest 16 bit sample magnitude counted as silent, 0 is digital silence only
+#define PCM_SILENCE_MIN_RUN_FRAMES  1024    // Shortest internal run worth indexing, one DMA descriptor at the sink rate
+#define PCM_SILENCE_MAX_RUNS        8       // Internal runs kept per clip, the longest ones
+
+/**
+ * How clips are analysed when they are loaded. tools/silence_report.py takes the same settings.
+ */
+typedef struct {
+    bool enabled;               // Off leaves every clip as it is
+    uint16_t threshold;         // Frames with every sample within +-threshold are silent, 8 bit samples are scaled up
+    uint32_t min_run_frames;    // Internal runs shorter than this are played as they are
+} pcm_silence_config_t;
+
+typedef struct {
+    uint32_t offset;            // Bytes from the start of the data, 4 byte aligned
+    uint32_t nr_bytes;          // Multiple of 4
+} pcm_silence_run_t;
+
+/**
+ * Silent runs inside a clip, in order. Only whole 4 byte words of each run are included, so a player can swap the
+ * run for zeros without splitting a frame.
+ */
+typedef struct {
+    uint32_t nr_runs;
+    uint32_t nr_bytes;          // Sum of the runs
+    pcm_silence_run_t runs[PCM_SILENCE_MAX_RUNS];
+} pcm_silence_index_t;
+
+/**
+ * Replaces the analysis settings, which start as the PCM_SILENCE_ defaults. Clips already loaded keep their analysis.
+ */
+void pcm_silence_set_config(const pcm_silence_config_t* config);
+
+const pcm_silence_config_t* pcm_silence_get_config();
+
+/**
+ * Measures the silence at either end of nr_bytes of PCM data. leading is rounded down to a multiple of 4 bytes, so the
+ * data that is left keeps the alignment of data. trailing includes any part frame at the end.
+ * Both are 0 if the data is silent throughout, or the analysis is off.
+ */
+void pcm_silence_trim(const char* data, uint32_t nr_bytes, uint16_t num_channels, uint16_t bits_per_sample,
+                      uint32_t* leading, uint32_t* trailing);
+
+/**
+ * Finds the runs of at least min_run_frames silent frames in nr_bytes of PCM data, keeping the longest
+ * PCM_SILENCE_MAX_RUNS. Meant for data that has already been trimmed.
+ */
+void pcm_silence_index(const char* data, uint32_t nr_bytes, uint16_t num_channels, uint16_t bits_per_sample,
+                       pcm_silence_index_t* index);
+
+/**
+ * Returns the first run of index that ends after offset, or nullptr if there is none. index may be nullptr.
+ */
+const pcm_silence_run_t* pcm_silence_next(const pcm_silence_index_t* index, uint32_t offset);
+
+/**
+ * True if bytes [offset, offset + nr_bytes) of the data lie within one run of index. index may be nullptr.
+ */
+bool pcm_silence_covers(const pcm_silence_index_t* index, uint32_t offset, uint32_t nr_bytes);
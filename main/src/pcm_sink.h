@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+/**
+ * Destination of the PCM data leaving the players.
+ * On the ESP32 this wraps i2s_write, on the host it can be replaced by a simulated timed sink.
+ */
+typedef struct {
+    esp_err_t (*write)(void* ctx, const char* data, size_t size, size_t* nr_bytes_written);
+
+    /**
+     * Blocks until nr_buffers more DMA buffers have been clocked out, or returns ESP_ERR_TIMEOUT.
+     * May be nullptr if the sink cannot report completion.
+     */
+    esp_err_t (*wait_sent)(void* ctx, uint32_t nr_buffers);
+
+    void* ctx;
+    uint32_t dma_buf_bytes;     // Size of one DMA descriptor in bytes, ie dma_buf_len * bytes per frame
+    uint32_t dma_buf_count;     // Number of DMA descriptors in the ring
+    uint32_t sample_rate;       // Fixed output rate clips are resampled to, 0 if the player sets the port rate per clip
+} pcm_sink_t;
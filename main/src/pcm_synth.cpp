@@ -0,0 +1,177 @@
+#include "pcm_synth.h"
+#include "const_math.h"
+
+#include <esp_log.h>
+
+static const char *TAG = "pcm_synth";
+
+#define TABLE_SIZE              (1 << PCM_SYNTH_TABLE_BITS)
+#define TABLE_FRAC_BITS         15      // Position between two entries, so the interpolation fits in 32 bits
+#define INCREMENT_FRAC_BITS     16      // Extra fraction bits of the phase increment, so slow sweeps still move it
+#define LEVEL_SHIFT             15      // Q30 envelope to Q15
+
+// Compile time wavetables, band limited to PCM_SYNTH_HARMONICS and normalised to full scale.
+
+/**
+ * Fourier series amplitude of harmonic k of each wave, in sines.
+ */
+static constexpr double harmonic(int wave, int k) {
+    return wave == PCM_WAVE_SINE ? (k == 1 ? 1.0 : 0.0)
+         : wave == PCM_WAVE_TRIANGLE ? (k % 2 == 0 ? 0.0 : (k % 4 == 1 ? 1.0 : -1.0) / (k * k))
+         : wave == PCM_WAVE_SQUARE ? (k % 2 == 0 ? 0.0 : 1.0 / k)
+         : (k % 2 == 0 ? -1.0 : 1.0) / k;
+}
+
+static constexpr double wave_value(int wave, int index, int k) {
+    return k > PCM_SYNTH_HARMONICS ? 0.0
+         : harmonic(wave, k) * const_sin(2 * PI * k * index / TABLE_SIZE) + wave_value(wave, index, k + 1);
+}
+
+static constexpr double larger(double a, double b) {
+    return a > b ? a : b;
+}
+
+/**
+ * Largest magnitude over entries [first, last), by halves to keep the recursion shallow.
+ */
+static constexpr double wave_peak(int wave, int first, int last) {
+    return last - first == 1 ? larger(wave_value(wave, first, 1), -wave_value(wave, first, 1))
+         : larger(wave_peak(wave, first, (first + last) / 2), wave_peak(wave, (first + last) / 2, last));
+}
+
+static constexpr int16_t round_to_int16(double x) {
+    return (int16_t) (x + (x >= 0 ? 0.5 : -0.5));
+}
+
+// One extra entry, a copy of the first, so every entry can interpolate with the next one.
+typedef struct {
+    int16_t s[TABLE_SIZE + 1];
+} wavetable_t;
+
+template <int... I>
+static constexpr wavetable_t make_table(int wave, double scale, index_list<I...>) {
+    return {{ round_to_int16(wave_value(wave, I % TABLE_SIZE, 1) * scale)... }};
+}
+
+static constexpr wavetable_t make_table(int wave) {
+    return make_table(wave, 32767 / wave_peak(wave, 0, TABLE_SIZE), make_index_list<TABLE_SIZE + 1>::type());
+}
+
+static constexpr wavetable_t wavetables[PCM_WAVE_COUNT] = {
+        make_table(PCM_WAVE_SINE),
+        make_table(PCM_WAVE_TRIANGLE),
+        make_table(PCM_WAVE_SQUARE),
+        make_table(PCM_WAVE_SAW),
+};
+
+static_assert(wavetables[PCM_WAVE_SINE].s[TABLE_SIZE / 4] == 32767 && wavetables[PCM_WAVE_SINE].s[0] == 0,
+              "sine should start at zero and peak a quarter of the way round");
+
+/**
+ * Phase increment per frame for hz, with INCREMENT_FRAC_BITS extra fraction bits.
+ */
+static int64_t increment(uint32_t hz, uint32_t sample_rate) {
+    return (int64_t) (((uint64_t) hz << (32 + INCREMENT_FRAC_BITS)) / sample_rate);
+}
+
+static uint32_t ms_to_frames(uint32_t ms, uint32_t sample_rate) {
+    return (uint32_t) ((uint64_t) ms * sample_rate / 1000);
+}
+
+esp_err_t pcm_synth_init(pcm_synth_t* synth, const pcm_tone_t* tone, uint32_t sample_rate) {
+    if (tone->wave >= PCM_WAVE_COUNT || sample_rate == 0 || tone->start_hz >= sample_rate / 2
+        || tone->end_hz >= sample_rate / 2) {
+        ESP_LOGE(TAG, "Unsupported tone, wave %d %d-%dHz at %dHz", tone->wave, tone->start_hz, tone->end_hz, sample_rate);
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Full scale is the most the Q30 envelope can hold.
+    if (tone->gain < 0 || tone->gain > PCM_SYNTH_GAIN_UNITY || tone->sustain < 0 || tone->sustain > PCM_SYNTH_GAIN_UNITY) {
+        ESP_LOGE(TAG, "Unsupported tone, gain %d sustain %d", tone->gain, tone->sustain);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const uint32_t attack = ms_to_frames(tone->attack_ms, sample_rate);
+    const uint32_t decay = ms_to_frames(tone->decay_ms, sample_rate);
+    const uint32_t release = ms_to_frames(tone->release_ms, sample_rate);
+    uint32_t nr_frames = ms_to_frames(tone->duration_ms, sample_rate);
+    nr_frames = nr_frames > attack + decay + release ? nr_frames : attack + decay + release;
+
+    synth->table = wavetables[tone->wave].s;
+    synth->phase = 0;
+    synth->increment = increment(tone->start_hz, sample_rate);
+    synth->sweep = nr_frames > 0 ? (increment(tone->end_hz, sample_rate) - synth->increment) / nr_frames : 0;
+    synth->peak = tone->gain << LEVEL_SHIFT;
+    synth->sustain = (int32_t) (((int64_t) tone->sustain * tone->gain) >> 15) << LEVEL_SHIFT;
+    // With no attack, or no decay either, the tone starts at the level it would have reached.
+    synth->level = attack > 0 ? 0 : decay > 0 ? synth->peak : synth->sustain;
+    synth->step = 0;
+    synth->frame = 0;
+    synth->segment_end = 0;
+    synth->attack_end = attack;
+    synth->decay_end = attack + decay;
+    synth->release_start = nr_frames - release;
+    synth->nr_frames = nr_frames;
+    return ESP_OK;
+}
+
+uint32_t pcm_synth_frames(const pcm_synth_t* synth) {
+    return synth->nr_frames;
+}
+
+/**
+ * Renders nr_frames with the envelope moving by step every frame.
+ */
+static void render_segment(pcm_synth_t* synth, int16_t* dst, uint32_t nr_frames, int32_t step) {
+    const int16_t* table = synth->table;
+    uint32_t phase = synth->phase;
+    int64_t increment = synth->increment;
+    int32_t level = synth->level;
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        const uint32_t index = phase >> (32 - PCM_SYNTH_TABLE_BITS);
+        const int32_t frac = (phase >> (32 - PCM_SYNTH_TABLE_BITS - TABLE_FRAC_BITS)) & ((1 << TABLE_FRAC_BITS) - 1);
+        const int32_t a = table[index];
+        const int32_t value = a + (((table[index + 1] - a) * frac) >> TABLE_FRAC_BITS);
+        const int16_t sample = (int16_t) ((value * (level >> LEVEL_SHIFT)) >> 15);
+        dst[2 * i] = sample;
+        dst[2 * i + 1] = sample;
+
+        phase += (uint32_t) (increment >> INCREMENT_FRAC_BITS);
+        increment += synth->sweep;
+        level += step;
+    }
+    synth->phase = phase;
+    synth->increment = increment;
+    synth->level = level;
+}
+
+uint32_t pcm_synth_render(pcm_synth_t* synth, int16_t* dst, uint32_t max_frames) {
+    uint32_t nr_out = 0;
+    while (nr_out < max_frames && synth->frame < synth->nr_frames) {
+        if (synth->frame == synth->segment_end) {
+            // The envelope is linear within each part, aimed to land on the part's end level. The step is set once
+            // per part, so the output is the same however the tone is split into blocks.
+            int32_t target;
+            if (synth->frame < synth->attack_end) {
+                synth->segment_end = synth->attack_end;
+                target = synth->peak;
+            } else if (synth->frame < synth->decay_end) {
+                synth->segment_end = synth->decay_end;
+                target = synth->sustain;
+            } else if (synth->frame < synth->release_start) {
+                synth->segment_end = synth->release_start;
+                target = synth->sustain;
+            } else {
+                synth->segment_end = synth->nr_frames;
+                target = 0;
+            }
+            synth->step = (target - synth->level) / (int32_t) (synth->segment_end - synth->frame);
+        }
+        uint32_t nr_frames = synth->segment_end - synth->frame;
+        nr_frames = nr_frames < max_frames - nr_out ? nr_frames : max_frames - nr_out;
+
+        render_segment(synth, &dst[2 * nr_out], nr_frames, synth->step);
+        synth->frame += nr_frames;
+        nr_out += nr_frames;
+    }
+    return nr_out;
+}
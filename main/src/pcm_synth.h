@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <esp_err.h>
+
+#define PCM_SYNTH_TABLE_BITS    8       // 256 entry wavetables, linearly interpolated
+#define PCM_SYNTH_HARMONICS     9       // Highest harmonic in the tables, none alias below 2.4kHz at 44.1kHz
+#define PCM_SYNTH_GAIN_UNITY    32768   // Q15 gain of 1.0, full scale
+
+typedef enum {
+    PCM_WAVE_SINE,
+    PCM_WAVE_TRIANGLE,
+    PCM_WAVE_SQUARE,
+    PCM_WAVE_SAW,
+    PCM_WAVE_COUNT
+} pcm_wave_t;
+
+/**
+ * A tone: one oscillator, swept linearly from start_hz to end_hz, shaped by an ADSR envelope.
+ */
+typedef struct {
+    pcm_wave_t wave;
+    uint32_t start_hz;
+    uint32_t end_hz;            // Same as start_hz for a steady tone
+    int32_t gain;               // Q15 peak level, 0 to PCM_SYNTH_GAIN_UNITY, which is full scale
+    uint32_t duration_ms;       // Start of the attack to the end of the release, stretched to fit all three if short
+    uint32_t attack_ms;         // Up from silence to gain
+    uint32_t decay_ms;          // Down from gain to the sustain level
+    uint32_t release_ms;        // Down to silence over the end of the tone
+    int32_t sustain;            // Q15 fraction of gain held between the decay and the release, 0 to PCM_SYNTH_GAIN_UNITY
+} pcm_tone_t;
+
+/**
+ * Rendering state of one tone.
+ */
+typedef struct {
+    const int16_t* table;
+    uint32_t phase;
+    int64_t increment;          // Phase step per frame, with 16 more fraction bits than phase
+    int64_t sweep;              // Added to increment every frame
+    int32_t level;              // Envelope, Q30
+    int32_t peak;               // Envelope levels, Q30
+    int32_t sustain;
+    int32_t step;               // Added to level every frame until segment_end
+    uint32_t frame;
+    uint32_t segment_end;       // Frame at which the current part of the envelope ends
+    uint32_t attack_end;        // Frames at which each part of the envelope ends
+    uint32_t decay_end;
+    uint32_t release_start;
+    uint32_t nr_frames;
+} pcm_synth_t;
+
+/**
+ * Gets ready to render tone at sample_rate.
+ * Returns ESP_ERR_INVALID_ARG if either pitch is at or above the Nyquist frequency, or the gain or sustain is outside
+ * 0 to PCM_SYNTH_GAIN_UNITY.
+ */
+esp_err_t pcm_synth_init(pcm_synth_t* synth, const pcm_tone_t* tone, uint32_t sample_rate);
+
+/**
+ * Length of the tone in frames.
+ */
+uint32_t pcm_synth_frames(const pcm_synth_t* synth);
+
+/**
+ * Renders up to max_frames of the tone as 16 bit stereo, the same on both channels, into dst.
+ * Returns the number of frames, short at the end of the tone and 0 after it.
+ */
+uint32_t pcm_synth_render(pcm_synth_t* synth, int16_t* dst, uint32_t max_frames);
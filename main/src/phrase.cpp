@@ -0,0 +1,112 @@
+#include "phrase.h"
+#include "clip_store.h"
+
+#include <esp_log.h>
+
+static const char *TAG = "phrase";
+
+#define MAX_NUMBER_UNITS        2       // "ninety" "nine"
+#define MAX_TIME_UNITS          9       // "ninety" "nine" "minutes" "fifty" "nine" "point" "nine" "nine" "seconds"
+
+static const char* const ONES[] = {"zero", "one", "two", "three", "four", "five", "six", "seven", "eight", "nine", "ten",
+                                   "eleven", "twelve", "thirteen", "fourteen", "fifteen", "sixteen", "seventeen",
+                                   "eighteen", "nineteen"};
+static const char* const TENS[] = {nullptr, nullptr, "twenty", "thirty", "forty", "fifty", "sixty", "seventy", "eighty",
+                                   "ninety"};
+
+/**
+ * Appends all nr_units of units, or none if they do not fit.
+ */
+static esp_err_t append(phrase_t* phrase, const char* const* units, uint32_t nr_units) {
+    if (phrase->nr_units + nr_units > PHRASE_MAX_UNITS) {
+        ESP_LOGW(TAG, "No room for %d more units after %d", nr_units, phrase->nr_units);
+        return ESP_ERR_NO_MEM;
+    }
+    for (uint32_t i = 0; i < nr_units; i++) {
+        phrase->units[phrase->nr_units++] = units[i];
+    }
+    return ESP_OK;
+}
+
+/**
+ * Fills units with number, at most PHRASE_MAX_NUMBER, in words and returns how many.
+ */
+static uint32_t number_units(uint32_t number, const char** units) {
+    if (number < 20) {
+        units[0] = ONES[number];
+        return 1;
+    }
+    units[0] = TENS[number / 10];
+    if (number % 10 == 0) {
+        return 1;
+    }
+    units[1] = ONES[number % 10];
+    return 2;
+}
+
+void phrase_init(phrase_t* phrase) {
+    phrase->nr_units = 0;
+}
+
+esp_err_t phrase_add(phrase_t* phrase, const char* unit) {
+    return append(phrase, &unit, 1);
+}
+
+esp_err_t phrase_add_number(phrase_t* phrase, uint32_t number) {
+    if (number > PHRASE_MAX_NUMBER) {
+        ESP_LOGW(TAG, "Cannot say %d", number);
+        return ESP_ERR_INVALID_ARG;
+    }
+    const char* units[MAX_NUMBER_UNITS];
+    return append(phrase, units, number_units(number, units));
+}
+
+esp_err_t phrase_add_time(phrase_t* phrase, uint32_t time_ms) {
+    const uint32_t hundredths = time_ms / 10;
+    const uint32_t minutes = hundredths / 6000;
+    const uint32_t seconds = hundredths / 100 % 60;
+    if (minutes > PHRASE_MAX_NUMBER) {
+        ESP_LOGW(TAG, "Cannot say a time of %dms", time_ms);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const char* units[MAX_TIME_UNITS];
+    uint32_t nr_units = 0;
+    if (minutes > 0) {
+        nr_units += number_units(minutes, &units[nr_units]);
+        units[nr_units++] = minutes == 1 ? "minute" : "minutes";
+    }
+    nr_units += number_units(seconds, &units[nr_units]);
+    units[nr_units++] = "point";
+    units[nr_units++] = ONES[hundredths / 10 % 10];
+    units[nr_units++] = ONES[hundredths % 10];
+    units[nr_units++] = "seconds";
+    return append(phrase, units, nr_units);
+}
+
+esp_err_t phrase_find_units(const phrase_t* phrase) {
+    for (uint32_t i = 0; i < phrase->nr_units; i++) {
+        if (clip_store_find_entry(phrase->units[i]) == nullptr) {
+            ESP_LOGW(TAG, "No speech unit %s in the clip store, see main/phrase_units.txt", phrase->units[i]);
+            return ESP_ERR_NOT_FOUND;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t phrase_play(const phrase_t* phrase, int32_t gain, sequence_stats_t* stats) {
+    if (phrase->nr_units == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // All or nothing, sequence_play would say the units up to the missing one.
+    const esp_err_t err = phrase_find_units(phrase);
+    if (err != ESP_OK) {
+        return err;
+    }
+    sequence_item_t items[PHRASE_MAX_UNITS];
+    for (uint32_t i = 0; i < phrase->nr_units; i++) {
+        items[i].filename = phrase->units[i];
+        items[i].offset_frames = -PHRASE_CROSSFADE_FRAMES;  // Ignored for the first
+    }
+    return sequence_play(items, phrase->nr_units, gain, stats);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <esp_err.h>
+
+#include "sequence.h"
+
+#define PHRASE_MAX_UNITS        16      // Longest announcement, a time with minutes takes 9
+#define PHRASE_CROSSFADE_FRAMES 441     // 10ms at 44.1kHz, how much neighbouring units overlap
+#define PHRASE_MAX_NUMBER       99      // Largest number phrase_add_number can say
+
+/**
+ * An announcement, as the speech units to say in order. Units are clips in the clip store packed from
+ * main/phrase_units.txt, which lists the vocabulary.
+ */
+typedef struct {
+    const char* units[PHRASE_MAX_UNITS];
+    uint32_t nr_units;
+} phrase_t;
+
+void phrase_init(phrase_t* phrase);
+
+/**
+ * Appends unit, which must outlive the phrase. Returns ESP_ERR_NO_MEM if the phrase is full.
+ */
+esp_err_t phrase_add(phrase_t* phrase, const char* unit);
+
+/**
+ * Appends number in words, eg "forty" "two". Returns ESP_ERR_INVALID_ARG above PHRASE_MAX_NUMBER and ESP_ERR_NO_MEM
+ * if it does not fit, adding nothing either way.
+ */
+esp_err_t phrase_add_number(phrase_t* phrase, uint32_t number);
+
+/**
+ * Appends a race time to the hundredth, eg "twelve" "point" "three" "four" "seconds", with the minutes first from a
+ * minute up. Returns ESP_ERR_INVALID_ARG from 100 minutes and ESP_ERR_NO_MEM if it does not fit, adding nothing.
+ */
+esp_err_t phrase_add_time(phrase_t* phrase, uint32_t time_ms);
+
+/**
+ * Checks every unit of the phrase is in the clip store, logging the first that is not. Returns ESP_ERR_NOT_FOUND if
+ * one is missing, as most are until the vocabulary listed in main/phrase_units.txt has been recorded.
+ */
+esp_err_t phrase_find_units(const phrase_t* phrase);
+
+/**
+ * Says the phrase through sequence_play, each unit crossfaded into the next over PHRASE_CROSSFADE_FRAMES so the
+ * announcement is one continuous stream. Blocks until it has been mixed. Returns ESP_ERR_NOT_FOUND, saying nothing,
+ * if any unit is missing from the clip store.
+ */
+esp_err_t phrase_play(const phrase_t* phrase, int32_t gain, sequence_stats_t* stats);
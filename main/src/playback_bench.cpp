@@ -0,0 +1,603 @@
+#include "playback_bench.h"
+#include "adpcm.h"
+#include "clip_cache.h"
+#include "clip_store.h"
+#include "mixer.h"
+#include "pcm_convert.h"
+#include "pcm_dsp.h"
+#include "pcm_synth.h"
+#include "playback_pipeline.h"
+#include "resampler.h"
+#include "sim_sink.h"
+#include "wav_file.h"
+#include "wav_player.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+static const char *TAG = "bench";
+
+#define BENCH_SYNTH_FRAMES      1024    // One DMA descriptor of the default geometry
+#define BENCH_RESAMPLE_FRAMES   1024    // Output frames per block, one DMA descriptor
+#define BENCH_CONVERT_FRAMES    1024    // Output frames per conversion, one DMA descriptor
+#define BENCH_ADPCM_FRAMES      1024    // Output frames per decode, one DMA descriptor
+#define BENCH_ADPCM_IN_BLOCKS   4       // ADPCM blocks decoded over and over
+#define BENCH_DSP_FRAMES        1024    // Frames per pass of the chain, one DMA descriptor
+#define BENCH_MIX_POLL_MS       10
+#define BENCH_PHRASE_FIRST      0       // Timings kept by bench_assembly
+#define BENCH_PHRASE_ALL        1
+
+typedef struct {
+    const char* name;
+    bool fixed_rate;    // Resamples to the output rate. Otherwise the DMA restarts at the file's rate first
+    esp_err_t (*play)(const char* filename, const pcm_sink_t* sink);
+} bench_strategy_t;
+
+static const char* bench_silence;
+static uint32_t bench_silence_size;
+
+template <typename Policy>
+static esp_err_t play_with(const char* filename, const pcm_sink_t* sink) {
+    FILE* f;
+    wav_header_t wav_header;
+    esp_err_t err = load_wav_header((char*) filename, &wav_header, &f);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = wav_player_stream<Policy>(f, sink, bench_silence, bench_silence_size);
+    fclose(f);
+    return err;
+}
+
+static esp_err_t play_clip(const wav_data_t* clip, const pcm_sink_t* sink, int64_t request_us) {
+    uint32_t nr_bytes_written;
+    const esp_err_t err = clip_cache_stream(clip, sink, request_us, &nr_bytes_written);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return wav_player_flush_to_dma_boundary(sink, nr_bytes_written, bench_silence, bench_silence_size, true);
+}
+
+static esp_err_t play_cached(const char* filename, const pcm_sink_t* sink) {
+    const int64_t request_us = esp_timer_get_time();
+    const wav_data_t* clip = clip_cache_get(filename);
+    if (clip == nullptr) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return play_clip(clip, sink, request_us);
+}
+
+static esp_err_t play_mapped(const char* filename, const pcm_sink_t* sink) {
+    const int64_t request_us = esp_timer_get_time();
+    wav_data_t clip;
+    const esp_err_t err = clip_store_find(filename, &clip);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return play_clip(&clip, sink, request_us);
+}
+
+static const bench_strategy_t strategies[] = {
+        {"legacy_policy_1", false, play_with<legacy_policy_1>},
+        {"legacy_policy_2", false, play_with<legacy_policy_2>},
+        {"legacy_policy_3", false, play_with<legacy_policy_3>},
+        {"legacy_policy_4", false, play_with<legacy_policy_4>},
+        {"legacy_policy_5", false, play_with<legacy_policy_5>},
+        {"legacy_policy_6", false, play_with<legacy_policy_6>},
+        {"legacy_policy_7", false, play_with<legacy_policy_7>},
+        {"legacy_policy_8", false, play_with<legacy_policy_8>},
+        {"legacy_policy_9", false, play_with<legacy_policy_9>},
+        {"dma_aligned", false, play_with<dma_aligned_policy>},
+        {"gapless", false, play_with<gapless_policy>},
+        {"cached", true, play_cached},
+        {"mapped", true, play_mapped},
+};
+
+esp_err_t playback_bench_run(const char* filename, uint32_t dma_buf_bytes, uint32_t dma_buf_count, uint32_t output_rate,
+                             const char* silence, uint32_t silence_size) {
+    bench_silence = silence;
+    bench_silence_size = silence_size;
+
+    FILE* f;
+    wav_header_t wav_header;
+    esp_err_t err = load_wav_header((char*) filename, &wav_header, &f);
+    if (err != ESP_OK) {
+        return err;
+    }
+    fclose(f);
+
+    sim_sink_t sim;
+    err = sim_sink_init(&sim, dma_buf_bytes, dma_buf_count);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    ESP_LOGI(TAG, "%s, %dHz. cpu excludes time blocked in the sink. tail is from return to the last audible sample",
+             filename, wav_header.SampleRate);
+    ESP_LOGI(TAG, "%-16s %8s %10s %9s %9s %5s %6s %8s %10s", "strategy", "MB/s", "cpu/write", "start_ms", "tail_ms",
+             "gaps", "clicks", "max_step", "hash");
+    for (const bench_strategy_t& strategy : strategies) {
+        sim_sink_start(&sim, strategy.fixed_rate ? output_rate : wav_header.SampleRate);
+
+        const int64_t start_us = esp_timer_get_time();
+        err = strategy.play(filename, &sim.sink);
+        const int64_t end_us = esp_timer_get_time();
+        sim_sink_drain(&sim);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "%-16s skipped err=%s", strategy.name, esp_err_to_name(err));
+            continue;
+        }
+
+        const sim_sink_stats_t* stats = &sim.stats;
+        int64_t cpu_us = end_us - start_us - stats->sink_us;
+        cpu_us = cpu_us > 0 ? cpu_us : 1;
+        const bool audible = stats->first_audible_us != 0;
+        ESP_LOGI(TAG, "%-16s %8.2f %10lld %9.1f %9.1f %5d %6d %8d %08x", strategy.name,
+                 (double) stats->nr_bytes_written / cpu_us,
+                 (long long) (cpu_us / (stats->nr_writes > 0 ? stats->nr_writes : 1)),
+                 audible ? (stats->first_audible_us - start_us) / 1000.0 : 0.0,
+                 audible ? (stats->last_audible_us - end_us) / 1000.0 : 0.0,
+                 stats->nr_gaps, stats->nr_clicks, stats->max_step, stats->output_hash);
+    }
+
+    sim_sink_free(&sim);
+    return ESP_OK;
+}
+
+esp_err_t playback_bench_synth(uint32_t output_rate, uint32_t nr_blocks) {
+    int16_t* block = (int16_t*) heap_caps_malloc(BENCH_SYNTH_FRAMES * 4, MALLOC_CAP_8BIT);
+    if (block == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    static const char* const wave_names[PCM_WAVE_COUNT] = {"sine", "triangle", "square", "saw"};
+    const double block_us = BENCH_SYNTH_FRAMES * 1000000.0 / output_rate;
+
+    ESP_LOGI(TAG, "pcm_synth, %d frame blocks at %dHz, a block plays for %.0fus", BENCH_SYNTH_FRAMES, output_rate, block_us);
+    ESP_LOGI(TAG, "%-16s %10s %8s", "wave", "us/block", "load");
+    for (int wave = 0; wave < PCM_WAVE_COUNT; wave++) {
+        // A sweep held at sustain, the usual case for every block but the first and last.
+        const uint32_t duration_ms = (uint32_t) ((uint64_t) nr_blocks * BENCH_SYNTH_FRAMES * 1000 / output_rate + 1);
+        const pcm_tone_t tone = {(pcm_wave_t) wave, 1000, 2000, PCM_SYNTH_GAIN_UNITY, duration_ms, 0, 0, 0,
+                                 PCM_SYNTH_GAIN_UNITY / 2};
+        pcm_synth_t synth;
+        esp_err_t err = pcm_synth_init(&synth, &tone, output_rate);
+        if (err != ESP_OK) {
+            heap_caps_free(block);
+            return err;
+        }
+        const int64_t start_us = esp_timer_get_time();
+        for (uint32_t i = 0; i < nr_blocks; i++) {
+            pcm_synth_render(&synth, block, BENCH_SYNTH_FRAMES);
+        }
+        const double per_block_us = (double) (esp_timer_get_time() - start_us) / (nr_blocks > 0 ? nr_blocks : 1);
+        ESP_LOGI(TAG, "%-16s %10.1f %7.2f%%", wave_names[wave], per_block_us, 100 * per_block_us / block_us);
+    }
+
+    heap_caps_free(block);
+    return ESP_OK;
+}
+
+esp_err_t playback_bench_resample(uint32_t output_rate, uint32_t nr_blocks) {
+    static const uint32_t in_rates[] = {8000, 11025, 16000, 22050, 32000, 44100, 48000};
+    // Enough input for a block from the highest rate, filled with a tone so the filter sees real data.
+    const uint32_t max_in_frames = (uint32_t) ((uint64_t) BENCH_RESAMPLE_FRAMES * 48000 / output_rate + 2);
+    int16_t* in = (int16_t*) heap_caps_malloc(max_in_frames * 4, MALLOC_CAP_8BIT);
+    int16_t* block = (int16_t*) heap_caps_malloc(BENCH_RESAMPLE_FRAMES * 4, MALLOC_CAP_8BIT);
+    if (in == nullptr || block == nullptr) {
+        heap_caps_free(in);
+        heap_caps_free(block);
+        return ESP_ERR_NO_MEM;
+    }
+    for (uint32_t i = 0; i < max_in_frames * 2; i++) {
+        in[i] = (int16_t) ((i * 2654435761u) >> 18) - 8192;
+    }
+    const double block_us = BENCH_RESAMPLE_FRAMES * 1000000.0 / output_rate;
+
+    ESP_LOGI(TAG, "resampler, %d frame blocks to %dHz, a block plays for %.0fus", BENCH_RESAMPLE_FRAMES, output_rate,
+             block_us);
+    ESP_LOGI(TAG, "%-16s %10s %10s %8s", "input_rate", "us/block", "ns/frame", "load");
+    for (uint32_t in_rate : in_rates) {
+        if (in_rate == output_rate) {
+            continue;   // Played as it is
+        }
+        resampler_t resampler;
+        resampler_init(&resampler, in_rate, output_rate);
+        const int64_t start_us = esp_timer_get_time();
+        for (uint32_t i = 0; i < nr_blocks; i++) {
+            const uint32_t nr_in_frames = resampler_input_frames(&resampler, BENCH_RESAMPLE_FRAMES);
+            uint32_t nr_in_used;
+            resampler_process(&resampler, in, nr_in_frames, block, BENCH_RESAMPLE_FRAMES, &nr_in_used);
+        }
+        const double per_block_us = (double) (esp_timer_get_time() - start_us) / (nr_blocks > 0 ? nr_blocks : 1);
+        ESP_LOGI(TAG, "%-16d %10.1f %10.2f %7.2f%%", in_rate, per_block_us, per_block_us * 1000 / BENCH_RESAMPLE_FRAMES,
+                 100 * per_block_us / block_us);
+    }
+
+    heap_caps_free(in);
+    heap_caps_free(block);
+    return ESP_OK;
+}
+
+/**
+ * The conversion pcm_convert_to_stereo16 replaces, a sample at a time, for the word kernels to be measured against.
+ */
+static void convert_bytewise(int16_t* dst, const uint8_t* src, uint32_t nr_bytes, uint16_t num_channels,
+                             uint16_t bits_per_sample) {
+    const uint32_t sample_bytes = bits_per_sample / 8;
+    for (int32_t i = nr_bytes / sample_bytes - 1; i >= 0; i--) {
+        const int16_t sample = bits_per_sample == 8 ? (int16_t) ((src[i] - 128) << 8)
+                                                    : (int16_t) (src[2 * i] | (src[2 * i + 1] << 8));
+        if (num_channels == 1) {
+            dst[2 * i + 1] = sample;
+            dst[2 * i] = sample;
+        } else {
+            dst[i] = sample;
+        }
+    }
+}
+
+esp_err_t playback_bench_convert(uint32_t nr_blocks) {
+    char* block = (char*) heap_caps_malloc(BENCH_CONVERT_FRAMES * 4, MALLOC_CAP_8BIT);
+    if (block == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    typedef struct {
+        const char* name;
+        uint16_t num_channels;
+        uint16_t bits_per_sample;
+    } bench_format_t;
+    static const bench_format_t formats[] = {
+        {"8 bit mono", 1, 8},
+        {"8 bit stereo", 2, 8},
+        {"16 bit mono", 1, 16},
+    };
+    nr_blocks = nr_blocks > 0 ? nr_blocks : 1;
+
+    ESP_LOGI(TAG, "pcm_convert_to_stereo16, in place, %d output frames per block", BENCH_CONVERT_FRAMES);
+    ESP_LOGI(TAG, "%-16s %12s %12s %8s", "format", "Msamples/s", "bytewise", "speedup");
+    for (const bench_format_t& format : formats) {
+        const uint32_t nr_bytes = BENCH_CONVERT_FRAMES * 4 / pcm_expansion(format.num_channels, format.bits_per_sample);
+        for (uint32_t i = 0; i < nr_bytes; i++) {
+            block[i] = (char) (i * 37);
+        }
+        int64_t start_us = esp_timer_get_time();
+        for (uint32_t i = 0; i < nr_blocks; i++) {
+            pcm_convert_to_stereo16(block, block, nr_bytes, format.num_channels, format.bits_per_sample);
+        }
+        const int64_t word_us = esp_timer_get_time() - start_us;
+        start_us = esp_timer_get_time();
+        for (uint32_t i = 0; i < nr_blocks; i++) {
+            convert_bytewise((int16_t*) block, (const uint8_t*) block, nr_bytes, format.num_channels,
+                             format.bits_per_sample);
+        }
+        const int64_t bytewise_us = esp_timer_get_time() - start_us;
+
+        // Output samples, both channels counted.
+        const double nr_samples = 2.0 * BENCH_CONVERT_FRAMES * nr_blocks;
+        ESP_LOGI(TAG, "%-16s %12.1f %12.1f %7.2fx", format.name, nr_samples / (word_us > 0 ? word_us : 1),
+                 nr_samples / (bytewise_us > 0 ? bytewise_us : 1), (double) bytewise_us / (word_us > 0 ? word_us : 1));
+    }
+
+    heap_caps_free(block);
+    return ESP_OK;
+}
+
+esp_err_t playback_bench_adpcm(uint32_t nr_blocks) {
+    typedef struct {
+        const char* name;
+        uint16_t num_channels;
+        uint16_t block_align;
+    } adpcm_format_t;
+    static const adpcm_format_t formats[] = {
+            {"mono 256", 1, 256},
+            {"mono 1024", 1, 1024},
+            {"stereo 512", 2, 512},
+            {"stereo 2048", 2, 2048},
+    };
+    const uint32_t in_size = BENCH_ADPCM_IN_BLOCKS * 2048;
+    uint8_t* in = (uint8_t*) heap_caps_malloc(in_size, MALLOC_CAP_8BIT);
+    int16_t* block = (int16_t*) heap_caps_malloc(BENCH_ADPCM_FRAMES * 4, MALLOC_CAP_8BIT);
+    if (in == nullptr || block == nullptr) {
+        heap_caps_free(in);
+        heap_caps_free(block);
+        return ESP_ERR_NO_MEM;
+    }
+    // Any bytes are valid ADPCM, and decode at the same speed as speech.
+    for (uint32_t i = 0; i < in_size; i++) {
+        in[i] = (uint8_t) ((i * 2654435761u) >> 24);
+    }
+
+    ESP_LOGI(TAG, "adpcm_decode to 16 bit stereo, %d frame blocks", BENCH_ADPCM_FRAMES);
+    ESP_LOGI(TAG, "%-16s %12s %12s", "format", "Msamples/s", "bytes/frame");
+    for (const adpcm_format_t& format : formats) {
+        const uint32_t format_size = BENCH_ADPCM_IN_BLOCKS * format.block_align;
+        adpcm_decoder_t decoder;
+        adpcm_init(&decoder, format.num_channels, format.block_align);
+        uint32_t position = 0;
+        uint64_t nr_samples = 0;
+        const int64_t start_us = esp_timer_get_time();
+        for (uint32_t i = 0; i < nr_blocks; i++) {
+            uint32_t nr_bytes = adpcm_input_bytes(&decoder, BENCH_ADPCM_FRAMES);
+            if (position + nr_bytes > format_size) {
+                position = 0;   // Back to the first block, where a new stream starts
+                adpcm_init(&decoder, format.num_channels, format.block_align);
+                nr_bytes = adpcm_input_bytes(&decoder, BENCH_ADPCM_FRAMES);
+            }
+            uint32_t nr_used;
+            nr_samples += adpcm_decode(&decoder, in + position, nr_bytes, block, BENCH_ADPCM_FRAMES, &nr_used)
+                          * format.num_channels;
+            position += nr_used;
+        }
+        const int64_t elapsed_us = esp_timer_get_time() - start_us;
+        ESP_LOGI(TAG, "%-16s %12.1f %12.2f", format.name, nr_samples / (double) (elapsed_us > 0 ? elapsed_us : 1),
+                 (double) format.block_align / decoder.frames_per_block);
+    }
+
+    heap_caps_free(in);
+    heap_caps_free(block);
+    return ESP_OK;
+}
+
+esp_err_t playback_bench_dsp(uint32_t output_rate, uint32_t cpu_mhz, uint32_t nr_blocks) {
+    typedef struct {
+        const char* name;
+        int32_t gain;
+        int32_t limiter_knee;
+        bool eq;
+        pcm_eq_type_t type;
+        float freq;
+        float gain_db;
+    } dsp_case_t;
+    static const dsp_case_t cases[] = {
+            {"unity", PCM_DSP_GAIN_UNITY, PCM_DSP_LIMITER_KNEE, false, PCM_EQ_PEAKING, 0, 0},
+            {"gain -6dB", PCM_DSP_GAIN_UNITY / 2, PCM_DSP_LIMITER_KNEE, false, PCM_EQ_PEAKING, 0, 0},
+            {"gain +6dB limit", PCM_DSP_GAIN_MAX, PCM_DSP_LIMITER_KNEE, false, PCM_EQ_PEAKING, 0, 0},
+            {"gain +6dB clip", PCM_DSP_GAIN_MAX, 0, false, PCM_EQ_PEAKING, 0, 0},
+            {"peaking 1k +6dB", PCM_DSP_GAIN_UNITY, PCM_DSP_LIMITER_KNEE, true, PCM_EQ_PEAKING, 1000, 6},
+            {"high pass 150", PCM_DSP_GAIN_UNITY * 3 / 2, PCM_DSP_LIMITER_KNEE, true, PCM_EQ_HIGH_PASS, 150, 0},
+    };
+    int16_t* block = (int16_t*) heap_caps_malloc(BENCH_DSP_FRAMES * 4, MALLOC_CAP_8BIT);
+    if (block == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    const pcm_dsp_config_t saved = *pcm_dsp_get_config();
+    const double block_us = BENCH_DSP_FRAMES * 1000000.0 / output_rate;
+    nr_blocks = nr_blocks > 0 ? nr_blocks : 1;
+
+    ESP_LOGI(TAG, "pcm_dsp_process, %d frame blocks at %dHz, a block plays for %.0fus, cycles at %dMHz",
+             BENCH_DSP_FRAMES, output_rate, block_us, cpu_mhz);
+    ESP_LOGI(TAG, "%-16s %10s %14s %8s", "chain", "us/block", "cycles/sample", "load");
+    for (const dsp_case_t& item : cases) {
+        pcm_dsp_config_t config = {item.gain, item.limiter_knee, item.eq, {1 << PCM_BIQUAD_SHIFT, 0, 0, 0, 0}};
+        if (item.eq) {
+            pcm_biquad_design(item.type, item.freq, 0.707f, item.gain_db, output_rate, &config.biquad);
+        }
+        pcm_dsp_set_config(&config);
+        pcm_dsp_t dsp;
+        pcm_dsp_init(&dsp);
+        int64_t elapsed_us = 0;
+        for (uint32_t i = 0; i < nr_blocks; i++) {
+            // Loud enough to reach the limiter at +6dB. Refilled every block, the chain would otherwise decay it.
+            for (uint32_t j = 0; j < BENCH_DSP_FRAMES * 2; j++) {
+                block[j] = (int16_t) ((j * 2654435761u) >> 17) - 16384 + (int16_t) (i & 0xff);
+            }
+            const int64_t start_us = esp_timer_get_time();
+            pcm_dsp_process(&dsp, block, BENCH_DSP_FRAMES);
+            elapsed_us += esp_timer_get_time() - start_us;
+        }
+        const double per_block_us = (double) elapsed_us / nr_blocks;
+        ESP_LOGI(TAG, "%-16s %10.1f %14.1f %7.2f%%", item.name, per_block_us,
+                 per_block_us * cpu_mhz / (BENCH_DSP_FRAMES * 2), 100 * per_block_us / block_us);
+    }
+
+    pcm_dsp_set_config(&saved);
+    heap_caps_free(block);
+    return ESP_OK;
+}
+
+esp_err_t playback_bench_mix(const char* filename, uint32_t dma_buf_bytes, uint32_t dma_buf_count, uint32_t nr_blocks) {
+    wav_data_t clip;
+    const esp_err_t err = clip_store_find(filename, &clip);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Phrase units or %s missing from the clip store", filename);
+        return err;
+    }
+    // The whole clip as its loop, so every block of the run mixes every voice, and no silent runs skipped.
+    const uint32_t block_frames = dma_buf_bytes / 4;
+    clip.loop.start_frame = 0;
+    clip.loop.end_frame = clip.nr_bytes / (clip.num_channels * clip.bits_per_sample / 8);
+    clip.silence = nullptr;
+
+    ESP_LOGI(TAG, "mix of %s at %dHz, %d blocks of %d frames per voice count", filename, clip.sample_rate, nr_blocks,
+             block_frames);
+    ESP_LOGI(TAG, "%-8s %10s %14s %8s", "voices", "ns/sample", "ns/voice_smpl", "clipped");
+    for (uint32_t nr_voices = 1; nr_voices <= MIXER_MAX_VOICES; nr_voices++) {
+        while (mixer_active_voices() > 0) {
+            vTaskDelay(BENCH_MIX_POLL_MS / portTICK_PERIOD_MS);
+        }
+        // Far enough off that the mixer cannot reach it while the voices are added, it fills the DMA ring at once.
+        const mixer_start_t start = {MIXER_GAIN_UNITY / 2, mixer_next_frame() + (dma_buf_count + 2) * block_frames,
+                                     0, 0, esp_timer_get_time(), 0, MIXER_LOOP_FOREVER};
+        mixer_voice_t voices[MIXER_MAX_VOICES];
+        for (uint32_t i = 0; i < nr_voices; i++) {
+            if (mixer_play_at(&clip, &start, &voices[i]) != ESP_OK) {
+                return ESP_ERR_NO_MEM;
+            }
+        }
+
+        // Timed from the first block after the voices started to nr_blocks later.
+        mixer_voice_times_t times;
+        do {
+            vTaskDelay(BENCH_MIX_POLL_MS / portTICK_PERIOD_MS);
+        } while (mixer_get_voice_times(voices[0], &times) == ESP_OK && times.first_us == 0);
+        mixer_stats_t before;
+        mixer_get_stats(&before);
+        mixer_stats_t after;
+        do {
+            vTaskDelay(BENCH_MIX_POLL_MS / portTICK_PERIOD_MS);
+            mixer_get_stats(&after);
+        } while (after.nr_blocks - before.nr_blocks < nr_blocks);
+        for (uint32_t i = 0; i < nr_voices; i++) {
+            mixer_stop(voices[i]);
+        }
+
+        const uint64_t nr_samples = (uint64_t) (after.nr_blocks - before.nr_blocks) * block_frames * 2;
+        const double ns_per_sample = (double) (after.mix_us - before.mix_us) * 1000 / nr_samples;
+        ESP_LOGI(TAG, "%-8d %10.2f %14.2f %8d", nr_voices, ns_per_sample, ns_per_sample / nr_voices,
+                 after.clipped_samples - before.clipped_samples);
+    }
+    return ESP_OK;
+}
+
+/**
+ * Finds each of the nr_clips clips in the clip store, as sequence_play does before starting it, nr_runs times over.
+ * Fills the average time to the first clip, which is when the first sample can be queued, and to the last one, and
+ * the flash and output frames the clips take.
+ */
+static esp_err_t bench_assembly(const char* const* names, uint32_t nr_clips, uint32_t nr_runs, double* us,
+                                uint32_t* nr_flash_bytes, uint64_t* nr_frames) {
+    int64_t total_us[2] = {0, 0};
+    for (uint32_t run = 0; run < nr_runs; run++) {
+        const int64_t start_us = esp_timer_get_time();
+        for (uint32_t i = 0; i < nr_clips; i++) {
+            wav_data_t clip;
+            const esp_err_t err = clip_store_find(names[i], &clip);
+            if (err != ESP_OK) {
+                return err;
+            }
+            if (i == 0) {
+                total_us[BENCH_PHRASE_FIRST] += esp_timer_get_time() - start_us;
+            }
+        }
+        total_us[BENCH_PHRASE_ALL] += esp_timer_get_time() - start_us;
+    }
+    us[BENCH_PHRASE_FIRST] = (double) total_us[BENCH_PHRASE_FIRST] / (nr_runs > 0 ? nr_runs : 1);
+    us[BENCH_PHRASE_ALL] = (double) total_us[BENCH_PHRASE_ALL] / (nr_runs > 0 ? nr_runs : 1);
+
+    *nr_flash_bytes = 0;
+    *nr_frames = 0;
+    for (uint32_t i = 0; i < nr_clips; i++) {
+        wav_data_t clip;
+        clip_store_find(names[i], &clip);
+        *nr_flash_bytes += clip_store_find_entry(names[i])->nr_bytes;
+        *nr_frames += mixer_clip_frames(&clip) - (i > 0 ? PHRASE_CROSSFADE_FRAMES : 0);
+    }
+    return ESP_OK;
+}
+
+esp_err_t playback_bench_phrase(const phrase_t* phrase, const char* filename, uint32_t nr_runs) {
+    double phrase_us[2];
+    double wav_us[2];
+    uint32_t phrase_bytes;
+    uint32_t wav_bytes;
+    uint64_t phrase_frames;
+    uint64_t wav_frames;
+    if (phrase_find_units(phrase) != ESP_OK) {
+        ESP_LOGW(TAG, "Phrase bench inert, the phrase's speech units are not recorded yet");
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = bench_assembly(phrase->units, phrase->nr_units, nr_runs, phrase_us, &phrase_bytes, &phrase_frames);
+    if (err == ESP_OK) {
+        err = bench_assembly(&filename, 1, nr_runs, wav_us, &wav_bytes, &wav_frames);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Phrase units or %s missing from the clip store", filename);
+        return err;
+    }
+
+    ESP_LOGI(TAG, "phrase of %d units against %s, from the clip store, average of %d runs", phrase->nr_units, filename,
+             nr_runs);
+    ESP_LOGI(TAG, "%-16s %10s %10s %8s %8s", "source", "first_us", "all_us", "flash", "frames");
+    ESP_LOGI(TAG, "%-16s %10.1f %10.1f %8d %8lld", "phrase", phrase_us[BENCH_PHRASE_FIRST], phrase_us[BENCH_PHRASE_ALL],
+             phrase_bytes, phrase_frames);
+    ESP_LOGI(TAG, "%-16s %10.1f %10.1f %8d %8lld", "wav", wav_us[BENCH_PHRASE_FIRST], wav_us[BENCH_PHRASE_ALL],
+             wav_bytes, wav_frames);
+    return ESP_OK;
+}
+
+esp_err_t playback_bench_read(const audio_source_t* source, const char* name, uint32_t nr_bytes, uint32_t read_bytes,
+                              uint32_t dma_buf_bytes, uint32_t byte_rate) {
+    char* block = (char*) heap_caps_malloc(dma_buf_bytes, MALLOC_CAP_8BIT);
+    if (block == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    read_bytes = read_bytes > 0 && read_bytes < dma_buf_bytes ? read_bytes : dma_buf_bytes;
+
+    // As the pipeline reader takes it, one descriptor's worth at a time, in reads of read_bytes.
+    uint32_t remaining = nr_bytes;
+    uint32_t nr_blocks = 0;
+    int64_t max_block_us = 0;
+    const int64_t start_us = esp_timer_get_time();
+    while (remaining > 0) {
+        const uint32_t to_read = remaining < dma_buf_bytes ? remaining : dma_buf_bytes;
+        const int64_t block_start_us = esp_timer_get_time();
+        size_t nr_bytes_read = 0;
+        while (nr_bytes_read < to_read) {
+            const uint32_t chunk = to_read - nr_bytes_read < read_bytes ? to_read - nr_bytes_read : read_bytes;
+            const size_t nr_chunk_read = audio_source_read_fully(source, block + nr_bytes_read, chunk);
+            nr_bytes_read += nr_chunk_read;
+            if (nr_chunk_read != chunk) {
+                break;
+            }
+        }
+        const int64_t block_us = esp_timer_get_time() - block_start_us;
+        max_block_us = block_us > max_block_us ? block_us : max_block_us;
+        nr_blocks++;
+        remaining -= nr_bytes_read;
+        if (nr_bytes_read != to_read) {
+            ESP_LOGW(TAG, "%s ended %d bytes early", name, remaining);
+            break;
+        }
+    }
+    int64_t total_us = esp_timer_get_time() - start_us;
+    total_us = total_us > 0 ? total_us : 1;
+    heap_caps_free(block);
+
+    // A block plays for play_us, a read slower than that eats into the read ahead.
+    const double play_us = byte_rate > 0 ? (double) dma_buf_bytes * 1000000 / byte_rate : 0;
+    ESP_LOGI(TAG, "%-16s %8s %10s %10s %10s", "source", "MB/s", "us/block", "max_us", "play_us");
+    ESP_LOGI(TAG, "%-16s %8.2f %10.1f %10lld %10.0f", name, (double) (nr_bytes - remaining) / total_us,
+             (double) total_us / (nr_blocks > 0 ? nr_blocks : 1), max_block_us, play_us);
+    return remaining == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t playback_bench_source(const audio_source_t* source, const char* name, uint32_t dma_buf_bytes) {
+    wav_header_t wav_header;
+    uint32_t data_offset;
+    esp_err_t err = wav_parse_source_header(source, &wav_header, &data_offset);
+    if (err != ESP_OK || wav_header.ByteRate == 0) {
+        return ESP_FAIL;
+    }
+    playback_bench_read(source, name, wav_header.data.chunk_size, dma_buf_bytes, dma_buf_bytes, wav_header.ByteRate);
+    return ESP_OK;
+}
+
+esp_err_t playback_bench_pipeline(const audio_source_t* source, const char* name, uint32_t output_rate) {
+    wav_header_t wav_header;
+    uint32_t data_offset;
+    const int64_t start_us = esp_timer_get_time();
+    esp_err_t err = wav_parse_source_header(source, &wav_header, &data_offset);
+    if (err != ESP_OK) {
+        return err;
+    }
+    const int64_t header_us = esp_timer_get_time() - start_us;
+    pipeline_stats_t stats;
+    err = pipeline_play_source(source, &wav_header, &stats);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // Under 1.0x the pipeline could not keep up with the output even with the sink never holding it back.
+    output_rate = output_rate != 0 ? output_rate : wav_header.SampleRate;
+    const double play_us = (double) stats.nr_bytes_written / 4 * 1000000 / output_rate;
+    const uint32_t nr_blocks = stats.nr_blocks > 0 ? stats.nr_blocks : 1;
+    const int64_t elapsed_us = stats.elapsed_us > 0 ? stats.elapsed_us : 1;
+    ESP_LOGI(TAG, "%-16s %10s %10s %10s %10s %9s %5s", "pipeline", "header_us", "us/block", "play_us", "realtime",
+             "underruns", "high");
+    ESP_LOGI(TAG, "%-16s %10lld %10.1f %10.0f %9.1fx %9d %5d", name, header_us, (double) elapsed_us / nr_blocks,
+             play_us / nr_blocks, play_us / elapsed_us, stats.underruns, stats.high_water);
+    return ESP_OK;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <esp_err.h>
+
+#include "audio_source.h"
+#include "phrase.h"
+
+/**
+ * Plays filename with every playback strategy into a simulated DMA ring (see sim_sink.h) instead of the I2S port,
+ * and logs one line per strategy: CPU cost, start and tail latency, gaps, clicks and a hash of the output.
+ * Takes a few times the length of the clip, it runs in real time. The DMA geometry is dma_buf_bytes x dma_buf_count,
+ * output_rate is the fixed rate clips are resampled to.
+ *
+ * The pipeline and mixer bind their sink at init, so they are not covered. Build with PLAYBACK_TRACE for those.
+ */
+esp_err_t playback_bench_run(const char* filename, uint32_t dma_buf_bytes, uint32_t dma_buf_count, uint32_t output_rate,
+                             const char* silence, uint32_t silence_size);
+
+/**
+ * Renders nr_blocks blocks of a sweeping tone with each pcm_synth wave and logs the cost per block, and as a share of
+ * the time the block takes to play at output_rate.
+ */
+esp_err_t playback_bench_synth(uint32_t output_rate, uint32_t nr_blocks);
+
+/**
+ * Resamples nr_blocks blocks of output at output_rate from each common input rate up to 48000 and logs the cost per
+ * block and per output frame, and as a share of the time the block takes to play.
+ */
+esp_err_t playback_bench_resample(uint32_t output_rate, uint32_t nr_blocks);
+
+/**
+ * Converts nr_blocks blocks of 8 bit mono, 8 bit stereo and 16 bit mono to 16 bit stereo with pcm_convert and with a
+ * sample at a time loop, and logs the output samples per second of each.
+ */
+esp_err_t playback_bench_convert(uint32_t nr_blocks);
+
+/**
+ * Decodes nr_blocks blocks of IMA-ADPCM output, mono and stereo at common block sizes, and logs the output samples
+ * per second and the bytes each frame takes, against 4 for 16 bit stereo PCM.
+ */
+esp_err_t playback_bench_adpcm(uint32_t nr_blocks);
+
+/**
+ * Runs the output chain of pcm_dsp.h over nr_blocks blocks at output_rate with gain alone, gain into the limiter or
+ * clipping, and each through a biquad, and logs the cost per block, per sample in cycles of a cpu_mhz CPU, and as a
+ * share of the time the block takes to play. Leaves the chain settings as it found them.
+ */
+esp_err_t playback_bench_dsp(uint32_t output_rate, uint32_t cpu_mhz, uint32_t nr_blocks);
+
+/**
+ * Mixes 1 to MIXER_MAX_VOICES voices of filename from the clip store at once, through the running mixer, and logs
+ * the mix time per output sample and per voice sample for each voice count. The voices loop the whole clip for
+ * nr_blocks blocks, all starting on the same frame. Plays in real time. dma_buf_bytes x dma_buf_count is the geometry
+ * of the sink the mixer was started with, a clip at another rate than the sink is resampled on the way.
+ */
+esp_err_t playback_bench_mix(const char* filename, uint32_t dma_buf_bytes, uint32_t dma_buf_count, uint32_t nr_blocks);
+
+/**
+ * Compares assembling phrase from speech units with playing filename, a WAV of the same announcement, both from the
+ * clip store. Logs the time until the first clip can start and until every clip has been found, averaged over
+ * nr_runs, and the flash and output frames each takes. The units can be shared with other phrases, the WAV cannot.
+ * Returns ESP_ERR_NOT_FOUND, timing nothing, until every unit of phrase is recorded, see main/phrase_units.txt.
+ */
+esp_err_t playback_bench_phrase(const phrase_t* phrase, const char* filename, uint32_t nr_runs);
+
+/**
+ * Reads the WAV file from source a DMA descriptor at a time, as the pipeline reader does, and logs the throughput
+ * and the slowest read against the time a descriptor takes to play. Needs no sink or tasks, so with a file source
+ * it measures host file I/O as readily as SPIFFS or FAT.
+ */
+esp_err_t playback_bench_source(const audio_source_t* source, const char* name, uint32_t dma_buf_bytes);
+
+/**
+ * As playback_bench_source for nr_bytes from the current position of source, which need not be a WAV, each descriptor
+ * read in pieces of read_bytes, eg 1 KB as the first players read through a buffered FILE. byte_rate is the data's,
+ * for the time a descriptor takes to play. ESP_FAIL if the source ends early.
+ */
+esp_err_t playback_bench_read(const audio_source_t* source, const char* name, uint32_t nr_bytes, uint32_t read_bytes,
+                              uint32_t dma_buf_bytes, uint32_t byte_rate);
+
+/**
+ * Plays the WAV file from source through the reader/writer pipeline, header and all, and logs the time per block
+ * against the time a block takes to play at output_rate, the rate of the sink the pipeline was started with, 0 for
+ * the clip's own. On the board the I2S port holds it to real time and the underruns are what matter. Against a sink
+ * that takes blocks as fast as they come, as on the host, it measures the whole path from source to sink: reads,
+ * conversion, resampling, ramps, the DSP chain and the hand over between the tasks.
+ */
+esp_err_t playback_bench_pipeline(const audio_source_t* source, const char* name, uint32_t output_rate);
@@ -0,0 +1,329 @@
+#include "playback_pipeline.h"
+#include "adpcm.h"
+#include "audio_pool.h"
+#include "pcm_convert.h"
+#include "pcm_dsp.h"
+#include "pcm_ramp.h"
+#include "pcm_synth.h"
+#include "playback_trace.h"
+#include "resampler.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <atomic>
+#include <cstring>
+
+static const char *TAG = "pipeline";
+
+#define READER_TASK_PRIORITY    4
+#define WRITER_TASK_PRIORITY    5       // Writer must win over the reader so the DMA never waits on a flash read
+#define PIPELINE_TASK_STACK     3072
+#define ADPCM_BUFFER_SIZE       (PIPELINE_BLOCK_SIZE / 2)   // IMA-ADPCM of one block, 1820 bytes with the smallest stereo blocks
+
+typedef struct {
+    char* data;
+    uint32_t size;
+} pcm_block_t;
+
+// Single producer (reader task) / single consumer (writer task) ring.
+// ring_head is only written by the reader, ring_tail only by the writer, so no lock is needed.
+static pcm_block_t ring[PIPELINE_MAX_BLOCKS];     // Blocks borrowed from the audio pool for each play
+static uint32_t ring_depth;                         // Blocks in use, one per DMA descriptor of the sink
+
+static_assert(PIPELINE_BLOCK_SIZE == AUDIO_POOL_BLOCK_SIZE, "Ring blocks come from the audio pool");
+static char* staging;                   // Reader only. Converted input waiting to be resampled into a block
+static uint8_t* compressed;             // Reader only. IMA-ADPCM waiting to be decoded
+static adpcm_decoder_t adpcm;           // Reader only
+static pcm_synth_t synth;               // Reader only, once pipeline_play_tone has set it up
+static std::atomic<uint32_t> ring_head(0);
+static std::atomic<uint32_t> ring_tail(0);
+static std::atomic<bool> reader_done(false);
+
+static pcm_sink_t sink;
+static TaskHandle_t reader_task = nullptr;
+static TaskHandle_t writer_task = nullptr;
+static SemaphoreHandle_t reader_start = nullptr;
+static SemaphoreHandle_t writer_start = nullptr;
+static SemaphoreHandle_t play_done = nullptr;
+
+// Current job. Only touched by pipeline_play while both tasks are idle.
+static bool job_tone;                   // Rendered by synth rather than read from job_source
+static const audio_source_t* job_source;
+static uint32_t job_nr_bytes;
+static uint16_t job_num_channels;
+static uint16_t job_bits_per_sample;
+static uint16_t job_format_id;
+static uint16_t job_block_align;
+static uint32_t job_sample_rate;
+static esp_err_t job_result;
+static pipeline_stats_t job_stats;
+
+/**
+ * Reads up to nr_frames frames of the job and converts or decodes them to 16 bit stereo in dst.
+ * Returns the number of frames, nr_bytes_read says how many bytes were taken from the source.
+ */
+static uint32_t read_frames(char* dst, uint32_t nr_frames, uint32_t remaining, uint32_t* nr_bytes_read) {
+    if (job_format_id == WAV_FORMAT_IMA_ADPCM) {
+        // Whole groups only, so the decoder takes everything read and the file position stays in step.
+        uint32_t to_read = adpcm_input_bytes(&adpcm, nr_frames);
+        to_read = remaining < to_read ? remaining : to_read;
+        *nr_bytes_read = audio_source_read_fully(job_source, (char*) compressed, to_read);
+        uint32_t nr_used;
+        return adpcm_decode(&adpcm, compressed, *nr_bytes_read, (int16_t*) dst, nr_frames, &nr_used);
+    }
+
+    const uint32_t frame_bytes = job_num_channels * job_bits_per_sample / 8;
+    uint32_t to_read = nr_frames * frame_bytes;
+    to_read = remaining < to_read ? remaining : to_read;
+    *nr_bytes_read = audio_source_read_fully(job_source, dst, to_read);
+    return pcm_convert_to_stereo16(dst, dst, *nr_bytes_read, job_num_channels, job_bits_per_sample) / 4;
+}
+
+/**
+ * Reads, converts and resamples to the sink rate up to one block. Returns the number of bytes read from the source.
+ */
+static uint32_t read_resampled(resampler_t* resampler, pcm_block_t* block, uint32_t remaining) {
+    const uint32_t out_frames = PIPELINE_BLOCK_SIZE / 4;
+
+    // Only what one block of output needs, so resampler_process uses all of it.
+    uint32_t nr_frames = resampler_input_frames(resampler, out_frames);
+    nr_frames = nr_frames < out_frames ? nr_frames : out_frames;
+
+    uint32_t nr_bytes_read;
+    nr_frames = read_frames(staging, nr_frames, remaining, &nr_bytes_read);
+
+    uint32_t nr_used;
+    block->size = 4 * resampler_process(resampler, (const int16_t*) staging, nr_frames,
+                                        (int16_t*) block->data, out_frames, &nr_used);
+    return nr_bytes_read;
+}
+
+static void reader_loop(void*) {
+    resampler_t resampler;
+    while (true) {
+        xSemaphoreTake(reader_start, portMAX_DELAY);
+
+        const bool resample = !job_tone && sink.sample_rate != 0 && job_sample_rate != sink.sample_rate;
+        uint32_t nr_frames;
+        if (job_tone) {
+            nr_frames = pcm_synth_frames(&synth);
+        } else if (job_format_id == WAV_FORMAT_IMA_ADPCM) {
+            adpcm_init(&adpcm, job_num_channels, job_block_align);
+            nr_frames = adpcm_stream_frames(&adpcm, job_nr_bytes);
+        } else {
+            nr_frames = job_nr_bytes / (job_num_channels * job_bits_per_sample / 8);
+        }
+        if (resample) {
+            resampler_init(&resampler, job_sample_rate, sink.sample_rate);
+            nr_frames = resampler_output_frames(&resampler, nr_frames);
+        }
+        pcm_ramp_config_t ramp = *pcm_ramp_get_config();
+        if (job_tone) {
+            ramp.fade_in_frames = ramp.fade_out_frames = 0;     // The tone's own envelope does it
+        }
+        pcm_dsp_t dsp;
+        pcm_dsp_init(&dsp);
+        uint32_t frame = 0;
+
+        uint32_t remaining = job_nr_bytes;
+        while (remaining > 0) {
+            const uint32_t head = ring_head.load(std::memory_order_relaxed);
+            // Wait for the writer to free a block.
+            while (head - ring_tail.load(std::memory_order_acquire) == ring_depth) {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            }
+
+            pcm_block_t* block = &ring[head % ring_depth];
+            TRACE_START(read_us);
+            uint32_t nr_bytes_read;
+            if (job_tone) {
+                block->size = 4 * pcm_synth_render(&synth, (int16_t*) block->data, PIPELINE_BLOCK_SIZE / 4);
+                nr_bytes_read = block->size;
+            } else if (resample) {
+                nr_bytes_read = read_resampled(&resampler, block, remaining);
+            } else {
+                block->size = 4 * read_frames(block->data, PIPELINE_BLOCK_SIZE / 4, remaining, &nr_bytes_read);
+            }
+            TRACE(TRACE_READ, read_us, nr_bytes_read);
+            if (nr_bytes_read == 0) {
+                ESP_LOGW(TAG, "reader - source ended %d bytes early", remaining);
+                break;
+            }
+            job_stats.nr_bytes_read += nr_bytes_read;
+            remaining -= nr_bytes_read;
+
+            pcm_ramp_envelope((int16_t*) block->data, block->size / 4, frame, nr_frames, ramp.fade_in_frames, ramp.fade_out_frames);
+            pcm_dsp_process(&dsp, (int16_t*) block->data, block->size / 4);
+            frame += block->size / 4;
+
+            ring_head.store(head + 1, std::memory_order_release);
+            xTaskNotifyGive(writer_task);
+
+            const uint32_t queued = head + 1 - ring_tail.load(std::memory_order_acquire);
+            if (queued > job_stats.high_water) {
+                job_stats.high_water = queued;
+            }
+        }
+
+        reader_done.store(true, std::memory_order_release);
+        xTaskNotifyGive(writer_task);
+    }
+}
+
+static void writer_loop(void*) {
+    while (true) {
+        xSemaphoreTake(writer_start, portMAX_DELAY);
+
+        bool started = false;
+        bool starved = false;
+        while (true) {
+            const uint32_t tail = ring_tail.load(std::memory_order_relaxed);
+            if (tail == ring_head.load(std::memory_order_acquire)) {
+                // Check done before re-checking head, the reader publishes its last block before it sets done.
+                if (reader_done.load(std::memory_order_acquire) && tail == ring_head.load(std::memory_order_acquire)) {
+                    break;
+                }
+                if (started && !starved) {
+                    job_stats.underruns++;
+                    starved = true;
+                }
+                TRACE_START(wait_us);
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                if (starved) {
+                    TRACE(TRACE_UNDERRUN, wait_us, 0);
+                }
+                continue;
+            }
+            started = true;
+            starved = false;
+
+            const pcm_block_t* block = &ring[tail % ring_depth];
+            if (job_result == ESP_OK) {
+                size_t nr_bytes_written = 0;
+                job_result = sink.write(sink.ctx, block->data, block->size, &nr_bytes_written);
+                job_stats.nr_bytes_written += nr_bytes_written;
+            }
+            // On a sink error keep draining so the reader never blocks on a full ring.
+            job_stats.nr_blocks++;
+
+            ring_tail.store(tail + 1, std::memory_order_release);
+            xTaskNotifyGive(reader_task);
+        }
+
+        xSemaphoreGive(play_done);
+    }
+}
+
+esp_err_t pipeline_init(const pcm_sink_t* pcm_sink) {
+    sink = *pcm_sink;
+    ring_depth = sink.dma_buf_count < PIPELINE_MAX_BLOCKS ? sink.dma_buf_count : PIPELINE_MAX_BLOCKS;
+    ring_depth = ring_depth > 2 ? ring_depth : 2;
+
+    staging = (char*) heap_caps_malloc(PIPELINE_BLOCK_SIZE, MALLOC_CAP_8BIT);
+    compressed = (uint8_t*) heap_caps_malloc(ADPCM_BUFFER_SIZE, MALLOC_CAP_8BIT);
+    if (staging == nullptr || compressed == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    reader_start = xSemaphoreCreateBinary();
+    writer_start = xSemaphoreCreateBinary();
+    play_done = xSemaphoreCreateBinary();
+    if (reader_start == nullptr || writer_start == nullptr || play_done == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(reader_loop, "pcm_reader", PIPELINE_TASK_STACK, nullptr, READER_TASK_PRIORITY, &reader_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(writer_loop, "pcm_writer", PIPELINE_TASK_STACK, nullptr, WRITER_TASK_PRIORITY, &writer_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+/**
+ * Returns the ring blocks to the audio pool, so the DMA capable memory is only held while playing.
+ */
+static void release_ring() {
+    for (uint32_t i = 0; i < ring_depth; i++) {
+        audio_pool_release(ring[i].data);
+        ring[i].data = nullptr;
+    }
+}
+
+/**
+ * Runs the job set up by the caller through both tasks and waits for it to finish.
+ */
+static esp_err_t run_job(pipeline_stats_t* stats) {
+
+    const int64_t start_us = esp_timer_get_time();
+
+    for (uint32_t i = 0; i < ring_depth; i++) {
+        ring[i].data = audio_pool_acquire();
+        ring[i].size = 0;
+        if (ring[i].data == nullptr) {
+            ESP_LOGE(TAG, "Audio pool has no block for ring block %d", i);
+            release_ring();
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    job_result = ESP_OK;
+    memset(&job_stats, 0, sizeof(job_stats));
+    ring_head.store(0, std::memory_order_relaxed);
+    ring_tail.store(0, std::memory_order_relaxed);
+    reader_done.store(false, std::memory_order_release);
+
+    xSemaphoreGive(writer_start);
+    xSemaphoreGive(reader_start);
+    xSemaphoreTake(play_done, portMAX_DELAY);
+    release_ring();
+
+    job_stats.elapsed_us = esp_timer_get_time() - start_us;
+    ESP_LOGI(TAG, "pipeline_play - Finish. read=%d written=%d blocks=%d underruns=%d high_water=%d/%d Elapsed time=%lldms",
+             job_stats.nr_bytes_read, job_stats.nr_bytes_written, job_stats.nr_blocks, job_stats.underruns,
+             job_stats.high_water, ring_depth, job_stats.elapsed_us / 1000);
+    if (stats != nullptr) {
+        *stats = job_stats;
+    }
+    return job_result;
+}
+
+esp_err_t pipeline_play_source(const audio_source_t* source, const wav_header_t* wav_header, pipeline_stats_t* stats) {
+    // Both tasks are parked on their start semaphores, so the job can be set up without synchronisation.
+    job_tone = false;
+    job_source = source;
+    job_nr_bytes = wav_header->data.chunk_size;
+    job_num_channels = wav_header->NumChannels;
+    job_bits_per_sample = wav_header->BitsPerSample;
+    job_format_id = wav_header->FormatID;
+    job_block_align = wav_header->BlockAlign;
+    job_sample_rate = wav_header->SampleRate;
+    return run_job(stats);
+}
+
+esp_err_t pipeline_play(FILE* f, const wav_header_t* wav_header, pipeline_stats_t* stats) {
+    file_source_t file;
+    file_source_wrap(&file, f);
+    return pipeline_play_source(&file.source, wav_header, stats);
+}
+
+esp_err_t pipeline_play_tone(const pcm_tone_t* tone, pipeline_stats_t* stats) {
+    if (sink.sample_rate == 0) {
+        ESP_LOGW(TAG, "Tones need a fixed sink rate");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    const esp_err_t err = pcm_synth_init(&synth, tone, sink.sample_rate);
+    if (err != ESP_OK) {
+        return err;
+    }
+    job_tone = true;
+    job_source = nullptr;
+    job_nr_bytes = pcm_synth_frames(&synth) * 4;    // Of rendered 16 bit stereo
+    job_sample_rate = sink.sample_rate;
+    return run_job(stats);
+}
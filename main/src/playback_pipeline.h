@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+#include "audio_source.h"
+#include "pcm_sink.h"
+#include "pcm_synth.h"
+#include "wav_file.h"
+
+#define PIPELINE_BLOCK_SIZE     4096    // One DMA descriptor, ie dma_buf_len (1024) frames of 4 bytes (16 bit stereo)
+#define PIPELINE_MAX_BLOCKS     8       // Most blocks in the ring between the reader and writer tasks
+
+typedef struct {
+    uint32_t nr_bytes_read;     // Bytes read from the source by the reader task, or rendered for a tone
+    uint32_t nr_bytes_written;  // Bytes handed to the sink by the writer task, after conversion to 16 bit stereo
+    uint32_t nr_blocks;         // Blocks that went through the ring
+    uint32_t underruns;         // Times the writer found the ring empty after playback had started
+    uint32_t high_water;        // Most blocks ever queued in the ring at once
+    int64_t elapsed_us;
+} pipeline_stats_t;
+
+/**
+ * Starts the reader and writer tasks. The ring holds one block per DMA descriptor of the sink, up to
+ * PIPELINE_MAX_BLOCKS, so the reader can get a whole DMA ring ahead of the output.
+ * Must be called once, after the sink is ready to accept data.
+ */
+esp_err_t pipeline_init(const pcm_sink_t* sink);
+
+/**
+ * Streams the data section described by wav_header from the current position of f to the sink.
+ * The reader task fills the ring while the writer task drains it, so flash reads overlap with DMA output.
+ * Mono, 8 bit and IMA-ADPCM data is converted to 16 bit stereo, and resampled to the sink rate, by the reader task
+ * block by block, straight into the DMA capable ring.
+ * The reader also applies the pcm_ramp fade in and fade out, then the pcm_dsp chain.
+ * The ring is borrowed from the audio pool for the play, ESP_ERR_NO_MEM if it has too few.
+ * Blocks the caller until the last byte has been handed to the sink. Does NOT close f.
+ */
+esp_err_t pipeline_play(FILE* f, const wav_header_t* wav_header, pipeline_stats_t* stats);
+
+/**
+ * As pipeline_play, reading the data section from the current position of source, see audio_source.h.
+ * The ring is the source's read ahead, so a pipe or other slow source only underruns if it falls a whole DMA ring
+ * behind.
+ */
+esp_err_t pipeline_play_source(const audio_source_t* source, const wav_header_t* wav_header, pipeline_stats_t* stats);
+
+/**
+ * As pipeline_play, but the reader task renders tone at the sink rate straight into the ring, no file involved.
+ * The tone's envelope stands in for the pcm_ramp fades, the pcm_dsp chain applies as usual.
+ * Returns ESP_ERR_NOT_SUPPORTED if the sink has no fixed rate.
+ */
+esp_err_t pipeline_play_tone(const pcm_tone_t* tone, pipeline_stats_t* stats);
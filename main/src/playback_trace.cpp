@@ -0,0 +1,194 @@
+#include "playback_trace.h"
+
+#include <cstring>
+
+#if PLAYBACK_TRACE_ENABLED
+
+#include <atomic>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+
+static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "TRACE_RING_SIZE must be a power of 2");
+
+static const char* const event_names[TRACE_NR_EVENTS] = {"read", "write", "underrun", "dma_dry", "mix"};
+
+// Multiple producer ring. Each producer claims a slot with one fetch_add, so recording never waits.
+// The slot's seq is odd while it is being written and 2 * (sequence + 1) once it is complete, so trace_read can
+// tell a finished record from one being written or one already overwritten.
+typedef struct {
+    std::atomic<uint32_t> seq;
+    trace_record_t record;
+} trace_slot_t;
+
+static trace_slot_t ring[TRACE_RING_SIZE];
+static std::atomic<uint32_t> next_sequence(0);
+static uint32_t dump_cursor = 0;
+
+static std::atomic<uint32_t> counts[TRACE_NR_EVENTS];
+static std::atomic<uint64_t> totals_us[TRACE_NR_EVENTS];
+static std::atomic<uint32_t> maxes_us[TRACE_NR_EVENTS];
+static std::atomic<uint64_t> totals_bytes[TRACE_NR_EVENTS];
+static std::atomic<uint32_t> max_heap_used(0);
+
+// DMA fill estimate, kept by the traced sink.
+static pcm_sink_t inner_sink;
+static pcm_sink_t traced_sink;
+static int64_t last_write_us = 0;
+static std::atomic<uint32_t> dma_fill(0);
+
+int64_t trace_now_us() {
+    return esp_timer_get_time();
+}
+
+/**
+ * Bytes of 8 bit capable heap allocated, the host shim counts what goes through its heap_caps as the ESP32 does.
+ */
+static uint32_t heap_used() {
+    return (uint32_t) (heap_caps_get_total_size(MALLOC_CAP_8BIT) - heap_caps_get_free_size(MALLOC_CAP_8BIT));
+}
+
+static void store_max(std::atomic<uint32_t>* max, uint32_t value) {
+    uint32_t current = max->load(std::memory_order_relaxed);
+    while (value > current && !max->compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+void trace_record(trace_event_t event, int64_t start_us, uint32_t nr_bytes) {
+    const int64_t now_us = trace_now_us();
+    const uint32_t duration_us = (uint32_t) (now_us - start_us);
+    const uint32_t heap = heap_used();
+
+    counts[event].fetch_add(1, std::memory_order_relaxed);
+    totals_us[event].fetch_add(duration_us, std::memory_order_relaxed);
+    totals_bytes[event].fetch_add(nr_bytes, std::memory_order_relaxed);
+    store_max(&maxes_us[event], duration_us);
+    store_max(&max_heap_used, heap);
+
+    const uint32_t sequence = next_sequence.fetch_add(1, std::memory_order_relaxed);
+    trace_slot_t* slot = &ring[sequence & (TRACE_RING_SIZE - 1)];
+    slot->seq.store(2 * sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->record.sequence = sequence;
+    slot->record.timestamp_us = (uint32_t) now_us;
+    slot->record.duration_us = duration_us;
+    slot->record.nr_bytes = nr_bytes;
+    slot->record.dma_fill = dma_fill.load(std::memory_order_relaxed);
+    slot->record.heap_used = heap;
+    slot->record.event = (uint8_t) event;
+    slot->seq.store(2 * sequence + 2, std::memory_order_release);
+}
+
+/**
+ * Before the write: drain the estimate at the sink rate, noting if it ran dry. After: add what was written.
+ * i2s_write only returns once the data is in the DMA ring, so the estimate can never exceed the ring.
+ */
+static esp_err_t traced_write(void* ctx, const char* data, size_t size, size_t* nr_bytes_written) {
+    TRACE_START(start_us);
+    const uint32_t ring_bytes = inner_sink.dma_buf_bytes * inner_sink.dma_buf_count;
+    uint32_t fill = dma_fill.load(std::memory_order_relaxed);
+    if (inner_sink.sample_rate != 0 && last_write_us != 0) {
+        const uint64_t drained = (uint64_t) (start_us - last_write_us) * inner_sink.sample_rate * 4 / 1000000;
+        if (fill > 0 && drained >= fill) {
+            TRACE(TRACE_DMA_DRY, last_write_us + (int64_t) fill * 1000000 / (inner_sink.sample_rate * 4), 0);
+        }
+        fill = drained >= fill ? 0 : fill - (uint32_t) drained;
+    }
+
+    const esp_err_t err = inner_sink.write(inner_sink.ctx, data, size, nr_bytes_written);
+
+    fill += *nr_bytes_written;
+    dma_fill.store(fill < ring_bytes || ring_bytes == 0 ? fill : ring_bytes, std::memory_order_relaxed);
+    last_write_us = trace_now_us();
+    TRACE(TRACE_WRITE, start_us, *nr_bytes_written);
+    return err;
+}
+
+static esp_err_t traced_wait_sent(void* ctx, uint32_t nr_buffers) {
+    return inner_sink.wait_sent(inner_sink.ctx, nr_buffers);
+}
+
+const pcm_sink_t* trace_sink(const pcm_sink_t* sink) {
+    inner_sink = *sink;
+    traced_sink = *sink;
+    traced_sink.write = traced_write;
+    traced_sink.wait_sent = sink->wait_sent != nullptr ? traced_wait_sent : nullptr;
+    traced_sink.ctx = nullptr;
+    return &traced_sink;
+}
+
+uint32_t trace_read(trace_record_t* records, uint32_t max_records, uint32_t* cursor) {
+    const uint32_t head = next_sequence.load(std::memory_order_acquire);
+    if (head - *cursor > TRACE_RING_SIZE) {
+        *cursor = head - TRACE_RING_SIZE;   // The rest were overwritten
+    }
+
+    uint32_t nr_records = 0;
+    while (*cursor != head && nr_records < max_records) {
+        const trace_slot_t* slot = &ring[*cursor & (TRACE_RING_SIZE - 1)];
+        const uint32_t seq = slot->seq.load(std::memory_order_acquire);
+        if (seq == 2 * *cursor + 1) {
+            break;      // Still being written, pick it up next time
+        }
+        if (seq == 2 * *cursor + 2) {
+            records[nr_records] = slot->record;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->seq.load(std::memory_order_relaxed) == seq) {
+                nr_records++;
+            }
+        }
+        (*cursor)++;
+    }
+    return nr_records;
+}
+
+void trace_get_counters(trace_counters_t* counters) {
+    for (int i = 0; i < TRACE_NR_EVENTS; i++) {
+        counters->count[i] = counts[i].load(std::memory_order_relaxed);
+        counters->total_us[i] = totals_us[i].load(std::memory_order_relaxed);
+        counters->max_us[i] = maxes_us[i].load(std::memory_order_relaxed);
+        counters->nr_bytes[i] = totals_bytes[i].load(std::memory_order_relaxed);
+    }
+    counters->max_heap_used = max_heap_used.load(std::memory_order_relaxed);
+}
+
+void trace_dump(FILE* out) {
+    trace_record_t records[16];
+    uint32_t nr_records;
+    fprintf(out, "sequence,event,timestamp_us,duration_us,nr_bytes,dma_fill,heap_used\n");
+    while ((nr_records = trace_read(records, 16, &dump_cursor)) > 0) {
+        for (uint32_t i = 0; i < nr_records; i++) {
+            const trace_record_t* r = &records[i];
+            fprintf(out, "%u,%s,%u,%u,%u,%u,%u\n", (unsigned) r->sequence, event_names[r->event],
+                    (unsigned) r->timestamp_us, (unsigned) r->duration_us, (unsigned) r->nr_bytes,
+                    (unsigned) r->dma_fill, (unsigned) r->heap_used);
+        }
+    }
+
+    trace_counters_t counters;
+    trace_get_counters(&counters);
+    for (int i = 0; i < TRACE_NR_EVENTS; i++) {
+        fprintf(out, "# %s count=%u total_us=%llu max_us=%u bytes=%llu\n", event_names[i], (unsigned) counters.count[i],
+                (unsigned long long) counters.total_us[i], (unsigned) counters.max_us[i],
+                (unsigned long long) counters.nr_bytes[i]);
+    }
+    fprintf(out, "# max_heap_used=%u\n", (unsigned) counters.max_heap_used);
+}
+
+#else
+
+const pcm_sink_t* trace_sink(const pcm_sink_t* sink) {
+    return sink;
+}
+
+uint32_t trace_read(trace_record_t* records, uint32_t max_records, uint32_t* cursor) {
+    return 0;
+}
+
+void trace_get_counters(trace_counters_t* counters) {
+    memset(counters, 0, sizeof(trace_counters_t));
+}
+
+void trace_dump(FILE* out) {
+}
+
+#endif
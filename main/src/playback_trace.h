@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "pcm_sink.h"
+
+// Build with idf.py -DPLAYBACK_TRACE=ON, or cmake -DPLAYBACK_TRACE=ON on the host, to record. When off the TRACE
+// macros compile to nothing, trace_sink returns the sink it is given and the rest of the API does nothing.
+#ifndef PLAYBACK_TRACE_ENABLED
+#define PLAYBACK_TRACE_ENABLED  0
+#endif
+
+#define TRACE_RING_SIZE         256     // Records kept, the oldest are overwritten. Power of 2
+
+typedef enum {
+    TRACE_READ,         // Block read from a file, duration is the fread
+    TRACE_WRITE,        // Block handed to the sink, duration is how long the write blocked
+    TRACE_UNDERRUN,     // Pipeline writer found the ring empty mid stream, duration is the wait
+    TRACE_DMA_DRY,      // The DMA ring had run out before this write, by the sink's estimate. Also seen between clips
+    TRACE_MIX,          // Mixer block, duration is the mixing
+    TRACE_NR_EVENTS
+} trace_event_t;
+
+typedef struct {
+    uint32_t sequence;      // Counts every record made, gaps mean the ring was overwritten before it was read
+    uint32_t timestamp_us;  // End of the event, low 32 bits of the clock
+    uint32_t duration_us;
+    uint32_t nr_bytes;
+    uint32_t dma_fill;      // Bytes queued in the DMA ring, estimated from the sink rate
+    uint32_t heap_used;     // Bytes of 8 bit capable heap allocated
+    uint8_t event;          // trace_event_t
+} trace_record_t;
+
+typedef struct {
+    uint32_t count[TRACE_NR_EVENTS];
+    uint64_t total_us[TRACE_NR_EVENTS];
+    uint32_t max_us[TRACE_NR_EVENTS];
+    uint64_t nr_bytes[TRACE_NR_EVENTS];
+    uint32_t max_heap_used;
+} trace_counters_t;
+
+#if PLAYBACK_TRACE_ENABLED
+int64_t trace_now_us();
+void trace_record(trace_event_t event, int64_t start_us, uint32_t nr_bytes);
+
+#define TRACE_START(start_us)                   const int64_t start_us = trace_now_us()
+#define TRACE(event, start_us, nr_bytes)        trace_record(event, start_us, nr_bytes)
+#else
+#define TRACE_START(start_us)
+#define TRACE(event, start_us, nr_bytes)        do {} while (0)
+#endif
+
+/**
+ * Returns a sink that times every write and keeps the DMA fill estimate, then passes it on to sink.
+ * Only one sink can be traced. Returns sink itself when tracing is off.
+ */
+const pcm_sink_t* trace_sink(const pcm_sink_t* sink);
+
+/**
+ * Copies up to max_records records made since *cursor into records, oldest first, and advances *cursor.
+ * Never blocks the tasks making records. Start with *cursor = 0.
+ */
+uint32_t trace_read(trace_record_t* records, uint32_t max_records, uint32_t* cursor);
+
+void trace_get_counters(trace_counters_t* counters);
+
+/**
+ * Writes the records made since the last dump as CSV, then the counters.
+ */
+void trace_dump(FILE* out);
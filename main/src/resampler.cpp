@@ -0,0 +1,132 @@
+#include "resampler.h"
+#include "const_math.h"
+
+#include <cstring>
+
+#define RESAMPLER_PHASES        (1 << RESAMPLER_PHASE_BITS)
+#define RESAMPLER_FRAC_BITS     (16 - RESAMPLER_PHASE_BITS)     // Position between two table phases
+
+#define UPSAMPLE_CUTOFF         0.9                             // Of the input Nyquist frequency
+#define DOWNSAMPLE_CUTOFF       (0.9 * 44100.0 / 48000.0)       // Of the input Nyquist frequency, for the worst case
+
+static constexpr double sinc(double x) {
+    return x == 0.0 ? 1.0 : const_sin(PI * x) / (PI * x);
+}
+
+/**
+ * Blackman window, zero at x = +-RESAMPLER_TAPS / 2.
+ */
+static constexpr double blackman(double x) {
+    return 0.42 + 0.5 * const_cos(2 * PI * x / RESAMPLER_TAPS) + 0.08 * const_cos(4 * PI * x / RESAMPLER_TAPS);
+}
+
+/**
+ * Weight of history frame tap for an output phase / RESAMPLER_PHASES of a frame past the middle of the history.
+ */
+static constexpr double tap_weight(double cutoff, int phase, int tap) {
+    return cutoff * sinc(cutoff * (tap - (RESAMPLER_TAPS / 2 - 1) - (double) phase / RESAMPLER_PHASES))
+           * blackman(tap - (RESAMPLER_TAPS / 2 - 1) - (double) phase / RESAMPLER_PHASES);
+}
+
+static constexpr double phase_sum(double cutoff, int phase, int tap) {
+    return tap == RESAMPLER_TAPS ? 0.0 : tap_weight(cutoff, phase, tap) + phase_sum(cutoff, phase, tap + 1);
+}
+
+static constexpr int16_t round_q15(double x) {
+    return (int16_t) (x * 32768 + (x >= 0 ? 0.5 : -0.5));
+}
+
+/**
+ * Each phase is normalised to a DC gain of exactly one, so a constant input comes out constant at every phase.
+ */
+static constexpr int16_t coefficient(double cutoff, int index) {
+    return round_q15(tap_weight(cutoff, index / RESAMPLER_TAPS, index % RESAMPLER_TAPS)
+                     / phase_sum(cutoff, index / RESAMPLER_TAPS, 0));
+}
+
+// One row per phase plus a last row at a whole frame, so every phase can interpolate with the next one.
+#define TABLE_SIZE  ((RESAMPLER_PHASES + 1) * RESAMPLER_TAPS)
+
+typedef struct {
+    int16_t c[TABLE_SIZE];
+} coeff_table_t;
+
+template <int... I>
+static constexpr coeff_table_t make_table(double cutoff, index_list<I...>) {
+    return {{ coefficient(cutoff, I)... }};
+}
+
+static constexpr coeff_table_t upsample_table = make_table(UPSAMPLE_CUTOFF, make_index_list<TABLE_SIZE>::type());
+static constexpr coeff_table_t downsample_table = make_table(DOWNSAMPLE_CUTOFF, make_index_list<TABLE_SIZE>::type());
+
+static_assert(upsample_table.c[RESAMPLER_TAPS / 2 - 1] > 0 && upsample_table.c[RESAMPLER_PHASES * RESAMPLER_TAPS] == 0,
+              "centre tap should be the peak and the window zero at the edge");
+
+void resampler_init(resampler_t* resampler, uint32_t in_rate, uint32_t out_rate) {
+    resampler->in_rate = in_rate;
+    resampler->out_rate = out_rate;
+    resampler->phase = out_rate;        // Take the first input frame before the first output
+    resampler->coeffs = in_rate > out_rate ? downsample_table.c : upsample_table.c;
+    resampler->write = 0;
+    memset(resampler->history, 0, sizeof(resampler->history));
+}
+
+uint32_t resampler_input_frames(const resampler_t* resampler, uint32_t nr_out_frames) {
+    if (nr_out_frames == 0) {
+        return 0;
+    }
+    return (uint32_t) ((resampler->phase + (uint64_t) (nr_out_frames - 1) * resampler->in_rate) / resampler->out_rate);
+}
+
+uint32_t resampler_output_frames(const resampler_t* resampler, uint32_t nr_in_frames) {
+    // Output k needs 1 + k * in_rate / out_rate input frames.
+    return (uint32_t) (((uint64_t) nr_in_frames * resampler->out_rate + resampler->in_rate - 1) / resampler->in_rate);
+}
+
+uint32_t resampler_process(resampler_t* resampler, const int16_t* in, uint32_t nr_in_frames,
+                           int16_t* out, uint32_t max_out_frames, uint32_t* nr_in_used) {
+    uint32_t nr_used = 0;
+    uint32_t nr_out = 0;
+    while (nr_out < max_out_frames) {
+        while (resampler->phase >= resampler->out_rate) {
+            if (nr_used == nr_in_frames) {
+                *nr_in_used = nr_used;
+                return nr_out;
+            }
+            const uint32_t l = resampler->write * 2;
+            const uint32_t r = (resampler->write + RESAMPLER_TAPS) * 2;
+            resampler->history[l] = resampler->history[r] = in[nr_used * 2];
+            resampler->history[l + 1] = resampler->history[r + 1] = in[nr_used * 2 + 1];
+            resampler->write = (resampler->write + 1) % RESAMPLER_TAPS;
+            resampler->phase -= resampler->out_rate;
+            nr_used++;
+        }
+
+        // Filter with the two table phases either side of the output position, then interpolate between them.
+        const uint32_t position = (resampler->phase << 16) / resampler->out_rate;     // Q16, phase < out_rate <= 48000
+        const int16_t* window = &resampler->history[resampler->write * 2];    // Oldest frame first
+        const int16_t* c0 = &resampler->coeffs[(position >> RESAMPLER_FRAC_BITS) * RESAMPLER_TAPS];
+        const int16_t* c1 = c0 + RESAMPLER_TAPS;
+        int32_t l0 = 0, r0 = 0, l1 = 0, r1 = 0;
+        for (int tap = 0; tap < RESAMPLER_TAPS; tap++) {
+            const int32_t l = window[2 * tap];
+            const int32_t r = window[2 * tap + 1];
+            l0 += l * c0[tap];
+            r0 += r * c0[tap];
+            l1 += l * c1[tap];
+            r1 += r * c1[tap];
+        }
+        l0 >>= 15;
+        r0 >>= 15;
+        const int32_t frac = position & ((1 << RESAMPLER_FRAC_BITS) - 1);
+        int32_t l = l0 + (((l1 >> 15) - l0) * frac >> RESAMPLER_FRAC_BITS);
+        int32_t r = r0 + (((r1 >> 15) - r0) * frac >> RESAMPLER_FRAC_BITS);
+        out[nr_out * 2] = (int16_t) (l > INT16_MAX ? INT16_MAX : l < INT16_MIN ? INT16_MIN : l);
+        out[nr_out * 2 + 1] = (int16_t) (r > INT16_MAX ? INT16_MAX : r < INT16_MIN ? INT16_MIN : r);
+
+        nr_out++;
+        resampler->phase += resampler->in_rate;
+    }
+    *nr_in_used = nr_used;
+    return nr_out;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+#define RESAMPLER_TAPS          32      // Input frames under the filter for each output frame
+#define RESAMPLER_PHASE_BITS    5       // 32 sub-sample phases in the coefficient table, interpolated between
+
+/**
+ * Polyphase windowed-sinc converter for 16 bit stereo, from any rate up to 48000 to a fixed output rate.
+ * Upsampling filters at 0.9 of the input Nyquist frequency, downsampling at 0.9 of the output's (sized for
+ * 48000 to 44100). The tables are computed at compile time, see resampler.cpp.
+ *
+ * The filter delays the output by RESAMPLER_TAPS / 2 input frames. The last of them are never output.
+ */
+typedef struct {
+    uint32_t in_rate;
+    uint32_t out_rate;
+    uint32_t phase;             // Position of the next output past the middle of the history, in 1 / out_rate frames.
+                                // Exact, so a clip never drifts however long it is
+    const int16_t* coeffs;      // Table for the cut off this ratio needs
+    uint32_t write;             // Next frame of history to overwrite
+    int16_t history[2 * RESAMPLER_TAPS * 2];    // Last RESAMPLER_TAPS frames, stored twice so the window is contiguous
+} resampler_t;
+
+/**
+ * Starts a new stream, with silence before it.
+ */
+void resampler_init(resampler_t* resampler, uint32_t in_rate, uint32_t out_rate);
+
+/**
+ * Number of input frames the next nr_out_frames output frames need.
+ * Passing at most this many to resampler_process with max_out_frames = nr_out_frames always uses all of them.
+ */
+uint32_t resampler_input_frames(const resampler_t* resampler, uint32_t nr_out_frames);
+
+/**
+ * Number of output frames a whole stream of nr_in_frames comes out as, from resampler_init to the end.
+ */
+uint32_t resampler_output_frames(const resampler_t* resampler, uint32_t nr_in_frames);
+
+/**
+ * Converts nr_in_frames stereo frames from in into at most max_out_frames frames in out. Returns the number of
+ * frames written. Stops when either runs out, nr_in_used says how much of in was taken.
+ */
+uint32_t resampler_process(resampler_t* resampler, const int16_t* in, uint32_t nr_in_frames,
+                           int16_t* out, uint32_t max_out_frames, uint32_t* nr_in_used);
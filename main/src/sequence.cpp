@@ -0,0 +1,105 @@
+#include "sequence.h"
+#include "clip_cache.h"
+#include "clip_store.h"
+#include "mixer.h"
+#include "pcm_ramp.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <cstring>
+
+static const char *TAG = "sequence";
+
+/**
+ * Finds the clip in the clip store, or loads it into the clip cache.
+ */
+static esp_err_t find_clip(const char* filename, wav_data_t* clip) {
+    if (clip_store_find(filename, clip) == ESP_OK) {
+        return ESP_OK;
+    }
+    const wav_data_t* cached = clip_cache_get(filename);
+    if (cached == nullptr) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *clip = *cached;
+    return ESP_OK;
+}
+
+/**
+ * Sleeps until the mixer has mixed up to frame, or has nothing left to mix.
+ */
+static void wait_for_frame(uint64_t frame) {
+    while (mixer_frames_mixed() < frame && mixer_active_voices() > 0) {
+        vTaskDelay(SEQUENCE_POLL_MS / portTICK_PERIOD_MS);
+    }
+}
+
+esp_err_t sequence_play(const sequence_item_t* items, uint32_t nr_items, int32_t gain, sequence_stats_t* stats) {
+    sequence_stats_t sequence_stats;
+    memset(&sequence_stats, 0, sizeof(sequence_stats));
+    const pcm_ramp_config_t ramp = *pcm_ramp_get_config();
+    mixer_stats_t mixer_stats;
+    mixer_get_stats(&mixer_stats);
+    const uint32_t late_starts = mixer_stats.late_starts;
+
+    uint64_t first_frame = 0;
+    uint64_t start_frame = 0;
+    uint32_t nr_frames = 0;
+    uint64_t previous_end = 0;
+    esp_err_t err = ESP_OK;
+    for (uint32_t i = 0; i < nr_items; i++) {
+        const int64_t load_us = esp_timer_get_time();
+        wav_data_t clip;
+        err = find_clip(items[i].filename, &clip);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Could not load %s, stopping the sequence", items[i].filename);
+            break;
+        }
+        const int64_t preroll_us = esp_timer_get_time() - load_us;
+        if (preroll_us > sequence_stats.max_preroll_us) {
+            sequence_stats.max_preroll_us = preroll_us;
+        }
+
+        // The overlap with either neighbour is the fade, so the two gains always add up to one.
+        const int32_t offset = items[i].offset_frames;
+        const int32_t next_offset = i + 1 < nr_items ? items[i + 1].offset_frames : 0;
+        mixer_start_t start;
+        start.gain = gain;
+        start.fade_in_frames = i > 0 && offset < 0 ? (uint32_t) -offset : ramp.fade_in_frames;
+        start.fade_out_frames = next_offset < 0 ? (uint32_t) -next_offset : ramp.fade_out_frames;
+        start.request_us = load_us;
+        start.start_us = 0;
+        start.loop_count = 1;   // A sequence item plays straight through
+        if (i == 0) {
+            start_frame = first_frame = mixer_next_frame();
+        } else if (offset >= 0 || (uint32_t) -offset <= nr_frames) {
+            start_frame += nr_frames + offset;
+        }
+        start.start_frame = start_frame;
+        nr_frames = mixer_clip_frames(&clip);
+
+        err = mixer_play_at(&clip, &start, nullptr);
+        if (err != ESP_OK) {
+            break;
+        }
+        sequence_stats.nr_clips++;
+
+        // Load the next clip only once the one before this has finished with its data, it may leave the cache.
+        wait_for_frame(previous_end);
+        previous_end = start_frame + nr_frames;
+    }
+
+    wait_for_frame(start_frame + nr_frames);
+    sequence_stats.nr_frames = start_frame + nr_frames - first_frame;
+    mixer_get_stats(&mixer_stats);
+    sequence_stats.late_starts = mixer_stats.late_starts - late_starts;
+
+    ESP_LOGI(TAG, "sequence_play - Finish. clips=%d frames=%lld max_preroll=%lldus late_starts=%d", sequence_stats.nr_clips,
+             sequence_stats.nr_frames, sequence_stats.max_preroll_us, sequence_stats.late_starts);
+    if (stats != nullptr) {
+        *stats = sequence_stats;
+    }
+    return err;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <esp_err.h>
+
+#define SEQUENCE_POLL_MS        10      // How often sequence_play checks the mixer's progress
+
+typedef struct {
+    const char* filename;
+    int32_t offset_frames;      // From the end of the clip before to the start of this one, in frames at the sink rate.
+                                // Positive leaves that much silence, negative overlaps the two as a linear crossfade.
+                                // Ignored for the first clip. A cached clip is only loaded once the clip two before
+                                // it has been mixed, so it must start in a later mixer block than that clip ends
+} sequence_item_t;
+
+typedef struct {
+    uint32_t nr_clips;          // Clips started
+    uint64_t nr_frames;         // Length of the whole sequence at the sink rate
+    int64_t max_preroll_us;     // Slowest load of a clip, done while the clip before it plays
+    uint32_t late_starts;       // Clips that could not start on their exact frame because their load took too long
+} sequence_stats_t;
+
+/**
+ * Plays items through the mixer as one stream, every seam exact to the frame. Clip N+1 is found in the clip store, or
+ * loaded into the clip cache, while clip N plays, so the two must fit in the cache together. Outside crossfades every
+ * clip gets the usual pcm_ramp fades. Blocks until the last clip has been mixed.
+ */
+esp_err_t sequence_play(const sequence_item_t* items, uint32_t nr_items, int32_t gain, sequence_stats_t* stats);
@@ -0,0 +1,229 @@
+#include "sim_sink.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <cstring>
+#include <stdlib.h>
+
+static const char *TAG = "sim_sink";
+
+#define SIM_MAX_DESCRIPTORS     16
+#define SIM_FRAME_BYTES         4       // 16 bit stereo
+#define FNV_OFFSET_BASIS        2166136261u
+#define FNV_PRIME               16777619u
+
+static uint32_t fnv_sample(uint32_t hash, int16_t sample) {
+    hash = (hash ^ (uint8_t) sample) * FNV_PRIME;
+    return (hash ^ (uint8_t) (sample >> 8)) * FNV_PRIME;
+}
+
+/**
+ * When frame went out, counted from the first frame of the first descriptor. Each is worked out from the start rather
+ * than stepped on by a period rounded to the microsecond, which would drift at rates that do not divide a second.
+ */
+static int64_t frame_us(const sim_sink_t* sim, uint64_t frame) {
+    return sim->started_us + (int64_t) (frame * 1000000 / sim->sink.sample_rate);
+}
+
+/**
+ * Runs the output analysis over the descriptor that has just been sent, the first_frame of the output on.
+ */
+static void analyse(sim_sink_t* sim, const int16_t* samples, uint64_t first_frame) {
+    const uint32_t nr_frames = sim->sink.dma_buf_bytes / SIM_FRAME_BYTES;
+    bool audible = false;
+
+    if (sim->capture != nullptr && sim->nr_captured < sim->capture_frames) {
+        const uint32_t room = sim->capture_frames - sim->nr_captured;
+        const uint32_t nr_copied = nr_frames < room ? nr_frames : room;
+        memcpy(sim->capture + 2 * sim->nr_captured, samples, nr_copied * SIM_FRAME_BYTES);
+        sim->nr_captured += nr_copied;
+    }
+
+    for (uint32_t i = 0; i < nr_frames; i++) {
+        for (int ch = 0; ch < 2; ch++) {
+            const int16_t sample = samples[2 * i + ch];
+            const uint32_t step = (uint32_t) abs(sample - sim->last_sample[ch]);
+            if (step > sim->stats.max_step) {
+                sim->stats.max_step = step;
+            }
+            if (step > SIM_CLICK_THRESHOLD) {
+                sim->stats.nr_clicks++;
+            }
+            sim->last_sample[ch] = sample;
+
+            if (sample == 0) {
+                sim->pending_silence++;
+                continue;
+            }
+            // Silence only counts once something audible follows it, so the hash ignores leading and trailing gaps.
+            if (sim->stats.first_audible_us != 0) {
+                for (; sim->pending_silence > 0; sim->pending_silence--) {
+                    sim->stats.output_hash = fnv_sample(sim->stats.output_hash, 0);
+                }
+            }
+            sim->pending_silence = 0;
+            sim->stats.output_hash = fnv_sample(sim->stats.output_hash, sample);
+
+            const int64_t sample_us = frame_us(sim, first_frame + i);
+            if (sim->stats.first_audible_us == 0) {
+                sim->stats.first_audible_us = sample_us;
+            }
+            sim->stats.last_audible_us = sample_us;
+            audible = true;
+        }
+    }
+
+    if (audible) {
+        sim->stats.nr_gaps += sim->silent_descriptors;
+        sim->silent_descriptors = 0;
+    } else if (sim->stats.first_audible_us != 0) {
+        sim->silent_descriptors++;
+    }
+}
+
+/**
+ * Sends every descriptor whose time has come by now_us.
+ */
+static void advance(sim_sink_t* sim, int64_t now_us) {
+    const uint32_t count = sim->sink.dma_buf_count;
+    const uint32_t nr_frames = sim->sink.dma_buf_bytes / SIM_FRAME_BYTES;
+    while (now_us >= sim->next_eof_us) {
+        char* buffer = sim->buffers + sim->sending * sim->sink.dma_buf_bytes;
+        analyse(sim, (const int16_t*) buffer, (uint64_t) sim->stats.nr_descriptors * nr_frames);
+        memset(buffer, 0, sim->sink.dma_buf_bytes);     // tx_desc_auto_clear
+        sim->stats.nr_descriptors++;
+
+        if (sim->nr_free == count) {
+            sim->free_head = (sim->free_head + 1) % count;  // The driver drops the oldest when the queue is full
+            sim->nr_free--;
+        }
+        sim->free_queue[(sim->free_head + sim->nr_free) % count] = sim->sending;
+        sim->nr_free++;
+
+        sim->sending = (sim->sending + 1) % count;
+        sim->next_eof_us = frame_us(sim, (uint64_t) (sim->stats.nr_descriptors + 1) * nr_frames);
+    }
+}
+
+/**
+ * The driver wakes a blocked writer from the EOF interrupt, so sleep whole ticks and spin the rest, or the mixer's
+ * output clock would see tick sized wake ups.
+ */
+static void sleep_until(int64_t until_us) {
+    const int64_t tick_us = portTICK_PERIOD_MS * 1000;
+    const int64_t wait_us = until_us - esp_timer_get_time();
+    if (wait_us > tick_us) {
+        vTaskDelay((TickType_t) (wait_us / tick_us));
+    }
+    while (esp_timer_get_time() < until_us) {
+    }
+}
+
+/**
+ * Waits until the descriptor being sent is done, then sends it.
+ */
+static void wait_eof(sim_sink_t* sim) {
+    sim->wait_until(sim->next_eof_us);
+    advance(sim, esp_timer_get_time());
+}
+
+static esp_err_t sim_write(void* ctx, const char* data, size_t size, size_t* nr_bytes_written) {
+    sim_sink_t* sim = (sim_sink_t*) ctx;
+    const int64_t start_us = esp_timer_get_time();
+    advance(sim, start_us);
+
+    *nr_bytes_written = 0;
+    while (size > 0) {
+        if (sim->current < 0 || sim->write_pos == sim->sink.dma_buf_bytes) {
+            while (sim->nr_free == 0) {
+                wait_eof(sim);
+            }
+            sim->current = sim->free_queue[sim->free_head];
+            sim->free_head = (sim->free_head + 1) % sim->sink.dma_buf_count;
+            sim->nr_free--;
+            sim->write_pos = 0;
+        }
+        const uint32_t room = sim->sink.dma_buf_bytes - sim->write_pos;
+        const uint32_t chunk = size < room ? size : room;
+        memcpy(sim->buffers + sim->current * sim->sink.dma_buf_bytes + sim->write_pos, data, chunk);
+        sim->write_pos += chunk;
+        data += chunk;
+        size -= chunk;
+        *nr_bytes_written += chunk;
+    }
+
+    sim->stats.nr_writes++;
+    sim->stats.nr_bytes_written += *nr_bytes_written;
+    sim->stats.sink_us += esp_timer_get_time() - start_us;
+    return ESP_OK;
+}
+
+static esp_err_t sim_wait_sent(void* ctx, uint32_t nr_buffers) {
+    sim_sink_t* sim = (sim_sink_t*) ctx;
+    const int64_t start_us = esp_timer_get_time();
+    advance(sim, start_us);
+    const uint32_t target = sim->stats.nr_descriptors + nr_buffers;
+    while (sim->stats.nr_descriptors < target) {
+        wait_eof(sim);
+    }
+    sim->stats.sink_us += esp_timer_get_time() - start_us;
+    return ESP_OK;
+}
+
+esp_err_t sim_sink_init(sim_sink_t* sim, uint32_t dma_buf_bytes, uint32_t dma_buf_count) {
+    memset(sim, 0, sizeof(sim_sink_t));
+    if (dma_buf_count == 0 || dma_buf_count > SIM_MAX_DESCRIPTORS || dma_buf_bytes % SIM_FRAME_BYTES != 0) {
+        ESP_LOGE(TAG, "Unsupported DMA geometry %d x %d bytes", dma_buf_count, dma_buf_bytes);
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim->buffers = (char*) heap_caps_malloc(dma_buf_bytes * dma_buf_count, MALLOC_CAP_8BIT);
+    if (sim->buffers == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %d descriptors of %d bytes", dma_buf_count, dma_buf_bytes);
+        return ESP_ERR_NO_MEM;
+    }
+    sim->wait_until = sleep_until;
+    sim->sink.write = sim_write;
+    sim->sink.wait_sent = sim_wait_sent;
+    sim->sink.ctx = sim;
+    sim->sink.dma_buf_bytes = dma_buf_bytes;
+    sim->sink.dma_buf_count = dma_buf_count;
+    return ESP_OK;
+}
+
+void sim_sink_start(sim_sink_t* sim, uint32_t sample_rate) {
+    memset(sim->buffers, 0, sim->sink.dma_buf_bytes * sim->sink.dma_buf_count);
+    sim->sink.sample_rate = sample_rate;
+    sim->started_us = esp_timer_get_time();
+    sim->next_eof_us = frame_us(sim, sim->sink.dma_buf_bytes / SIM_FRAME_BYTES);
+    sim->sending = 0;
+    sim->free_head = 0;
+    sim->nr_free = 0;
+    sim->current = -1;
+    sim->write_pos = 0;
+    sim->last_sample[0] = sim->last_sample[1] = 0;
+    sim->pending_silence = 0;
+    sim->silent_descriptors = 0;
+    sim->nr_captured = 0;
+    memset(&sim->stats, 0, sizeof(sim->stats));
+    sim->stats.output_hash = FNV_OFFSET_BASIS;
+}
+
+void sim_sink_capture(sim_sink_t* sim, int16_t* frames, uint32_t max_frames) {
+    sim->capture = frames;
+    sim->capture_frames = frames != nullptr ? max_frames : 0;
+}
+
+void sim_sink_drain(sim_sink_t* sim) {
+    const uint32_t target = sim->stats.nr_descriptors + 2 * sim->sink.dma_buf_count;
+    while (sim->stats.nr_descriptors < target) {
+        wait_eof(sim);
+    }
+}
+
+void sim_sink_free(sim_sink_t* sim) {
+    heap_caps_free(sim->buffers);
+    sim->buffers = nullptr;
+}
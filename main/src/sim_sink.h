@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <esp_err.h>
+
+#include "pcm_sink.h"
+
+#define SIM_CLICK_THRESHOLD     4096    // Sample to sample jump, on either channel, counted as a click
+
+typedef struct {
+    uint32_t nr_bytes_written;
+    uint32_t nr_writes;
+    uint32_t nr_descriptors;        // Sent by the simulated DMA since sim_sink_start
+    uint32_t nr_gaps;               // Silent descriptors between the first and last audible ones
+    uint32_t nr_clicks;             // Jumps over SIM_CLICK_THRESHOLD in the output
+    uint32_t max_step;              // Largest sample to sample jump in the output
+    int64_t sink_us;                // Time spent in the sink, waiting for a free descriptor or simulating the DMA
+    int64_t first_audible_us;       // When the first and last non zero samples were sent, 0 if none were
+    int64_t last_audible_us;
+    uint32_t output_hash;           // FNV-1a of the output from the first to the last audible sample
+} sim_sink_stats_t;
+
+typedef void (*sim_sink_wait_t)(int64_t until_us);
+
+/**
+ * Model of the I2S driver's DMA ring, as configured in main.cpp, for judging playback strategies without ears.
+ *
+ * The DMA loops over the descriptors in real time. As each one is sent it is zeroed (tx_desc_auto_clear) and queued
+ * as free, the oldest free descriptor being dropped when the queue is full. Writes fill the descriptor taken from
+ * that queue, blocking until there is one. A partly written descriptor is sent as it stands when its turn comes.
+ */
+typedef struct {
+    pcm_sink_t sink;                // Hand this to the players, ctx points back here
+    char* buffers;                  // dma_buf_count descriptors of dma_buf_bytes
+    sim_sink_wait_t wait_until;     // Sleeps until an esp_timer time, see sim_sink_init
+    int64_t next_eof_us;            // When the descriptor being sent finishes
+    uint32_t sending;               // Descriptor being sent
+    uint32_t free_queue[16];        // Ring of free descriptors, up to dma_buf_count of them
+    uint32_t free_head;
+    uint32_t nr_free;
+    int32_t current;                // Descriptor being written, -1 until the first write
+    uint32_t write_pos;
+    int16_t last_sample[2];
+    uint32_t pending_silence;       // Zero samples not hashed yet, in case nothing audible follows
+    uint32_t silent_descriptors;    // Run of silent descriptors since the last audible one
+    int16_t* capture;               // Everything the DMA sends is copied here when set, see sim_sink_capture
+    uint32_t capture_frames;
+    uint32_t nr_captured;           // Frames captured since sim_sink_start
+    int64_t started_us;             // When the DMA started sending the first descriptor
+    sim_sink_stats_t stats;
+} sim_sink_t;
+
+/**
+ * Allocates the descriptors. Geometry as in i2s_config, at most 16 descriptors. The DMA waits for its end of frame
+ * times by sleeping whole ticks and spinning the rest, a host test can set wait_until to a simulated clock's wait.
+ */
+esp_err_t sim_sink_init(sim_sink_t* sim, uint32_t dma_buf_bytes, uint32_t dma_buf_count);
+
+/**
+ * Clears the stats and restarts the DMA from silence at sample_rate, as i2s_set_sample_rates does.
+ */
+void sim_sink_start(sim_sink_t* sim, uint32_t sample_rate);
+
+/**
+ * Records the exact output from the next sim_sink_start on, up to max_frames 16 bit stereo frames into frames,
+ * silence included. Frame i went out at started_us + i * 1000000 / sample_rate, the descriptor holding it at that
+ * of its first frame, rounded down to the microsecond. nullptr stops recording.
+ */
+void sim_sink_capture(sim_sink_t* sim, int16_t* frames, uint32_t max_frames);
+
+/**
+ * Lets the DMA run on until the whole ring has been sent twice, so everything written has come out.
+ */
+void sim_sink_drain(sim_sink_t* sim);
+
+void sim_sink_free(sim_sink_t* sim);
@@ -0,0 +1,403 @@
+#include "wav_file.h"
+#include "adpcm.h"
+#include "clip_index.h"
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cstring>
+#include <errno.h>
+#include <sys/stat.h>
+
+static const char *TAG = "wav_file";
+
+bool validate_wav_data(wav_header_t* Wav) {
+
+    if (memcmp(Wav->RIFFSectionID, "RIFF", 4) != 0) {
+        ESP_LOGW(TAG, "Invalid data - Not RIFF format");
+        return false;
+    }
+    if (memcmp(Wav->RiffFormat, "WAVE", 4) != 0) {
+        ESP_LOGW(TAG, "Invalid data - Not Wave file");
+        return false;
+    }
+    if (memcmp(Wav->FormatSectionID, "fmt", 3) != 0) {
+        ESP_LOGW(TAG, "Invalid data - No format section found");
+        return false;
+    }
+    if (memcmp(Wav->data.chunkID, "data", 4) != 0) {
+        ESP_LOGW(TAG, "Invalid data - data section not found");
+        return false;
+    }
+    if (Wav->FormatID != WAV_FORMAT_PCM && Wav->FormatID != WAV_FORMAT_IMA_ADPCM) {
+        ESP_LOGW(TAG, "Invalid data - format Id must be 1 or 0x11");
+        return false;
+    }
+    if (Wav->FormatSize < WAV_FMT_PCM_SIZE) {
+        ESP_LOGW(TAG, "Invalid data - format section size must be at least 16.");
+        return false;
+    }
+    if ((Wav->NumChannels != 1) && (Wav->NumChannels != 2)) {
+        ESP_LOGW(TAG, "Invalid data - only mono or stereo permitted.");
+        return false;
+    }
+    if (Wav->SampleRate > 48000) {
+        ESP_LOGW(TAG, "Invalid data - Sample rate cannot be greater than 48000");
+        return false;
+    }
+    if (Wav->FormatID == WAV_FORMAT_IMA_ADPCM) {
+        if (Wav->BitsPerSample != 4 || !adpcm_valid_block_align(Wav->NumChannels, Wav->BlockAlign)) {
+            ESP_LOGW(TAG, "Invalid data - IMA-ADPCM needs 4 bits per sample and whole 8 sample groups per block.");
+            return false;
+        }
+    } else if ((Wav->BitsPerSample != 8) && (Wav->BitsPerSample != 16)) {
+        ESP_LOGW(TAG, "Invalid data - Only 8 or 16 bits per sample permitted.");
+        return false;
+    }
+    return true;
+}
+
+void log_wav_header(wav_header_t* Wav) {
+    if (memcmp(Wav->RIFFSectionID, "RIFF", 4) != 0) {
+        ESP_LOGE(TAG, "Not a RIFF format file - '%s'", Wav->RIFFSectionID);
+        return;
+    }
+    if (memcmp(Wav->RiffFormat, "WAVE", 4) != 0) {
+        ESP_LOGE(TAG, "Not a WAVE file -  '%s'", Wav->RiffFormat);
+        return;
+    }
+    if (memcmp(Wav->FormatSectionID, "fmt", 3) != 0) {
+        ESP_LOGE(TAG, "fmt ID not present - '%s'", Wav->FormatSectionID);
+        return;
+    }
+    if (memcmp(Wav->data.chunkID, "data", 4) != 0) {
+        ESP_LOGE(TAG, "data ID not present - '%s'", Wav->data.chunkID);
+        return;
+    }
+    // All looks good, dump the data
+    ESP_LOGI(TAG, "Total size : %d", Wav->Size);
+    ESP_LOGI(TAG, "Format section size : %d", Wav->FormatSize);
+    ESP_LOGI(TAG, "Wave format : %d", Wav->FormatID);
+    ESP_LOGI(TAG, "Channels : %d", Wav->NumChannels);
+    ESP_LOGI(TAG, "Sample Rate : %d", Wav->SampleRate);
+    ESP_LOGI(TAG, "Byte Rate : %d", Wav->ByteRate);
+    ESP_LOGI(TAG, "Block Align : %d", Wav->BlockAlign);
+    ESP_LOGI(TAG, "Bits Per Sample : %d", Wav->BitsPerSample);
+    ESP_LOGI(TAG, "Data Size : %d", Wav->data.chunk_size);
+    if (Wav->loop.end_frame != 0) {
+        ESP_LOGI(TAG, "Loop : frames %d-%d, plays %d times (0 is until stopped)", Wav->loop.start_frame,
+                 Wav->loop.end_frame, Wav->loop.play_count);
+    }
+}
+
+/**
+ * Reads a little endian field out of a chunk body.
+ */
+static uint16_t read_u16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t read_u32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/**
+ * Takes the first forward loop out of the smpl chunk body in smpl, nr_bytes of it. Leaves loop alone if there is none.
+ */
+static void parse_smpl(const uint8_t* smpl, uint32_t nr_bytes, wav_loop_t* loop) {
+    const uint32_t nr_loops = read_u32(smpl + 28);
+    for (uint32_t i = 0; i < nr_loops && WAV_SMPL_SIZE + (i + 1) * WAV_SMPL_LOOP_SIZE <= nr_bytes; i++) {
+        const uint8_t* entry = smpl + WAV_SMPL_SIZE + i * WAV_SMPL_LOOP_SIZE;
+        if (read_u32(entry + 4) != WAV_SMPL_LOOP_FORWARD) {
+            continue;   // Ping pong and backward loops are not supported
+        }
+        loop->start_frame = read_u32(entry + 8);
+        loop->end_frame = read_u32(entry + 12) + 1;     // smpl gives the last frame
+        loop->play_count = read_u32(entry + 20);
+        return;
+    }
+}
+
+/**
+ * Whether a seekable source has a byte at offset.
+ */
+static bool source_has_byte(const audio_source_t* source, uint64_t offset) {
+    char byte;
+    return offset <= UINT32_MAX && source->seek(source->ctx, (uint32_t) offset) == ESP_OK
+           && audio_source_read_fully(source, &byte, 1) == 1;
+}
+
+/**
+ * End of a seekable source that holds every byte before from, if it is short of to. Found by reading single bytes,
+ * halving the range each time, as a source has no size of its own. Only a truncated file needs more than the one.
+ */
+static uint64_t source_end(const audio_source_t* source, uint64_t from, uint64_t to) {
+    if (to <= from || source_has_byte(source, to - 1)) {
+        return to;
+    }
+    to--;
+    while (from < to) {
+        const uint64_t middle = from + (to - from) / 2;
+        if (source_has_byte(source, middle)) {
+            from = middle + 1;
+        } else {
+            to = middle;
+        }
+    }
+    return from;
+}
+
+esp_err_t wav_parse_source_header(const audio_source_t* source, wav_header_t* wav_header, uint32_t* data_offset) {
+
+    memset(wav_header, 0, sizeof(wav_header_t));
+
+    // RIFF Section
+    uint8_t riff[12];
+    if (audio_source_read_fully(source, (char*) riff, sizeof(riff)) != sizeof(riff)) {
+        ESP_LOGW(TAG, "Invalid data - file shorter than a RIFF header");
+        return ESP_FAIL;
+    }
+    memcpy(wav_header->RIFFSectionID, riff, 4);
+    wav_header->Size = read_u32(riff + 4);
+    memcpy(wav_header->RiffFormat, riff + 8, 4);
+    if (memcmp(wav_header->RIFFSectionID, "RIFF", 4) != 0 || memcmp(wav_header->RiffFormat, "WAVE", 4) != 0) {
+        ESP_LOGW(TAG, "Invalid data - Not a RIFF WAVE file");
+        return ESP_FAIL;
+    }
+
+    // Walk the chunks, seeking past everything but fmt, data and smpl. Never reads a chunk body into a fixed size buffer.
+    uint64_t offset = sizeof(riff);     // 64 bit so a corrupt chunk size cannot wrap it
+    uint64_t read_end = offset;         // The source holds every byte before this
+    bool have_format = false;
+    bool have_data = false;
+    while (true) {
+        uint8_t chunk[8];
+        if (audio_source_read_fully(source, (char*) chunk, sizeof(chunk)) != sizeof(chunk)) {
+            if (have_data) {
+                break;      // End of the file
+            }
+            ESP_LOGW(TAG, "Invalid data - data section not found");
+            return ESP_FAIL;
+        }
+        offset += sizeof(chunk);
+        read_end = offset;
+        const uint32_t chunk_size = read_u32(chunk + 4);
+        uint32_t skip = chunk_size + (chunk_size & 1);     // Chunks are padded to an even size
+
+        if (memcmp(chunk, "data", 4) == 0 && !have_data) {
+            if (!have_format) {
+                ESP_LOGW(TAG, "Invalid data - data section before format section");
+                return ESP_FAIL;
+            }
+            memcpy(wav_header->data.chunkID, chunk, 4);
+            wav_header->data.chunk_size = chunk_size;
+            *data_offset = offset;
+            have_data = true;
+            if (source->seek == nullptr) {
+                break;      // No coming back from past the data, so no smpl chunk
+            }
+        } else if (memcmp(chunk, "smpl", 4) == 0 && chunk_size >= WAV_SMPL_SIZE) {
+            uint8_t smpl[WAV_SMPL_SIZE + 4 * WAV_SMPL_LOOP_SIZE];
+            const uint32_t smpl_size = chunk_size < sizeof(smpl) ? chunk_size : sizeof(smpl);
+            if (audio_source_read_fully(source, (char*) smpl, smpl_size) != smpl_size) {
+                if (have_data) {
+                    break;
+                }
+                ESP_LOGW(TAG, "Invalid data - smpl section truncated");
+                return ESP_FAIL;
+            }
+            parse_smpl(smpl, smpl_size, &wav_header->loop);
+            offset += smpl_size;
+            skip -= smpl_size;
+        } else if (memcmp(chunk, "fmt ", 4) == 0 && have_format) {
+            // Only the first counts, as for data. A later one must not change the format under data already found.
+            ESP_LOGW(TAG, "Ignoring a second format section, %d bytes", chunk_size);
+        } else if (memcmp(chunk, "fmt ", 4) == 0) {
+            if (chunk_size < WAV_FMT_PCM_SIZE) {
+                ESP_LOGW(TAG, "Invalid data - format section only %d bytes", chunk_size);
+                return ESP_FAIL;
+            }
+            uint8_t fmt[WAV_FMT_EXTENSIBLE_SIZE];
+            const uint32_t fmt_size = chunk_size < sizeof(fmt) ? chunk_size : sizeof(fmt);
+            if (audio_source_read_fully(source, (char*) fmt, fmt_size) != fmt_size) {
+                ESP_LOGW(TAG, "Invalid data - format section truncated");
+                return ESP_FAIL;
+            }
+            memcpy(wav_header->FormatSectionID, chunk, 4);
+            wav_header->FormatSize = chunk_size;
+            wav_header->FormatID = read_u16(fmt);
+            wav_header->NumChannels = read_u16(fmt + 2);
+            wav_header->SampleRate = read_u32(fmt + 4);
+            wav_header->ByteRate = read_u32(fmt + 8);
+            wav_header->BlockAlign = read_u16(fmt + 12);
+            wav_header->BitsPerSample = read_u16(fmt + 14);
+            if (wav_header->FormatID == WAV_FORMAT_EXTENSIBLE && fmt_size == WAV_FMT_EXTENSIBLE_SIZE) {
+                // The real format is the first two bytes of the SubFormat GUID.
+                wav_header->FormatID = read_u16(fmt + 24);
+            }
+            have_format = true;
+            offset += fmt_size;
+            skip -= fmt_size;
+        } else {
+            ESP_LOGI(TAG, "Skipping past WAV chunk %.4s, %d bytes", (const char*) chunk, chunk_size);
+        }
+
+        offset += skip;
+        if (offset > (uint64_t) wav_header->Size + 8) {
+            if (have_data) {
+                break;
+            }
+            ESP_LOGW(TAG, "Invalid data - chunk %.4s runs past the end of the RIFF section", (const char*) chunk);
+            return ESP_FAIL;
+        }
+        if (skip > 0 && audio_source_skip(source, (uint32_t) (offset - skip), skip) != ESP_OK) {
+            if (have_data) {
+                break;
+            }
+            ESP_LOGW(TAG, "Invalid data - chunk %.4s runs past the end of the file", (const char*) chunk);
+            return ESP_FAIL;
+        }
+    }
+
+    // A file cut short, or with sizes that overstate it, must not send the players past the end of the RIFF section
+    // or of the file. The rest of the data still plays, in whole blocks.
+    const uint64_t riff_end = (uint64_t) wav_header->Size + 8;
+    uint64_t data_end = (uint64_t) *data_offset + wav_header->data.chunk_size;
+    data_end = data_end < riff_end ? data_end : riff_end;
+    if (source->seek != nullptr && data_end > read_end) {
+        data_end = source_end(source, read_end, data_end);
+    }
+    if (data_end < (uint64_t) *data_offset + wav_header->data.chunk_size) {
+        uint32_t nr_bytes = data_end > *data_offset ? (uint32_t) (data_end - *data_offset) : 0;
+        nr_bytes -= wav_header->BlockAlign != 0 ? nr_bytes % wav_header->BlockAlign : 0;
+        ESP_LOGW(TAG, "Data section of %d bytes runs past the end of the file or RIFF section, playing %d",
+                 wav_header->data.chunk_size, nr_bytes);
+        wav_header->data.chunk_size = nr_bytes;
+        wav_header->data_truncated = true;
+    }
+
+    wav_loop_t* loop = &wav_header->loop;
+    if (loop->end_frame != 0) {
+        const uint32_t nr_frames = wav_header->BlockAlign != 0 ? wav_header->data.chunk_size / wav_header->BlockAlign : 0;
+        if (wav_header->FormatID != WAV_FORMAT_PCM || loop->start_frame >= loop->end_frame || loop->end_frame > nr_frames) {
+            ESP_LOGW(TAG, "Ignoring loop %d-%d, it must be PCM and within the %d frames of data", loop->start_frame,
+                     loop->end_frame, nr_frames);
+            memset(loop, 0, sizeof(wav_loop_t));
+        }
+    }
+    if (source->seek != nullptr && source->seek(source->ctx, *data_offset) != ESP_OK) {
+        ESP_LOGW(TAG, "Invalid data - cannot seek back to the data section");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t wav_parse_header(FILE* f, wav_header_t* wav_header, uint32_t* data_offset) {
+    file_source_t file;
+    file_source_wrap(&file, f);
+    return wav_parse_source_header(&file.source, wav_header, data_offset);
+}
+
+typedef struct {
+    char filename[WAV_HEADER_CACHE_NAME_SIZE];
+    off_t size;                 // The file as it was parsed, a rewritten one is parsed again
+    time_t mtime;
+    wav_header_t header;
+    uint32_t data_offset;
+} header_cache_entry_t;
+
+// Headers of recently opened files, so reopening one costs a single seek. Replaced round robin.
+static header_cache_entry_t header_cache[WAV_HEADER_CACHE_SIZE];
+static uint32_t header_cache_next = 0;
+
+static const header_cache_entry_t* find_cached_header(const char* filename, const struct stat* st) {
+    for (int i = 0; i < WAV_HEADER_CACHE_SIZE; i++) {
+        const header_cache_entry_t* entry = &header_cache[i];
+        if (strcmp(entry->filename, filename) == 0 && entry->size == st->st_size && entry->mtime == st->st_mtime) {
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+static void cache_header(const char* filename, const struct stat* st, const wav_header_t* wav_header,
+                         uint32_t data_offset) {
+    if (strlen(filename) >= WAV_HEADER_CACHE_NAME_SIZE) {
+        return;
+    }
+    // A stale entry for the file goes first, so it cannot outlive the new one.
+    header_cache_entry_t* entry = nullptr;
+    for (int i = 0; i < WAV_HEADER_CACHE_SIZE && entry == nullptr; i++) {
+        entry = strcmp(header_cache[i].filename, filename) == 0 ? &header_cache[i] : nullptr;
+    }
+    if (entry == nullptr) {
+        entry = &header_cache[header_cache_next];
+        header_cache_next = (header_cache_next + 1) % WAV_HEADER_CACHE_SIZE;
+    }
+    strcpy(entry->filename, filename);
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtime;
+    entry->header = *wav_header;
+    entry->data_offset = data_offset;
+}
+
+/**
+ * Loads the wav file and populates the pointer to the header and the pointer to the opened File.
+ */
+esp_err_t load_wav_header(char* filename, wav_header_t* wav_header, FILE** f) {
+
+    const int64_t start_ms = esp_timer_get_time() / 1000;
+
+    // A clip the index has found corrupt or truncated would only play as garbage.
+    const esp_err_t integrity = clip_index_check(filename);
+    if (integrity != ESP_OK && integrity != ESP_ERR_NOT_FOUND) {
+        ESP_LOGE(TAG, "Refusing %s, it failed its integrity check err=%s", filename, esp_err_to_name(integrity));
+        *f = nullptr;
+        return integrity;
+    }
+
+    // Use POSIX and C standard library functions to work with files.
+    // Open the file for reading.
+    ESP_LOGI(TAG, "Opening file");
+    *f = fopen(filename, "r");
+    if (*f == nullptr) {
+        ESP_LOGE(TAG, "Failed to open file for reading errno=%d err=str=%s", errno, strerror(errno));
+        return ESP_FAIL;
+    }
+    // Unbuffered, newlib then reads straight into the caller's buffer with one SPIFFS read per fread, rather than
+    // refilling its small FILE buffer and copying out of it every BUFSIZ bytes. Must precede any other use of *f.
+    setvbuf(*f, nullptr, _IONBF, 0);
+
+    // Seen this file before, as it is now, jump straight to the data. SD cards and host files can be rewritten.
+    struct stat st;
+    const bool have_stat = fstat(fileno(*f), &st) == 0;
+    const header_cache_entry_t* cached = have_stat ? find_cached_header(filename, &st) : nullptr;
+    if (cached != nullptr && fseek(*f, cached->data_offset, SEEK_SET) == 0) {
+        *wav_header = cached->header;
+        ESP_LOGI(TAG, "Loaded cached wav header - Finish. filename=%s Elapsed time=%lldms", filename, (esp_timer_get_time() / 1000 - start_ms));
+        return ESP_OK;
+    }
+
+    uint32_t data_offset;
+    if (wav_parse_header(*f, wav_header, &data_offset) != ESP_OK) {
+        ESP_LOGW(TAG, "Could not parse the Sound");
+        fclose(*f);
+        *f = nullptr;
+        return ESP_FAIL;
+    }
+
+    log_wav_header(wav_header);                // Dump the header data to serial, optional!
+    if (!validate_wav_data(wav_header)) {
+        ESP_LOGW(TAG, "Could not validate the Sound");
+        fclose(*f);
+        *f = nullptr;
+        return ESP_FAIL;
+    }
+    if (have_stat) {
+        cache_header(filename, &st, wav_header, data_offset);
+    }
+
+    ESP_LOGI(TAG, "Loaded wav header - Finish. filename=%s Elapsed time=%lldms free_heap=%d", filename, (esp_timer_get_time() / 1000 - start_ms), heap_caps_get_free_size(MALLOC_CAP_8BIT));
+
+    return ESP_OK;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+#include "audio_source.h"
+#include "pcm_silence.h"
+
+typedef struct {
+    // Data Section
+    char chunkID[4];            // The letters "data" (if it is a data section), otherwise LIST or similar)
+    uint32_t chunk_size;        // Size of the data that follows
+} wav_chunk_t;
+
+/**
+ * Loop region from the first forward loop of a smpl chunk.
+ */
+typedef struct {
+    uint32_t start_frame;       // First frame of the loop, counted from the start of the data section
+    uint32_t end_frame;         // Frame after the last one of the loop, 0 if there is no loop
+    uint32_t play_count;        // Times the loop plays as authored, 0 for until stopped
+} wav_loop_t;
+
+typedef struct {
+    //   RIFF Section
+    char RIFFSectionID[4];      // Letters "RIFF"
+    uint32_t Size;              // Size of entire file less 8
+    char RiffFormat[4];         // Letters "WAVE"
+
+    //   Format Section
+    char FormatSectionID[4];    // letters "fmt"
+    uint32_t FormatSize;        // Size of format section less 8
+    uint16_t FormatID;          // 1=uncompressed PCM, 0x11=IMA-ADPCM
+    uint16_t NumChannels;       // 1=mono,2=stereo
+    uint32_t SampleRate;        // 44100, 16000, 8000 etc.
+    uint32_t ByteRate;          // =SampleRate * Channels * (BitsPerSample/8)
+    uint16_t BlockAlign;        // =Channels * (BitsPerSample/8)
+    uint16_t BitsPerSample;     // 8,16,24 or 32
+    wav_chunk_t data;
+    wav_loop_t loop;            // From the smpl chunk, if there is one
+    bool data_truncated;        // data.chunk_size was cut to the end of the file or RIFF section
+} wav_header_t;
+
+typedef struct {
+    char* data;
+    uint32_t sample_rate;
+    uint32_t nr_bytes;
+    char* filename;
+    uint16_t num_channels;      // data is converted to stereo as it is played
+    uint16_t bits_per_sample;   // 8 bit data is converted to 16 bit as it is played
+    const pcm_silence_index_t* silence;     // Silent runs inside data that players may skip, nullptr if not indexed
+    wav_loop_t loop;            // Frames of data to repeat, only the mixer plays loops
+} wav_data_t;
+
+#define WAV_HEADER_SIZE sizeof(wav_header_t)
+
+#define WAV_FORMAT_PCM              1
+#define WAV_FORMAT_IMA_ADPCM        0x11    // 4 bits per sample, see adpcm.h. Only pipeline_play decodes it
+#define WAV_FORMAT_EXTENSIBLE       0xFFFE
+#define WAV_FMT_PCM_SIZE            16      // Smallest fmt chunk, plain PCM
+#define WAV_FMT_EXTENSIBLE_SIZE     40      // fmt chunk of a WAVE_FORMAT_EXTENSIBLE file
+#define WAV_SMPL_SIZE               36      // smpl chunk up to its list of loops
+#define WAV_SMPL_LOOP_SIZE          24      // One loop in a smpl chunk
+#define WAV_SMPL_LOOP_FORWARD       0
+#define WAV_HEADER_CACHE_SIZE       8       // Files whose data offset is remembered by load_wav_header
+#define WAV_HEADER_CACHE_NAME_SIZE  48
+
+/**
+ * Checks the header describes PCM or IMA-ADPCM data the I2S port can play.
+ */
+bool validate_wav_data(wav_header_t* Wav);
+
+/**
+ * Dumps the header fields to the log.
+ */
+void log_wav_header(wav_header_t* Wav);
+
+/**
+ * Walks the RIFF chunks of f from the start, seeking past anything that is not fmt, data or smpl.
+ * Accepts fmt sections of any size, resolving WAVE_FORMAT_EXTENSIBLE to the format in its SubFormat.
+ * A smpl chunk is usually after the data, so the walk goes on to the end of the file for one. Its first forward loop
+ * goes in wav_header->loop, if it lies within the data. Anything wrong after the data just ends the walk.
+ * A data section that runs past the end of the file or of the RIFF section is cut to whole blocks before it, with
+ * data_truncated set, so data_offset + data.chunk_size never lies outside either.
+ * On success f is positioned at the start of the data section, which is also returned in data_offset.
+ */
+esp_err_t wav_parse_header(FILE* f, wav_header_t* wav_header, uint32_t* data_offset);
+
+/**
+ * As wav_parse_header, reading source. A source that cannot seek is read up to the start of the data section and no
+ * further, so it has no loop, and its data is only cut to the RIFF section.
+ */
+esp_err_t wav_parse_source_header(const audio_source_t* source, wav_header_t* wav_header, uint32_t* data_offset);
+
+/**
+ * Loads the wav file and populates the pointer to the header and the pointer to the opened File.
+ * On success the file is positioned at the start of the data section.
+ * The file is unbuffered, so read it in large blocks. Each fread goes straight to SPIFFS.
+ * Files that clip_index has found corrupt or truncated are refused with its error, before they are opened.
+ * The data offset of the last few files is cached, so opening one of them again costs one seek and no parsing.
+ */
+esp_err_t load_wav_header(char* filename, wav_header_t* wav_header, FILE** f);
@@ -0,0 +1,59 @@
+#include "wav_player.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+
+static const char *TAG = "wav_player";
+
+static char* player_buffer = nullptr;  // Reused by every play, never freed
+
+esp_err_t wav_player_init() {
+    if (player_buffer != nullptr) {
+        return ESP_OK;
+    }
+    player_buffer = (char*) heap_caps_malloc(PLAYER_BUFFER_SIZE, MALLOC_CAP_DMA);
+    if (player_buffer == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %d byte DMA player buffer", PLAYER_BUFFER_SIZE);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+char* wav_player_buffer() {
+    return player_buffer;
+}
+
+esp_err_t wav_player_flush_to_dma_boundary(const pcm_sink_t* sink, uint32_t nr_bytes_written, const char* silence, uint32_t silence_size, bool wait) {
+    if (sink->dma_buf_bytes == 0) {
+        return ESP_OK;
+    }
+
+    // With tx_desc_auto_clear the driver zeroes a descriptor once it is sent, so all that is needed to push the
+    // last sample out is to complete the descriptor it sits in.
+    uint32_t pad = (sink->dma_buf_bytes - nr_bytes_written % sink->dma_buf_bytes) % sink->dma_buf_bytes;
+    while (pad > 0) {
+        const uint32_t chunk = pad < silence_size ? pad : silence_size;
+        size_t written;
+        const esp_err_t err = sink->write(sink->ctx, silence, chunk, &written);
+        if (err != ESP_OK) {
+            return err;
+        }
+        pad -= chunk;
+        nr_bytes_written += chunk;
+    }
+
+    if (!wait || sink->wait_sent == nullptr) {
+        return ESP_OK;
+    }
+
+    // The stream can occupy at most every descriptor in the ring. Shorter streams only need the ones they filled.
+    uint32_t nr_buffers = nr_bytes_written / sink->dma_buf_bytes;
+    if (nr_buffers > sink->dma_buf_count) {
+        nr_buffers = sink->dma_buf_count;
+    }
+    const int64_t start_us = esp_timer_get_time();
+    const esp_err_t err = sink->wait_sent(sink->ctx, nr_buffers);
+    ESP_LOGD(TAG, "flush_to_dma_boundary - waited for %d buffers, %lldus", nr_buffers, esp_timer_get_time() - start_us);
+    return err;
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <cstring>
+#include <esp_err.h>
+
+#include "pcm_sink.h"
+#include "playback_trace.h"
+
+#define PLAYER_BUFFER_SIZE      8096    // Largest block_size any play_policy may use
+
+/**
+ * What to do with the last, partially filled, block of the file.
+ */
+typedef enum {
+    TAIL_WRITE_READ,        // Write just the bytes that were read
+    TAIL_PAD_TO_BLOCK,      // Zero the rest of the block and write all of it
+} tail_padding_t;
+
+/**
+ * What to write after the file data to flush the sound out of the DMA buffers.
+ */
+typedef enum {
+    FLUSH_SILENCE,                  // Write full SILENCE buffers only
+    FLUSH_SILENCE_TO_BOUNDARY,      // Write SILENCE until the end of the next SILENCE sized block, then full SILENCE buffers
+    FLUSH_DMA_BOUNDARY,             // Write SILENCE up to the end of the current DMA descriptor, so the next clip can follow gap-free
+    FLUSH_DMA_BOUNDARY_AND_WAIT,    // As FLUSH_DMA_BOUNDARY, then wait on the sink until the last descriptor has been sent
+} flush_t;
+
+/**
+ * Compile time description of a playback strategy.
+ * Every field is a constant so wav_player_stream<> is specialised per policy with no branching in the hot loop.
+ */
+template <uint32_t BLOCK_SIZE, tail_padding_t TAIL, flush_t FLUSH, uint32_t FULL_SILENCE_WRITES, bool DISCARD_FIRST_BLOCK = false>
+struct play_policy {
+    static const uint32_t block_size = BLOCK_SIZE;
+    static const tail_padding_t tail = TAIL;
+    static const flush_t flush = FLUSH;
+    static const uint32_t full_silence_writes = FULL_SILENCE_WRITES;
+    static const bool discard_first_block = DISCARD_FIRST_BLOCK;   // Variants 6-8 threw away the first block they read
+
+    static_assert(BLOCK_SIZE > 0 && BLOCK_SIZE <= PLAYER_BUFFER_SIZE, "block_size must fit in the player buffer");
+};
+
+// The original play_wav_file1..9 experiments, byte for byte.
+typedef play_policy<1024, TAIL_PAD_TO_BLOCK, FLUSH_SILENCE, 0>                 legacy_policy_1;    // "OnYourMark Mar"
+typedef play_policy<1024, TAIL_PAD_TO_BLOCK, FLUSH_SILENCE, 1>                 legacy_policy_2;    // soft click
+typedef play_policy<1024, TAIL_PAD_TO_BLOCK, FLUSH_SILENCE, 2>                 legacy_policy_3;    // clean
+typedef play_policy<8096, TAIL_PAD_TO_BLOCK, FLUSH_SILENCE, 0>                 legacy_policy_4;    // hard click
+typedef play_policy<8096, TAIL_WRITE_READ, FLUSH_SILENCE, 0>                   legacy_policy_5;    // double-click
+typedef play_policy<8096, TAIL_WRITE_READ, FLUSH_SILENCE_TO_BOUNDARY, 0, true> legacy_policy_6;    // soft click, hard click
+typedef play_policy<8096, TAIL_WRITE_READ, FLUSH_SILENCE_TO_BOUNDARY, 1, true> legacy_policy_7;    // soft click
+typedef play_policy<8096, TAIL_WRITE_READ, FLUSH_SILENCE, 2, true>             legacy_policy_8;    // soft click
+typedef play_policy<8096, TAIL_PAD_TO_BLOCK, FLUSH_SILENCE, 2>                 legacy_policy_9;    // soft click
+
+// Pads only to the next DMA descriptor instead of writing 16K of SILENCE.
+typedef play_policy<4096, TAIL_WRITE_READ, FLUSH_DMA_BOUNDARY_AND_WAIT, 0>     dma_aligned_policy; // Returns once the sound is out
+typedef play_policy<4096, TAIL_WRITE_READ, FLUSH_DMA_BOUNDARY, 0>              gapless_policy;     // Returns as soon as the tail is queued
+
+/**
+ * Allocates the DMA capable block buffer shared by every play. Must be called once before wav_player_stream.
+ */
+esp_err_t wav_player_init();
+
+/**
+ * Returns the buffer allocated by wav_player_init.
+ */
+char* wav_player_buffer();
+
+/**
+ * Writes SILENCE from the end of the last of nr_bytes_written bytes up to the next DMA descriptor boundary of sink.
+ * If wait is set, then blocks until every descriptor holding the stream has been sent.
+ * Returns immediately with nothing written if the sink has no DMA geometry.
+ */
+esp_err_t wav_player_flush_to_dma_boundary(const pcm_sink_t* sink, uint32_t nr_bytes_written, const char* silence, uint32_t silence_size, bool wait);
+
+/**
+ * Reads f from its current position until EOF and writes it to sink in Policy::block_size blocks,
+ * followed by the Policy's SILENCE flush. silence must hold silence_size zero bytes.
+ */
+template <typename Policy>
+esp_err_t wav_player_stream(FILE* f, const pcm_sink_t* sink, const char* silence, uint32_t silence_size) {
+
+    char* data = wav_player_buffer();
+    size_t nr_bytes_written;
+    uint32_t nr_bytes_total = 0;
+    esp_err_t err;
+
+    uint32_t nr_bytes_read = 0;
+    if (Policy::discard_first_block) {
+        nr_bytes_read = fread(data, sizeof(char), Policy::block_size, f);
+    }
+
+    while (true) {
+        TRACE_START(read_us);
+        nr_bytes_read = fread(data, sizeof(char), Policy::block_size, f);
+        TRACE(TRACE_READ, read_us, nr_bytes_read);
+        if (nr_bytes_read == 0) {
+            break;
+        }
+        if (nr_bytes_read == Policy::block_size) {
+            err = sink->write(sink->ctx, data, Policy::block_size, &nr_bytes_written);
+            if (err != ESP_OK) {
+                return err;
+            }
+            nr_bytes_total += nr_bytes_written;
+            continue;
+        }
+
+        // Last, partial, block.
+        if (Policy::tail == TAIL_PAD_TO_BLOCK) {
+            memset(data + nr_bytes_read, 0, Policy::block_size - nr_bytes_read);   // Only the stale tail needs clearing
+            err = sink->write(sink->ctx, data, Policy::block_size, &nr_bytes_written);
+        } else {
+            err = sink->write(sink->ctx, data, nr_bytes_read, &nr_bytes_written);
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+        nr_bytes_total += nr_bytes_written;
+        break;
+    }
+
+    if (Policy::flush == FLUSH_DMA_BOUNDARY || Policy::flush == FLUSH_DMA_BOUNDARY_AND_WAIT) {
+        err = wav_player_flush_to_dma_boundary(sink, nr_bytes_total, silence, silence_size, Policy::flush == FLUSH_DMA_BOUNDARY_AND_WAIT);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    if (Policy::flush == FLUSH_SILENCE_TO_BOUNDARY) {
+        err = sink->write(sink->ctx, silence, silence_size - nr_bytes_read, &nr_bytes_written);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    for (uint32_t i = 0; i < Policy::full_silence_writes; i++) {
+        err = sink->write(sink->ctx, silence, silence_size, &nr_bytes_written);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,43 @@
+#!/usr/bin/env python
+#
+# Writes a header identifying the SPIFFS image built from a directory, for main/src/clip_index.cpp.
+#
+#   clip_image_id.py --output clip_image_id.h spiffs_data/a.wav spiffs_data/b.wav ...
+#
+# The id is a CRC32 of every file's name and contents, so it changes whenever any file does, even if its size does
+# not. It is compiled into the firmware flashed with the image, and a stored clip index from another image is dropped.
+
+import argparse
+import os
+import zlib
+
+
+def image_id(paths):
+    crc = 0
+    for path in sorted(paths, key=os.path.basename):
+        crc = zlib.crc32(os.path.basename(path).encode() + b'\0', crc)
+        with open(path, 'rb') as f:
+            crc = zlib.crc32(f.read(), crc)
+    return crc & 0xffffffff
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Write the clip image id header')
+    parser.add_argument('--output', required=True, help='Header file to write')
+    parser.add_argument('files', nargs='*', help='Files in the SPIFFS image')
+    args = parser.parse_args()
+
+    header = ('#pragma once\n\n'
+              '// Generated by tools/clip_image_id.py from the files in the SPIFFS image, do not edit.\n'
+              '#define CLIP_IMAGE_ID   0x%08xu\n' % image_id(args.files))
+    # Only rewrite it when it changes, so an unchanged image does not rebuild main.cpp.
+    if os.path.exists(args.output):
+        with open(args.output) as f:
+            if f.read() == header:
+                return
+    with open(args.output, 'w') as f:
+        f.write(header)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,138 @@
+#!/usr/bin/env python
+#
+# Packs WAV files into the raw clips partition image read by main/src/clip_store.cpp.
+#
+#   pack_clips.py --size 0x30000 --output clips.bin [--units units.txt] a.wav b.wav ...
+#
+# The layout must match clip_table_header_t and clip_table_entry_t in clip_store.h.
+#
+# --units adds the speech units main/src/phrase.cpp builds announcements from, each cut out of a longer recording.
+# One unit per line of the manifest, blank lines and lines starting with '#' are ignored:
+#
+#   <unit name> <WAV file, relative to the manifest> <start ms> <end ms>
+#
+# A unit is packed as a clip of its own, named without an extension, so the firmware finds it with clip_store_find.
+
+import argparse
+import os
+import struct
+import sys
+
+CLIP_TABLE_MAGIC = b'CLPS'
+CLIP_TABLE_VERSION = 1
+CLIP_TABLE_NAME_SIZE = 32
+HEADER_FORMAT = '<4sHH'
+ENTRY_FORMAT = '<%dsIIIHHHH' % CLIP_TABLE_NAME_SIZE
+DATA_ALIGN = 4
+
+
+def read_wav(path):
+    """Returns (fmt fields, PCM data) of a RIFF WAVE file, skipping any chunks other than fmt and data."""
+    with open(path, 'rb') as f:
+        blob = f.read()
+    if blob[0:4] != b'RIFF' or blob[8:12] != b'WAVE':
+        raise ValueError('%s: not a RIFF WAVE file' % path)
+
+    fmt = None
+    pos = 12
+    while pos + 8 <= len(blob):
+        chunk_id = blob[pos:pos + 4]
+        chunk_size = struct.unpack_from('<I', blob, pos + 4)[0]
+        body = pos + 8
+        if chunk_id == b'fmt ':
+            format_id, num_channels, sample_rate, _, block_align, bits_per_sample = struct.unpack_from('<HHIIHH', blob, body)
+            fmt = (format_id, num_channels, sample_rate, block_align, bits_per_sample)
+        elif chunk_id == b'data':
+            if fmt is None:
+                raise ValueError('%s: data chunk before fmt chunk' % path)
+            data = blob[body:body + chunk_size]
+            if len(data) != chunk_size:
+                raise ValueError('%s: data chunk truncated, %d of %d bytes' % (path, len(data), chunk_size))
+            return fmt, data
+        pos = body + chunk_size + (chunk_size & 1)  # Chunks are padded to an even size
+    raise ValueError('%s: no data chunk' % path)
+
+
+def read_units(manifest):
+    """Returns (name, fmt fields, PCM data) of each unit in the manifest, cut on whole frames."""
+    units = []
+    recordings = {}
+    base = os.path.dirname(manifest)
+    with open(manifest) as f:
+        for line_nr, line in enumerate(f, 1):
+            fields = line.split()
+            if not fields or fields[0].startswith('#'):
+                continue
+            if len(fields) != 4:
+                raise ValueError('%s:%d: expected <name> <wav> <start ms> <end ms>' % (manifest, line_nr))
+            name, path, start_ms, end_ms = fields[0], os.path.join(base, fields[1]), int(fields[2]), int(fields[3])
+            if path not in recordings:
+                recordings[path] = read_wav(path)
+            fmt, data = recordings[path]
+            format_id, _, sample_rate, block_align, _ = fmt
+            if format_id != 1:
+                raise ValueError('%s:%d: units can only be cut from PCM recordings' % (manifest, line_nr))
+            start = start_ms * sample_rate // 1000 * block_align
+            end = min(end_ms * sample_rate // 1000 * block_align, len(data))
+            if start >= end:
+                raise ValueError('%s:%d: empty unit %s' % (manifest, line_nr, name))
+            units.append((name.encode(), fmt, data[start:end]))
+    return units
+
+
+def align(value, alignment):
+    return (value + alignment - 1) // alignment * alignment
+
+
+def pack(paths, units):
+    clips = []
+    for path in paths:
+        fmt, data = read_wav(path)
+        clips.append((os.path.basename(path).encode(), fmt, data))
+    clips += units
+    names = set()
+    for name, _, _ in clips:
+        if len(name) >= CLIP_TABLE_NAME_SIZE:
+            raise ValueError('%s: name longer than %d bytes' % (name.decode(), CLIP_TABLE_NAME_SIZE - 1))
+        if name in names:
+            raise ValueError('%s: packed twice' % name.decode())
+        names.add(name)
+
+    offset = align(struct.calcsize(HEADER_FORMAT) + len(clips) * struct.calcsize(ENTRY_FORMAT), DATA_ALIGN)
+    table = struct.pack(HEADER_FORMAT, CLIP_TABLE_MAGIC, CLIP_TABLE_VERSION, len(clips))
+    body = b''
+    for name, (format_id, num_channels, sample_rate, block_align, bits_per_sample), data in clips:
+        table += struct.pack(ENTRY_FORMAT, name, offset, len(data), sample_rate,
+                             format_id, num_channels, bits_per_sample, block_align)
+        padded = data + b'\0' * (align(len(data), DATA_ALIGN) - len(data))
+        body += padded
+        offset += len(padded)
+
+    table += b'\0' * (align(len(table), DATA_ALIGN) - len(table))
+    return table + body
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Pack WAV files into a clips partition image')
+    parser.add_argument('--size', type=lambda x: int(x, 0), required=True, help='Partition size in bytes')
+    parser.add_argument('--output', required=True, help='Image file to write')
+    parser.add_argument('--units', help='Manifest of speech units to cut out of recordings and pack')
+    parser.add_argument('wavs', nargs='*', help='WAV files to pack')
+    args = parser.parse_args()
+
+    units = read_units(args.units) if args.units else []
+    if not args.wavs and not units:
+        parser.error('nothing to pack')
+    image = pack(sorted(args.wavs), units)
+    if len(image) > args.size:
+        sys.exit('Clips need %d bytes, partition is only %d' % (len(image), args.size))
+
+    # Pad with 0xFF, the erased flash value, so unused space costs no programming time.
+    image += b'\xff' * (args.size - len(image))
+    with open(args.output, 'wb') as f:
+        f.write(image)
+    print('Packed %d clips and %d units into %s' % (len(args.wavs), len(units), args.output))
+
+
+if __name__ == '__main__':
+    main()
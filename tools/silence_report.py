@@ -0,0 +1,114 @@
+#!/usr/bin/env python
+#
+# Reports the silence the firmware trims and indexes in each clip when it loads it, see main/src/pcm_silence.h.
+#
+#   silence_report.py [--threshold 0] [--min-run 1024] a.wav b.wav ...
+#
+# Leading and trailing silence is never held or played, so it comes straight off the start latency and the clip
+# length. Internal runs are still played, but from zeros instead of being read.
+
+import argparse
+import os
+import struct
+import sys
+
+from pack_clips import read_wav
+
+WAV_FORMAT_PCM = 1
+PCM_SILENCE_THRESHOLD = 0
+PCM_SILENCE_MIN_RUN_FRAMES = 1024
+PCM_SILENCE_MAX_RUNS = 8
+
+
+def silent_frames(data, num_channels, bits_per_sample, threshold):
+    """Returns a list of booleans, one per whole frame, true where every sample is within +-threshold."""
+    if bits_per_sample == 8:
+        samples = [(b - 128) << 8 for b in bytearray(data)]
+    else:
+        samples = struct.unpack('<%dh' % (len(data) // 2), data[:len(data) // 2 * 2])
+    nr_frames = len(data) // (num_channels * bits_per_sample // 8)
+    return [all(-threshold <= s <= threshold for s in samples[i * num_channels:(i + 1) * num_channels])
+            for i in range(nr_frames)]
+
+
+def trim(silent, frame_bytes, nr_bytes):
+    """As pcm_silence_trim, returns (leading, trailing) bytes."""
+    if all(silent):
+        return 0, 0
+    first = silent.index(False)
+    end = len(silent)
+    while silent[end - 1]:
+        end -= 1
+    return (first * frame_bytes) & ~3, nr_bytes - end * frame_bytes
+
+
+def index(silent, frame_bytes, min_run_frames):
+    """As pcm_silence_index, returns the (offset, nr_bytes) of the runs kept."""
+    runs = []
+
+    def add_run(start, end):
+        start = (start + 3) & ~3
+        end &= ~3
+        if end <= start:
+            return
+        if len(runs) == PCM_SILENCE_MAX_RUNS:
+            shortest = min(range(len(runs)), key=lambda i: (runs[i][1], i))
+            if runs[shortest][1] >= end - start:
+                return
+            del runs[shortest]
+        runs.append((start, end - start))
+
+    run_start = 0
+    run_frames = 0
+    for i, frame_silent in enumerate(silent):
+        if frame_silent:
+            if run_frames == 0:
+                run_start = i
+            run_frames += 1
+            continue
+        if min_run_frames > 0 and run_frames >= min_run_frames:
+            add_run(run_start * frame_bytes, i * frame_bytes)
+        run_frames = 0
+    if min_run_frames > 0 and run_frames >= min_run_frames:
+        add_run(run_start * frame_bytes, len(silent) * frame_bytes)
+    return runs
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Report the silence trimmed and indexed in each clip')
+    parser.add_argument('--threshold', type=int, default=PCM_SILENCE_THRESHOLD,
+                        help='Largest 16 bit sample magnitude counted as silent')
+    parser.add_argument('--min-run', type=int, default=PCM_SILENCE_MIN_RUN_FRAMES,
+                        help='Shortest internal run indexed, in frames')
+    parser.add_argument('wavs', nargs='+', help='WAV files to analyse')
+    args = parser.parse_args()
+
+    print('%-36s %10s %10s %10s %10s %6s %10s %10s' % ('clip', 'bytes', 'leading', 'trailing', 'internal', 'runs',
+                                                      'lead_ms', 'saved_ms'))
+    total_trimmed = 0
+    total_internal = 0
+    for path in args.wavs:
+        (format_id, num_channels, sample_rate, _, bits_per_sample), data = read_wav(path)
+        if format_id != WAV_FORMAT_PCM:
+            print('%-36s not PCM, streamed as it is' % os.path.basename(path))
+            continue
+        frame_bytes = num_channels * bits_per_sample // 8
+        byte_rate = float(sample_rate * frame_bytes)
+
+        silent = silent_frames(data, num_channels, bits_per_sample, args.threshold)
+        leading, trailing = trim(silent, frame_bytes, len(data))
+        kept = silent[leading // frame_bytes:len(silent) - (trailing // frame_bytes)]
+        runs = index(kept, frame_bytes, args.min_run)
+        internal = sum(nr_bytes for _, nr_bytes in runs)
+
+        print('%-36s %10d %10d %10d %10d %6d %10.1f %10.1f' % (
+            os.path.basename(path), len(data), leading, trailing, internal, len(runs),
+            leading * 1000 / byte_rate, (leading + trailing) * 1000 / byte_rate))
+        total_trimmed += leading + trailing
+        total_internal += internal
+
+    print('Trimmed %d bytes, %d more played from zeros' % (total_trimmed, total_internal))
+
+
+if __name__ == '__main__':
+    sys.exit(main())